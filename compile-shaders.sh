@@ -5,8 +5,19 @@ compile_shader() {
 mkdir -p 'shaders/bin/bdpt'
 mkdir -p 'shaders/bin/forward'
 mkdir -p 'shaders/bin/aabb'
+mkdir -p 'shaders/bin/common'
+mkdir -p 'shaders/bin/deferred'
 compile_shader 'forward/shader.vert'
+compile_shader 'forward/depth.vert'
 compile_shader 'forward/shader.frag'
+compile_shader 'forward/cull.comp'
+compile_shader 'forward/occlusion.comp'
+compile_shader 'forward/compact_draws.comp'
+compile_shader 'common/depth_reduce.comp'
+compile_shader 'common/light_clusters.comp'
+compile_shader 'deferred/gbuffer.frag'
+compile_shader 'deferred/lighting.comp'
 compile_shader 'bdpt/main.comp'
+compile_shader 'bdpt/resolve.comp'
 compile_shader 'aabb/shader.vert'
 compile_shader 'aabb/shader.frag'
@@ -0,0 +1,203 @@
+// Two level scene BVH built on the CPU. Every unique model has a bottom level BVH in object space,
+// built by bvh::build*() and concatenated by bvh::appendBottomLevel(), and a top level BVH from
+// bvh::buildTopLevel() places their instances in the world. Nodes are stored depth first: an
+// interior node's first child is the next node and offset is the second one, a leaf's offset is
+// its first triangle, or its first instance in the top level. Includers declare Ray.
+
+// bvh::kMaxDepth
+const uint kMaxBvhDepth = 64;
+// What intersectBox() returns for a miss
+const float kBoxMiss = 3.402823e38;
+
+struct BvhNode {
+  vec3 boundsMin;
+  uint offset;
+  vec3 boundsMax;
+  // 0 for interior nodes
+  uint count;
+};
+
+struct BvhTriangle {
+  vec4 v0;
+  vec4 v1;
+  vec4 v2;
+};
+
+struct BvhInstance {
+  mat4 worldToObject;
+  uint blasRoot;
+};
+
+layout (std430, set = 0, binding = 2) readonly buffer BlasNodes {
+  BvhNode nodes[];
+} blasNodes;
+
+layout (std430, set = 0, binding = 3) readonly buffer BvhTriangles {
+  BvhTriangle triangles[];
+} bvhTriangles;
+
+layout (std430, set = 0, binding = 4) readonly buffer TlasNodes {
+  BvhNode nodes[];
+} tlasNodes;
+
+layout (std430, set = 0, binding = 5) readonly buffer BvhInstances {
+  BvhInstance instances[];
+} bvhInstances;
+
+struct Hit {
+  float t;
+  uint triangle;
+  uint instance;
+  vec2 barycentrics;
+};
+
+// Distance along the ray to where it enters the box, or kBoxMiss if it misses it or only enters
+// past tMax
+float intersectBox(vec3 origin, vec3 invDir, vec3 boundsMin, vec3 boundsMax, float tMax) {
+  vec3 t0 = (boundsMin - origin) * invDir;
+  vec3 t1 = (boundsMax - origin) * invDir;
+  vec3 tNear = min(t0, t1);
+  vec3 tFar = max(t0, t1);
+  float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+  float exit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+  return enter <= exit ? enter : kBoxMiss;
+}
+
+// Moller-Trumbore, updates hit if the triangle is closer
+void intersectTriangle(Ray r, uint index, uint instance, inout Hit hit) {
+  BvhTriangle tri = bvhTriangles.triangles[index];
+  vec3 e1 = tri.v1.xyz - tri.v0.xyz;
+  vec3 e2 = tri.v2.xyz - tri.v0.xyz;
+  vec3 p = cross(r.dir, e2);
+  float det = dot(e1, p);
+  // Parallel to the triangle, or the triangle is degenerate
+  if (abs(det) < 1e-12) {
+    return;
+  }
+
+  float invDet = 1.0 / det;
+  vec3 s = r.origin - tri.v0.xyz;
+  float u = dot(s, p) * invDet;
+  if (u < 0.0 || u > 1.0) {
+    return;
+  }
+  vec3 q = cross(s, e1);
+  float v = dot(r.dir, q) * invDet;
+  if (v < 0.0 || u + v > 1.0) {
+    return;
+  }
+
+  float t = dot(e2, q) * invDet;
+  if (t > 1e-4 && t < hit.t) {
+    hit = Hit(t, index, instance, vec2(u, v));
+  }
+}
+
+// Orders two children by where the ray enters them, so the farther one is more likely to get
+// culled by hit.t by the time it's visited
+void orderChildren(inout uint first, inout uint second, inout float tFirst, inout float tSecond) {
+  if (tSecond < tFirst) {
+    uint tmpNode = first;
+    first = second;
+    second = tmpNode;
+    float tmpT = tFirst;
+    tFirst = tSecond;
+    tSecond = tmpT;
+  }
+}
+
+// Updates hit if the bottom level BVH rooted at `root` has a closer hit. The ray is in that BVH's
+// object space.
+void traceBlas(Ray r, uint root, uint instance, inout Hit hit) {
+  vec3 invDir = 1.0 / r.dir;
+
+  uint stack[kMaxBvhDepth];
+  uint stackSize = 0;
+  uint node = root;
+  if (intersectBox(r.origin, invDir, blasNodes.nodes[root].boundsMin, blasNodes.nodes[root].boundsMax, hit.t) == kBoxMiss) {
+    return;
+  }
+
+  while (true) {
+    BvhNode current = blasNodes.nodes[node];
+    if (current.count > 0) {
+      for (uint i = current.offset; i < current.offset + current.count; ++i) {
+        intersectTriangle(r, i, instance, hit);
+      }
+    } else {
+      uint first = node + 1;
+      uint second = current.offset;
+      float tFirst = intersectBox(r.origin, invDir, blasNodes.nodes[first].boundsMin, blasNodes.nodes[first].boundsMax, hit.t);
+      float tSecond = intersectBox(r.origin, invDir, blasNodes.nodes[second].boundsMin, blasNodes.nodes[second].boundsMax, hit.t);
+      orderChildren(first, second, tFirst, tSecond);
+
+      if (tFirst != kBoxMiss) {
+        if (tSecond != kBoxMiss) {
+          stack[stackSize++] = second;
+        }
+        node = first;
+        continue;
+      }
+    }
+
+    if (stackSize == 0) {
+      break;
+    }
+    node = stack[--stackSize];
+  }
+}
+
+// Closest hit along the ray, hit.t stays at tMax if there is none
+Hit traceScene(Ray r, float tMax) {
+  Hit hit = Hit(tMax, 0, 0, vec2(0.0));
+  vec3 invDir = 1.0 / r.dir;
+
+  uint stack[kMaxBvhDepth];
+  uint stackSize = 0;
+  uint node = 0;
+  if (intersectBox(r.origin, invDir, tlasNodes.nodes[0].boundsMin, tlasNodes.nodes[0].boundsMax, hit.t) == kBoxMiss) {
+    return hit;
+  }
+
+  while (true) {
+    BvhNode current = tlasNodes.nodes[node];
+    if (current.count > 0) {
+      for (uint i = current.offset; i < current.offset + current.count; ++i) {
+        // The direction isn't normalized again, so distances along the ray are the same in both
+        // spaces and hit.t carries over from one instance to the next
+        mat4 worldToObject = bvhInstances.instances[i].worldToObject;
+        Ray objectRay = Ray((worldToObject * vec4(r.origin, 1.0)).xyz, mat3(worldToObject) * r.dir);
+        traceBlas(objectRay, bvhInstances.instances[i].blasRoot, i, hit);
+      }
+    } else {
+      uint first = node + 1;
+      uint second = current.offset;
+      float tFirst = intersectBox(r.origin, invDir, tlasNodes.nodes[first].boundsMin, tlasNodes.nodes[first].boundsMax, hit.t);
+      float tSecond = intersectBox(r.origin, invDir, tlasNodes.nodes[second].boundsMin, tlasNodes.nodes[second].boundsMax, hit.t);
+      orderChildren(first, second, tFirst, tSecond);
+
+      if (tFirst != kBoxMiss) {
+        if (tSecond != kBoxMiss) {
+          stack[stackSize++] = second;
+        }
+        node = first;
+        continue;
+      }
+    }
+
+    if (stackSize == 0) {
+      break;
+    }
+    node = stack[--stackSize];
+  }
+
+  return hit;
+}
+
+// World space normal of a hit
+vec3 triangleNormal(uint index, uint instance) {
+  BvhTriangle tri = bvhTriangles.triangles[index];
+  vec3 objectNormal = cross(tri.v1.xyz - tri.v0.xyz, tri.v2.xyz - tri.v0.xyz);
+  // Normals go to world space with the inverse transpose of the object to world transform
+  return normalize(transpose(mat3(bvhInstances.instances[instance].worldToObject)) * objectNormal);
+}
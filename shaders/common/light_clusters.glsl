@@ -0,0 +1,49 @@
+// Point lights and the clustered light lists built by common/light_clusters.comp.
+//
+// The view frustum is split into a grid of clusters: screen space tiles along x and y, and
+// exponentially growing slices of view depth along z. Every cluster has a fixed size slot in the
+// light list buffer, holding the number of lights that reach it followed by their indices.
+
+struct PointLight
+{
+    // w is the radius past which the light contributes nothing
+    vec4 position;
+    vec4 color;
+};
+
+struct ClusterGrid
+{
+    // Clusters along x, y and z, and the stride of one cluster's slot in the light list buffer
+    uvec4 size;
+    // near, far, and the scale and bias that map log(view depth) to a slice
+    vec4 depth;
+    // Tile size in pixels in xy, one over the framebuffer size in zw
+    vec4 screen;
+    uint lightCount;
+    // Zero to skip the clusters and shade every light, for comparison
+    uint clustered;
+    mat4 inverseProj;
+};
+
+const float kPointLightIntensity = 5.0;
+
+// Inverse square falloff, windowed so that it smoothly reaches zero at the light's radius
+float pointLightAttenuation(float distance, float radius)
+{
+    float ratio = distance / radius;
+    float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+    return kPointLightIntensity * window * window / max(distance * distance, 0.0001);
+}
+
+uint clusterSlice(ClusterGrid grid, float viewDepth)
+{
+    float slice = log(max(viewDepth, grid.depth.x)) * grid.depth.z - grid.depth.w;
+    return min(uint(max(slice, 0.0)), grid.size.z - 1);
+}
+
+uint clusterIndex(ClusterGrid grid, vec2 fragCoord, float viewDepth)
+{
+    uvec2 tile = min(uvec2(fragCoord / grid.screen.xy), grid.size.xy - 1);
+    uint slice = clusterSlice(grid, viewDepth);
+    return tile.x + grid.size.x * (tile.y + grid.size.y * slice);
+}
@@ -0,0 +1,41 @@
+// Bindless materials, the forward renderer's set 1. Every texture of the scene lives in one
+// array and each material holds the indices of its textures in it. Includers need
+// GL_EXT_nonuniform_qualifier for the runtime sized array.
+
+const uint kNoTexture = 0xFFFFFFFFu;
+
+struct Material
+{
+    uint albedoTexture;
+    uint metalnessRoughnessTexture;
+};
+
+layout (std430, set = 1, binding = 0) readonly buffer MaterialBuffer {
+    Material materials[];
+} materialBuffer;
+
+layout (set = 1, binding = 1) uniform sampler2D textures[];
+
+// A single vkCmdDrawIndexedIndirectCount covers meshes with different materials, so the texture
+// index can differ between invocations of one subgroup and needs nonuniformEXT
+vec4 sampleMaterialTexture(uint textureIndex, vec2 texCoord, vec4 fallback)
+{
+    if (textureIndex == kNoTexture)
+    {
+        return fallback;
+    }
+    return texture(textures[nonuniformEXT(textureIndex)], texCoord);
+}
+
+vec4 materialAlbedo(uint materialIndex, vec2 texCoord)
+{
+    return sampleMaterialTexture(materialBuffer.materials[materialIndex].albedoTexture, texCoord,
+                                 vec4(1.0));
+}
+
+// Metalness in x and roughness in y, a rough dielectric without a texture
+vec2 materialMetalnessRoughness(uint materialIndex, vec2 texCoord)
+{
+    return sampleMaterialTexture(materialBuffer.materials[materialIndex].metalnessRoughnessTexture,
+                                 texCoord, vec4(0.0, 1.0, 0.0, 0.0)).rg;
+}
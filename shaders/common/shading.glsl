@@ -0,0 +1,87 @@
+// Shades a surface point with the scene's directional light and the point lights of its cluster.
+// The bindings match the forward renderer's global set, which the deferred lighting pass mirrors.
+
+#include "light_clusters.glsl"
+#include "pbr.glsl"
+
+layout (set = 0, binding = 0) uniform CameraBuffer{
+    mat4 view;
+    mat4 proj;
+    mat4 viewproj;
+    vec3 position;
+} cameraData;
+
+struct DirLight
+{
+    vec3 direction;
+    vec3 color;
+};
+layout (std140, set = 0, binding = 2) uniform DirLightBuffer
+{
+    DirLight dirLight;
+};
+
+// A big list of point lights in the scene
+layout (std140, set = 0, binding = 3) readonly buffer LightBuffer
+{
+    PointLight lights[];
+} lightBuffer;
+
+layout (std140, set = 0, binding = 5) uniform ClusterGridBuffer
+{
+    ClusterGrid clusterGrid;
+};
+
+// Indices into lightBuffer for every cluster, see light_clusters.glsl
+layout (std430, set = 0, binding = 6) readonly buffer ClusterLightBuffer
+{
+    uint clusterLights[];
+};
+
+const vec3 kAmbient = vec3(0.2);
+
+// Returns the tonemapped and gamma corrected color of a point seen at `fragCoord`
+vec3 shadeSurface(vec3 albedo, float metalness, float roughness, vec3 N, vec3 worldPos,
+                  vec2 fragCoord)
+{
+    vec3 V = normalize(cameraData.position - worldPos);
+
+    // reflectance equation
+    vec3 Lo = vec3(0.0);
+
+    // DIRECTIONAL LIGHT
+    Lo += cookTorrance(N, V, normalize(dirLight.direction), vec3(3.), albedo, metalness,
+                       roughness);
+
+    // POINT LIGHTS
+    // Only the ones that reach this point's cluster, unless clustering is turned off
+    uint lightCount = clusterGrid.lightCount;
+    uint listBase = 0;
+    if (clusterGrid.clustered != 0)
+    {
+        float viewDepth = -(cameraData.view * vec4(worldPos, 1.0)).z;
+        listBase = clusterIndex(clusterGrid, fragCoord, viewDepth) * clusterGrid.size.w;
+        lightCount = clusterLights[listBase];
+    }
+
+    for (uint i = 0; i < lightCount; ++i)
+    {
+        uint lightIndex = clusterGrid.clustered != 0 ? clusterLights[listBase + 1 + i] : i;
+        vec3 lightPosition = lightBuffer.lights[lightIndex].position.xyz;
+        float lightRadius = lightBuffer.lights[lightIndex].position.w;
+        vec3 lightColor = lightBuffer.lights[lightIndex].color.rgb;
+
+        // calculate per-light radiance
+        vec3 L = normalize(lightPosition - worldPos);
+        float distance    = length(lightPosition - worldPos);
+        float attenuation = pointLightAttenuation(distance, lightRadius);
+        vec3 radiance     = lightColor * attenuation;
+
+        Lo += cookTorrance(N, V, L, radiance, albedo, metalness, roughness);
+    }
+
+    vec3 color = kAmbient * albedo + Lo;
+
+    color = reinhardTonemap(color);
+    return gammaCorrection(color);
+}
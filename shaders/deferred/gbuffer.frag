@@ -0,0 +1,26 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Writes the surface attributes lighting.comp shades with. Takes the forward vertex shader's
+// outputs as is.
+
+#include "../common/materials.glsl"
+
+layout(location = 0) in vec2 inTexCoord;
+layout(location = 1) in vec3 inWorldPos;
+layout(location = 2) in vec3 inNormal;
+layout(location = 3) in vec3 inCameraPos;
+layout(location = 4) flat in uint inMaterialIndex;
+
+layout(location = 0) out vec4 outAlbedo;
+// World space normal mapped to [0, 1]
+layout(location = 1) out vec4 outNormal;
+layout(location = 2) out vec2 outMetalnessRoughness;
+
+void main()
+{
+    outAlbedo = materialAlbedo(inMaterialIndex, inTexCoord);
+    outNormal = vec4(normalize(inNormal) * 0.5 + 0.5, 0.0);
+    outMetalnessRoughness = materialMetalnessRoughness(inMaterialIndex, inTexCoord);
+}
@@ -0,0 +1,69 @@
+// Shared by the culling passes: the scene and draw list buffers at bindings 0 to 4 of set 0, and
+// the tests done on each (renderable, mesh) pair. Needs GL_GOOGLE_include_directive.
+
+#include "draws.glsl"
+
+struct ObjectData
+{
+    mat4 modelTransform;
+};
+
+layout (std140, set = 0, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+struct CullItem
+{
+    uint objectIndex;
+    uint drawIndex;
+};
+
+layout (std430, set = 0, binding = 1) readonly buffer CullItemBuffer {
+    CullItem items[];
+} cullItemBuffer;
+
+layout (std430, set = 0, binding = 2) readonly buffer DrawRecordBuffer {
+    uint bucketStarts[kDrawBucketCount];
+    DrawRecord records[];
+} drawRecordBuffer;
+
+// One command per draw, instanceCount starts out at 0 every frame. compact_draws.comp turns these
+// into what gets drawn.
+layout (std430, set = 0, binding = 3) buffer DrawCommandBuffer {
+    DrawCommand commands[];
+} drawCommandBuffer;
+
+layout (std430, set = 0, binding = 4) writeonly buffer InstanceObjectBuffer {
+    uint objectIndices[];
+} instanceObjectBuffer;
+
+// World space box around the transformed local bounds
+void worldBounds(DrawRecord record, mat4 modelTransform, out vec3 center, out vec3 halfExtent)
+{
+    vec3 localCenter = (record.boundsMin.xyz + record.boundsMax.xyz) * 0.5;
+    vec3 localHalfExtent = (record.boundsMax.xyz - record.boundsMin.xyz) * 0.5;
+    center = vec3(modelTransform * vec4(localCenter, 1.0));
+    mat3 absTransform = mat3(abs(modelTransform[0].xyz), abs(modelTransform[1].xyz),
+                             abs(modelTransform[2].xyz));
+    halfExtent = absTransform * localHalfExtent;
+}
+
+bool insideFrustum(vec4 frustumPlanes[6], vec3 center, vec3 halfExtent)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        vec4 plane = frustumPlanes[i];
+        if (dot(plane.xyz, center) + plane.w + dot(abs(plane.xyz), halfExtent) < 0.0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Appends the item to its draw's instance list
+void emitInstance(CullItem item, DrawRecord record)
+{
+    uint slot = atomicAdd(drawCommandBuffer.commands[item.drawIndex].instanceCount, 1);
+    instanceObjectBuffer.objectIndices[record.instanceBase + slot] = item.objectIndex;
+}
@@ -0,0 +1,14 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+// Depth pre-pass. Only reads the position out of the vertex buffer, and has no fragment shader.
+
+#include "transform.glsl"
+
+layout(location = 0) in vec4 inPosition;
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = clipPosition(instanceModelTransform(), decodePosition(inPosition));
+}
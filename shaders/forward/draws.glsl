@@ -0,0 +1,31 @@
+// The draw list shared by the culling passes, the draw compaction and the vertex shaders. There is
+// one draw per unique mesh, sorted into buckets by vertex format and index type, and each bucket
+// is drawn with a single vkCmdDrawIndexedIndirectCount. Includers declare the buffers themselves
+// since the bindings differ.
+
+// kDrawBucketCount in ForwardRenderer.h
+const uint kDrawBucketCount = 4;
+
+// Declared in each includer as
+//   uint bucketStarts[kDrawBucketCount];
+//   DrawRecord records[];
+// where bucket b's draws are [bucketStarts[b], bucketStarts[b + 1])
+struct DrawRecord
+{
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uint instanceBase;
+    uint materialIndex;
+    uint padding0;
+    uint padding1;
+};
+
+// Matches VkDrawIndexedIndirectCommand
+struct DrawCommand
+{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
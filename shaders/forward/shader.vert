@@ -1,6 +1,11 @@
 #version 460
+#extension GL_GOOGLE_include_directive : require
 
-layout(location = 0) in vec3 inPosition;
+#include "transform.glsl"
+
+// Full: position xyz with w = 1, normal xyz
+// Packed: unorm position relative to the mesh bounds, octahedral normal in xy
+layout(location = 0) in vec4 inPosition;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec2 inTexCoord;
 
@@ -8,31 +13,29 @@ layout(location = 0) out vec2 outTexCoord;
 layout(location = 1) out vec3 outWorldPos;
 layout(location = 2) out vec3 outNormal;
 layout(location = 3) out vec3 outCameraPos;
+layout(location = 4) flat out uint outMaterialIndex;
 
-layout (set = 0, binding = 0) uniform CameraBuffer{
-    mat4 view;
-    mat4 proj;
-    mat4 viewproj;
-    vec3 position;
-} cameraData;
+invariant gl_Position;
 
-struct ObjectData
+vec3 octDecode(vec2 encoded)
 {
-    mat4 modelTransform;
-};
-
-layout (std140, set = 0, binding = 1) readonly buffer ObjectBuffer {
-    ObjectData objects[];
-} objectBuffer;
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main() {
-    mat4 modelTransform = objectBuffer.objects[gl_BaseInstance].modelTransform;
-    mat4 transformMatrix = cameraData.viewproj * modelTransform;
+    vec3 position = decodePosition(inPosition);
+    vec3 normal = kPackedVertices ? octDecode(inNormal.xy) : inNormal;
 
-    gl_Position = transformMatrix * vec4(inPosition, 1.0);
+    mat4 modelTransform = instanceModelTransform();
+    gl_Position = clipPosition(modelTransform, position);
 
-    outWorldPos = vec3(modelTransform * vec4(inPosition, 1.0));
+    outWorldPos = vec3(modelTransform * vec4(position, 1.0));
     outTexCoord = inTexCoord;
-    outNormal = inNormal;
+    outNormal = normal;
     outCameraPos = cameraData.position;
+    outMaterialIndex = currentDraw().materialIndex;
 }
@@ -0,0 +1,73 @@
+// Everything that places an instance's vertex, shared by shader.vert and depth.vert. The depth
+// pre-pass is followed by an EQUAL depth test, so both have to compute bit identical positions.
+
+#include "draws.glsl"
+
+// Set per pipeline, true when the vertex buffer holds PackedVertex instead of Vertex
+layout(constant_id = 0) const bool kPackedVertices = false;
+// Also set per pipeline, every bucket of draws has its own
+layout(constant_id = 1) const uint kDrawBucket = 0;
+
+layout (set = 0, binding = 0) uniform CameraBuffer{
+    mat4 view;
+    mat4 proj;
+    mat4 viewproj;
+    vec3 position;
+} cameraData;
+
+struct ObjectData
+{
+    mat4 modelTransform;
+};
+
+layout (std140, set = 0, binding = 1) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+// Object index of every instance drawn, either all of them or only the ones that survived culling
+layout (std430, set = 0, binding = 4) readonly buffer InstanceObjectBuffer {
+    uint objectIndices[];
+} instanceObjectBuffer;
+
+// Local bounds of every mesh, only read for packed vertices, and its material
+layout (std430, set = 0, binding = 7) readonly buffer DrawRecordBuffer {
+    uint bucketStarts[kDrawBucketCount];
+    DrawRecord records[];
+} drawRecordBuffer;
+
+// The draw each command of the bucket's vkCmdDrawIndexedIndirectCount is for, starting at
+// bucketStarts[kDrawBucket]
+layout (std430, set = 0, binding = 8) readonly buffer DrawIdBuffer {
+    uint drawIds[];
+} drawIdBuffer;
+
+DrawRecord currentDraw()
+{
+    // gl_DrawID counts the draws of one vkCmdDrawIndexedIndirectCount, so from 0 in every bucket
+    uint drawId = drawIdBuffer.drawIds[drawRecordBuffer.bucketStarts[kDrawBucket] + gl_DrawID];
+    return drawRecordBuffer.records[drawId];
+}
+
+// Object space position of a vertex in either format
+vec3 decodePosition(vec4 inPosition)
+{
+    if (kPackedVertices)
+    {
+        DrawRecord draw = currentDraw();
+        return draw.boundsMin.xyz + inPosition.xyz * (draw.boundsMax.xyz - draw.boundsMin.xyz);
+    }
+    return inPosition.xyz;
+}
+
+mat4 instanceModelTransform()
+{
+    // gl_InstanceIndex already includes the draw's firstInstance
+    uint objectIndex = instanceObjectBuffer.objectIndices[gl_InstanceIndex];
+    return objectBuffer.objects[objectIndex].modelTransform;
+}
+
+vec4 clipPosition(mat4 modelTransform, vec3 position)
+{
+    mat4 transformMatrix = cameraData.viewproj * modelTransform;
+    return transformMatrix * vec4(position, 1.0);
+}
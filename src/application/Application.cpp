@@ -15,6 +15,7 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstring>
 #include <iostream>
 #include <limits>
@@ -26,9 +27,6 @@ namespace hatgpu
 {
 namespace
 {
-constexpr int kWidth  = 1366;
-constexpr int kHeight = 768;
-
 const std::vector<const char *> kValidationLayers = {"VK_LAYER_KHRONOS_validation"};
 constexpr bool kEnableValidationLayers =
 #ifdef DEBUG
@@ -253,9 +251,12 @@ VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities, GLFWwi
 }
 }  // namespace
 
-Application::Application(const std::string &windowName, const std::string &scenePath)
+Application::Application(const std::string &windowName,
+                         const std::string &scenePath,
+                         VkExtent2D windowExtent)
     : mWindow(nullptr),
       mWindowName(std::move(windowName)),
+      mWindowExtent(windowExtent),
       mInputManager(this),
       mCtx(std::make_shared<vk::Ctx>()),
       mScene(std::make_shared<Scene>())
@@ -264,13 +265,16 @@ Application::Application(const std::string &windowName, const std::string &scene
     mScene->loadFromJson(scenePath);
 
     mRequirements = ForwardRenderer::kRequirements.concat(BdptRenderer::kRequirements)
+                        .concat(DeferredRenderer::kRequirements)
                         .concat(AabbLayer::kRequirements);
 
-    mForwardRenderer = std::make_shared<ForwardRenderer>(mCtx, mScene);
-    mBdptRenderer    = std::make_shared<BdptRenderer>(mCtx, mScene);
-    mAabbLayer       = std::make_shared<AabbLayer>(mCtx, mScene);
+    mForwardRenderer  = std::make_shared<ForwardRenderer>(mCtx, mScene);
+    mBdptRenderer     = std::make_shared<BdptRenderer>(mCtx, mScene);
+    mDeferredRenderer = std::make_shared<DeferredRenderer>(mCtx, mScene);
+    mAabbLayer        = std::make_shared<AabbLayer>(mCtx, mScene);
     mLayers.push_back(mForwardRenderer);
     mLayers.push_back(mBdptRenderer);
+    mLayers.push_back(mDeferredRenderer);
     mLayers.push_back(mAabbLayer);
 }
 
@@ -280,29 +284,27 @@ void Application::Init()
     initVulkan();
     initImGui();
 
-    VmaAllocatorCreateInfo allocatorInfo = {};
-    allocatorInfo.physicalDevice         = mCtx->physicalDevice;
-    allocatorInfo.device                 = mCtx->device;
-    allocatorInfo.instance               = mCtx->instance;
-
-    H_LOG("...creating VMA allocator");
-    mCtx->allocator = vk::Allocator(allocatorInfo);
-
-    mDeleter.enqueue([this]() {
-        H_LOG("...destroying VMA allocator");
-        mCtx->allocator.destroy();
-    });
-
-    createDepthImage();
+    createDepthImages();
 
-    for (auto &drawCtx : mDrawCtxs)
+    for (uint32_t i = 0; i < mDrawCtxs.size(); ++i)
     {
-        drawCtx.vk             = mCtx;
-        drawCtx.depthImageView = mDepthImageView;
+        mDrawCtxs[i].vk             = mCtx;
+        mDrawCtxs[i].depthImage     = mDepthImages[i].image;
+        mDrawCtxs[i].depthImageView = mDepthImageViews[i];
+        mDrawCtxs[i].frameIndex     = i;
     }
 
-    // Set up initial layer state
-    SetRenderer(mForwardRenderer);
+    // Set up initial layer state, the BDPT benchmarks measure the BDPT renderer
+    if (benchmark::enabled(benchmark::Mode::kBdptTiles) ||
+        benchmark::enabled(benchmark::Mode::kBdptThroughput))
+    {
+        mSelectedRendererOption = RendererOption::kBdptRenderer;
+        SetRenderer(mBdptRenderer);
+    }
+    else
+    {
+        SetRenderer(mForwardRenderer);
+    }
     PushOverlay(mAabbLayer);
 
     mDeleter.enqueue([this]() {
@@ -321,7 +323,9 @@ void Application::initWindow()
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
-    mWindow = glfwCreateWindow(kWidth, kHeight, mWindowName.c_str(), nullptr, nullptr);
+    mWindow = glfwCreateWindow(static_cast<int>(mWindowExtent.width),
+                               static_cast<int>(mWindowExtent.height), mWindowName.c_str(), nullptr,
+                               nullptr);
     H_ASSERT(mWindow != nullptr, "Could not create GLFWwindow");
 
     mInputManager.SetGLFWCallbacks(mWindow, &mScene->camera);
@@ -348,9 +352,31 @@ void Application::initVulkan()
     createCommandPool();
     createCommandBuffers();
     createTracyContexts();
+
+    // The upload context owns staging buffers, so the allocator has to exist before it and be
+    // destroyed after it
+    VmaAllocatorCreateInfo allocatorInfo = {};
+    allocatorInfo.physicalDevice         = mCtx->physicalDevice;
+    allocatorInfo.device                 = mCtx->device;
+    allocatorInfo.instance               = mCtx->instance;
+
+    H_LOG("...creating VMA allocator");
+    mCtx->allocator = vk::Allocator(allocatorInfo);
+
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying VMA allocator");
+        mCtx->allocator.destroy();
+    });
+
     H_LOG("...creating upload context");
-    mCtx->uploadContext = vk::UploadContext(mCtx->device, mGraphicsQueue, mGraphicsQueueIndex);
+    mCtx->uploadContext =
+        vk::UploadContext(mCtx->device, &mCtx->allocator, mGraphicsQueue, mGraphicsQueueIndex,
+                          mTransferQueue, mTransferQueueIndex, constants::kStagingRingSize);
     mDeleter.enqueue([this]() { mCtx->uploadContext.destroy(); });
+
+    H_LOG("...creating sampler cache");
+    mCtx->samplerCache = vk::SamplerCache(mCtx->device);
+    mDeleter.enqueue([this]() { mCtx->samplerCache.destroy(); });
 }
 
 bool Application::checkDeviceExtensionSupport(const VkPhysicalDevice &device)
@@ -444,13 +470,15 @@ void Application::initImGui()
     });
 }
 
-void Application::createDepthImage()
+void Application::createDepthImages()
 {
-    H_LOG("...creating depth image");
+    H_LOG("...creating depth images");
     VkExtent3D depthImageExtent = {mCtx->swapchainExtent.width, mCtx->swapchainExtent.height, 1};
 
-    VkImageCreateInfo imageInfo =
-        vk::imageInfo(kDepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImageExtent);
+    // Also sampled, renderers read it back for occlusion culling
+    VkImageCreateInfo imageInfo = vk::imageInfo(
+        kDepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        depthImageExtent);
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
@@ -458,19 +486,27 @@ void Application::createDepthImage()
     VmaAllocationCreateInfo allocationInfo{};
     allocationInfo.usage         = VMA_MEMORY_USAGE_GPU_ONLY;
     allocationInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    H_CHECK(vmaCreateImage(mCtx->allocator.Impl, &imageInfo, &allocationInfo, &mDepthImage.image,
-                           &mDepthImage.allocation, nullptr),
-            "Failed to allocate depth image");
 
-    VkImageViewCreateInfo viewInfo =
-        vk::imageViewInfo(kDepthFormat, mDepthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
-    H_CHECK(vkCreateImageView(mCtx->device, &viewInfo, nullptr, &mDepthImageView),
-            "Failed to create depth image view");
+    for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
+    {
+        H_CHECK(vmaCreateImage(mCtx->allocator.Impl, &imageInfo, &allocationInfo,
+                               &mDepthImages[i].image, &mDepthImages[i].allocation, nullptr),
+                "Failed to allocate depth image");
+
+        VkImageViewCreateInfo viewInfo =
+            vk::imageViewInfo(kDepthFormat, mDepthImages[i].image, VK_IMAGE_ASPECT_DEPTH_BIT);
+        H_CHECK(vkCreateImageView(mCtx->device, &viewInfo, nullptr, &mDepthImageViews[i]),
+                "Failed to create depth image view");
+    }
 
     mDeleter.enqueue([this]() {
-        H_LOG("...destroying depth image");
-        vkDestroyImageView(mCtx->device, mDepthImageView, nullptr);
-        vmaDestroyImage(mCtx->allocator.Impl, mDepthImage.image, mDepthImage.allocation);
+        H_LOG("...destroying depth images");
+        for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
+        {
+            vkDestroyImageView(mCtx->device, mDepthImageViews[i], nullptr);
+            vmaDestroyImage(mCtx->allocator.Impl, mDepthImages[i].image,
+                            mDepthImages[i].allocation);
+        }
     });
 }
 
@@ -524,6 +560,23 @@ void Application::OnImGuiRender()
                        static_cast<int>(RendererOption::kForwardRenderer));
     ImGui::SameLine();
     ImGui::RadioButton("Bdpt renderer", &choice, static_cast<int>(RendererOption::kBdptRenderer));
+    ImGui::SameLine();
+    ImGui::RadioButton("Deferred renderer", &choice,
+                       static_cast<int>(RendererOption::kDeferredRenderer));
+    // Last measured while each was selected
+    ImGui::Text("GPU time: forward %.2f ms, deferred %.2f ms", mForwardRenderer->gpuTimeMs(),
+                mDeferredRenderer->gpuTimeMs());
+    ImGui::Text("Samplers: %zu created, %zu reused", mCtx->samplerCache.createdCount(),
+                mCtx->samplerCache.reusedCount());
+
+    int framesInFlight = static_cast<int>(mFramesInFlight);
+    if (ImGui::SliderInt("Frames in flight", &framesInFlight, 1,
+                         static_cast<int>(constants::kMaxFramesInFlight)))
+    {
+        mFramesInFlight = static_cast<size_t>(framesInFlight);
+    }
+    ImGui::Text("Frame time %.2f ms, %.2f ms of it waiting on the GPU", mFrameTimeMs,
+                mFenceWaitMs);
 
     if (static_cast<RendererOption>(choice) != mSelectedRendererOption)
     {
@@ -536,6 +589,9 @@ void Application::OnImGuiRender()
             case RendererOption::kBdptRenderer:
                 SetRenderer(mBdptRenderer);
                 break;
+            case RendererOption::kDeferredRenderer:
+                SetRenderer(mDeferredRenderer);
+                break;
         }
     }
 }
@@ -546,11 +602,17 @@ void Application::Run()
     {
         mInputManager.ProcessInput(mWindow, mTime.GetDeltaTime());
         ZoneScopedC(tracy::Color::Aqua);
+        const auto frameStart = std::chrono::steady_clock::now();
         {
+            // With a single frame in flight this waits for the whole of the last frame, with more
+            // only for the one that used this frame's resources before
             ZoneScopedNC("vkWaitForFences", tracy::Color::Linen);
             vkWaitForFences(mCtx->device, 1, &mCurrentDrawCtx->inFlightFence, VK_TRUE,
                             std::numeric_limits<uint64_t>::max());
         }
+        const float fenceWaitMs =
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart)
+                .count();
         {
             ZoneScopedNC("vkAcquireNextImageKHR", tracy::Color::Orchid);
             VkResult nextImageResult = vkAcquireNextImageKHR(
@@ -669,16 +731,58 @@ void Application::Run()
         }
         H_ASSERT(presentResult == VK_SUCCESS, "Failed to present swapchain image");
 
-        mCurrentFrameIndex = (1 + mCurrentFrameIndex) % kMaxFramesInFlight;
+        mCurrentFrameIndex = (1 + mCurrentFrameIndex) % mFramesInFlight;
         mCurrentDrawCtx    = &mDrawCtxs[mCurrentFrameIndex];
 
         glfwSwapBuffers(mWindow);
+
+        const float frameTimeMs =
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart)
+                .count();
+        constexpr float kSmoothing = 0.05f;
+        mFrameTimeMs += (frameTimeMs - mFrameTimeMs) * kSmoothing;
+        mFenceWaitMs += (fenceWaitMs - mFenceWaitMs) * kSmoothing;
+        TracyPlot("Frame time (ms)", frameTimeMs);
+        TracyPlot("Fence wait (ms)", fenceWaitMs);
+        if (benchmark::enabled(benchmark::Mode::kFramesInFlight))
+        {
+            stepFramesInFlightBenchmark(frameTimeMs, fenceWaitMs);
+        }
         FrameMark;
+
+        if (benchmark::finished())
+        {
+            glfwSetWindowShouldClose(mWindow, GLFW_TRUE);
+        }
     }
 
     vkDeviceWaitIdle(mCtx->device);
 }
 
+void Application::stepFramesInFlightBenchmark(float frameTimeMs, float fenceWaitMs)
+{
+    if (const std::optional<std::vector<double>> averages =
+            mFramesInFlightSeries.add({frameTimeMs, fenceWaitMs});
+        averages.has_value())
+    {
+        // Frame time includes the fence wait, the rest is the CPU's share of the frame
+        const double frameTime = (*averages)[0];
+        const double fenceWait = (*averages)[1];
+        LOGGER.info("{} frames in flight: {:.3f} ms per frame, {:.3f} ms of it waiting on the GPU, "
+                    "{:.3f} ms on the CPU, on {}",
+                    mFramesInFlight, frameTime, fenceWait, frameTime - fenceWait,
+                    mCtx->gpuProperties.deviceName);
+    }
+
+    if (const std::optional<size_t> setting = mFramesInFlightSeries.setting(); setting.has_value())
+    {
+        mFramesInFlight = *setting + 1;
+        return;
+    }
+    mFramesInFlight = constants::kDefaultFramesInFlight;
+    benchmark::finish();
+}
+
 void Application::createInstance()
 {
     H_LOG("...creating vulkan instance");
@@ -771,29 +875,37 @@ Application::QueueFamilyIndices Application::findQueueFamilies(const VkPhysicalD
     std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
+    // The required families are taken from the first family that supports them, but we keep
+    // looking through the rest for a dedicated transfer family
     uint32_t i = 0;
     for (const auto &queueFamily : queueFamilies)
     {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        if (!indices.IsComplete())
         {
-            indices.graphicsFamily = i;
-        }
+            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+            {
+                indices.graphicsFamily = i;
+            }
 
-        VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-        if (presentSupport)
-        {
-            indices.presentFamily = i;
-        }
+            VkBool32 presentSupport = false;
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            if (presentSupport)
+            {
+                indices.presentFamily = i;
+            }
 
-        if (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)
-        {
-            indices.computeFamily = i;
+            if (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)
+            {
+                indices.computeFamily = i;
+            }
         }
 
-        if (indices.IsComplete())
+        const bool isTransferOnly =
+            (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+        if (isTransferOnly && !indices.transferFamily.has_value())
         {
-            break;
+            indices.transferFamily = i;
         }
 
         ++i;
@@ -855,6 +967,10 @@ void Application::createLogicalDevice()
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{};
     std::set<uint32_t> uniqueQueueFamilies = {*indices.graphicsFamily, *indices.presentFamily};
+    if (indices.transferFamily.has_value())
+    {
+        uniqueQueueFamilies.insert(*indices.transferFamily);
+    }
 
     float queuePriority = 1.0f;
     for (const auto queueFamily : uniqueQueueFamilies)
@@ -886,9 +1002,26 @@ void Application::createLogicalDevice()
     dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
     dynamicRenderingFeatures.pNext            = nullptr;
 
+    // Vulkan 1.2 features go in one struct, which can't be chained along with the structs of the
+    // extensions they were promoted from
+    VkPhysicalDeviceVulkan12Features vulkan12Features{};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    // Used by the upload context to hand batches from the transfer queue to the graphics queue
+    vulkan12Features.timelineSemaphore = VK_TRUE;
+    // The forward renderer's bindless material textures, which one indirect call can draw
+    // several of
+    vulkan12Features.descriptorIndexing                        = VK_TRUE;
+    vulkan12Features.runtimeDescriptorArray                    = VK_TRUE;
+    vulkan12Features.descriptorBindingPartiallyBound           = VK_TRUE;
+    vulkan12Features.descriptorBindingVariableDescriptorCount  = VK_TRUE;
+    vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    // And its draw counts written by the culling passes
+    vulkan12Features.drawIndirectCount = VK_TRUE;
+    vulkan12Features.pNext             = &dynamicRenderingFeatures;
+
     VkPhysicalDeviceShaderDrawParametersFeatures shaderDrawFeatures;
     shaderDrawFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETERS_FEATURES;
-    shaderDrawFeatures.pNext = &dynamicRenderingFeatures;
+    shaderDrawFeatures.pNext = &vulkan12Features;
     shaderDrawFeatures.shaderDrawParameters = VK_TRUE;
     createInfo.pNext                        = &shaderDrawFeatures;
 
@@ -909,6 +1042,20 @@ void Application::createLogicalDevice()
     vkGetDeviceQueue(mCtx->device, *indices.graphicsFamily, 0, &mGraphicsQueue);
     mGraphicsQueueIndex = *indices.graphicsFamily;
     vkGetDeviceQueue(mCtx->device, *indices.presentFamily, 0, &mPresentQueue);
+
+    if (indices.transferFamily.has_value())
+    {
+        H_LOG("...using dedicated transfer queue family " +
+              std::to_string(*indices.transferFamily));
+        vkGetDeviceQueue(mCtx->device, *indices.transferFamily, 0, &mTransferQueue);
+        mTransferQueueIndex = *indices.transferFamily;
+    }
+    else
+    {
+        H_LOG("...no dedicated transfer queue family, uploading on the graphics queue");
+        mTransferQueue      = mGraphicsQueue;
+        mTransferQueueIndex = mGraphicsQueueIndex;
+    }
 }
 
 void Application::createSwapchain()
@@ -1006,14 +1153,14 @@ void Application::createCommandPool()
 void Application::createCommandBuffers()
 {
     H_LOG("...creating command buffers");
-    std::array<VkCommandBuffer, kMaxFramesInFlight> commandBuffers{};
+    std::array<VkCommandBuffer, constants::kMaxFramesInFlight> commandBuffers{};
 
     VkCommandBufferAllocateInfo allocInfo =
         vk::commandBufferAllocInfo(mCommandPool, static_cast<uint32_t>(commandBuffers.size()));
     H_CHECK(vkAllocateCommandBuffers(mCtx->device, &allocInfo, commandBuffers.data()),
             "Failed to allocate command buffer");
 
-    for (size_t i = 0; i < kMaxFramesInFlight; ++i)
+    for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
     {
         mDrawCtxs[i].commandBuffer = commandBuffers[i];
     }
@@ -1022,7 +1169,7 @@ void Application::createCommandBuffers()
 void Application::createTracyContexts()
 {
     H_LOG("...creating Tracy contexts");
-    for (size_t i = 0; i < kMaxFramesInFlight; ++i)
+    for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
     {
         mDrawCtxs[i].tracyCtx = TracyVkContext(mCtx->physicalDevice, mCtx->device, mGraphicsQueue,
                                                mDrawCtxs[i].commandBuffer);
@@ -1030,7 +1177,7 @@ void Application::createTracyContexts()
 
     mDeleter.enqueue([this]() {
         H_LOG("...destroying Tracy contexts");
-        for (size_t i = 0; i < kMaxFramesInFlight; ++i)
+        for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
         {
             TracyVkDestroy(mDrawCtxs[i].tracyCtx);
         }
@@ -1043,7 +1190,7 @@ void Application::createSyncObjects()
     VkSemaphoreCreateInfo semaphoreCreateInfo = vk::semaphoreInfo();
     VkFenceCreateInfo fenceCreateInfo         = vk::fenceInfo(VK_FENCE_CREATE_SIGNALED_BIT);
 
-    for (size_t i = 0; i < kMaxFramesInFlight; ++i)
+    for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
     {
         H_CHECK(vkCreateSemaphore(mCtx->device, &semaphoreCreateInfo, nullptr,
                                   &mDrawCtxs[i].imageAvailableSemaphore),
@@ -1057,7 +1204,7 @@ void Application::createSyncObjects()
 
     mDeleter.enqueue([this]() {
         H_LOG("...destroying frame sync objects");
-        for (size_t i = 0; i < kMaxFramesInFlight; ++i)
+        for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
         {
             vkDestroySemaphore(mCtx->device, mDrawCtxs[i].imageAvailableSemaphore, nullptr);
             vkDestroySemaphore(mCtx->device, mDrawCtxs[i].renderFinishedSemaphore, nullptr);
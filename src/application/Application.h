@@ -4,11 +4,14 @@
 #include "application/DrawCtx.h"
 #include "hatpch.h"
 #include "renderers/BdptRenderer.h"
+#include "renderers/DeferredRenderer.h"
 #include "renderers/ForwardRenderer.h"
 #include "renderers/overlays/AabbLayer.h"
 
 #include "Layer.h"
+#include "application/Constants.h"
 #include "application/InputManager.h"
+#include "util/Benchmark.h"
 #include "util/Time.h"
 #include "vk/allocator.h"
 #include "vk/ctx.h"
@@ -25,7 +28,11 @@ namespace hatgpu
 class Application
 {
   public:
-    Application(const std::string &windowName, const std::string &scenePath);
+    static constexpr VkExtent2D kDefaultWindowExtent = {1366, 768};
+
+    Application(const std::string &windowName,
+                const std::string &scenePath,
+                VkExtent2D windowExtent = kDefaultWindowExtent);
     virtual ~Application();
 
     Application(const Application &other)            = delete;
@@ -42,27 +49,24 @@ class Application
 
     static constexpr VkFormat kDepthFormat = VK_FORMAT_D32_SFLOAT;
 
-    // We are setting this to 1 since we will possibly have lots
-    // of data on the GPU at once for path tracing. Seem to be easily changed
-    // either way -- the path tracer will be implemented agnostic of this.
-    static constexpr size_t kMaxFramesInFlight = 1;
-
   protected:
     LayerStack mLayerStack;
     enum class RendererOption
     {
         kForwardRenderer,
         kBdptRenderer,
+        kDeferredRenderer,
     };
     RendererOption mSelectedRendererOption{RendererOption::kForwardRenderer};
     std::vector<std::shared_ptr<Layer>> mLayers;
     std::shared_ptr<ForwardRenderer> mForwardRenderer;
     std::shared_ptr<BdptRenderer> mBdptRenderer;
+    std::shared_ptr<DeferredRenderer> mDeferredRenderer;
     std::shared_ptr<AabbLayer> mAabbLayer;
 
     LayerRequirements mRequirements;
 
-    void createDepthImage();
+    void createDepthImages();
     bool checkDeviceExtensionSupport(const VkPhysicalDevice &device);
 
     void immediateSubmit(std::function<void(VkCommandBuffer)> &&function);
@@ -89,6 +93,7 @@ class Application
 
     GLFWwindow *mWindow;
     std::string mWindowName;
+    VkExtent2D mWindowExtent;
     InputManager mInputManager;
     Time mTime;
 
@@ -100,14 +105,17 @@ class Application
     std::vector<VkImageView> mSwapchainImageViews;
     std::vector<VkImage> mSwapchainImages;
     std::vector<VkFramebuffer> mSwapchainFramebuffers;
-    VkImageView mDepthImageView;
-    vk::AllocatedImage mDepthImage{};
+    // One per frame in flight, so a frame never clears depth the previous one is still testing
+    std::array<VkImageView, constants::kMaxFramesInFlight> mDepthImageViews{};
+    std::array<vk::AllocatedImage, constants::kMaxFramesInFlight> mDepthImages{};
 
     struct QueueFamilyIndices
     {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
         std::optional<uint32_t> computeFamily;
+        // Only set when there's a family that supports transfers but not graphics or compute
+        std::optional<uint32_t> transferFamily;
 
         bool IsComplete() const
         {
@@ -119,13 +127,26 @@ class Application
                                                 const VkSurfaceKHR &surface);
 
     VkCommandPool mCommandPool;
-    std::array<DrawCtx, kMaxFramesInFlight> mDrawCtxs{};
+    std::array<DrawCtx, constants::kMaxFramesInFlight> mDrawCtxs{};
     uint32_t mCurrentFrameIndex{0};
     DrawCtx *mCurrentDrawCtx = &mDrawCtxs.front();
+    // Can change between frames, every ring is sized for the maximum. Frames past the new count
+    // just stop being reused, and the ones that start being used again are waited on as usual.
+    size_t mFramesInFlight{constants::kDefaultFramesInFlight};
+
+    // Smoothed CPU frame time and the part of it spent waiting on the frame's fence
+    float mFrameTimeMs{0.f};
+    float mFenceWaitMs{0.f};
+
+    // See benchmark::Mode::kFramesInFlight, setting i is i + 1 frames in flight
+    benchmark::FrameSeries mFramesInFlightSeries{constants::kMaxFramesInFlight, 60, 600};
 
     VkQueue mGraphicsQueue;
     uint32_t mGraphicsQueueIndex;
     VkQueue mPresentQueue;
+    // Same as the graphics queue when the device has no dedicated transfer family
+    VkQueue mTransferQueue;
+    uint32_t mTransferQueueIndex;
 
     bool mFramebufferResized{false};
 
@@ -140,6 +161,8 @@ class Application
     void initImGui();
 
     void renderImGui(VkCommandBuffer commandBuffer);
+    // Called once per frame when benchmarking, with the frame's unsmoothed times
+    void stepFramesInFlightBenchmark(float frameTimeMs, float fenceWaitMs);
 
     void createInstance();
     void setupDebugMessenger();
@@ -7,8 +7,25 @@ namespace hatgpu
 {
 namespace constants
 {
-static constexpr size_t kMaxFramesInFlight = 1;
-static constexpr VkFormat kDepthFormat     = VK_FORMAT_D32_SFLOAT;
+// Size of every per-frame resource ring. How many frames are actually in flight is picked at
+// runtime, anywhere from 1 to this.
+static constexpr size_t kMaxFramesInFlight = 3;
+// Two lets the CPU record a frame while the GPU is still rendering the previous one
+static constexpr size_t kDefaultFramesInFlight = 2;
+static constexpr VkFormat kDepthFormat         = VK_FORMAT_D32_SFLOAT;
+// Size of the persistently mapped ring all asset uploads get staged through
+static constexpr VkDeviceSize kStagingRingSize = 64 * 1024 * 1024;
+// Reorders imported meshes for vertex cache locality, overdraw and vertex fetch. Changing this
+// invalidates the mesh cache.
+static constexpr bool kOptimizeMeshes = true;
+// Uploads meshes with the 16 byte PackedVertex layout instead of the 32 byte Vertex one. A mesh
+// keeps the full layout if half float UVs would be off by more than kMaxPackedUvError, which
+// happens with UVs that tile far outside [0, 1].
+static constexpr bool kPackVertices      = true;
+static constexpr float kMaxPackedUvError = 1.f / 2048.f;
+// Capacity of the vertex and index buffers every mesh gets suballocated from
+static constexpr VkDeviceSize kGeometryArenaVertexSize = 256 * 1024 * 1024;
+static constexpr VkDeviceSize kGeometryArenaIndexSize  = 128 * 1024 * 1024;
 }  // namespace constants
 }  // namespace hatgpu
 
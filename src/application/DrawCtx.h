@@ -18,8 +18,10 @@ struct DrawCtx
     std::shared_ptr<vk::Ctx> vk;
     VkImageView swapchainImageView;
     VkImage swapchainImage;
+    VkImage depthImage;
     VkImageView depthImageView;
 
+    // Which slot of the per-frame resource rings this frame uses
     uint32_t frameIndex;
 };
 
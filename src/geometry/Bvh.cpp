@@ -0,0 +1,1007 @@
+#include "hatpch.h"
+
+#include "Bvh.h"
+
+#include "util/ThreadPool.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <thread>
+
+namespace hatgpu
+{
+namespace bvh
+{
+namespace
+{
+// Ranges shorter than this are never split across threads
+constexpr size_t kMinChunkSize = 16 * 1024;
+// Nodes with at least this many triangles get their centroids binned by several threads
+constexpr uint32_t kParallelBinningSize = 128 * 1024;
+// The parallel builds cut the tree into about this many subtrees per thread, so that uneven
+// subtrees still even out, but never into subtrees smaller than kMinSubtreeSize
+constexpr uint32_t kSubtreesPerThread = 8;
+constexpr uint32_t kMinSubtreeSize    = 1024;
+// Bits of every axis in a Morton code
+constexpr uint32_t kMortonBits = 10;
+
+struct Bounds
+{
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+    void grow(const glm::vec3 &point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void grow(const Bounds &other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    bool contains(const Bounds &other) const
+    {
+        return glm::all(glm::lessThanEqual(min, other.min)) &&
+               glm::all(glm::greaterThanEqual(max, other.max));
+    }
+
+    float area() const
+    {
+        if (min.x > max.x)
+        {
+            return 0.f;
+        }
+        const glm::vec3 size = max - min;
+        return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+};
+
+Bounds triangleBounds(const BvhTriangle &triangle)
+{
+    Bounds bounds;
+    bounds.grow(glm::vec3(triangle.v0));
+    bounds.grow(glm::vec3(triangle.v1));
+    bounds.grow(glm::vec3(triangle.v2));
+    return bounds;
+}
+
+Bounds nodeBounds(const BvhNode &node)
+{
+    return Bounds{node.boundsMin, node.boundsMax};
+}
+
+// Contains all eight corners of `bounds` after transforming them
+Bounds transformBounds(const Bounds &bounds, const glm::mat4 &transform)
+{
+    Bounds result;
+    for (uint32_t corner = 0; corner < 8; ++corner)
+    {
+        const glm::vec3 point((corner & 1) ? bounds.max.x : bounds.min.x,
+                              (corner & 2) ? bounds.max.y : bounds.min.y,
+                              (corner & 4) ? bounds.max.z : bounds.min.z);
+        result.grow(glm::vec3(transform * glm::vec4(point, 1.f)));
+    }
+    return result;
+}
+
+// How many pieces forEachChunk() cuts `size` elements into
+size_t chunkCount(ThreadPool *pool, size_t size)
+{
+    if (pool == nullptr)
+    {
+        return 1;
+    }
+    return std::clamp<size_t>(size / kMinChunkSize, 1, pool->size());
+}
+
+// Calls function(chunk, begin, end) for every chunk of [begin, end) and waits for all of them.
+// More than one chunk run on the pool, so this must never be called from one of its tasks.
+template <typename F>
+void forEachChunk(ThreadPool *pool, size_t begin, size_t end, F &&function)
+{
+    const size_t chunks = chunkCount(pool, end - begin);
+    if (chunks == 1)
+    {
+        function(size_t{0}, begin, end);
+        return;
+    }
+
+    std::vector<std::future<void>> futures;
+    futures.reserve(chunks);
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+        const size_t chunkBegin = begin + (end - begin) * chunk / chunks;
+        const size_t chunkEnd   = begin + (end - begin) * (chunk + 1) / chunks;
+        futures.push_back(pool->submit(
+            [&function, chunk, chunkBegin, chunkEnd]() { function(chunk, chunkBegin, chunkEnd); }));
+    }
+    for (std::future<void> &future : futures)
+    {
+        future.get();
+    }
+}
+
+// Per primitive data all the builders work from. Primitives are triangles, or instances for top
+// level BVHs.
+struct Primitives
+{
+    Primitives(const std::vector<BvhTriangle> &triangles, ThreadPool *pool)
+        : bounds(triangles.size()), centroids(triangles.size()), order(triangles.size())
+    {
+        forEachChunk(pool, 0, triangles.size(), [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                bounds[i]    = triangleBounds(triangles[i]);
+                centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+            }
+        });
+        std::iota(order.begin(), order.end(), 0);
+    }
+
+    // Primitives that aren't triangles, from their bounds
+    explicit Primitives(std::vector<Bounds> primitiveBounds)
+        : bounds(std::move(primitiveBounds)), centroids(bounds.size()), order(bounds.size())
+    {
+        for (size_t i = 0; i < bounds.size(); ++i)
+        {
+            centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+        }
+        std::iota(order.begin(), order.end(), 0);
+    }
+
+    // Bounds of the primitives in [begin, end) of the order, and bounds of their centroids
+    std::pair<Bounds, Bounds> rangeBounds(uint32_t begin, uint32_t end, ThreadPool *pool) const
+    {
+        std::vector<std::pair<Bounds, Bounds>> partial(chunkCount(pool, end - begin));
+        forEachChunk(pool, begin, end, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd) {
+            for (size_t i = chunkBegin; i < chunkEnd; ++i)
+            {
+                partial[chunk].first.grow(bounds[order[i]]);
+                partial[chunk].second.grow(centroids[order[i]]);
+            }
+        });
+
+        // Min and max don't care about order, so this gives the same bounds however it's chunked
+        std::pair<Bounds, Bounds> result;
+        for (const auto &[chunkBounds, chunkCentroidBounds] : partial)
+        {
+            result.first.grow(chunkBounds);
+            result.second.grow(chunkCentroidBounds);
+        }
+        return result;
+    }
+
+    std::vector<Bounds> bounds;
+    std::vector<glm::vec3> centroids;
+    // Triangle indices, partitioned in place as the tree gets built
+    std::vector<uint32_t> order;
+};
+
+// Splits nodes at the cheapest boundary between bins of centroids by the surface area heuristic
+class SahSplitter
+{
+  public:
+    // `pool` helps binning big nodes, nullptr bins everything on the calling thread
+    SahSplitter(const BuildSettings &settings, ThreadPool *pool)
+        : mSettings(settings), mPool(pool), mRightAreas(settings.binCount)
+    {
+        H_ASSERT(settings.binCount >= 2, "A binned BVH build needs at least two bins");
+        H_ASSERT(settings.maxLeafSize >= 1, "BVH leaves have to hold at least one triangle");
+    }
+
+    // First index of the second child, nullopt to make the range a leaf
+    std::optional<uint32_t> split(Primitives &primitives,
+                                  uint32_t begin,
+                                  uint32_t end,
+                                  const Bounds &bounds,
+                                  const Bounds &centroidBounds)
+    {
+        const uint32_t count            = end - begin;
+        const std::optional<Split> best = findSplit(primitives, begin, end, bounds, centroidBounds);
+        if (!best.has_value())
+        {
+            // Every centroid is in the same spot, so there's no plane between them. Small ranges
+            // gain nothing from splitting, bigger ones just get halved in whatever order they're
+            // in.
+            if (count <= mSettings.maxLeafSize)
+            {
+                return std::nullopt;
+            }
+            return begin + count / 2;
+        }
+        if (count <= mSettings.maxLeafSize && best->cost >= count * kIntersectionCost)
+        {
+            return std::nullopt;
+        }
+
+        const AxisBinning binning = axisBinning(centroidBounds, best->axis);
+        const auto first          = primitives.order.begin() + begin;
+        const auto firstRight     = std::partition(first, first + count, [&](uint32_t i) {
+            return binning.bin(primitives.centroids[i][best->axis]) < best->bin;
+        });
+        return static_cast<uint32_t>(firstRight - primitives.order.begin());
+    }
+
+  private:
+    struct Split
+    {
+        uint32_t axis;
+        // First bin that goes to the second child
+        uint32_t bin;
+        float cost;
+    };
+
+    struct Bin
+    {
+        Bounds bounds;
+        uint32_t count{0};
+    };
+
+    // Maps centroids along one axis to bins, scale is 0 when the centroids don't spread out along
+    // it
+    struct AxisBinning
+    {
+        float min;
+        float scale;
+        uint32_t binCount;
+
+        uint32_t bin(float centroid) const
+        {
+            return std::min(static_cast<uint32_t>((centroid - min) * scale), binCount - 1);
+        }
+    };
+
+    AxisBinning axisBinning(const Bounds &centroidBounds, uint32_t axis) const
+    {
+        const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        const float scale  = extent > 0.f ? mSettings.binCount / extent : 0.f;
+        return AxisBinning{centroidBounds.min[axis], scale, mSettings.binCount};
+    }
+
+    // Cheapest split of the range between two bins of centroids, over all three axes. There is
+    // none when every centroid is in the same spot.
+    std::optional<Split> findSplit(const Primitives &primitives,
+                                   uint32_t begin,
+                                   uint32_t end,
+                                   const Bounds &bounds,
+                                   const Bounds &centroidBounds)
+    {
+        const std::array<AxisBinning, 3> binnings = {axisBinning(centroidBounds, 0),
+                                                     axisBinning(centroidBounds, 1),
+                                                     axisBinning(centroidBounds, 2)};
+
+        // All three axes get binned in one pass over the range. Big ranges are cut into chunks
+        // that each fill their own bins, which get merged into the first chunk's afterwards.
+        ThreadPool *pool          = end - begin >= kParallelBinningSize ? mPool : nullptr;
+        const size_t binsPerChunk = 3 * mSettings.binCount;
+        mBins.assign(chunkCount(pool, end - begin) * binsPerChunk, Bin{});
+        forEachChunk(pool, begin, end, [&](size_t chunk, size_t chunkBegin, size_t chunkEnd) {
+            Bin *chunkBins = mBins.data() + chunk * binsPerChunk;
+            for (size_t i = chunkBegin; i < chunkEnd; ++i)
+            {
+                const uint32_t triangle = primitives.order[i];
+                for (uint32_t axis = 0; axis < 3; ++axis)
+                {
+                    const uint32_t bin = binnings[axis].bin(primitives.centroids[triangle][axis]);
+                    Bin &target        = chunkBins[axis * mSettings.binCount + bin];
+                    target.bounds.grow(primitives.bounds[triangle]);
+                    ++target.count;
+                }
+            }
+        });
+        for (size_t i = binsPerChunk; i < mBins.size(); ++i)
+        {
+            mBins[i % binsPerChunk].bounds.grow(mBins[i].bounds);
+            mBins[i % binsPerChunk].count += mBins[i].count;
+        }
+
+        // Keeps the division finite for nodes whose triangles all lie on one line
+        const float nodeArea = std::max(bounds.area(), std::numeric_limits<float>::min());
+
+        std::optional<Split> best;
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            if (binnings[axis].scale == 0.f)
+            {
+                continue;
+            }
+            const Bin *bins = mBins.data() + axis * mSettings.binCount;
+
+            // mRightAreas[i] covers bins i and up, then sweeping from the left gives every split
+            Bounds right;
+            for (uint32_t i = mSettings.binCount - 1; i > 0; --i)
+            {
+                right.grow(bins[i].bounds);
+                mRightAreas[i] = right.area();
+            }
+
+            Bounds left;
+            uint32_t leftCount = 0;
+            for (uint32_t i = 1; i < mSettings.binCount; ++i)
+            {
+                left.grow(bins[i - 1].bounds);
+                leftCount += bins[i - 1].count;
+                const uint32_t rightCount = (end - begin) - leftCount;
+                if (leftCount == 0 || rightCount == 0)
+                {
+                    continue;
+                }
+
+                const float childCost = left.area() * leftCount + mRightAreas[i] * rightCount;
+                const float cost      = kTraversalCost + kIntersectionCost * childCost / nodeArea;
+                if (!best.has_value() || cost < best->cost)
+                {
+                    best = Split{axis, i, cost};
+                }
+            }
+        }
+        return best;
+    }
+
+    BuildSettings mSettings;
+    ThreadPool *mPool;
+
+    // Scratch space of findSplit()
+    std::vector<Bin> mBins;
+    std::vector<float> mRightAreas;
+};
+
+// Splits ranges of triangles sorted by Morton code at the first bit their codes differ in, which
+// halves the cell they share along one axis. Linear BVHs don't reorder anything while building.
+class MortonSplitter
+{
+  public:
+    // `codes` holds the Morton code of every entry of the order, sorted
+    MortonSplitter(const BuildSettings &settings, const std::vector<uint32_t> &codes)
+        : mSettings(settings), mCodes(&codes)
+    {
+        H_ASSERT(settings.maxLeafSize >= 1, "BVH leaves have to hold at least one triangle");
+    }
+
+    std::optional<uint32_t> split(
+        Primitives &, uint32_t begin, uint32_t end, const Bounds &, const Bounds &)
+    {
+        const uint32_t count = end - begin;
+        if (count <= mSettings.maxLeafSize)
+        {
+            return std::nullopt;
+        }
+
+        const std::vector<uint32_t> &codes = *mCodes;
+        const uint32_t firstCode           = codes[begin];
+        const uint32_t lastCode            = codes[end - 1];
+        if (firstCode == lastCode)
+        {
+            return begin + count / 2;
+        }
+
+        // Codes that agree with the first one past the bits the whole range shares all come
+        // before the ones that don't
+        const int sharedBits  = std::countl_zero(firstCode ^ lastCode);
+        const auto firstRight = std::partition_point(
+            codes.begin() + begin, codes.begin() + end,
+            [&](uint32_t code) { return std::countl_zero(firstCode ^ code) > sharedBits; });
+        return static_cast<uint32_t>(firstRight - codes.begin());
+    }
+
+  private:
+    BuildSettings mSettings;
+    const std::vector<uint32_t> *mCodes;
+};
+
+// Range the top levels of a parallel build leave for a task of its own, with a placeholder node
+// in its place
+struct Subtree
+{
+    uint32_t node;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t depth;
+};
+
+// Emits nodes depth first, with `Splitter` deciding where to split every range:
+//     std::optional<uint32_t> split(Primitives &, begin, end, bounds, centroidBounds);
+// returns the first index of the second child, or nullopt to make the range a leaf.
+template <typename Splitter>
+class NodeBuilder
+{
+  public:
+    // `pool` helps computing the bounds of big nodes, nullptr does everything on the calling
+    // thread
+    NodeBuilder(Primitives &primitives, Splitter splitter, ThreadPool *pool)
+        : mPrimitives(primitives), mSplitter(std::move(splitter)), mPool(pool)
+    {}
+
+    // Ranges of at most `size` triangles get recorded in `subtrees` instead of being built
+    void deferSubtrees(std::vector<Subtree> *subtrees, uint32_t size)
+    {
+        mSubtrees    = subtrees;
+        mSubtreeSize = size;
+    }
+
+    void buildNode(uint32_t begin, uint32_t end, uint32_t depth)
+    {
+        const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+
+        const uint32_t count = end - begin;
+        if (mSubtrees != nullptr && count <= mSubtreeSize)
+        {
+            mSubtrees->push_back(Subtree{nodeIndex, begin, end, depth});
+            return;
+        }
+
+        const auto [bounds, centroidBounds] = mPrimitives.rangeBounds(begin, end, mPool);
+        std::optional<uint32_t> middle;
+        if (count > 1 && depth < kMaxDepth)
+        {
+            middle = mSplitter.split(mPrimitives, begin, end, bounds, centroidBounds);
+        }
+        if (!middle.has_value())
+        {
+            nodes[nodeIndex] = BvhNode{bounds.min, begin, bounds.max, count};
+            return;
+        }
+
+        buildNode(begin, *middle, depth + 1);
+        const uint32_t secondChild = static_cast<uint32_t>(nodes.size());
+        buildNode(*middle, end, depth + 1);
+        nodes[nodeIndex] = BvhNode{bounds.min, secondChild, bounds.max, 0};
+    }
+
+    std::vector<BvhNode> nodes;
+
+  private:
+    Primitives &mPrimitives;
+    Splitter mSplitter;
+    ThreadPool *mPool;
+
+    std::vector<Subtree> *mSubtrees{nullptr};
+    uint32_t mSubtreeSize{0};
+};
+
+// Copies the top levels into `result` depth first, with every placeholder replaced by the nodes
+// of its subtree
+void spliceSubtrees(const std::vector<BvhNode> &top,
+                    const std::vector<int32_t> &subtreeOf,
+                    const std::vector<std::vector<BvhNode>> &subtrees,
+                    uint32_t topIndex,
+                    std::vector<BvhNode> &result)
+{
+    if (subtreeOf[topIndex] >= 0)
+    {
+        const auto base = static_cast<uint32_t>(result.size());
+        for (BvhNode node : subtrees[subtreeOf[topIndex]])
+        {
+            // Leaves point at triangles, whose indices are already final
+            if (node.count == 0)
+            {
+                node.offset += base;
+            }
+            result.push_back(node);
+        }
+        return;
+    }
+
+    const BvhNode &node      = top[topIndex];
+    const uint32_t nodeIndex = static_cast<uint32_t>(result.size());
+    result.push_back(node);
+    if (node.count == 0)
+    {
+        spliceSubtrees(top, subtreeOf, subtrees, topIndex + 1, result);
+        result[nodeIndex].offset = static_cast<uint32_t>(result.size());
+        spliceSubtrees(top, subtreeOf, subtrees, node.offset, result);
+    }
+}
+
+// Builds the top levels on the calling thread, with the pool helping out inside the big nodes,
+// then every subtree below them as a task of its own. `makeSplitter(ThreadPool *)` gets the pool
+// for the top levels and nullptr for the subtree tasks. Subtrees cover disjoint ranges of the
+// order, so they can partition it concurrently, and every split only depends on its own range,
+// so the tree comes out the same as building it in one go.
+template <typename MakeSplitter>
+std::vector<BvhNode> buildNodesInParallel(Primitives &primitives,
+                                          ThreadPool &pool,
+                                          const MakeSplitter &makeSplitter)
+{
+    const auto count           = static_cast<uint32_t>(primitives.order.size());
+    const auto threadCount     = static_cast<uint32_t>(std::max<size_t>(pool.size(), 1));
+    const uint32_t subtreeSize =
+        std::max(kMinSubtreeSize, count / (threadCount * kSubtreesPerThread));
+
+    std::vector<Subtree> subtrees;
+    NodeBuilder top(primitives, makeSplitter(&pool), &pool);
+    top.deferSubtrees(&subtrees, subtreeSize);
+    top.buildNode(0, count, 0);
+
+    // Biggest first, so that no large subtree is left to start last
+    std::vector<uint32_t> schedule(subtrees.size());
+    std::iota(schedule.begin(), schedule.end(), 0);
+    std::sort(schedule.begin(), schedule.end(), [&](uint32_t a, uint32_t b) {
+        return subtrees[a].end - subtrees[a].begin > subtrees[b].end - subtrees[b].begin;
+    });
+
+    std::vector<std::future<std::vector<BvhNode>>> futures(subtrees.size());
+    for (const uint32_t i : schedule)
+    {
+        futures[i] = pool.submit([&primitives, &makeSplitter, subtree = subtrees[i]]() {
+            NodeBuilder builder(primitives, makeSplitter(nullptr), nullptr);
+            builder.buildNode(subtree.begin, subtree.end, subtree.depth);
+            return std::move(builder.nodes);
+        });
+    }
+
+    std::vector<std::vector<BvhNode>> built(subtrees.size());
+    std::vector<int32_t> subtreeOf(top.nodes.size(), -1);
+    size_t nodeCount = top.nodes.size() - subtrees.size();
+    for (size_t i = 0; i < subtrees.size(); ++i)
+    {
+        built[i]                     = futures[i].get();
+        subtreeOf[subtrees[i].node]  = static_cast<int32_t>(i);
+        nodeCount                   += built[i].size();
+    }
+
+    std::vector<BvhNode> nodes;
+    nodes.reserve(nodeCount);
+    spliceSubtrees(top.nodes, subtreeOf, built, 0, nodes);
+    return nodes;
+}
+
+Bvh finish(std::vector<BvhNode> nodes,
+           const std::vector<BvhTriangle> &triangles,
+           const Primitives &primitives,
+           ThreadPool *pool)
+{
+    Bvh result{std::move(nodes), std::vector<BvhTriangle>(triangles.size())};
+    forEachChunk(pool, 0, triangles.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            result.triangles[i] = triangles[primitives.order[i]];
+        }
+    });
+    return result;
+}
+
+// Degenerate, so no ray ever hits it, but it keeps the tree and its buffers from being empty
+void ensureNotEmpty(std::vector<BvhTriangle> &triangles)
+{
+    if (triangles.empty())
+    {
+        triangles.push_back(BvhTriangle{glm::vec4(0.f), glm::vec4(0.f), glm::vec4(0.f)});
+    }
+    H_ASSERT(triangles.size() <= std::numeric_limits<uint32_t>::max(),
+             "BVH triangle indices are 32 bit");
+}
+
+// Spreads the low kMortonBits bits of v out to every third bit
+uint32_t expandBits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// Interleaves the bits of the centroid's cell in a grid over `centroidBounds`, x highest
+uint32_t mortonCode(const glm::vec3 &centroid, const Bounds &centroidBounds)
+{
+    constexpr float kCells = static_cast<float>(1u << kMortonBits);
+
+    uint32_t code = 0;
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        const float offset =
+            extent > 0.f ? (centroid[axis] - centroidBounds.min[axis]) / extent : 0.f;
+        const auto cell = static_cast<uint32_t>(std::clamp(offset * kCells, 0.f, kCells - 1.f));
+        code |= expandBits(cell) << (2 - axis);
+    }
+    return code;
+}
+
+// Sorts chunks on the pool, then merges neighbouring pairs of them until one is left
+void parallelSort(std::vector<uint64_t> &keys, ThreadPool &pool)
+{
+    forEachChunk(&pool, 0, keys.size(), [&](size_t, size_t begin, size_t end) {
+        std::sort(keys.begin() + begin, keys.begin() + end);
+    });
+
+    // Same boundaries as forEachChunk()'s
+    const size_t chunks = chunkCount(&pool, keys.size());
+    std::vector<size_t> boundaries;
+    for (size_t chunk = 0; chunk <= chunks; ++chunk)
+    {
+        boundaries.push_back(keys.size() * chunk / chunks);
+    }
+
+    while (boundaries.size() > 2)
+    {
+        std::vector<std::future<void>> merges;
+        std::vector<size_t> merged = {0};
+        for (size_t i = 0; i + 2 < boundaries.size(); i += 2)
+        {
+            const auto first  = keys.begin() + boundaries[i];
+            const auto middle = keys.begin() + boundaries[i + 1];
+            const auto last   = keys.begin() + boundaries[i + 2];
+            merges.push_back(
+                pool.submit([first, middle, last]() { std::inplace_merge(first, middle, last); }));
+            merged.push_back(boundaries[i + 2]);
+        }
+        // With an odd number of chunks the last one sits this round out
+        if (merged.back() != keys.size())
+        {
+            merged.push_back(keys.size());
+        }
+        for (std::future<void> &merge : merges)
+        {
+            merge.get();
+        }
+        boundaries = std::move(merged);
+    }
+}
+
+// Rolling terrain of `count` triangles, far more than any of the scenes have
+std::vector<BvhTriangle> syntheticTriangles(size_t count)
+{
+    const auto side   = static_cast<size_t>(std::ceil(std::sqrt(count / 2.0)));
+    const auto vertex = [side](size_t x, size_t z) {
+        const float u = 1000.f * x / side;
+        const float v = 1000.f * z / side;
+        return glm::vec4(u, 20.f * std::sin(u * 0.05f) * std::cos(v * 0.03f), v, 1.f);
+    };
+
+    std::vector<BvhTriangle> triangles;
+    triangles.reserve(count + 1);
+    for (size_t z = 0; z < side && triangles.size() < count; ++z)
+    {
+        for (size_t x = 0; x < side && triangles.size() < count; ++x)
+        {
+            triangles.push_back(BvhTriangle{vertex(x, z), vertex(x + 1, z), vertex(x, z + 1)});
+            triangles.push_back(
+                BvhTriangle{vertex(x + 1, z), vertex(x + 1, z + 1), vertex(x, z + 1)});
+        }
+    }
+    return triangles;
+}
+}  // namespace
+
+void appendTriangles(const Mesh &mesh,
+                     const glm::mat4 &transform,
+                     std::vector<BvhTriangle> &triangles)
+{
+    const auto worldPosition = [&](Mesh::IndexType index) {
+        return transform * glm::vec4(mesh.vertices[index].position, 1.f);
+    };
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        triangles.push_back(BvhTriangle{worldPosition(mesh.indices[i]),
+                                        worldPosition(mesh.indices[i + 1]),
+                                        worldPosition(mesh.indices[i + 2])});
+    }
+}
+
+Bvh build(std::vector<BvhTriangle> triangles, const BuildSettings &settings)
+{
+    ZoneScopedNC("bvh::build", tracy::Color::Orange);
+    ensureNotEmpty(triangles);
+
+    Primitives primitives(triangles, nullptr);
+    NodeBuilder builder(primitives, SahSplitter(settings, nullptr), nullptr);
+    // A binary tree with at most one triangle per leaf has fewer than twice as many nodes
+    builder.nodes.reserve(2 * triangles.size());
+    builder.buildNode(0, static_cast<uint32_t>(triangles.size()), 0);
+    return finish(std::move(builder.nodes), triangles, primitives, nullptr);
+}
+
+Bvh buildParallel(std::vector<BvhTriangle> triangles,
+                  ThreadPool &pool,
+                  const BuildSettings &settings)
+{
+    ZoneScopedNC("bvh::buildParallel", tracy::Color::Orange);
+    ensureNotEmpty(triangles);
+
+    Primitives primitives(triangles, &pool);
+    const auto makeSplitter    = [&](ThreadPool *binningPool) {
+        return SahSplitter(settings, binningPool);
+    };
+    std::vector<BvhNode> nodes = buildNodesInParallel(primitives, pool, makeSplitter);
+    return finish(std::move(nodes), triangles, primitives, &pool);
+}
+
+Bvh buildLinear(std::vector<BvhTriangle> triangles,
+                ThreadPool &pool,
+                const BuildSettings &settings)
+{
+    ZoneScopedNC("bvh::buildLinear", tracy::Color::Orange);
+    ensureNotEmpty(triangles);
+
+    Primitives primitives(triangles, &pool);
+    const auto count            = static_cast<uint32_t>(triangles.size());
+    const Bounds centroidBounds = primitives.rangeBounds(0, count, &pool).second;
+
+    // Codes in the high half, so sorting the keys sorts by code, with the triangle index breaking
+    // ties the same way every time
+    std::vector<uint64_t> keys(count);
+    forEachChunk(&pool, 0, count, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const uint64_t code = mortonCode(primitives.centroids[i], centroidBounds);
+            keys[i]             = code << 32 | i;
+        }
+    });
+    parallelSort(keys, pool);
+
+    std::vector<uint32_t> codes(count);
+    forEachChunk(&pool, 0, count, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            codes[i]            = static_cast<uint32_t>(keys[i] >> 32);
+            primitives.order[i] = static_cast<uint32_t>(keys[i]);
+        }
+    });
+
+    std::vector<BvhNode> nodes = buildNodesInParallel(
+        primitives, pool, [&](ThreadPool *) { return MortonSplitter(settings, codes); });
+    return finish(std::move(nodes), triangles, primitives, &pool);
+}
+
+uint32_t appendBottomLevel(const Bvh &blas, Bvh &bottomLevels)
+{
+    const auto nodeBase     = static_cast<uint32_t>(bottomLevels.nodes.size());
+    const auto triangleBase = static_cast<uint32_t>(bottomLevels.triangles.size());
+    H_ASSERT(triangleBase + blas.triangles.size() <= std::numeric_limits<uint32_t>::max(),
+             "BVH triangle indices are 32 bit");
+
+    bottomLevels.nodes.reserve(bottomLevels.nodes.size() + blas.nodes.size());
+    for (BvhNode node : blas.nodes)
+    {
+        node.offset += node.count == 0 ? nodeBase : triangleBase;
+        bottomLevels.nodes.push_back(node);
+    }
+    bottomLevels.triangles.insert(bottomLevels.triangles.end(), blas.triangles.begin(),
+                                  blas.triangles.end());
+    return nodeBase;
+}
+
+TopLevelBvh buildTopLevel(const std::vector<BvhNode> &blasNodes,
+                          const std::vector<uint32_t> &blasRoots,
+                          const std::vector<glm::mat4> &transforms,
+                          const BuildSettings &settings)
+{
+    ZoneScopedNC("bvh::buildTopLevel", tracy::Color::Orange);
+    H_ASSERT(blasRoots.size() == transforms.size(), "Every instance needs a transform");
+
+    TopLevelBvh result;
+    if (transforms.empty())
+    {
+        // A placeholder instance keeps the buffers from being empty. Its bounds are inverted,
+        // which intersectBox() in bvh.glsl swaps into a box around everything, so traversal does
+        // reach it. Without any instances there are no bottom levels but the empty build's, so
+        // root 0 is a degenerate triangle and the ray comes out without a hit.
+        const Bounds empty;
+        result.nodes.push_back(BvhNode{empty.min, 0, empty.max, 1});
+        result.instances.push_back(BvhInstance{glm::mat4(1.f), 0, {}});
+        return result;
+    }
+
+    std::vector<Bounds> instanceBounds(transforms.size());
+    for (size_t i = 0; i < transforms.size(); ++i)
+    {
+        instanceBounds[i] = transformBounds(nodeBounds(blasNodes[blasRoots[i]]), transforms[i]);
+    }
+
+    Primitives primitives(std::move(instanceBounds));
+    NodeBuilder builder(primitives, SahSplitter(settings, nullptr), nullptr);
+    builder.buildNode(0, static_cast<uint32_t>(transforms.size()), 0);
+
+    result.nodes           = std::move(builder.nodes);
+    result.instanceIndices = std::move(primitives.order);
+    result.instances.reserve(transforms.size());
+    for (const uint32_t i : result.instanceIndices)
+    {
+        result.instances.push_back(BvhInstance{glm::inverse(transforms[i]), blasRoots[i], {}});
+    }
+    return result;
+}
+
+void refitTopLevel(TopLevelBvh &tlas,
+                   const std::vector<BvhNode> &blasNodes,
+                   const std::vector<glm::mat4> &transforms)
+{
+    ZoneScopedNC("bvh::refitTopLevel", tracy::Color::Orange);
+    H_ASSERT(transforms.size() == tlas.instanceIndices.size(), "Every instance needs a transform");
+    // The placeholder tree of an empty build has nothing to move
+    if (transforms.empty())
+    {
+        return;
+    }
+
+    std::vector<Bounds> instanceBounds(tlas.instances.size());
+    for (size_t i = 0; i < tlas.instances.size(); ++i)
+    {
+        const glm::mat4 &transform = transforms[tlas.instanceIndices[i]];
+        BvhInstance &instance      = tlas.instances[i];
+        instance.worldToObject     = glm::inverse(transform);
+        instanceBounds[i] = transformBounds(nodeBounds(blasNodes[instance.blasRoot]), transform);
+    }
+
+    // Children always come after their parent, so walking backwards reaches every node after
+    // its children
+    for (size_t i = tlas.nodes.size(); i-- > 0;)
+    {
+        BvhNode &node = tlas.nodes[i];
+        Bounds bounds;
+        if (node.count > 0)
+        {
+            for (uint32_t instance = node.offset; instance < node.offset + node.count; ++instance)
+            {
+                bounds.grow(instanceBounds[instance]);
+            }
+        }
+        else
+        {
+            bounds.grow(nodeBounds(tlas.nodes[i + 1]));
+            bounds.grow(nodeBounds(tlas.nodes[node.offset]));
+        }
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+    }
+}
+
+Stats computeStats(const Bvh &bvh)
+{
+    Stats stats{bvh.nodes.size(), 0, 0, 0.f};
+    const float rootArea = nodeBounds(bvh.nodes[0]).area();
+
+    // Node index and depth
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 1}};
+    while (!stack.empty())
+    {
+        const auto [index, depth] = stack.back();
+        stack.pop_back();
+
+        const BvhNode &node   = bvh.nodes[index];
+        const float areaRatio = rootArea > 0.f ? nodeBounds(node).area() / rootArea : 1.f;
+        stats.depth           = std::max(stats.depth, depth);
+        if (node.count > 0)
+        {
+            ++stats.leafCount;
+            stats.sahCost += areaRatio * node.count * kIntersectionCost;
+        }
+        else
+        {
+            stats.sahCost += areaRatio * kTraversalCost;
+            stack.push_back({index + 1, depth + 1});
+            stack.push_back({node.offset, depth + 1});
+        }
+    }
+    return stats;
+}
+
+bool validate(const Bvh &bvh)
+{
+    if (bvh.nodes.empty())
+    {
+        return false;
+    }
+
+    std::vector<uint32_t> leafHits(bvh.triangles.size(), 0);
+    size_t visited = 0;
+
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty())
+    {
+        const uint32_t index = stack.back();
+        stack.pop_back();
+        ++visited;
+
+        const BvhNode &node = bvh.nodes[index];
+        const Bounds bounds = nodeBounds(node);
+        if (node.count > 0)
+        {
+            if (static_cast<size_t>(node.offset) + node.count > bvh.triangles.size())
+            {
+                return false;
+            }
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+            {
+                if (!bounds.contains(triangleBounds(bvh.triangles[i])))
+                {
+                    return false;
+                }
+                ++leafHits[i];
+            }
+            continue;
+        }
+
+        // Children always come after their parent, which also rules out cycles
+        if (node.offset <= index + 1 || node.offset >= bvh.nodes.size())
+        {
+            return false;
+        }
+        for (const uint32_t child : {index + 1, node.offset})
+        {
+            if (!bounds.contains(nodeBounds(bvh.nodes[child])))
+            {
+                return false;
+            }
+            stack.push_back(child);
+        }
+    }
+
+    return visited == bvh.nodes.size() &&
+           std::all_of(leafHits.begin(), leafHits.end(), [](uint32_t hits) { return hits == 1; });
+}
+
+void benchmark(const std::vector<BvhTriangle> &sceneTriangles)
+{
+    const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> threadCounts{1, 2, 4, hardwareThreads};
+    std::sort(threadCounts.begin(), threadCounts.end());
+    threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+    const auto run = [&](const char *name, const std::vector<BvhTriangle> &triangles) {
+        // Builds from a copy of the triangles, made before the clock starts
+        const auto timeBuild = [&](const auto &buildFunction, Bvh &result) {
+            std::vector<BvhTriangle> input = triangles;
+
+            const auto start = std::chrono::steady_clock::now();
+            result           = buildFunction(std::move(input));
+            const std::chrono::duration<float, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            return elapsed.count();
+        };
+
+        Bvh sequential;
+        const float sequentialMs = timeBuild(
+            [](std::vector<BvhTriangle> input) { return build(std::move(input)); }, sequential);
+        const float sequentialCost = computeStats(sequential).sahCost;
+        LOGGER.info("BVH build benchmark, {} ({} triangles): sequential SAH {:.2f}ms, SAH cost "
+                    "{:.2f}",
+                    name, triangles.size(), sequentialMs, sequentialCost);
+
+        for (const size_t threadCount : threadCounts)
+        {
+            ThreadPool pool(threadCount);
+
+            Bvh parallel;
+            const float parallelMs = timeBuild(
+                [&](std::vector<BvhTriangle> input) {
+                    return buildParallel(std::move(input), pool);
+                },
+                parallel);
+            Bvh linear;
+            const float linearMs = timeBuild(
+                [&](std::vector<BvhTriangle> input) {
+                    return buildLinear(std::move(input), pool);
+                },
+                linear);
+            const float linearCost = computeStats(linear).sahCost;
+
+            LOGGER.info("  {} threads: parallel SAH {:.2f}ms, {:.2f}x speedup{}", threadCount,
+                        parallelMs, sequentialMs / parallelMs,
+                        parallel.nodes == sequential.nodes ? "" : ", differs from sequential");
+            LOGGER.info("  {} threads: LBVH {:.2f}ms, {:.2f}x speedup, SAH cost {:.2f} ({:.2f}x){}",
+                        threadCount, linearMs, sequentialMs / linearMs, linearCost,
+                        linearCost / sequentialCost, validate(linear) ? "" : ", invalid");
+        }
+    };
+
+    run("scene", sceneTriangles);
+    run("synthetic", syntheticTriangles(10'000'000));
+}
+}  // namespace bvh
+}  // namespace hatgpu
@@ -0,0 +1,151 @@
+#ifndef _INCLUDE_BVH_H
+#define _INCLUDE_BVH_H
+#include "hatpch.h"
+
+#include "geometry/Mesh.h"
+
+#include <vector>
+
+namespace hatgpu
+{
+class ThreadPool;
+
+// World space triangle, laid out the way the path tracer reads it. The w components are unused.
+struct BvhTriangle
+{
+    glm::vec4 v0;
+    glm::vec4 v1;
+    glm::vec4 v2;
+};
+
+// 32 bytes, so two nodes share a cache line. Nodes are stored depth first: an interior node's
+// first child directly follows it, and only the index of the second child is stored.
+struct BvhNode
+{
+    glm::vec3 boundsMin;
+    // Second child of an interior node, first triangle of a leaf
+    uint32_t offset;
+    glm::vec3 boundsMax;
+    // Triangles in a leaf, 0 for interior nodes
+    uint32_t count;
+
+    bool operator==(const BvhNode &other) const = default;
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode must match the std430 layout in bvh.glsl");
+
+struct Bvh
+{
+    std::vector<BvhNode> nodes;
+    // Reordered so that every leaf's triangles are contiguous
+    std::vector<BvhTriangle> triangles;
+};
+
+// Placement of a bottom level BVH in the world, laid out the way the path tracer reads it
+struct BvhInstance
+{
+    // Rays are moved into the bottom level's object space with this
+    glm::mat4 worldToObject;
+    // Root node of the bottom level BVH
+    uint32_t blasRoot;
+    uint32_t padding[3];
+};
+static_assert(sizeof(BvhInstance) == 80, "BvhInstance must match the std430 layout in bvh.glsl");
+
+// Top level BVH over instances. Its nodes are laid out like a Bvh's, but leaves index
+// `instances` instead of triangles.
+struct TopLevelBvh
+{
+    std::vector<BvhNode> nodes;
+    // Reordered so that every leaf's instances are contiguous
+    std::vector<BvhInstance> instances;
+    // The index every entry of `instances` had in the build's arguments
+    std::vector<uint32_t> instanceIndices;
+};
+
+// CPU-only bounding volume hierarchy construction over triangle soups. Nothing here touches the
+// GPU, and the results only depend on the arguments.
+namespace bvh
+{
+// Deepest a tree can get, the traversal stack in bvh.glsl is sized for it
+static constexpr uint32_t kMaxDepth = 64;
+// Relative costs the surface area heuristic weighs a split with
+static constexpr float kTraversalCost    = 1.f;
+static constexpr float kIntersectionCost = 1.f;
+
+struct BuildSettings
+{
+    // Candidate split planes per axis are the boundaries between this many bins of centroids
+    uint32_t binCount = 16;
+    // Nodes with more triangles than this are always split
+    uint32_t maxLeafSize = 4;
+};
+
+struct Stats
+{
+    size_t nodeCount;
+    size_t leafCount;
+    uint32_t depth;
+    // Expected cost of a random ray hitting the root, in units of kIntersectionCost
+    float sahCost;
+};
+
+// Appends the mesh's triangles, transformed by `transform`. Doesn't reserve, callers appending
+// several meshes should reserve their total once.
+void appendTriangles(const Mesh &mesh,
+                     const glm::mat4 &transform,
+                     std::vector<BvhTriangle> &triangles);
+
+// Top down binned SAH build. An empty triangle list gives a single leaf with one degenerate
+// triangle that no ray hits.
+Bvh build(std::vector<BvhTriangle> triangles, const BuildSettings &settings = {});
+
+// Same tree as build(), node for node, built on `pool`. The top levels are split on the calling
+// thread with their binning spread over the pool, every subtree below them is built by a task of
+// its own. Must not be called from one of the pool's tasks.
+Bvh buildParallel(std::vector<BvhTriangle> triangles,
+                  ThreadPool &pool,
+                  const BuildSettings &settings = {});
+
+// Linear BVH: triangles get sorted by the Morton codes of their centroids and nodes split where
+// the codes first differ, with the same subtree tasks as buildParallel(). Much quicker to build
+// than the SAH trees but slower to trace. Only settings.maxLeafSize is used. Must not be called
+// from one of the pool's tasks.
+Bvh buildLinear(std::vector<BvhTriangle> triangles,
+                ThreadPool &pool,
+                const BuildSettings &settings = {});
+
+// Appends `blas` to `bottomLevels`, with its offsets moved past the nodes and triangles that are
+// already there, and returns the index of its root. Any number of bottom levels can share the
+// same arrays this way.
+uint32_t appendBottomLevel(const Bvh &blas, Bvh &bottomLevels);
+
+// SAH build over the world space bounds of instance i, which places the bottom level rooted at
+// blasNodes[blasRoots[i]] with transforms[i]. Without any instances the tree is a single leaf
+// with a placeholder instance of blasNodes[0], which has to be an empty build's bottom level for
+// no ray to hit it.
+TopLevelBvh buildTopLevel(const std::vector<BvhNode> &blasNodes,
+                          const std::vector<uint32_t> &blasRoots,
+                          const std::vector<glm::mat4> &transforms,
+                          const BuildSettings &settings = {});
+
+// Moves the instances to `transforms`, indexed like the build's arguments, and recomputes every
+// node's bounds bottom up. The tree keeps its shape, so it gets slower to trace the further the
+// instances move from where they were when it was built.
+void refitTopLevel(TopLevelBvh &tlas,
+                   const std::vector<BvhNode> &blasNodes,
+                   const std::vector<glm::mat4> &transforms);
+
+Stats computeStats(const Bvh &bvh);
+
+// Checks that every triangle is in exactly one leaf and that every node's bounds contain
+// everything below it
+bool validate(const Bvh &bvh);
+
+// Times build(), buildParallel() and buildLinear() over `sceneTriangles` and a synthetic 10M
+// triangle mesh with 1, 2, 4 and all hardware threads, and logs the speedups, how the LBVH's SAH
+// cost compares and whether the parallel SAH tree matches the sequential one
+void benchmark(const std::vector<BvhTriangle> &sceneTriangles);
+}  // namespace bvh
+}  // namespace hatgpu
+
+#endif  //_INCLUDE_BVH_H
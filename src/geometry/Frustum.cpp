@@ -0,0 +1,44 @@
+#include "hatpch.h"
+
+#include "Frustum.h"
+
+namespace hatgpu
+{
+Frustum Frustum::fromMatrix(const glm::mat4 &viewproj)
+{
+    // glm is column major, so rows have to be gathered by hand
+    const auto row = [&viewproj](int i) {
+        return glm::vec4(viewproj[0][i], viewproj[1][i], viewproj[2][i], viewproj[3][i]);
+    };
+
+    Frustum frustum;
+    frustum.planes[kLeft]   = row(3) + row(0);
+    frustum.planes[kRight]  = row(3) - row(0);
+    frustum.planes[kBottom] = row(3) + row(1);
+    frustum.planes[kTop]    = row(3) - row(1);
+    frustum.planes[kNear]   = row(2);
+    frustum.planes[kFar]    = row(3) - row(2);
+
+    for (glm::vec4 &plane : frustum.planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+bool Frustum::intersects(const Aabb &box) const
+{
+    const glm::vec3 center     = glm::vec3(box.min + box.max) * 0.5f;
+    const glm::vec3 halfExtent = glm::vec3(box.max - box.min) * 0.5f;
+    for (const glm::vec4 &plane : planes)
+    {
+        const glm::vec3 normal = glm::vec3(plane);
+        // Distance of the box's furthest point along the normal
+        if (glm::dot(normal, center) + plane.w + glm::dot(glm::abs(normal), halfExtent) < 0.f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+}  // namespace hatgpu
@@ -0,0 +1,36 @@
+#ifndef _INCLUDE_FRUSTUM_H
+#define _INCLUDE_FRUSTUM_H
+#include "hatpch.h"
+
+#include "geometry/Aabb.h"
+
+#include <array>
+
+namespace hatgpu
+{
+// The six planes bounding what a view projection matrix can see, each stored as (normal, d) with
+// the normal pointing inwards so that dot(normal, p) + d >= 0 for points inside
+struct Frustum
+{
+    enum Plane
+    {
+        kLeft = 0,
+        kRight,
+        kBottom,
+        kTop,
+        kNear,
+        kFar,
+        kPlaneCount,
+    };
+
+    std::array<glm::vec4, kPlaneCount> planes;
+
+    // Gribb/Hartmann plane extraction, assumes a [0, 1] clip space depth range
+    static Frustum fromMatrix(const glm::mat4 &viewproj);
+
+    // Conservative: boxes outside the frustum but straddling two planes near a corner still pass
+    bool intersects(const Aabb &box) const;
+};
+}  // namespace hatgpu
+
+#endif  //_INCLUDE_FRUSTUM_H
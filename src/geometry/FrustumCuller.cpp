@@ -0,0 +1,325 @@
+#include "hatpch.h"
+
+#include "FrustumCuller.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <random>
+
+#if defined(__SSE__) || defined(__AVX__) || defined(__AVX512F__)
+#    include <immintrin.h>
+#endif
+
+namespace hatgpu
+{
+void AabbSoA::clear()
+{
+    for (std::vector<float> *component : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ})
+    {
+        component->clear();
+    }
+}
+
+void AabbSoA::reserve(size_t count)
+{
+    for (std::vector<float> *component : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ})
+    {
+        component->reserve(count);
+    }
+}
+
+void AabbSoA::push_back(const Aabb &box)
+{
+    minX.push_back(box.min.x);
+    minY.push_back(box.min.y);
+    minZ.push_back(box.min.z);
+    maxX.push_back(box.max.x);
+    maxY.push_back(box.max.y);
+    maxZ.push_back(box.max.z);
+}
+
+namespace frustum_culling
+{
+namespace
+{
+// For each plane, the corner of a box furthest along the plane's normal is the one to test. The
+// normal is the same for every box, so which array each coordinate of that corner comes from can
+// be picked once per plane instead of once per box.
+struct PlaneTest
+{
+    glm::vec4 plane;
+    const float *x;
+    const float *y;
+    const float *z;
+};
+
+std::array<PlaneTest, Frustum::kPlaneCount> planeTests(const Frustum &frustum,
+                                                       const AabbSoA &boxes)
+{
+    std::array<PlaneTest, Frustum::kPlaneCount> tests;
+    for (size_t i = 0; i < tests.size(); ++i)
+    {
+        const glm::vec4 &plane = frustum.planes[i];
+        tests[i].plane         = plane;
+        tests[i].x             = plane.x >= 0.f ? boxes.maxX.data() : boxes.minX.data();
+        tests[i].y             = plane.y >= 0.f ? boxes.maxY.data() : boxes.minY.data();
+        tests[i].z             = plane.z >= 0.f ? boxes.maxZ.data() : boxes.minZ.data();
+    }
+    return tests;
+}
+
+bool isVisible(const std::array<PlaneTest, Frustum::kPlaneCount> &tests, size_t box)
+{
+    for (const PlaneTest &test : tests)
+    {
+        const float distance = test.plane.x * test.x[box] + test.plane.y * test.y[box] +
+                               test.plane.z * test.z[box] + test.plane.w;
+        if (distance < 0.f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if defined(__SSE__) || defined(__AVX__) || defined(__AVX512F__)
+// Pushes the index of every set bit of `mask`, offset by `base`
+void appendMask(uint32_t mask, uint32_t base, std::vector<uint32_t> &visible)
+{
+    while (mask != 0)
+    {
+        visible.push_back(base + static_cast<uint32_t>(__builtin_ctz(mask)));
+        mask &= mask - 1;
+    }
+}
+#endif
+}  // namespace
+
+#if defined(__AVX512F__)
+size_t batchSize()
+{
+    return 16;
+}
+
+const char *simdName()
+{
+    return "AVX-512";
+}
+
+void cull(const Frustum &frustum, const AabbSoA &boxes, std::vector<uint32_t> &visible)
+{
+    ZoneScopedNC("frustum_culling::cull", tracy::Color::Orange);
+    visible.clear();
+    const auto tests  = planeTests(frustum, boxes);
+    const size_t size = boxes.size();
+
+    size_t box = 0;
+    for (; box + 16 <= size; box += 16)
+    {
+        __mmask16 inside = 0xFFFF;
+        for (const PlaneTest &test : tests)
+        {
+            const __m512 x  = _mm512_loadu_ps(test.x + box);
+            const __m512 y  = _mm512_loadu_ps(test.y + box);
+            const __m512 z  = _mm512_loadu_ps(test.z + box);
+            __m512 distance = _mm512_mul_ps(_mm512_set1_ps(test.plane.x), x);
+            distance =
+                _mm512_add_ps(distance, _mm512_mul_ps(_mm512_set1_ps(test.plane.y), y));
+            distance =
+                _mm512_add_ps(distance, _mm512_mul_ps(_mm512_set1_ps(test.plane.z), z));
+            distance = _mm512_add_ps(distance, _mm512_set1_ps(test.plane.w));
+            inside   = _mm512_mask_cmp_ps_mask(inside, distance, _mm512_setzero_ps(), _CMP_GE_OQ);
+        }
+        appendMask(inside, static_cast<uint32_t>(box), visible);
+    }
+
+    for (; box < size; ++box)
+    {
+        if (isVisible(tests, box))
+        {
+            visible.push_back(static_cast<uint32_t>(box));
+        }
+    }
+}
+#elif defined(__AVX__)
+size_t batchSize()
+{
+    return 8;
+}
+
+const char *simdName()
+{
+    return "AVX";
+}
+
+void cull(const Frustum &frustum, const AabbSoA &boxes, std::vector<uint32_t> &visible)
+{
+    ZoneScopedNC("frustum_culling::cull", tracy::Color::Orange);
+    visible.clear();
+    const auto tests  = planeTests(frustum, boxes);
+    const size_t size = boxes.size();
+
+    size_t box = 0;
+    for (; box + 8 <= size; box += 8)
+    {
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const PlaneTest &test : tests)
+        {
+            const __m256 x  = _mm256_loadu_ps(test.x + box);
+            const __m256 y  = _mm256_loadu_ps(test.y + box);
+            const __m256 z  = _mm256_loadu_ps(test.z + box);
+            __m256 distance = _mm256_mul_ps(_mm256_set1_ps(test.plane.x), x);
+            distance =
+                _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(test.plane.y), y));
+            distance =
+                _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(test.plane.z), z));
+            distance = _mm256_add_ps(distance, _mm256_set1_ps(test.plane.w));
+            inside   = _mm256_and_ps(inside,
+                                     _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        appendMask(static_cast<uint32_t>(_mm256_movemask_ps(inside)), static_cast<uint32_t>(box),
+                   visible);
+    }
+
+    for (; box < size; ++box)
+    {
+        if (isVisible(tests, box))
+        {
+            visible.push_back(static_cast<uint32_t>(box));
+        }
+    }
+}
+#elif defined(__SSE__)
+size_t batchSize()
+{
+    return 4;
+}
+
+const char *simdName()
+{
+    return "SSE";
+}
+
+void cull(const Frustum &frustum, const AabbSoA &boxes, std::vector<uint32_t> &visible)
+{
+    ZoneScopedNC("frustum_culling::cull", tracy::Color::Orange);
+    visible.clear();
+    const auto tests  = planeTests(frustum, boxes);
+    const size_t size = boxes.size();
+
+    size_t box = 0;
+    for (; box + 4 <= size; box += 4)
+    {
+        __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+        for (const PlaneTest &test : tests)
+        {
+            const __m128 x  = _mm_loadu_ps(test.x + box);
+            const __m128 y  = _mm_loadu_ps(test.y + box);
+            const __m128 z  = _mm_loadu_ps(test.z + box);
+            __m128 distance = _mm_mul_ps(_mm_set1_ps(test.plane.x), x);
+            distance        = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(test.plane.y), y));
+            distance        = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(test.plane.z), z));
+            distance        = _mm_add_ps(distance, _mm_set1_ps(test.plane.w));
+            inside          = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+        }
+        appendMask(static_cast<uint32_t>(_mm_movemask_ps(inside)), static_cast<uint32_t>(box),
+                   visible);
+    }
+
+    for (; box < size; ++box)
+    {
+        if (isVisible(tests, box))
+        {
+            visible.push_back(static_cast<uint32_t>(box));
+        }
+    }
+}
+#else
+size_t batchSize()
+{
+    return 1;
+}
+
+const char *simdName()
+{
+    return "scalar";
+}
+
+void cull(const Frustum &frustum, const AabbSoA &boxes, std::vector<uint32_t> &visible)
+{
+    cullScalar(frustum, boxes, visible);
+}
+#endif
+
+void cullScalar(const Frustum &frustum, const AabbSoA &boxes, std::vector<uint32_t> &visible)
+{
+    ZoneScopedNC("frustum_culling::cullScalar", tracy::Color::Orange);
+    visible.clear();
+    const auto tests = planeTests(frustum, boxes);
+    for (size_t box = 0; box < boxes.size(); ++box)
+    {
+        if (isVisible(tests, box))
+        {
+            visible.push_back(static_cast<uint32_t>(box));
+        }
+    }
+}
+
+void benchmark()
+{
+    ZoneScopedNC("frustum_culling::benchmark", tracy::Color::Orange);
+    constexpr int kRepetitions = 10;
+
+    // Camera at the origin looking down -z, boxes spread all around it so roughly a tenth of
+    // them end up visible
+    const glm::mat4 proj = glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.1f, 1000.f);
+    const glm::mat4 view =
+        glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+    const Frustum frustum = Frustum::fromMatrix(proj * view);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-500.f, 500.f);
+    std::uniform_real_distribution<float> extent(0.1f, 10.f);
+
+    for (const size_t count : {1'000, 100'000, 1'000'000})
+    {
+        AabbSoA boxes;
+        boxes.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const glm::vec3 min(position(rng), position(rng), position(rng));
+            const glm::vec3 size(extent(rng), extent(rng), extent(rng));
+            boxes.push_back(Aabb{glm::vec4(min, 1.f), glm::vec4(min + size, 1.f)});
+        }
+
+        // Best of a few runs to keep the noise down
+        const auto time = [&](auto &&function, std::vector<uint32_t> &visible) {
+            float best = std::numeric_limits<float>::max();
+            for (int i = 0; i < kRepetitions; ++i)
+            {
+                const auto start = std::chrono::steady_clock::now();
+                function(frustum, boxes, visible);
+                const std::chrono::duration<float, std::milli> elapsed =
+                    std::chrono::steady_clock::now() - start;
+                best = std::min(best, elapsed.count());
+            }
+            return best;
+        };
+
+        std::vector<uint32_t> scalarVisible;
+        std::vector<uint32_t> simdVisible;
+        const float scalarTime = time(cullScalar, scalarVisible);
+        const float simdTime   = time(cull, simdVisible);
+
+        LOGGER.info("Frustum culling {} boxes: scalar {:.3f}ms, {} {:.3f}ms ({:.1f}x), {} visible"
+                    "{}",
+                    count, scalarTime, simdName(), simdTime, scalarTime / simdTime,
+                    simdVisible.size(),
+                    scalarVisible == simdVisible ? "" : ", MISMATCH with the scalar reference");
+    }
+}
+}  // namespace frustum_culling
+}  // namespace hatgpu
@@ -0,0 +1,50 @@
+#ifndef _INCLUDE_FRUSTUM_CULLER_H
+#define _INCLUDE_FRUSTUM_CULLER_H
+#include "hatpch.h"
+
+#include "geometry/Aabb.h"
+#include "geometry/Frustum.h"
+
+#include <vector>
+
+namespace hatgpu
+{
+// World space boxes with one array per bound component, so that the culling loops can load a
+// whole register's worth of boxes with a single instruction
+struct AabbSoA
+{
+    std::vector<float> minX;
+    std::vector<float> minY;
+    std::vector<float> minZ;
+    std::vector<float> maxX;
+    std::vector<float> maxY;
+    std::vector<float> maxZ;
+
+    void clear();
+    void reserve(size_t count);
+    void push_back(const Aabb &box);
+
+    inline size_t size() const { return minX.size(); }
+};
+
+// Frustum culling of many boxes at once on the CPU. The SIMD width is picked at compile time from
+// what the build targets (AVX-512, AVX, SSE, or plain scalar code otherwise).
+namespace frustum_culling
+{
+// Boxes tested per iteration of cull()'s inner loop
+size_t batchSize();
+const char *simdName();
+
+// Both of these overwrite `visible` with the indices of the boxes that intersect the frustum, in
+// increasing order. The test is conservative like Frustum::intersects().
+void cull(const Frustum &frustum, const AabbSoA &boxes, std::vector<uint32_t> &visible);
+// Reference implementation, one box at a time
+void cullScalar(const Frustum &frustum, const AabbSoA &boxes, std::vector<uint32_t> &visible);
+
+// Times cull() against cullScalar() over random boxes at 1k, 100k and 1M boxes, checks that they
+// agree and logs the results
+void benchmark();
+}  // namespace frustum_culling
+}  // namespace hatgpu
+
+#endif  //_INCLUDE_FRUSTUM_CULLER_H
@@ -0,0 +1,31 @@
+#include "hatpch.h"
+
+#include "IndexNarrowing.h"
+
+#include <limits>
+
+namespace hatgpu
+{
+VkIndexType selectIndexType(size_t vertexCount)
+{
+    return vertexCount <= static_cast<size_t>(std::numeric_limits<uint16_t>::max()) + 1
+               ? VK_INDEX_TYPE_UINT16
+               : VK_INDEX_TYPE_UINT32;
+}
+
+size_t indexTypeSize(VkIndexType indexType)
+{
+    return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+void narrowIndices(const std::vector<uint32_t> &indices, std::vector<uint16_t> &narrowed)
+{
+    narrowed.resize(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        H_ASSERT(indices[i] <= std::numeric_limits<uint16_t>::max(),
+                 "Index doesn't fit in 16 bits");
+        narrowed[i] = static_cast<uint16_t>(indices[i]);
+    }
+}
+}  // namespace hatgpu
@@ -0,0 +1,17 @@
+#ifndef _INCLUDE_INDEX_NARROWING_H
+#define _INCLUDE_INDEX_NARROWING_H
+#include "hatpch.h"
+
+#include <vector>
+
+namespace hatgpu
+{
+// 16 bit indices whenever they can address every vertex, 32 bit otherwise. Primitive restart is
+// off in every pipeline, so 0xFFFF is an ordinary index and 65536 vertices still fit.
+VkIndexType selectIndexType(size_t vertexCount);
+size_t indexTypeSize(VkIndexType indexType);
+// Copies `indices` into `narrowed` as 16 bit values, all of them have to fit
+void narrowIndices(const std::vector<uint32_t> &indices, std::vector<uint16_t> &narrowed);
+}  // namespace hatgpu
+
+#endif  //_INCLUDE_INDEX_NARROWING_H
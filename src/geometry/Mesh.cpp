@@ -11,6 +11,7 @@
 #include <assimp/Importer.hpp>
 
 #include <iostream>
+#include <limits>
 
 namespace hatgpu
 {
@@ -65,49 +66,116 @@ bool Mesh::loadFromObj(const std::string &filename)
     return true;
 }
 
-void Mesh::upload(vk::Allocator &allocator, vk::UploadContext &context)
+bool Mesh::upload(vk::GeometryArena &arena, vk::UploadContext &context)
 {
-    // Uploading the vertex data followed by the index data in contiguous memory
-    const size_t verticesSize = vertices.size() * sizeof(Vertex);
-    const size_t indicesSize  = indices.size() * sizeof(Mesh::IndexType);
-    const size_t bufferSize   = verticesSize + indicesSize;
-
-    vk::AllocatedBuffer stagingBuffer = allocator.createBuffer(
-        bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-    void *data = allocator.map(stagingBuffer);
-    std::memcpy(data, vertices.data(), verticesSize);
-    std::memcpy(static_cast<char *>(data) + verticesSize, indices.data(), indicesSize);
-    allocator.unmap(stagingBuffer);
-
-    vertexBuffer = allocator.createBuffer(
-        verticesSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY);
-    indexBuffer = allocator.createBuffer(
-        indicesSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY);
-
-    context.immediateSubmit([=, this](VkCommandBuffer cmd) {
-        VkBufferCopy vboCopy{};
-        vboCopy.dstOffset = 0;
-        vboCopy.srcOffset = 0;
-        vboCopy.size      = verticesSize;
-        vkCmdCopyBuffer(cmd, stagingBuffer.buffer, vertexBuffer.buffer, 1, &vboCopy);
-
-        VkBufferCopy iboCopy{};
-        iboCopy.dstOffset = 0;
-        iboCopy.srcOffset = verticesSize;
-        iboCopy.size      = indicesSize;
-        vkCmdCopyBuffer(cmd, stagingBuffer.buffer, indexBuffer.buffer, 1, &iboCopy);
-    });
-
-    allocator.destroyBuffer(stagingBuffer);
+    // Materials nothing uses still get a mesh, there's nothing to draw for those
+    if (vertices.empty() || indices.empty())
+    {
+        return true;
+    }
+
+    const void *vertexData    = vertexFormat == VertexFormat::kPacked
+                                    ? static_cast<const void *>(packedVertices.data())
+                                    : static_cast<const void *>(vertices.data());
+    const size_t verticesSize = vertices.size() * vertexStride();
+
+    // Narrowed copy only lives until it's been staged
+    indexType = selectIndexType(vertices.size());
+    std::vector<uint16_t> narrowedIndices;
+    const void *indexData = indices.data();
+    if (indexType == VK_INDEX_TYPE_UINT16)
+    {
+        narrowIndices(indices, narrowedIndices);
+        indexData = narrowedIndices.data();
+    }
+    const size_t indicesSize = indices.size() * indexTypeSize(indexType);
+
+    // Aligning to the largest vertex stride keeps the offset a whole number of vertices for every
+    // vertex format, and since both index types fit in 4 bytes the same goes for indices
+    static_assert(sizeof(Vertex) % sizeof(PackedVertex) == 0);
+    geometry = arena.allocate(verticesSize, sizeof(Vertex), indicesSize, sizeof(uint32_t));
+    if (!geometry.has_value())
+    {
+        return false;
+    }
+
+    // The staging buffers are owned by the upload context and get released once the batch that
+    // these copies end up in has executed
+    vk::StagingAllocation vertexStaging = context.stage(vertexData, verticesSize);
+    vk::StagingAllocation indexStaging  = context.stage(indexData, indicesSize);
+
+    // Only this mesh's ranges change ownership, the rest of the arena may already be in use
+    const vk::GeometryAllocation allocation = *geometry;
+    const VkBuffer vertexBuffer             = arena.vertexBuffer();
+    const VkBuffer indexBuffer              = arena.indexBuffer();
+    context.record(
+        [=, &context](VkCommandBuffer cmd) {
+            VkBufferCopy vboCopy{};
+            vboCopy.dstOffset = allocation.vertexOffset;
+            vboCopy.srcOffset = vertexStaging.offset;
+            vboCopy.size      = verticesSize;
+            vkCmdCopyBuffer(cmd, vertexStaging.buffer, vertexBuffer, 1, &vboCopy);
+
+            VkBufferCopy iboCopy{};
+            iboCopy.dstOffset = allocation.indexOffset;
+            iboCopy.srcOffset = indexStaging.offset;
+            iboCopy.size      = indicesSize;
+            vkCmdCopyBuffer(cmd, indexStaging.buffer, indexBuffer, 1, &iboCopy);
+
+            context.releaseBuffer(cmd, vertexBuffer, allocation.vertexOffset,
+                                  allocation.vertexSize);
+            context.releaseBuffer(cmd, indexBuffer, allocation.indexOffset, allocation.indexSize);
+        },
+        [=, &context](VkCommandBuffer cmd) {
+            context.acquireBuffer(cmd, vertexBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                  VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, allocation.vertexOffset,
+                                  allocation.vertexSize);
+            context.acquireBuffer(cmd, indexBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                  VK_ACCESS_INDEX_READ_BIT, allocation.indexOffset,
+                                  allocation.indexSize);
+        });
+    return true;
+}
+
+void Mesh::freeGeometry(vk::GeometryArena &arena)
+{
+    if (geometry.has_value())
+    {
+        arena.free(*geometry);
+        geometry.reset();
+    }
 }
 
-void Mesh::destroyBuffers(vk::Allocator &allocator)
+int32_t Mesh::vertexOffset() const
 {
-    allocator.destroyBuffer(vertexBuffer);
-    allocator.destroyBuffer(indexBuffer);
+    return static_cast<int32_t>(geometry->vertexOffset / vertexStride());
+}
+
+uint32_t Mesh::firstIndex() const
+{
+    return static_cast<uint32_t>(geometry->indexOffset / indexTypeSize(indexType));
+}
+
+size_t Mesh::vertexStride() const
+{
+    return vertexFormat == VertexFormat::kPacked ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+void Mesh::computeLocalBounds()
+{
+    if (vertices.empty())
+    {
+        localBounds = Aabb{glm::vec4(0.f), glm::vec4(0.f)};
+        return;
+    }
+
+    localBounds = Aabb{glm::vec4(vertices.front().position, 1.0f),
+                       glm::vec4(vertices.front().position, 1.0f)};
+    for (const auto &vertex : vertices)
+    {
+        localBounds.min = glm::min(localBounds.min, glm::vec4(vertex.position, 1.0f));
+        localBounds.max = glm::max(localBounds.max, glm::vec4(vertex.position, 1.0f));
+    }
 }
 
 Aabb Mesh::BoundingBox(const glm::mat4 &worldTransform) const
@@ -117,11 +185,16 @@ Aabb Mesh::BoundingBox(const glm::mat4 &worldTransform) const
         return Aabb{glm::vec4(0.f), glm::vec4(0.f)};
     }
 
-    Aabb result{worldTransform * glm::vec4(vertices.front().position, 1.0f),
-                worldTransform * glm::vec4(vertices.front().position, 1.0f)};
-    for (const auto &vertex : vertices)
+    // Transforming the corners of the local bounds gives the same box as transforming every
+    // vertex whenever the transform has no rotation, and a conservative one otherwise
+    Aabb result{glm::vec4(std::numeric_limits<float>::max()),
+                glm::vec4(std::numeric_limits<float>::lowest())};
+    for (uint32_t corner = 0; corner < 8; ++corner)
     {
-        const glm::vec4 worldPos = worldTransform * glm::vec4(vertex.position, 1.0f);
+        const glm::vec4 localPos(corner & 1 ? localBounds.max.x : localBounds.min.x,
+                                 corner & 2 ? localBounds.max.y : localBounds.min.y,
+                                 corner & 4 ? localBounds.max.z : localBounds.min.z, 1.0f);
+        const glm::vec4 worldPos = worldTransform * localPos;
         result.min               = glm::min(result.min, worldPos);
         result.max               = glm::max(result.max, worldPos);
     }
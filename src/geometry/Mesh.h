@@ -2,16 +2,19 @@
 #define _INCLUDE_MESH_H
 #include "geometry/Aabb.h"
 #include "geometry/Hittable.h"
+#include "geometry/IndexNarrowing.h"
 #include "hatpch.h"
 
 #include "texture/Texture.h"
 #include "vk/allocator.h"
+#include "vk/geometry_arena.h"
 #include "vk/types.h"
 #include "vk/upload_context.h"
 
 #include <array>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -56,27 +59,101 @@ struct Vertex
     }
 };
 
+// Quantized version of Vertex, half the size. Positions are 16 bit unorm relative to the mesh's
+// local bounds, normals are octahedral encoded into two 16 bit snorms and UVs are half floats. The
+// vertex shader dequantizes them, see vertex_packing for the CPU side.
+struct PackedVertex
+{
+    // w is unused, it only keeps the normal 4 byte aligned
+    std::array<uint16_t, 4> position;
+    std::array<int16_t, 2> normal;
+    std::array<uint16_t, 2> uv;
+
+    static VkVertexInputBindingDescription getBindingDescription()
+    {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding   = 0;
+        bindingDescription.stride    = sizeof(PackedVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+    {
+        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions;
+
+        attributeDescriptions[0].binding  = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format   = VK_FORMAT_R16G16B16A16_UNORM;
+        attributeDescriptions[0].offset   = offsetof(PackedVertex, position);
+
+        attributeDescriptions[1].binding  = 0;
+        attributeDescriptions[1].location = 1;
+        attributeDescriptions[1].format   = VK_FORMAT_R16G16_SNORM;
+        attributeDescriptions[1].offset   = offsetof(PackedVertex, normal);
+
+        attributeDescriptions[2].binding  = 0;
+        attributeDescriptions[2].location = 2;
+        attributeDescriptions[2].format   = VK_FORMAT_R16G16_SFLOAT;
+        attributeDescriptions[2].offset   = offsetof(PackedVertex, uv);
+
+        return attributeDescriptions;
+    }
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex should be half the size of Vertex");
+
+// Layout of a mesh's vertex buffer, picked per mesh at import
+enum class VertexFormat : uint32_t
+{
+    kFull   = 0,
+    kPacked = 1,
+};
+static constexpr size_t kVertexFormatCount = 2;
+
 struct Mesh : public Hittable
 {
+    // Width of the indices on the CPU, the uploaded index buffer uses indexType instead
     using IndexType = uint32_t;
 
+    // Always kept in full precision on the CPU, packedVertices is only what gets uploaded when the
+    // mesh uses VertexFormat::kPacked
     std::vector<Vertex> vertices;
+    std::vector<PackedVertex> packedVertices;
+    VertexFormat vertexFormat{VertexFormat::kFull};
     std::vector<IndexType> indices;
     // Maps texture type to lists of texture paths
     // For example, ALBEDO -> { "texture1.png", "texture2.png" }
     std::unordered_map<TextureType, std::string> textures;
-    VkDescriptorSet descriptor;
-
-    vk::AllocatedBuffer vertexBuffer;
-    vk::AllocatedBuffer indexBuffer;
+    // Which of the renderer's materials this mesh is drawn with, assigned once its textures are
+    // uploaded
+    uint32_t materialIndex{0};
+    // Bounds of the vertices in model space
+    Aabb localBounds{glm::vec4(0.f), glm::vec4(0.f)};
+
+    // Where upload() put the vertex and index data in the geometry arena, empty until then and
+    // for meshes without any triangles
+    std::optional<vk::GeometryAllocation> geometry;
+    // Decided in upload() from the vertex count
+    VkIndexType indexType{VK_INDEX_TYPE_UINT32};
 
     bool loadFromObj(const std::string &filename);
+    void computeLocalBounds();
+    // Size in bytes of one vertex in the uploaded vertex buffer
+    size_t vertexStride() const;
+
+    // Returns false if the arena is out of space, the mesh is left without geometry then
+    bool upload(vk::GeometryArena &arena, vk::UploadContext &context);
+    void freeGeometry(vk::GeometryArena &arena);
 
-    void upload(vk::Allocator &allocator, vk::UploadContext &context);
-    void destroyBuffers(vk::Allocator &allocator);
+    // Offsets of this mesh in the arena's buffers, in vertices and indices
+    int32_t vertexOffset() const;
+    uint32_t firstIndex() const;
 
     Aabb BoundingBox(const glm::mat4 &worldTransform) const override;
 };
+static_assert(std::is_same_v<Mesh::IndexType, uint32_t>,
+              "narrowIndices() takes 32 bit indices");
 }  // namespace hatgpu
 
 #endif  //_INCLUDE_MESH_H
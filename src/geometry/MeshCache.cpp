@@ -0,0 +1,495 @@
+#include "hatpch.h"
+
+#include "MeshCache.h"
+
+#include <nlohmann/json.hpp>
+#include <tracy/Tracy.hpp>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+
+#ifdef __unix__
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace hatgpu
+{
+namespace mesh_cache
+{
+namespace
+{
+// Every section of the file starts on this alignment so the mapped data can be read in place
+constexpr size_t kSectionAlignment = 16;
+
+struct FileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t importFlags;
+    uint32_t processingFlags;
+    uint32_t meshCount;
+    uint32_t dependencyCount;
+    int64_t sourceMtime;
+    uint64_t sourcePathLength;
+};
+
+// Followed by the dependency's path, relative to the source file's directory
+struct DependencyHeader
+{
+    int64_t mtime;
+    uint64_t pathLength;
+};
+
+struct MeshHeader
+{
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    glm::vec4 boundsMin;
+    glm::vec4 boundsMax;
+    uint32_t textureCount;
+    uint32_t padding[3];
+};
+
+struct TextureHeader
+{
+    uint32_t type;
+    uint32_t pathLength;
+};
+
+static_assert(std::is_trivially_copyable_v<Vertex>,
+              "Vertices are copied straight out of the file");
+
+std::optional<int64_t> sourceMtime(const std::string &sourcePath)
+{
+    std::error_code error;
+    const auto mtime = std::filesystem::last_write_time(sourcePath, error);
+    if (error)
+    {
+        return std::nullopt;
+    }
+    return static_cast<int64_t>(mtime.time_since_epoch().count());
+}
+
+struct Dependency
+{
+    std::string path;
+    int64_t mtime;
+};
+
+// The external buffers a .gltf file references, whose contents end up in the meshes just like the
+// file's own. Textures aren't dependencies, the cache only stores their paths. Returns nothing if
+// the file can't be parsed or a buffer is missing, which the callers treat as a cache miss.
+std::optional<std::vector<Dependency>> sourceDependencies(const std::string &sourcePath)
+{
+    std::vector<Dependency> dependencies;
+    if (std::filesystem::path(sourcePath).extension() != ".gltf")
+    {
+        return dependencies;
+    }
+
+    std::ifstream file(sourcePath);
+    const nlohmann::json gltf = nlohmann::json::parse(file, nullptr, false);
+    if (!gltf.is_object())
+    {
+        return std::nullopt;
+    }
+    const auto buffers = gltf.find("buffers");
+    if (buffers == gltf.end() || !buffers->is_array())
+    {
+        return dependencies;
+    }
+
+    const std::filesystem::path directory = std::filesystem::path(sourcePath).parent_path();
+    for (const nlohmann::json &buffer : *buffers)
+    {
+        const auto uri = buffer.find("uri");
+        // Buffers without a URI live in a .glb's binary chunk, data URIs in the file itself
+        if (uri == buffer.end() || !uri->is_string())
+        {
+            continue;
+        }
+        const std::string &path = uri->get_ref<const std::string &>();
+        if (path.rfind("data:", 0) == 0)
+        {
+            continue;
+        }
+
+        const std::optional<int64_t> mtime = sourceMtime((directory / path).string());
+        if (!mtime.has_value())
+        {
+            return std::nullopt;
+        }
+        dependencies.push_back(Dependency{path, *mtime});
+    }
+    return dependencies;
+}
+
+// Read-only view of a whole file. Uses mmap where available so that the vertex and index data is
+// only paged in when it gets copied out.
+class MappedFile
+{
+  public:
+    explicit MappedFile(const std::string &path)
+    {
+#ifdef __unix__
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+        {
+            void *mapped = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                mData = static_cast<const char *>(mapped);
+                mSize = fileStat.st_size;
+                madvise(mapped, mSize, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+        {
+            return;
+        }
+        mFallback.resize(file.tellg());
+        file.seekg(0);
+        file.read(mFallback.data(), mFallback.size());
+        mData = mFallback.data();
+        mSize = mFallback.size();
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef __unix__
+        if (mData != nullptr)
+        {
+            munmap(const_cast<char *>(mData), mSize);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &other)            = delete;
+    MappedFile &operator=(const MappedFile &other) = delete;
+
+    inline const char *data() const { return mData; }
+    inline size_t size() const { return mSize; }
+
+  private:
+    const char *mData{nullptr};
+    size_t mSize{0};
+#ifndef __unix__
+    std::vector<char> mFallback;
+#endif
+};
+
+// Bounds checked cursor over a mapped cache file
+class Reader
+{
+  public:
+    Reader(const char *data, size_t size) : mData(data), mSize(size) {}
+
+    inline size_t remaining() const { return mSize - mOffset; }
+
+    // Returns nullptr if the file is too short
+    const char *read(size_t bytes)
+    {
+        if (bytes > remaining())
+        {
+            return nullptr;
+        }
+        const char *result = mData + mOffset;
+        mOffset += bytes;
+        return result;
+    }
+
+    // `count` comes from the file, so it's checked against what's left before it gets multiplied
+    // by the element size, which could otherwise wrap around
+    template <typename T>
+    const T *readArray(uint64_t count)
+    {
+        if (count > remaining() / sizeof(T))
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const T *>(read(count * sizeof(T)));
+    }
+
+    template <typename T>
+    bool readInto(T &value)
+    {
+        const char *bytes = read(sizeof(T));
+        if (bytes == nullptr)
+        {
+            return false;
+        }
+        std::memcpy(&value, bytes, sizeof(T));
+        return true;
+    }
+
+    void align() { mOffset = std::min(mSize, alignUp(mOffset)); }
+
+    static size_t alignUp(size_t offset)
+    {
+        return (offset + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+    }
+
+  private:
+    const char *mData;
+    size_t mSize;
+    size_t mOffset{0};
+};
+
+class Writer
+{
+  public:
+    explicit Writer(const std::string &path) : mFile(path, std::ios::binary | std::ios::trunc) {}
+
+    inline bool good() const { return mFile.good(); }
+
+    void write(const void *data, size_t bytes)
+    {
+        mFile.write(static_cast<const char *>(data), bytes);
+        mOffset += bytes;
+    }
+
+    template <typename T>
+    void write(const T &value)
+    {
+        write(&value, sizeof(T));
+    }
+
+    void align()
+    {
+        static constexpr std::array<char, kSectionAlignment> kZeroes{};
+        write(kZeroes.data(), Reader::alignUp(mOffset) - mOffset);
+    }
+
+    // Returns false if anything failed to write, including the final flush
+    bool close()
+    {
+        mFile.close();
+        return !mFile.fail();
+    }
+
+  private:
+    std::ofstream mFile;
+    size_t mOffset{0};
+};
+}  // namespace
+
+std::string cachePath(const std::string &sourcePath)
+{
+    return sourcePath + ".hatmesh";
+}
+
+bool load(const std::string &sourcePath,
+          uint32_t importFlags,
+          uint32_t processingFlags,
+          std::vector<Mesh> &meshes)
+{
+    ZoneScopedNC("mesh_cache::load", tracy::Color::Orange);
+
+    const std::optional<int64_t> mtime = sourceMtime(sourcePath);
+    const std::optional<std::vector<Dependency>> dependencies = sourceDependencies(sourcePath);
+    if (!mtime.has_value() || !dependencies.has_value())
+    {
+        return false;
+    }
+
+    MappedFile file(cachePath(sourcePath));
+    if (file.data() == nullptr)
+    {
+        return false;
+    }
+
+    Reader reader(file.data(), file.size());
+
+    FileHeader header;
+    if (!reader.readInto(header) || header.magic != kMagic || header.version != kVersion ||
+        header.importFlags != importFlags || header.processingFlags != processingFlags ||
+        header.sourceMtime != *mtime || header.dependencyCount != dependencies->size() ||
+        header.sourcePathLength != sourcePath.size())
+    {
+        return false;
+    }
+
+    const char *storedPath = reader.read(header.sourcePathLength);
+    if (storedPath == nullptr ||
+        std::memcmp(storedPath, sourcePath.data(), sourcePath.size()) != 0)
+    {
+        return false;
+    }
+    reader.align();
+
+    for (const Dependency &dependency : *dependencies)
+    {
+        DependencyHeader dependencyHeader;
+        if (!reader.readInto(dependencyHeader) || dependencyHeader.mtime != dependency.mtime ||
+            dependencyHeader.pathLength != dependency.path.size())
+        {
+            return false;
+        }
+        const char *path = reader.read(dependencyHeader.pathLength);
+        if (path == nullptr ||
+            std::memcmp(path, dependency.path.data(), dependency.path.size()) != 0)
+        {
+            return false;
+        }
+    }
+    reader.align();
+
+    // A corrupt count mustn't allocate more meshes than the rest of the file could hold
+    if (header.meshCount > reader.remaining() / sizeof(MeshHeader))
+    {
+        return false;
+    }
+
+    // Parse into a separate list so that a truncated file doesn't leave `meshes` half filled
+    std::vector<Mesh> result(header.meshCount);
+    for (Mesh &mesh : result)
+    {
+        MeshHeader meshHeader;
+        if (!reader.readInto(meshHeader))
+        {
+            return false;
+        }
+        mesh.localBounds = Aabb{meshHeader.boundsMin, meshHeader.boundsMax};
+
+        for (uint32_t i = 0; i < meshHeader.textureCount; ++i)
+        {
+            TextureHeader textureHeader;
+            if (!reader.readInto(textureHeader))
+            {
+                return false;
+            }
+            const char *path = reader.read(textureHeader.pathLength);
+            if (path == nullptr)
+            {
+                return false;
+            }
+            mesh.textures[static_cast<TextureType>(textureHeader.type)] =
+                std::string(path, textureHeader.pathLength);
+        }
+        reader.align();
+
+        // Bulk copies straight out of the mapping, no per-vertex work
+        const Vertex *vertices = reader.readArray<Vertex>(meshHeader.vertexCount);
+        if (vertices == nullptr)
+        {
+            return false;
+        }
+        mesh.vertices.assign(vertices, vertices + meshHeader.vertexCount);
+        reader.align();
+
+        const auto *indices = reader.readArray<Mesh::IndexType>(meshHeader.indexCount);
+        if (indices == nullptr)
+        {
+            return false;
+        }
+        mesh.indices.assign(indices, indices + meshHeader.indexCount);
+        reader.align();
+    }
+
+    meshes = std::move(result);
+    return true;
+}
+
+void store(const std::string &sourcePath,
+           uint32_t importFlags,
+           uint32_t processingFlags,
+           const std::vector<Mesh> &meshes)
+{
+    ZoneScopedNC("mesh_cache::store", tracy::Color::Orange);
+
+    const std::optional<int64_t> mtime = sourceMtime(sourcePath);
+    const std::optional<std::vector<Dependency>> dependencies = sourceDependencies(sourcePath);
+    if (!mtime.has_value() || !dependencies.has_value())
+    {
+        return;
+    }
+
+    // Write to a temporary file first so a crash halfway through never leaves a broken cache
+    const std::string path          = cachePath(sourcePath);
+    const std::string temporaryPath = path + ".tmp";
+    Writer writer(temporaryPath);
+    if (!writer.good())
+    {
+        LOGGER.warn("Unable to write mesh cache {}", path);
+        return;
+    }
+
+    FileHeader header{};
+    header.magic            = kMagic;
+    header.version          = kVersion;
+    header.importFlags      = importFlags;
+    header.processingFlags  = processingFlags;
+    header.meshCount        = static_cast<uint32_t>(meshes.size());
+    header.dependencyCount  = static_cast<uint32_t>(dependencies->size());
+    header.sourceMtime      = *mtime;
+    header.sourcePathLength = sourcePath.size();
+    writer.write(header);
+    writer.write(sourcePath.data(), sourcePath.size());
+    writer.align();
+
+    for (const Dependency &dependency : *dependencies)
+    {
+        DependencyHeader dependencyHeader{};
+        dependencyHeader.mtime      = dependency.mtime;
+        dependencyHeader.pathLength = dependency.path.size();
+        writer.write(dependencyHeader);
+        writer.write(dependency.path.data(), dependency.path.size());
+    }
+    writer.align();
+
+    for (const Mesh &mesh : meshes)
+    {
+        MeshHeader meshHeader{};
+        meshHeader.vertexCount  = mesh.vertices.size();
+        meshHeader.indexCount   = mesh.indices.size();
+        meshHeader.boundsMin    = mesh.localBounds.min;
+        meshHeader.boundsMax    = mesh.localBounds.max;
+        meshHeader.textureCount = static_cast<uint32_t>(mesh.textures.size());
+        writer.write(meshHeader);
+
+        for (const auto &[type, texturePath] : mesh.textures)
+        {
+            TextureHeader textureHeader{};
+            textureHeader.type       = static_cast<uint32_t>(type);
+            textureHeader.pathLength = static_cast<uint32_t>(texturePath.size());
+            writer.write(textureHeader);
+            writer.write(texturePath.data(), texturePath.size());
+        }
+        writer.align();
+
+        writer.write(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        writer.align();
+        writer.write(mesh.indices.data(), mesh.indices.size() * sizeof(Mesh::IndexType));
+        writer.align();
+    }
+
+    const bool succeeded = writer.close();
+
+    std::error_code error;
+    if (succeeded)
+    {
+        std::filesystem::rename(temporaryPath, path, error);
+    }
+    if (!succeeded || error)
+    {
+        LOGGER.warn("Unable to write mesh cache {}", path);
+        std::filesystem::remove(temporaryPath, error);
+    }
+}
+}  // namespace mesh_cache
+}  // namespace hatgpu
@@ -0,0 +1,41 @@
+#ifndef _INCLUDE_MESH_CACHE_H
+#define _INCLUDE_MESH_CACHE_H
+#include "hatpch.h"
+
+#include "geometry/Mesh.h"
+
+#include <string>
+#include <vector>
+
+namespace hatgpu
+{
+// Binary cache of imported models (.hatmesh files) written next to the source file. A cache file
+// stores the per-material vertex and index arrays, local bounds and texture references of a model,
+// and is keyed by the source path, the flags it was imported with, and the modification times of
+// the source and of the external buffers a .gltf references. Textures are read from their own
+// files on every load, so only their paths are cached. Anything that changes the layout of the
+// file, or the meshes import writes into it, has to bump kVersion.
+namespace mesh_cache
+{
+static constexpr uint32_t kMagic   = 0x48534D48;  // "HMSH"
+static constexpr uint32_t kVersion = 4;
+
+// Processing done by hatgpu on top of the Assimp import, also part of the cache key
+static constexpr uint32_t kProcessingOptimized = 1 << 0;
+
+std::string cachePath(const std::string &sourcePath);
+
+// Returns false if there's no cache for `sourcePath` or if it's stale, in which case `meshes` is
+// left untouched
+bool load(const std::string &sourcePath,
+          uint32_t importFlags,
+          uint32_t processingFlags,
+          std::vector<Mesh> &meshes);
+void store(const std::string &sourcePath,
+           uint32_t importFlags,
+           uint32_t processingFlags,
+           const std::vector<Mesh> &meshes);
+}  // namespace mesh_cache
+}  // namespace hatgpu
+
+#endif  //_INCLUDE_MESH_CACHE_H
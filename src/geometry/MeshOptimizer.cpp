@@ -0,0 +1,377 @@
+#include "hatpch.h"
+
+#include "MeshOptimizer.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <limits>
+#include <numeric>
+
+namespace hatgpu
+{
+namespace mesh_optimizer
+{
+namespace
+{
+using IndexType = Mesh::IndexType;
+
+// Triangles using each vertex, stored as one flat array with per-vertex offsets
+struct TriangleAdjacency
+{
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> triangles;
+};
+
+TriangleAdjacency buildAdjacency(const std::vector<IndexType> &indices, size_t vertexCount)
+{
+    TriangleAdjacency adjacency;
+    adjacency.counts.assign(vertexCount, 0);
+    adjacency.offsets.assign(vertexCount, 0);
+    adjacency.triangles.resize(indices.size());
+
+    for (const IndexType index : indices)
+    {
+        ++adjacency.counts[index];
+    }
+
+    uint32_t offset = 0;
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        adjacency.offsets[v] = offset;
+        offset += adjacency.counts[v];
+    }
+
+    std::vector<uint32_t> cursor = adjacency.offsets;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        adjacency.triangles[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    return adjacency;
+}
+
+// FIFO cache simulation shared by the analysis and the overdraw clustering
+class FifoCache
+{
+  public:
+    FifoCache(size_t vertexCount, uint32_t cacheSize)
+        : mTimestamps(vertexCount, 0), mTimestamp(cacheSize + 1), mCacheSize(cacheSize)
+    {}
+
+    // Returns true on a cache miss
+    bool access(IndexType index)
+    {
+        if (mTimestamp - mTimestamps[index] > mCacheSize)
+        {
+            mTimestamps[index] = mTimestamp++;
+            return true;
+        }
+        return false;
+    }
+
+    void reset() { mTimestamp += mCacheSize + 1; }
+
+  private:
+    std::vector<uint32_t> mTimestamps;
+    uint32_t mTimestamp;
+    uint32_t mCacheSize;
+};
+
+int64_t nextFanningVertex(const std::vector<uint32_t> &candidates,
+                          const std::vector<uint32_t> &liveTriangles,
+                          const std::vector<uint32_t> &cacheTimestamps,
+                          uint32_t timestamp,
+                          uint32_t cacheSize,
+                          std::vector<uint32_t> &deadEnd,
+                          size_t &cursor)
+{
+    // Prefer the candidate that has been in the cache the longest but will still be in it after
+    // all of its remaining triangles have been emitted
+    int64_t best         = -1;
+    int64_t bestPriority = -1;
+    for (const uint32_t v : candidates)
+    {
+        if (liveTriangles[v] == 0)
+        {
+            continue;
+        }
+
+        int64_t priority = 0;
+        if (timestamp - cacheTimestamps[v] + 2 * liveTriangles[v] <= cacheSize)
+        {
+            priority = timestamp - cacheTimestamps[v];
+        }
+        if (priority > bestPriority)
+        {
+            best         = v;
+            bestPriority = priority;
+        }
+    }
+
+    if (best != -1)
+    {
+        return best;
+    }
+
+    // Dead end: first try recently used vertices, then fall back to scanning in input order
+    while (!deadEnd.empty())
+    {
+        const uint32_t v = deadEnd.back();
+        deadEnd.pop_back();
+        if (liveTriangles[v] > 0)
+        {
+            return v;
+        }
+    }
+
+    while (cursor < liveTriangles.size())
+    {
+        if (liveTriangles[cursor] > 0)
+        {
+            return static_cast<int64_t>(cursor++);
+        }
+        ++cursor;
+    }
+
+    return -1;
+}
+}  // namespace
+
+VertexCacheStats analyzeVertexCache(const std::vector<IndexType> &indices,
+                                    size_t vertexCount,
+                                    uint32_t cacheSize)
+{
+    if (indices.empty())
+    {
+        return VertexCacheStats{0.f, 0.f};
+    }
+
+    FifoCache cache(vertexCount, cacheSize);
+    std::vector<bool> referenced(vertexCount, false);
+    size_t misses           = 0;
+    size_t uniqueReferenced = 0;
+    for (const IndexType index : indices)
+    {
+        misses += cache.access(index) ? 1 : 0;
+        if (!referenced[index])
+        {
+            referenced[index] = true;
+            ++uniqueReferenced;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+    stats.atvr = static_cast<float>(misses) / static_cast<float>(uniqueReferenced);
+    return stats;
+}
+
+void optimizeVertexCache(std::vector<IndexType> &indices, size_t vertexCount, uint32_t cacheSize)
+{
+    ZoneScopedNC("mesh_optimizer::optimizeVertexCache", tracy::Color::Orange);
+    if (indices.empty())
+    {
+        return;
+    }
+
+    const TriangleAdjacency adjacency = buildAdjacency(indices, vertexCount);
+    const size_t triangleCount        = indices.size() / 3;
+
+    std::vector<uint32_t> liveTriangles = adjacency.counts;
+    std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+
+    std::vector<IndexType> result;
+    result.reserve(indices.size());
+
+    uint32_t timestamp = cacheSize + 1;
+    size_t cursor      = 0;
+    int64_t fanning    = nextFanningVertex({}, liveTriangles, cacheTimestamps, timestamp,
+                                           cacheSize, deadEnd, cursor);
+    while (fanning >= 0)
+    {
+        candidates.clear();
+
+        const uint32_t begin = adjacency.offsets[fanning];
+        const uint32_t end   = begin + adjacency.counts[fanning];
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const uint32_t triangle = adjacency.triangles[i];
+            if (emitted[triangle])
+            {
+                continue;
+            }
+
+            for (uint32_t corner = 0; corner < 3; ++corner)
+            {
+                const IndexType v = indices[triangle * 3 + corner];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                --liveTriangles[v];
+
+                if (timestamp - cacheTimestamps[v] > cacheSize)
+                {
+                    cacheTimestamps[v] = timestamp++;
+                }
+            }
+            emitted[triangle] = true;
+        }
+
+        fanning = nextFanningVertex(candidates, liveTriangles, cacheTimestamps, timestamp,
+                                    cacheSize, deadEnd, cursor);
+    }
+
+    indices = std::move(result);
+}
+
+void optimizeOverdraw(std::vector<IndexType> &indices,
+                      const std::vector<Vertex> &vertices,
+                      uint32_t cacheSize,
+                      float threshold)
+{
+    ZoneScopedNC("mesh_optimizer::optimizeOverdraw", tracy::Color::Orange);
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // Split into clusters. A triangle that misses the cache on all three vertices starts a new
+    // cluster for free, and within those we also cut wherever the cluster so far is already
+    // about as cache efficient as the whole mesh.
+    const float meshAcmr = analyzeVertexCache(indices, vertices.size(), cacheSize).acmr;
+
+    std::vector<size_t> clusterStarts{0};
+    FifoCache cache(vertices.size(), cacheSize);
+    size_t clusterMisses = 0;
+    size_t clusterStart  = 0;
+    for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+    {
+        uint32_t misses = 0;
+        for (uint32_t corner = 0; corner < 3; ++corner)
+        {
+            misses += cache.access(indices[triangle * 3 + corner]) ? 1 : 0;
+        }
+
+        if (misses == 3 && clusterStarts.back() != triangle)
+        {
+            clusterStarts.push_back(triangle);
+            clusterStart  = triangle;
+            clusterMisses = 0;
+        }
+        clusterMisses += misses;
+
+        const size_t clusterSize = triangle - clusterStart + 1;
+        if (triangle + 1 < triangleCount &&
+            static_cast<float>(clusterMisses) <= threshold * meshAcmr * clusterSize &&
+            clusterSize > 1)
+        {
+            clusterStarts.push_back(triangle + 1);
+            clusterStart  = triangle + 1;
+            clusterMisses = 0;
+            cache.reset();
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+
+    // Sort by how much each cluster faces away from the mesh's centroid, clusters on the outside
+    // are the likely occluders
+    glm::vec3 meshCentroid(0.f);
+    float meshArea = 0.f;
+    std::vector<glm::vec3> clusterCentroids(clusterStarts.size() - 1, glm::vec3(0.f));
+    std::vector<glm::vec3> clusterNormals(clusterStarts.size() - 1, glm::vec3(0.f));
+    for (size_t cluster = 0; cluster + 1 < clusterStarts.size(); ++cluster)
+    {
+        float clusterArea = 0.f;
+        for (size_t triangle = clusterStarts[cluster]; triangle < clusterStarts[cluster + 1];
+             ++triangle)
+        {
+            const glm::vec3 &a = vertices[indices[triangle * 3 + 0]].position;
+            const glm::vec3 &b = vertices[indices[triangle * 3 + 1]].position;
+            const glm::vec3 &c = vertices[indices[triangle * 3 + 2]].position;
+
+            // Imported meshes have their winding flipped and front faces are clockwise, so this is
+            // the order whose cross product points out of the front face
+            const glm::vec3 normal = glm::cross(c - a, b - a);
+            const float area       = glm::length(normal);
+            const glm::vec3 center = (a + b + c) / 3.f;
+
+            clusterCentroids[cluster] += center * area;
+            clusterNormals[cluster] += normal;
+            clusterArea += area;
+        }
+
+        meshCentroid += clusterCentroids[cluster];
+        meshArea += clusterArea;
+        if (clusterArea > 0.f)
+        {
+            clusterCentroids[cluster] /= clusterArea;
+        }
+        const float normalLength = glm::length(clusterNormals[cluster]);
+        if (normalLength > 0.f)
+        {
+            clusterNormals[cluster] /= normalLength;
+        }
+    }
+    if (meshArea > 0.f)
+    {
+        meshCentroid /= meshArea;
+    }
+
+    std::vector<float> sortKeys(clusterCentroids.size());
+    for (size_t cluster = 0; cluster < sortKeys.size(); ++cluster)
+    {
+        sortKeys[cluster] =
+            glm::dot(clusterCentroids[cluster] - meshCentroid, clusterNormals[cluster]);
+    }
+
+    std::vector<size_t> order(sortKeys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<IndexType> result;
+    result.reserve(indices.size());
+    for (const size_t cluster : order)
+    {
+        result.insert(result.end(), indices.begin() + clusterStarts[cluster] * 3,
+                      indices.begin() + clusterStarts[cluster + 1] * 3);
+    }
+
+    indices = std::move(result);
+}
+
+void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<IndexType> &indices)
+{
+    ZoneScopedNC("mesh_optimizer::optimizeVertexFetch", tracy::Color::Orange);
+    constexpr IndexType kUnmapped = std::numeric_limits<IndexType>::max();
+
+    std::vector<IndexType> remap(vertices.size(), kUnmapped);
+    std::vector<Vertex> result;
+    result.reserve(vertices.size());
+
+    for (IndexType &index : indices)
+    {
+        if (remap[index] == kUnmapped)
+        {
+            remap[index] = static_cast<IndexType>(result.size());
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    vertices = std::move(result);
+}
+
+void optimize(Mesh &mesh)
+{
+    optimizeVertexCache(mesh.indices, mesh.vertices.size());
+    optimizeOverdraw(mesh.indices, mesh.vertices);
+    optimizeVertexFetch(mesh.vertices, mesh.indices);
+}
+}  // namespace mesh_optimizer
+}  // namespace hatgpu
@@ -0,0 +1,56 @@
+#ifndef _INCLUDE_MESH_OPTIMIZER_H
+#define _INCLUDE_MESH_OPTIMIZER_H
+#include "hatpch.h"
+
+#include "geometry/Mesh.h"
+
+#include <vector>
+
+namespace hatgpu
+{
+// CPU-only index and vertex reordering passes run on imported meshes. None of these touch the GPU
+// or depend on anything but their arguments, and they're fully deterministic.
+namespace mesh_optimizer
+{
+// Size of the simulated post-transform vertex cache
+static constexpr uint32_t kCacheSize = 16;
+// How much worse than the whole mesh's ACMR a cluster is allowed to be when splitting the index
+// buffer into clusters for overdraw sorting
+static constexpr float kOverdrawThreshold = 1.05f;
+
+struct VertexCacheStats
+{
+    // Average cache miss ratio: transformed vertices per triangle, between 0.5 and 3
+    float acmr;
+    // Average transformed vertex ratio: transformed vertices per unique vertex, 1 at best
+    float atvr;
+};
+
+// Simulates a FIFO cache of `cacheSize` entries over the triangle list
+VertexCacheStats analyzeVertexCache(const std::vector<Mesh::IndexType> &indices,
+                                    size_t vertexCount,
+                                    uint32_t cacheSize = kCacheSize);
+
+// Reorders triangles for post-transform cache locality using Tipsify (Sander et al. 2007)
+void optimizeVertexCache(std::vector<Mesh::IndexType> &indices,
+                         size_t vertexCount,
+                         uint32_t cacheSize = kCacheSize);
+
+// Splits the cache optimized triangle order into clusters and sorts them so that outward facing
+// clusters are drawn first, which tends to reduce overdraw from any viewpoint. Run this after
+// optimizeVertexCache(), it only gives up a little cache efficiency at cluster boundaries.
+void optimizeOverdraw(std::vector<Mesh::IndexType> &indices,
+                      const std::vector<Vertex> &vertices,
+                      uint32_t cacheSize = kCacheSize,
+                      float threshold    = kOverdrawThreshold);
+
+// Reorders vertices into the order they're first referenced in and rewrites the indices to
+// match. Vertices that aren't referenced at all get dropped.
+void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<Mesh::IndexType> &indices);
+
+// Runs all of the passes above in the right order
+void optimize(Mesh &mesh);
+}  // namespace mesh_optimizer
+}  // namespace hatgpu
+
+#endif  //_INCLUDE_MESH_OPTIMIZER_H
@@ -1,18 +1,32 @@
 #include "Model.h"
 #include "hatpch.h"
 
+#include "application/Constants.h"
+#include "geometry/MeshCache.h"
+#include "geometry/MeshOptimizer.h"
+#include "geometry/VertexPacking.h"
+
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
 
 #include <glm/gtx/string_cast.hpp>
+#include <tracy/Tracy.hpp>
 
+#include <chrono>
 #include <iostream>
 
 namespace hatgpu
 {
 namespace
 {
+// Part of the mesh cache key, so changing these invalidates existing caches
+constexpr uint32_t kImportFlags = aiProcess_Triangulate | aiProcess_FlipUVs |
+                                  aiProcess_OptimizeMeshes | aiProcess_OptimizeGraph |
+                                  aiProcess_ForceGenNormals | aiProcess_FlipWindingOrder;
+constexpr uint32_t kProcessingFlags =
+    constants::kOptimizeMeshes ? mesh_cache::kProcessingOptimized : 0;
+
 std::vector<std::string> loadMaterialTextures(aiMaterial *mat,
                                               aiTextureType typ,
                                               TextureManager &manager,
@@ -35,12 +49,44 @@ std::vector<std::string> loadMaterialTextures(aiMaterial *mat,
 }  // namespace
 
 void Model::loadFromObj(const std::string &filename, TextureManager &manager)
+{
+    ZoneScopedNC("Model::loadFromObj", tracy::Color::Orange);
+    const auto start = std::chrono::steady_clock::now();
+
+    const bool cached = mesh_cache::load(filename, kImportFlags, kProcessingFlags, meshes);
+    if (cached)
+    {
+        // Still have to let the texture manager know about everything this model references
+        for (const Mesh &mesh : meshes)
+        {
+            for (const auto &[typ, path] : mesh.textures)
+            {
+                manager.loadTexture(path);
+            }
+        }
+    }
+    else
+    {
+        importWithAssimp(filename, manager);
+        mesh_cache::store(filename, kImportFlags, kProcessingFlags, meshes);
+    }
+
+    // Cheap enough to redo on every load, so the cache only ever holds full precision vertices
+    if constexpr (constants::kPackVertices)
+    {
+        packVertices(filename);
+    }
+
+    const std::chrono::duration<float, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    LOGGER.info("Loaded {} {} in {:.2f}ms", filename,
+                cached ? "from mesh cache" : "with Assimp (cold)", elapsed.count());
+}
+
+void Model::importWithAssimp(const std::string &filename, TextureManager &manager)
 {
     Assimp::Importer importer;
-    const aiScene *scene =
-        importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs |
-                                        aiProcess_OptimizeMeshes | aiProcess_OptimizeGraph |
-                                        aiProcess_ForceGenNormals | aiProcess_FlipWindingOrder);
+    const aiScene *scene = importer.ReadFile(filename, kImportFlags);
 
     H_ASSERT(scene != nullptr && !(scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) &&
                  scene->mRootNode != nullptr,
@@ -52,6 +98,66 @@ void Model::loadFromObj(const std::string &filename, TextureManager &manager)
     mDirectory = filename.substr(0, filename.find_last_of('/'));
 
     processNode(scene->mRootNode, scene, manager);
+
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        Mesh &mesh = meshes[i];
+        mesh.computeLocalBounds();
+
+        if constexpr (constants::kOptimizeMeshes)
+        {
+            const auto before =
+                mesh_optimizer::analyzeVertexCache(mesh.indices, mesh.vertices.size());
+            mesh_optimizer::optimize(mesh);
+            const auto after =
+                mesh_optimizer::analyzeVertexCache(mesh.indices, mesh.vertices.size());
+            LOGGER.info("Optimized mesh {} of {}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}",
+                        i, filename, before.acmr, after.acmr, before.atvr, after.atvr);
+        }
+    }
+}
+
+void Model::packVertices(const std::string &filename)
+{
+    ZoneScopedNC("Model::packVertices", tracy::Color::Orange);
+    size_t packedMeshes    = 0;
+    size_t vertexCount     = 0;
+    size_t fullBytes       = 0;
+    size_t uploadedBytes   = 0;
+    float maxPositionError = 0.f;
+    for (Mesh &mesh : meshes)
+    {
+        const vertex_packing::PackingError error =
+            vertex_packing::packVertices(mesh.vertices, mesh.localBounds, mesh.packedVertices);
+        if (error.uv <= constants::kMaxPackedUvError)
+        {
+            mesh.vertexFormat = VertexFormat::kPacked;
+            maxPositionError  = std::max(maxPositionError, error.position);
+            ++packedMeshes;
+        }
+        else
+        {
+            mesh.vertexFormat = VertexFormat::kFull;
+            mesh.packedVertices.clear();
+            mesh.packedVertices.shrink_to_fit();
+        }
+
+        vertexCount += mesh.vertices.size();
+        fullBytes += mesh.vertices.size() * sizeof(Vertex);
+        uploadedBytes += mesh.vertices.size() * mesh.vertexStride();
+    }
+
+    if (vertexCount == 0)
+    {
+        return;
+    }
+
+    LOGGER.info(
+        "Packed {}/{} meshes of {}: {:.1f} -> {:.1f} bytes per vertex ({:.2f}MB saved), max "
+        "position error {:.6f}",
+        packedMeshes, meshes.size(), filename, static_cast<float>(fullBytes) / vertexCount,
+        static_cast<float>(uploadedBytes) / vertexCount,
+        static_cast<float>(fullBytes - uploadedBytes) / (1024.f * 1024.f), maxPositionError);
 }
 
 void Model::processNode(aiNode *node, const aiScene *scene, TextureManager &manager)
@@ -25,6 +25,8 @@ class Model : public Hittable
     // Aabb BoundingBox(const glm::mat4 &worldTransform) const override;
 
   private:
+    void importWithAssimp(const std::string &filename, TextureManager &manager);
+    void packVertices(const std::string &filename);
     void processNode(aiNode *node, const aiScene *scene, TextureManager &textureManager);
     std::string mDirectory;
 };
@@ -0,0 +1,119 @@
+#include "hatpch.h"
+
+#include "VertexPacking.h"
+
+#include <glm/gtc/packing.hpp>
+#include <tracy/Tracy.hpp>
+
+#include <algorithm>
+
+namespace hatgpu
+{
+namespace vertex_packing
+{
+namespace
+{
+glm::vec2 signNotZero(glm::vec2 v)
+{
+    return glm::vec2(v.x >= 0.f ? 1.f : -1.f, v.y >= 0.f ? 1.f : -1.f);
+}
+
+// Extent of the bounds with empty axes replaced by zero, so flat meshes still round trip
+glm::vec3 boundsExtent(const Aabb &bounds)
+{
+    return glm::max(glm::vec3(bounds.max - bounds.min), glm::vec3(0.f));
+}
+}  // namespace
+
+glm::vec2 octEncode(glm::vec3 normal)
+{
+    const float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (l1 == 0.f)
+    {
+        return glm::vec2(0.f);
+    }
+    normal /= l1;
+
+    glm::vec2 encoded(normal.x, normal.y);
+    if (normal.z < 0.f)
+    {
+        encoded = (1.f - glm::abs(glm::vec2(encoded.y, encoded.x))) * signNotZero(encoded);
+    }
+    return encoded;
+}
+
+glm::vec3 octDecode(glm::vec2 encoded)
+{
+    glm::vec3 normal(encoded.x, encoded.y, 1.f - std::abs(encoded.x) - std::abs(encoded.y));
+    const float t = std::max(-normal.z, 0.f);
+    normal.x += normal.x >= 0.f ? -t : t;
+    normal.y += normal.y >= 0.f ? -t : t;
+    return glm::normalize(normal);
+}
+
+PackedVertex pack(const Vertex &vertex, const Aabb &bounds)
+{
+    const glm::vec3 extent = boundsExtent(bounds);
+
+    PackedVertex packed{};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float t = extent[axis] > 0.f
+                            ? (vertex.position[axis] - bounds.min[axis]) / extent[axis]
+                            : 0.f;
+        packed.position[axis] = glm::packUnorm1x16(t);
+    }
+
+    const glm::vec2 normal = octEncode(vertex.normal);
+    packed.normal[0]       = static_cast<int16_t>(glm::packSnorm1x16(normal.x));
+    packed.normal[1]       = static_cast<int16_t>(glm::packSnorm1x16(normal.y));
+
+    packed.uv[0] = glm::packHalf1x16(vertex.uv.x);
+    packed.uv[1] = glm::packHalf1x16(vertex.uv.y);
+    return packed;
+}
+
+Vertex unpack(const PackedVertex &packed, const Aabb &bounds)
+{
+    const glm::vec3 extent = boundsExtent(bounds);
+
+    Vertex vertex;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        vertex.position[axis] =
+            bounds.min[axis] + glm::unpackUnorm1x16(packed.position[axis]) * extent[axis];
+    }
+
+    vertex.normal = octDecode(
+        glm::vec2(glm::unpackSnorm1x16(static_cast<uint16_t>(packed.normal[0])),
+                  glm::unpackSnorm1x16(static_cast<uint16_t>(packed.normal[1]))));
+
+    vertex.uv = glm::vec2(glm::unpackHalf1x16(packed.uv[0]), glm::unpackHalf1x16(packed.uv[1]));
+    return vertex;
+}
+
+PackingError packVertices(const std::vector<Vertex> &vertices,
+                          const Aabb &bounds,
+                          std::vector<PackedVertex> &packed)
+{
+    ZoneScopedNC("vertex_packing::packVertices", tracy::Color::Orange);
+    packed.resize(vertices.size());
+
+    PackingError error{0.f, 0.f};
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        packed[i] = pack(vertices[i], bounds);
+
+        const Vertex roundTrip        = unpack(packed[i], bounds);
+        const glm::vec3 positionError = glm::abs(roundTrip.position - vertices[i].position);
+        const glm::vec2 uvError       = glm::abs(roundTrip.uv - vertices[i].uv);
+
+        error.position = std::max({error.position, positionError.x, positionError.y,
+                                   positionError.z});
+        error.uv       = std::max({error.uv, uvError.x, uvError.y});
+    }
+
+    return error;
+}
+}  // namespace vertex_packing
+}  // namespace hatgpu
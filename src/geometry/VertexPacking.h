@@ -0,0 +1,39 @@
+#ifndef _INCLUDE_VERTEX_PACKING_H
+#define _INCLUDE_VERTEX_PACKING_H
+#include "hatpch.h"
+
+#include "geometry/Aabb.h"
+#include "geometry/Mesh.h"
+
+#include <vector>
+
+namespace hatgpu
+{
+// Conversion between Vertex and PackedVertex. The decoding side here mirrors what
+// shaders/forward/shader.vert does so the error of the packed format can be measured on the CPU.
+namespace vertex_packing
+{
+struct PackingError
+{
+    // Largest per-component difference after a round trip, in model space units
+    float position;
+    // Largest per-component difference after a round trip, in UV units
+    float uv;
+};
+
+// Octahedral mapping of a unit vector onto [-1, 1]^2 (Meyer et al. 2010)
+glm::vec2 octEncode(glm::vec3 normal);
+glm::vec3 octDecode(glm::vec2 encoded);
+
+PackedVertex pack(const Vertex &vertex, const Aabb &bounds);
+Vertex unpack(const PackedVertex &packed, const Aabb &bounds);
+
+// Packs every vertex relative to `bounds`, which has to contain all of them, and returns the
+// largest error introduced
+PackingError packVertices(const std::vector<Vertex> &vertices,
+                          const Aabb &bounds,
+                          std::vector<PackedVertex> &packed);
+}  // namespace vertex_packing
+}  // namespace hatgpu
+
+#endif  //_INCLUDE_VERTEX_PACKING_H
@@ -1,11 +1,41 @@
 #include "application/Application.h"
 #include "hatpch.h"
+#include "util/Benchmark.h"
 
+#include <cstdio>
 #include <memory>
+#include <string_view>
 
-int main()
+int main(int argc, char **argv)
 {
-    auto app = std::make_unique<hatgpu::Application>("HatGPU", "../scenes/sponza.json");
+    // e.g. ../scenes/sponza-many-lights.json to benchmark clustered lighting
+    const char *scenePath   = "../scenes/sponza.json";
+    VkExtent2D windowExtent = hatgpu::Application::kDefaultWindowExtent;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg != "--benchmark" && arg != "--size")
+        {
+            scenePath = argv[i];
+            continue;
+        }
+
+        const char *value = i + 1 < argc ? argv[++i] : "";
+        const bool valid =
+            arg == "--benchmark"
+                ? hatgpu::benchmark::select(value)
+                : std::sscanf(value, "%ux%u", &windowExtent.width, &windowExtent.height) == 2 &&
+                      windowExtent.width > 0 && windowExtent.height > 0;
+        if (!valid)
+        {
+            LOGGER.error("Usage: {} [scene.json] [--size <width>x<height>] [--benchmark <name>], "
+                         "with one of: {}",
+                         argv[0], hatgpu::benchmark::names());
+            return 1;
+        }
+    }
+
+    auto app = std::make_unique<hatgpu::Application>("HatGPU", scenePath, windowExtent);
     app->Init();
     app->Run();
 
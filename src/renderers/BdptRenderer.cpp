@@ -1,16 +1,20 @@
 #include "hatpch.h"
 
 #include "BdptRenderer.h"
+#include "geometry/Bvh.h"
 #include "imgui.h"
 #include "scene/Scene.h"
 #include "texture/Texture.h"
 #include "util/Random.h"
+#include "util/ThreadPool.h"
 #include "vk/initializers.h"
 #include "vk/shader.h"
 
 #include <glm/gtx/string_cast.hpp>
 #include <tracy/Tracy.hpp>
 
+#include <chrono>
+#include <cmath>
 #include <cstring>
 #include <fstream>
 #include <stdexcept>
@@ -18,7 +22,14 @@
 namespace
 {
 
-static constexpr const char *kMainShaderName = "../shaders/bin/bdpt/main.comp.spv";
+static constexpr const char *kMainShaderName    = "../shaders/bin/bdpt/main.comp.spv";
+static constexpr const char *kResolveShaderName = "../shaders/bin/bdpt/resolve.comp.spv";
+// Workgroup size of resolve.comp
+constexpr uint32_t kResolveGroupSize = 8;
+// How long samples are counted for before the throughput shown in ImGui is updated
+constexpr std::chrono::milliseconds kThroughputWindow(500);
+// How many of them benchmark::Mode::kBdptThroughput logs before it finishes
+constexpr uint32_t kBenchmarkThroughputWindows = 20;
 
 struct GpuRayGenConstants
 {
@@ -28,30 +39,52 @@ struct GpuRayGenConstants
     glm::vec4 lowerLeftCorner;
 
     glm::uvec2 viewportExtent;
+    // Samples already accumulated, 0 starts over
+    uint32_t sampleIndex;
 };
 
-GpuRayGenConstants makeGpuRayGenConstants(size_t width, size_t height)
+// Rays go through a viewport one unit in front of the camera, with the same vertical field of
+// view as Camera::GetProjectionMatrix()
+GpuRayGenConstants makeGpuRayGenConstants(const hatgpu::Camera &camera, size_t width, size_t height)
 {
     float aspectRatio = static_cast<float>(width) / height;
 
-    float viewportHeight = 2.0f;
+    float viewportHeight = 2.f * std::tan(glm::radians(45.f) * 0.5f);
     float viewportWidth  = aspectRatio * viewportHeight;
-    // TODO: Probably put this in the camera class, or somehow make this configurable?
-    float focalLength = 1.0f;
+
+    const glm::vec3 forward = glm::normalize(camera.Target - camera.Position);
+    const glm::vec3 right   = glm::normalize(glm::cross(forward, camera.Up));
+    const glm::vec3 up      = glm::cross(right, forward);
 
     GpuRayGenConstants result{};
-    result.origin          = glm::vec4(0.f);
-    result.horizontal      = glm::vec4(viewportWidth, 0.f, 0.f, 0.f);
-    result.vertical        = glm::vec4(0.f, viewportHeight, 0.f, 0.f);
-    result.lowerLeftCorner = result.origin - result.horizontal * 0.5f - result.vertical * 0.5f -
-                             glm::vec4(0.f, 0.f, focalLength, 0.f);
+    result.origin          = glm::vec4(camera.Position, 0.f);
+    result.horizontal      = glm::vec4(right * viewportWidth, 0.f);
+    result.vertical        = glm::vec4(up * viewportHeight, 0.f);
+    result.lowerLeftCorner = result.origin + glm::vec4(forward, 0.f) - result.horizontal * 0.5f -
+                             result.vertical * 0.5f;
     result.viewportExtent = glm::uvec2(width, height);
 
     return result;
 }
 
+std::vector<glm::mat4> renderableTransforms(const hatgpu::Scene &scene)
+{
+    std::vector<glm::mat4> transforms;
+    transforms.reserve(scene.renderables.size());
+    for (const hatgpu::RenderObject &renderObj : scene.renderables)
+    {
+        transforms.push_back(renderObj.transform);
+    }
+    return transforms;
+}
+
 constexpr size_t kCanvasBindingLocation          = 0;
 constexpr size_t kRayGenConstantsBindingLocation = 1;
+constexpr size_t kBlasNodesBindingLocation       = 2;
+constexpr size_t kBvhTrianglesBindingLocation    = 3;
+constexpr size_t kTlasNodesBindingLocation       = 4;
+constexpr size_t kBvhInstancesBindingLocation    = 5;
+constexpr size_t kAccumulationBindingLocation    = 6;
 
 }  // namespace
 
@@ -74,68 +107,76 @@ void BdptRenderer::Init()
     createDescriptorLayout();
     createPipeline();
     createCanvas();
+    buildSceneBvh();
     createDescriptorSets();
+
+    mDispatchTimer = vk::GpuTimer(mCtx->device, mCtx->gpuProperties, constants::kMaxFramesInFlight);
+    mDeleter.enqueue([this]() { mDispatchTimer.destroy(); });
 }
 
 void BdptRenderer::OnDetach() {}
 
+vk::GpuTexture BdptRenderer::createStorageImage(VkFormat format, VkImageUsageFlags usage)
+{
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(mCtx->physicalDevice, format, &formatProperties);
+    H_ASSERT(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT,
+             "requested image format does not support image storage operations");
+
+    VkExtent3D imageExtent;
+    imageExtent.width           = mCtx->swapchainExtent.width;
+    imageExtent.height          = mCtx->swapchainExtent.height;
+    imageExtent.depth           = 1;
+    VkImageCreateInfo imageInfo = vk::imageInfo(format, usage | VK_IMAGE_USAGE_STORAGE_BIT,
+                                                imageExtent);
+    imageInfo.flags             = VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+    imageInfo.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    vk::GpuTexture img{};
+    img.mipLevels = 1;
+    VmaAllocationCreateInfo imgAllocInfo{};
+    imgAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    vmaCreateImage(mCtx->allocator.Impl, &imageInfo, &imgAllocInfo, &img.image.image,
+                   &img.image.allocation, nullptr);
+
+    mCtx->uploadContext.immediateSubmit([&img](VkCommandBuffer commandBuffer) {
+        VkImageMemoryBarrier barrier;
+        barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout           = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image               = img.image.image;
+        barrier.pNext               = VK_NULL_HANDLE;
+
+        barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel   = 0;
+        barrier.subresourceRange.levelCount     = 1;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount     = 1;
+
+        barrier.srcAccessMask = VK_ACCESS_NONE;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                             &barrier);
+    });
+
+    VkImageViewCreateInfo viewInfo =
+        vk::imageViewInfo(format, img.image.image, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    H_CHECK(vkCreateImageView(mCtx->device, &viewInfo, nullptr, &img.imageView),
+            "failed to create storage image view");
+    return img;
+}
+
 void BdptRenderer::createCanvas()
 {
     H_LOG("...creating canvas image");
     for (FrameData &frame : mFrames)
     {
-        VkExtent3D imageExtent;
-        imageExtent.width           = mCtx->swapchainExtent.width;
-        imageExtent.height          = mCtx->swapchainExtent.height;
-        imageExtent.depth           = 1;
-        VkImageCreateInfo imageInfo = vk::imageInfo(
-            VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
-            imageExtent);
-        imageInfo.flags = VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
-
-        VkFormatProperties formatProperties;
-        vkGetPhysicalDeviceFormatProperties(mCtx->physicalDevice, VK_FORMAT_R8G8B8A8_UNORM,
-                                            &formatProperties);
-        H_ASSERT(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT,
-                 "requested image format does not support image storage operations");
-
-        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        VmaAllocationCreateInfo imgAllocInfo{};
-        frame.canvasImage.mipLevels = 1;
-        vk::GpuTexture &img         = frame.canvasImage;
-        imgAllocInfo.usage          = VMA_MEMORY_USAGE_GPU_ONLY;
-        vmaCreateImage(mCtx->allocator.Impl, &imageInfo, &imgAllocInfo, &img.image.image,
-                       &img.image.allocation, nullptr);
-
-        mCtx->uploadContext.immediateSubmit([&frame](VkCommandBuffer commandBuffer) {
-            VkImageMemoryBarrier barrier;
-            barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            barrier.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
-            barrier.newLayout           = VK_IMAGE_LAYOUT_GENERAL;
-            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            barrier.image               = frame.canvasImage.image.image;
-            barrier.pNext               = VK_NULL_HANDLE;
-
-            barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
-            barrier.subresourceRange.baseMipLevel   = 0;
-            barrier.subresourceRange.levelCount     = 1;
-            barrier.subresourceRange.baseArrayLayer = 0;
-            barrier.subresourceRange.layerCount     = 1;
-
-            barrier.srcAccessMask = VK_ACCESS_NONE;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-
-            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
-                                 &barrier);
-        });
-
-        VkImageViewCreateInfo canvasViewInfo = vk::imageViewInfo(
-            VK_FORMAT_R8G8B8A8_UNORM, frame.canvasImage.image.image, VK_IMAGE_ASPECT_COLOR_BIT, 1);
-        H_CHECK(
-            vkCreateImageView(mCtx->device, &canvasViewInfo, nullptr, &frame.canvasImage.imageView),
-            "failed to create canvas image view");
+        frame.canvasImage =
+            createStorageImage(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
     }
 
     mDeleter.enqueue([this]() {
@@ -145,6 +186,15 @@ void BdptRenderer::createCanvas()
             frame.canvasImage.destroy(mCtx->allocator);
         }
     });
+
+    H_LOG("...creating accumulation image");
+    // Shared by every frame in flight, draw() orders their accesses
+    mAccumulationImage = createStorageImage(VK_FORMAT_R32G32B32A32_SFLOAT, 0);
+
+    mDeleter.enqueue([this]() {
+        vkDestroyImageView(mCtx->device, mAccumulationImage.imageView, nullptr);
+        mAccumulationImage.destroy(mCtx->allocator);
+    });
 }
 
 void BdptRenderer::createDescriptorPool()
@@ -152,7 +202,7 @@ void BdptRenderer::createDescriptorPool()
     H_LOG("...creating descriptor set pool");
     std::vector<VkDescriptorPoolSize> sizes = {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
                                                {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 190},
-                                               {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
+                                               {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 20},
                                                {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 10}};
 
     // Creating the descriptor pool
@@ -180,8 +230,23 @@ void BdptRenderer::createDescriptorLayout()
     VkDescriptorSetLayoutBinding rayGenConstantsBinding = vk::descriptorSetLayoutBinding(
         VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT,
         kRayGenConstantsBindingLocation);
-
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {canvasBinding, rayGenConstantsBinding};
+    VkDescriptorSetLayoutBinding blasNodesBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, kBlasNodesBindingLocation);
+    VkDescriptorSetLayoutBinding bvhTrianglesBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT,
+        kBvhTrianglesBindingLocation);
+    VkDescriptorSetLayoutBinding tlasNodesBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, kTlasNodesBindingLocation);
+    VkDescriptorSetLayoutBinding bvhInstancesBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT,
+        kBvhInstancesBindingLocation);
+    VkDescriptorSetLayoutBinding accumulationBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT,
+        kAccumulationBindingLocation);
+
+    std::array<VkDescriptorSetLayoutBinding, 7> bindings = {
+        canvasBinding,    rayGenConstantsBinding, blasNodesBinding,   bvhTrianglesBinding,
+        tlasNodesBinding, bvhInstancesBinding,    accumulationBinding};
 
     VkDescriptorSetLayoutCreateInfo globalLayoutInfo{};
     globalLayoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -208,13 +273,7 @@ void BdptRenderer::createDescriptorSets()
     canvasSamplerInfo.maxLod              = 1;
     canvasSamplerInfo.anisotropyEnable    = VK_FALSE;
     canvasSamplerInfo.mipLodBias          = 0.f;
-    VkSampler canvasSampler;
-    vkCreateSampler(mCtx->device, &canvasSamplerInfo, nullptr, &canvasSampler);
-    mDeleter.enqueue(
-        [this, canvasSampler]() { vkDestroySampler(mCtx->device, canvasSampler, nullptr); });
-
-    GpuRayGenConstants gpuRayGenConstants =
-        makeGpuRayGenConstants(mCtx->swapchainExtent.width, mCtx->swapchainExtent.height);
+    VkSampler canvasSampler               = mCtx->samplerCache.get(canvasSamplerInfo);
 
     for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
     {
@@ -238,14 +297,17 @@ void BdptRenderer::createDescriptorSets()
             vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, mFrames[i].globalDescriptor,
                                      &canvasImageInfo, kCanvasBindingLocation);
 
-        mFrames[i].rayGenConstantsBuffer = mCtx->allocator.createBuffer(
-            sizeof(GpuRayGenConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VMA_MEMORY_USAGE_CPU_TO_GPU);
-        // Writing raygen constant data
-        auto data = static_cast<GpuRayGenConstants *>(
-            mCtx->allocator.map(mFrames[i].rayGenConstantsBuffer));
-        *data = gpuRayGenConstants;
-        mCtx->allocator.unmap(mFrames[i].rayGenConstantsBuffer);
+        VkDescriptorImageInfo accumulationImageInfo{};
+        accumulationImageInfo.imageView   = mAccumulationImage.imageView;
+        accumulationImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet accumulationSetWrite = vk::writeDescriptorImage(
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, mFrames[i].globalDescriptor, &accumulationImageInfo,
+            kAccumulationBindingLocation);
+
+        // Follows the camera, so it's rewritten every frame
+        mFrames[i].rayGenConstantsBuffer = mCtx->allocator.createMappedBuffer(
+            sizeof(GpuRayGenConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 
         VkDescriptorBufferInfo rayGenConstantsInfo{};
         rayGenConstantsInfo.buffer = mFrames[i].rayGenConstantsBuffer.buffer;
@@ -256,7 +318,23 @@ void BdptRenderer::createDescriptorSets()
             VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, mFrames[i].globalDescriptor, &rayGenConstantsInfo,
             kRayGenConstantsBindingLocation);
 
-        std::array<VkWriteDescriptorSet, 2> writes = {canvasSetWrite, rayGenConstantsSetWrite};
+        std::array<VkDescriptorBufferInfo, 4> bvhInfos = {
+            VkDescriptorBufferInfo{mBlasNodeBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{mBvhTriangleBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{mFrames[i].tlasNodeBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{mFrames[i].instanceBuffer.buffer, 0, VK_WHOLE_SIZE}};
+        std::array<size_t, 4> bvhBindings = {
+            kBlasNodesBindingLocation, kBvhTrianglesBindingLocation, kTlasNodesBindingLocation,
+            kBvhInstancesBindingLocation};
+
+        std::vector<VkWriteDescriptorSet> writes = {canvasSetWrite, rayGenConstantsSetWrite,
+                                                    accumulationSetWrite};
+        for (size_t binding = 0; binding < bvhInfos.size(); ++binding)
+        {
+            writes.push_back(vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                       mFrames[i].globalDescriptor,
+                                                       &bvhInfos[binding], bvhBindings[binding]));
+        }
 
         vkUpdateDescriptorSets(mCtx->device, writes.size(), writes.data(), 0, nullptr);
     }
@@ -270,6 +348,160 @@ void BdptRenderer::createDescriptorSets()
     });
 }
 
+void BdptRenderer::buildSceneBvh()
+{
+    ZoneScopedNC("buildSceneBvh", tracy::Color::Orange);
+    H_LOG("...building scene BVHs");
+
+    struct BottomLevel
+    {
+        uint32_t root;
+        size_t triangleCount;
+    };
+
+    ThreadPool &pool = ThreadPool::GetOrCreateInstance();
+    const auto start = std::chrono::steady_clock::now();
+
+    // One bottom level per model in object space, however many renderables share it
+    Bvh bottomLevels;
+    std::unordered_map<const Model *, BottomLevel> modelBottomLevels;
+    const bool benchmarkBuilds = benchmark::enabled(benchmark::Mode::kBvhBuild);
+    std::vector<BvhTriangle> benchmarkTriangles;
+    std::vector<uint32_t> instanceRoots;
+    size_t instancedTriangleCount = 0;
+    for (const RenderObject &renderObj : mScene->renderables)
+    {
+        auto it = modelBottomLevels.find(renderObj.model.get());
+        if (it == modelBottomLevels.end())
+        {
+            size_t modelTriangleCount = 0;
+            for (const Mesh &mesh : renderObj.model->meshes)
+            {
+                modelTriangleCount += mesh.indices.size() / 3;
+            }
+            std::vector<BvhTriangle> triangles;
+            triangles.reserve(modelTriangleCount);
+            for (const Mesh &mesh : renderObj.model->meshes)
+            {
+                bvh::appendTriangles(mesh, glm::mat4(1.f), triangles);
+            }
+            if (benchmarkBuilds)
+            {
+                benchmarkTriangles.insert(benchmarkTriangles.end(), triangles.begin(),
+                                          triangles.end());
+            }
+
+            const size_t triangleCount = triangles.size();
+            const Bvh blas             = bvh::buildParallel(std::move(triangles), pool);
+            H_ASSERT(bvh::validate(blas), "Bottom level BVH is malformed");
+            const uint32_t root = bvh::appendBottomLevel(blas, bottomLevels);
+            it = modelBottomLevels.emplace(renderObj.model.get(), BottomLevel{root, triangleCount})
+                     .first;
+        }
+        instanceRoots.push_back(it->second.root);
+        instancedTriangleCount += it->second.triangleCount;
+    }
+    // Only happens without any renderables, the shader still needs something to bind
+    if (bottomLevels.nodes.empty())
+    {
+        bvh::appendBottomLevel(bvh::build({}), bottomLevels);
+    }
+
+    mTopLevel =
+        bvh::buildTopLevel(bottomLevels.nodes, instanceRoots, renderableTransforms(*mScene));
+    mTopLevelRevision = mScene->revision;
+    const std::chrono::duration<float, std::milli> buildTime =
+        std::chrono::steady_clock::now() - start;
+
+    LOGGER.info("Scene BVH: {} models with {} triangles, {} as one world space BVH, {} bottom "
+                "level nodes, {} instances, {} top level nodes, built in {:.2f}ms",
+                modelBottomLevels.size(), bottomLevels.triangles.size(), instancedTriangleCount,
+                bottomLevels.nodes.size(), mScene->renderables.size(), mTopLevel.nodes.size(),
+                buildTime.count());
+
+    if (benchmarkBuilds)
+    {
+        bvh::benchmark(benchmarkTriangles);
+        benchmark::finish();
+    }
+
+    mBlasNodeBuffer     = uploadStorageBuffer(bottomLevels.nodes.data(),
+                                              bottomLevels.nodes.size() * sizeof(BvhNode));
+    mBvhTriangleBuffer  = uploadStorageBuffer(bottomLevels.triangles.data(),
+                                              bottomLevels.triangles.size() * sizeof(BvhTriangle));
+    mCtx->uploadContext.submit();
+    mBlasNodes = std::move(bottomLevels.nodes);
+
+    // Refitting never changes the size of the top level, so these never need to grow
+    for (FrameData &frame : mFrames)
+    {
+        frame.tlasNodeBuffer = mCtx->allocator.createMappedBuffer(
+            mTopLevel.nodes.size() * sizeof(BvhNode), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        frame.instanceBuffer = mCtx->allocator.createMappedBuffer(
+            mTopLevel.instances.size() * sizeof(BvhInstance), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    }
+
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying scene BVHs");
+        mCtx->allocator.destroyBuffer(mBlasNodeBuffer);
+        mCtx->allocator.destroyBuffer(mBvhTriangleBuffer);
+        for (FrameData &frame : mFrames)
+        {
+            mCtx->allocator.destroyBuffer(frame.tlasNodeBuffer);
+            mCtx->allocator.destroyBuffer(frame.instanceBuffer);
+        }
+    });
+}
+
+void BdptRenderer::updateTopLevel(size_t frameIndex)
+{
+    // Every frame has its own copy of the top level, so each one is brought up to date the first
+    // time it's used after the scene changed
+    FrameData &frame = mFrames[frameIndex];
+    if (frame.sceneRevision == mScene->revision)
+    {
+        return;
+    }
+    ZoneScopedNC("updateTopLevel", tracy::Color::Orange);
+    frame.sceneRevision = mScene->revision;
+
+    // Only the transforms can have changed, the bottom levels stay as they are
+    if (mTopLevelRevision != mScene->revision)
+    {
+        bvh::refitTopLevel(mTopLevel, mBlasNodes, renderableTransforms(*mScene));
+        mTopLevelRevision = mScene->revision;
+    }
+
+    std::memcpy(vk::Allocator::mapped<BvhNode>(frame.tlasNodeBuffer), mTopLevel.nodes.data(),
+                mTopLevel.nodes.size() * sizeof(BvhNode));
+    std::memcpy(vk::Allocator::mapped<BvhInstance>(frame.instanceBuffer),
+                mTopLevel.instances.data(), mTopLevel.instances.size() * sizeof(BvhInstance));
+}
+
+vk::AllocatedBuffer BdptRenderer::uploadStorageBuffer(const void *data, size_t size)
+{
+    vk::AllocatedBuffer buffer = mCtx->allocator.createBuffer(
+        size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    vk::StagingAllocation staging = mCtx->uploadContext.stage(data, size);
+
+    vk::UploadContext &context = mCtx->uploadContext;
+    context.record(
+        [=, &context](VkCommandBuffer cmd) {
+            VkBufferCopy copy{};
+            copy.srcOffset = staging.offset;
+            copy.dstOffset = 0;
+            copy.size      = size;
+            vkCmdCopyBuffer(cmd, staging.buffer, buffer.buffer, 1, &copy);
+            context.releaseBuffer(cmd, buffer.buffer);
+        },
+        [=, &context](VkCommandBuffer cmd) {
+            context.acquireBuffer(cmd, buffer.buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                  VK_ACCESS_SHADER_READ_BIT);
+        });
+    return buffer;
+}
+
 void BdptRenderer::createPipeline()
 {
     H_LOG("...creating main draw pipeline");
@@ -291,46 +523,263 @@ void BdptRenderer::createPipeline()
         vkDestroyPipelineLayout(mCtx->device, mBdptPipelineLayout, nullptr);
     });
 
-    VkComputePipelineCreateInfo pipelineInfo{};
-    pipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    pipelineInfo.pNext  = nullptr;
-    pipelineInfo.layout = mBdptPipelineLayout;
-    pipelineInfo.stage  = mainStageInfo;
+    const VkPhysicalDeviceLimits &limits = mCtx->gpuProperties.limits;
+    for (size_t i = 0; i < kTileSizes.size(); ++i)
+    {
+        const uint32_t tileSize = kTileSizes[i];
+        if (tileSize * tileSize > limits.maxComputeWorkGroupInvocations ||
+            tileSize > limits.maxComputeWorkGroupSize[0] ||
+            tileSize > limits.maxComputeWorkGroupSize[1])
+        {
+            H_LOG(std::format("...skipping {}x{} tiles, too large for this device", tileSize,
+                              tileSize));
+            continue;
+        }
 
-    H_CHECK(vkCreateComputePipelines(mCtx->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
-                                     &mBdptPipeline),
-            "Failed to create compute pipeline");
+        // local_size_x_id and local_size_y_id
+        const std::array<uint32_t, 2> workgroupSize = {tileSize, tileSize};
+
+        const std::array<VkSpecializationMapEntry, 2> specializationEntries = {
+            VkSpecializationMapEntry{0, 0, sizeof(uint32_t)},
+            VkSpecializationMapEntry{1, sizeof(uint32_t), sizeof(uint32_t)}};
+        VkSpecializationInfo specializationInfo{};
+        specializationInfo.mapEntryCount = specializationEntries.size();
+        specializationInfo.pMapEntries   = specializationEntries.data();
+        specializationInfo.dataSize      = sizeof(workgroupSize);
+        specializationInfo.pData         = workgroupSize.data();
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType                     = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.pNext                     = nullptr;
+        pipelineInfo.layout                    = mBdptPipelineLayout;
+        pipelineInfo.stage                     = mainStageInfo;
+        pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+
+        H_CHECK(vkCreateComputePipelines(mCtx->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+                                         &mBdptPipelines[i]),
+                "Failed to create compute pipeline");
+    }
+
+    // Shares the pipeline layout, it only uses the canvas and accumulation bindings
+    VkComputePipelineCreateInfo resolvePipelineInfo{};
+    resolvePipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    resolvePipelineInfo.pNext  = nullptr;
+    resolvePipelineInfo.layout = mBdptPipelineLayout;
+    resolvePipelineInfo.stage =
+        vk::createShaderStage(mCtx->device, kResolveShaderName, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    H_CHECK(vkCreateComputePipelines(mCtx->device, VK_NULL_HANDLE, 1, &resolvePipelineInfo,
+                                     nullptr, &mResolvePipeline),
+            "Failed to create resolve pipeline");
 
     mDeleter.enqueue([this]() {
-        H_LOG("...destroying compute pipeline");
-        vkDestroyPipeline(mCtx->device, mBdptPipeline, nullptr);
+        H_LOG("...destroying compute pipelines");
+        for (VkPipeline pipeline : mBdptPipelines)
+        {
+            vkDestroyPipeline(mCtx->device, pipeline, nullptr);
+        }
+        vkDestroyPipeline(mCtx->device, mResolvePipeline, nullptr);
     });
 
     vkDestroyShaderModule(mCtx->device, mainStageInfo.module, nullptr);
+    vkDestroyShaderModule(mCtx->device, resolvePipelineInfo.stage.module, nullptr);
 }
 
 void BdptRenderer::OnRender(DrawCtx &drawCtx)
 {
+    if (std::optional<float> dispatchTime = mDispatchTimer.read(drawCtx.frameIndex);
+        dispatchTime.has_value())
+    {
+        mDispatchTimeMs = mDispatchTimeMs == 0.f ? *dispatchTime
+                                                 : mDispatchTimeMs * 0.95f + *dispatchTime * 0.05f;
+        TracyPlot("BDPT dispatch (ms)", *dispatchTime);
+        if (benchmark::enabled(benchmark::Mode::kBdptTiles))
+        {
+            stepTileBenchmark(*dispatchTime);
+        }
+    }
+
+    // Samples taken from another viewpoint or of a different scene would never average out
+    const AccumulationKey key{mScene->camera.Position, mScene->camera.Target, mScene->camera.Up,
+                              mScene->revision};
+    if (mAccumulationKey != key)
+    {
+        if (benchmark::enabled(benchmark::Mode::kBdptThroughput) && mAccumulationKey.has_value())
+        {
+            LOGGER.info("BDPT accumulation restarted after {} spp, {}", mSampleCount,
+                        mAccumulationKey->sceneRevision != key.sceneRevision ? "the scene changed"
+                                                                           : "the camera moved");
+        }
+        mAccumulationKey = key;
+        mSampleCount     = 0;
+    }
+
+    GpuRayGenConstants rayGenConstants = makeGpuRayGenConstants(
+        mScene->camera, mCtx->swapchainExtent.width, mCtx->swapchainExtent.height);
+    rayGenConstants.sampleIndex = mSampleCount;
+    *vk::Allocator::mapped<GpuRayGenConstants>(
+        mFrames[drawCtx.frameIndex].rayGenConstantsBuffer) = rayGenConstants;
+    updateTopLevel(drawCtx.frameIndex);
+
     recordCommandBuffer(drawCtx);
-    ++mFrameCount;
+    ++mSampleCount;
+    updateThroughput();
+}
+
+void BdptRenderer::updateThroughput()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (mThroughputWindowSamples == 0)
+    {
+        mThroughputWindowStart = now;
+    }
+    ++mThroughputWindowSamples;
+
+    const std::chrono::duration<float> elapsed = now - mThroughputWindowStart;
+    if (elapsed < kThroughputWindow)
+    {
+        return;
+    }
+    // The first sample only starts the clock
+    mSamplesPerPixelPerSecond = (mThroughputWindowSamples - 1) / elapsed.count();
+    mThroughputWindowSamples  = 0;
+
+    const float pixelCount = static_cast<float>(mCtx->swapchainExtent.width) *
+                             static_cast<float>(mCtx->swapchainExtent.height);
+    TracyPlot("BDPT samples/s (M)", mSamplesPerPixelPerSecond * pixelCount / 1e6f);
+    if (benchmark::enabled(benchmark::Mode::kBdptThroughput))
+    {
+        LOGGER.info("BDPT at {}x{}: {} spp, {:.1f} spp/s, {:.2f} Msamples/s, {:.3f} ms dispatch "
+                    "on {}",
+                    mCtx->swapchainExtent.width, mCtx->swapchainExtent.height, mSampleCount,
+                    mSamplesPerPixelPerSecond, mSamplesPerPixelPerSecond * pixelCount / 1e6f,
+                    mDispatchTimeMs, mCtx->gpuProperties.deviceName);
+        if (++mLoggedThroughputWindows == kBenchmarkThroughputWindows)
+        {
+            benchmark::finish();
+        }
+    }
 }
+
+void BdptRenderer::stepTileBenchmark(float dispatchTimeMs)
+{
+    if (const std::optional<std::vector<double>> averages = mTileSeries.add({dispatchTimeMs});
+        averages.has_value())
+    {
+        const uint32_t tileSize = kTileSizes[mTileSizeIndex];
+        LOGGER.info("BDPT {}x{} tiles at {}x{}: {:.3f} ms per dispatch on {}", tileSize, tileSize,
+                    mCtx->swapchainExtent.width, mCtx->swapchainExtent.height, (*averages)[0],
+                    mCtx->gpuProperties.deviceName);
+    }
+
+    std::optional<size_t> setting = mTileSeries.setting();
+    while (setting.has_value() && mBdptPipelines[*setting] == VK_NULL_HANDLE)
+    {
+        mTileSeries.skip();
+        setting = mTileSeries.setting();
+    }
+    if (!setting.has_value())
+    {
+        benchmark::finish();
+        return;
+    }
+    mTileSizeIndex = static_cast<int>(*setting);
+}
+
 void BdptRenderer::OnImGuiRender()
 {
     ImGui::Text("You are viewing the BDPT renderer.");
     ImGui::Text("Move around with WASD, LSHIFT and LCTRL");
     ImGui::Text("Look around with arrow keys. Zoom in/out with mouse wheel");
+
+    ImGui::Separator();
+    for (size_t i = 0; i < kTileSizes.size(); ++i)
+    {
+        if (mBdptPipelines[i] == VK_NULL_HANDLE)
+        {
+            continue;
+        }
+        const std::string label = std::format("{}x{} tiles", kTileSizes[i], kTileSizes[i]);
+        ImGui::RadioButton(label.c_str(), &mTileSizeIndex, static_cast<int>(i));
+        ImGui::SameLine();
+    }
+    ImGui::NewLine();
+    ImGui::Text("Dispatch: %.3f ms at %ux%u", mDispatchTimeMs, mCtx->swapchainExtent.width,
+                mCtx->swapchainExtent.height);
+
+    ImGui::Separator();
+    const float pixelCount = static_cast<float>(mCtx->swapchainExtent.width) *
+                             static_cast<float>(mCtx->swapchainExtent.height);
+    ImGui::Text("Samples per pixel: %u", mSampleCount);
+    ImGui::Text("Throughput: %.1f spp/s, %.2f Msamples/s", mSamplesPerPixelPerSecond,
+                mSamplesPerPixelPerSecond * pixelCount / 1e6f);
+    // One sample per pixel per frame, so the above is capped by the frame rate. This is what the
+    // GPU could do if it only traced.
+    if (mDispatchTimeMs > 0.f)
+    {
+        ImGui::Text("Dispatch bound: %.2f Msamples/s", pixelCount / (mDispatchTimeMs * 1e3f));
+    }
+    if (ImGui::Button("Restart accumulation"))
+    {
+        mSampleCount = 0;
+    }
 }
 
 void BdptRenderer::draw(DrawCtx &drawCtx)
 {
     VkZoneC("draw", tracy::Color::Blue);
 
-    vkCmdBindPipeline(drawCtx.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mBdptPipeline);
+    const uint32_t tileSize = kTileSizes[mTileSizeIndex];
+    const VkExtent2D extent = mCtx->swapchainExtent;
+
+    // The accumulation image is shared between frames in flight, so the previous frame's sample
+    // and resolve have to be done with it first
+    accumulationBarrier(drawCtx.commandBuffer,
+                        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT,
+                        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT);
+
+    mDispatchTimer.begin(drawCtx.commandBuffer, drawCtx.frameIndex);
+    vkCmdBindPipeline(drawCtx.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      mBdptPipelines[mTileSizeIndex]);
     vkCmdBindDescriptorSets(drawCtx.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
                             mBdptPipelineLayout, 0, 1,
                             &mFrames[drawCtx.frameIndex].globalDescriptor, 0, nullptr);
-    vkCmdDispatch(drawCtx.commandBuffer, mCtx->swapchainExtent.width, mCtx->swapchainExtent.height,
-                  1);
+    vkCmdDispatch(drawCtx.commandBuffer, (extent.width + tileSize - 1) / tileSize,
+                  (extent.height + tileSize - 1) / tileSize, 1);
+    mDispatchTimer.end(drawCtx.commandBuffer, drawCtx.frameIndex);
+
+    accumulationBarrier(drawCtx.commandBuffer, VK_ACCESS_SHADER_WRITE_BIT,
+                        VK_ACCESS_SHADER_READ_BIT);
+
+    // Same pipeline layout, so the descriptor set stays bound
+    vkCmdBindPipeline(drawCtx.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mResolvePipeline);
+    vkCmdDispatch(drawCtx.commandBuffer, (extent.width + kResolveGroupSize - 1) / kResolveGroupSize,
+                  (extent.height + kResolveGroupSize - 1) / kResolveGroupSize, 1);
+}
+
+void BdptRenderer::accumulationBarrier(VkCommandBuffer cmd,
+                                       VkAccessFlags srcAccess,
+                                       VkAccessFlags dstAccess)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout           = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout           = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image               = mAccumulationImage.image.image;
+    barrier.srcAccessMask       = srcAccess;
+    barrier.dstAccessMask       = dstAccess;
+
+    barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel   = 0;
+    barrier.subresourceRange.levelCount     = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount     = 1;
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                         &barrier);
 }
 
 void BdptRenderer::transferCanvasToSwapchain(DrawCtx &drawCtx)
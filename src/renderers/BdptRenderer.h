@@ -5,17 +5,22 @@
 
 #include "application/Constants.h"
 #include "application/Renderer.h"
+#include "geometry/Bvh.h"
 #include "geometry/Model.h"
 #include "scene/Camera.h"
 #include "scene/Scene.h"
 #include "texture/Texture.h"
+#include "util/Benchmark.h"
 #include "vk/allocator.h"
 #include "vk/deleter.h"
+#include "vk/gpu_timer.h"
 #include "vk/gpu_texture.h"
 #include "vk/types.h"
 
 #include <glm/glm.hpp>
 
+#include <array>
+#include <chrono>
 #include <iostream>
 
 namespace hatgpu
@@ -40,13 +45,41 @@ class BdptRenderer : public Renderer
     void createDescriptorPool();
     void createDescriptorLayout();
     void createDescriptorSets();
+    // Device local image the size of the swapchain, in GENERAL layout
+    vk::GpuTexture createStorageImage(VkFormat format, VkImageUsageFlags usage);
+    // The per-frame canvases and the accumulation image
     void createCanvas();
     void createPipeline();
+    // Builds and uploads a bottom level BVH for every model the renderables use, and the top level
+    // BVH placing them
+    void buildSceneBvh();
+    // Refits the top level BVH to the renderables' transforms if the scene changed, and brings the
+    // frame's copy of it up to date
+    void updateTopLevel(size_t frameIndex);
+    vk::AllocatedBuffer uploadStorageBuffer(const void *data, size_t size);
+    // Compute to compute dependency on the accumulation image
+    void accumulationBarrier(VkCommandBuffer cmd, VkAccessFlags srcAccess, VkAccessFlags dstAccess);
+    void updateThroughput();
+    // Called with every dispatch time read back when benchmarking
+    void stepTileBenchmark(float dispatchTimeMs);
 
     VkDescriptorSetLayout mGlobalSetLayout;
 
     VkPipelineLayout mBdptPipelineLayout;
-    VkPipeline mBdptPipeline;
+    // Every workgroup renders a square tile of pixels, with one pipeline per tile size. Devices
+    // are only guaranteed 128 invocations per workgroup, so the larger sizes can be missing.
+    static constexpr std::array<uint32_t, 2> kTileSizes = {8, 16};
+    std::array<VkPipeline, kTileSizes.size()> mBdptPipelines{};
+    int mTileSizeIndex{0};
+    // Tonemaps the accumulation image into the frame's canvas
+    VkPipeline mResolvePipeline{VK_NULL_HANDLE};
+
+    // GPU time of the dispatch alone
+    vk::GpuTimer mDispatchTimer;
+    float mDispatchTimeMs{0.f};
+    // See benchmark::Mode::kBdptTiles, one setting per entry of kTileSizes. Readbacks lag a few
+    // frames behind, so the first ones of every tile size are still from the previous one.
+    benchmark::FrameSeries mTileSeries{kTileSizes.size(), 30, 300};
 
     void transferCanvasToSwapchain(DrawCtx &drawCtx);
 
@@ -56,10 +89,45 @@ class BdptRenderer : public Renderer
         VkDescriptorSet globalDescriptor;
         vk::GpuTexture canvasImage;
         vk::AllocatedBuffer rayGenConstantsBuffer;
+        vk::AllocatedBuffer tlasNodeBuffer;
+        vk::AllocatedBuffer instanceBuffer;
+        // Scene::revision the top level buffers were last written for
+        std::optional<uint64_t> sceneRevision;
     };
     std::array<FrameData, constants::kMaxFramesInFlight> mFrames;
 
-    size_t mFrameCount{0};
+    // Every model's bottom level BVH in one set of arrays, which never change
+    vk::AllocatedBuffer mBlasNodeBuffer;
+    vk::AllocatedBuffer mBvhTriangleBuffer;
+    // CPU copy for refitting the top level, which reads the bounds of the bottom levels' roots
+    std::vector<BvhNode> mBlasNodes;
+    TopLevelBvh mTopLevel;
+    // Scene::revision mTopLevel was last built or refitted for
+    uint64_t mTopLevelRevision{0};
+
+    // RGBA32F running average of every sample since the view last changed, shared by all frames
+    // in flight
+    vk::GpuTexture mAccumulationImage;
+    // What the accumulated samples were rendered with, accumulation starts over when it changes
+    struct AccumulationKey
+    {
+        glm::vec3 cameraPosition;
+        glm::vec3 cameraTarget;
+        glm::vec3 cameraUp;
+        uint64_t sceneRevision;
+
+        bool operator==(const AccumulationKey &other) const = default;
+    };
+    std::optional<AccumulationKey> mAccumulationKey;
+    // Samples per pixel in the accumulation image once the recorded frames are done
+    uint32_t mSampleCount{0};
+
+    // Samples taken over the current throughput window
+    std::chrono::steady_clock::time_point mThroughputWindowStart;
+    uint32_t mThroughputWindowSamples{0};
+    float mSamplesPerPixelPerSecond{0.f};
+    // See benchmark::Mode::kBdptThroughput
+    uint32_t mLoggedThroughputWindows{0};
 };
 
 }  // namespace hatgpu
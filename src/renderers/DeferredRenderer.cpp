@@ -0,0 +1,401 @@
+#include "hatpch.h"
+
+#include "DeferredRenderer.h"
+#include "imgui.h"
+#include "vk/initializers.h"
+#include "vk/shader.h"
+
+#include <tracy/Tracy.hpp>
+
+namespace hatgpu
+{
+namespace
+{
+struct LightingPushConstants
+{
+    glm::mat4 inverseViewProj;
+    glm::uvec2 extent;
+};
+
+static constexpr const char *kGBufferShaderName  = "../shaders/bin/deferred/gbuffer.frag.spv";
+static constexpr const char *kLightingShaderName = "../shaders/bin/deferred/lighting.comp.spv";
+static constexpr uint32_t kLightingWorkgroupSize = 8;
+
+static constexpr VkFormat kAlbedoFormat             = VK_FORMAT_R8G8B8A8_UNORM;
+static constexpr VkFormat kNormalFormat             = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+static constexpr VkFormat kMetalnessRoughnessFormat = VK_FORMAT_R8G8_UNORM;
+static constexpr VkFormat kColorFormat              = VK_FORMAT_R8G8B8A8_UNORM;
+
+// Bindings of deferred/lighting.comp past the ones shared with the forward renderer
+static constexpr uint32_t kAlbedoBinding             = 7;
+static constexpr uint32_t kNormalBinding             = 8;
+static constexpr uint32_t kMetalnessRoughnessBinding = 9;
+static constexpr uint32_t kDepthBinding              = 10;
+static constexpr uint32_t kColorBinding              = 11;
+
+VkImageMemoryBarrier imageBarrier(VkImage image,
+                                  VkImageAspectFlags aspect,
+                                  VkImageLayout oldLayout,
+                                  VkImageLayout newLayout,
+                                  VkAccessFlags srcAccess,
+                                  VkAccessFlags dstAccess)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout           = oldLayout;
+    barrier.newLayout           = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image               = image;
+    barrier.srcAccessMask       = srcAccess;
+    barrier.dstAccessMask       = dstAccess;
+    barrier.subresourceRange    = {aspect, 0, 1, 0, 1};
+    return barrier;
+}
+}  // namespace
+
+DeferredRenderer::DeferredRenderer(std::shared_ptr<vk::Ctx> ctx, std::shared_ptr<Scene> scene)
+    : ForwardRenderer("DeferredRenderer", ctx, scene, kGBufferShaderName)
+{}
+
+// The forward renderer's, plus blitting the shaded image to the swapchain. Spelled out since the
+// order statics of different files are initialized in is unspecified.
+const LayerRequirements DeferredRenderer::kRequirements = []() {
+    LayerRequirements result{
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        {VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+         VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME}};
+    result.deviceFeatures.samplerAnisotropy         = VK_TRUE;
+    result.deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+    result.deviceFeatures.multiDrawIndirect         = VK_TRUE;
+    return result;
+}();
+
+void DeferredRenderer::Init()
+{
+    ForwardRenderer::Init();
+    createGBuffer();
+    createLightingPipeline();
+}
+
+void DeferredRenderer::OnImGuiRender()
+{
+    ImGui::Text("You are viewing the deferred renderer.");
+    ImGui::Text("Move around with WASD, LSHIFT and LCTRL");
+    ImGui::Text("Look around with arrow keys. Zoom in/out with mouse wheel");
+    drawControls();
+}
+
+std::vector<VkFormat> DeferredRenderer::colorAttachmentFormats() const
+{
+    return {kAlbedoFormat, kNormalFormat, kMetalnessRoughnessFormat};
+}
+
+std::vector<VkImageView> DeferredRenderer::colorAttachments(const DrawCtx &drawCtx) const
+{
+    const GBuffer &gbuffer = mGBuffers[drawCtx.frameIndex];
+    return {gbuffer.albedo.imageView, gbuffer.normal.imageView,
+            gbuffer.metalnessRoughness.imageView};
+}
+
+void DeferredRenderer::createGBuffer()
+{
+    H_LOG("...creating G-buffer");
+    const VkExtent3D extent{mCtx->swapchainExtent.width, mCtx->swapchainExtent.height, 1};
+    auto createImage = [&](vk::GpuTexture &texture, VkFormat format, VkImageUsageFlags usage) {
+        VkImageCreateInfo imageInfo = vk::imageInfo(format, usage, extent);
+        imageInfo.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VmaAllocationCreateInfo allocationInfo{};
+        allocationInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        H_CHECK(vmaCreateImage(mCtx->allocator.Impl, &imageInfo, &allocationInfo,
+                               &texture.image.image, &texture.image.allocation, nullptr),
+                "Failed to allocate G-buffer image");
+        texture.mipLevels = 1;
+
+        VkImageViewCreateInfo viewInfo =
+            vk::imageViewInfo(format, texture.image.image, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+        H_CHECK(vkCreateImageView(mCtx->device, &viewInfo, nullptr, &texture.imageView),
+                "Failed to create G-buffer image view");
+    };
+
+    for (GBuffer &gbuffer : mGBuffers)
+    {
+        constexpr VkImageUsageFlags kAttachmentUsage =
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        createImage(gbuffer.albedo, kAlbedoFormat, kAttachmentUsage);
+        createImage(gbuffer.normal, kNormalFormat, kAttachmentUsage);
+        createImage(gbuffer.metalnessRoughness, kMetalnessRoughnessFormat, kAttachmentUsage);
+        createImage(gbuffer.color, kColorFormat,
+                    VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    }
+
+    // Only ever read with texelFetch
+    VkSamplerCreateInfo samplerInfo =
+        vk::samplerInfo(VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+    mGBufferSampler = mCtx->samplerCache.get(samplerInfo);
+
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying G-buffer");
+        for (GBuffer &gbuffer : mGBuffers)
+        {
+            for (vk::GpuTexture *texture : {&gbuffer.albedo, &gbuffer.normal,
+                                            &gbuffer.metalnessRoughness, &gbuffer.color})
+            {
+                vkDestroyImageView(mCtx->device, texture->imageView, nullptr);
+                texture->destroy(mCtx->allocator);
+            }
+        }
+    });
+}
+
+void DeferredRenderer::createLightingPipeline()
+{
+    H_LOG("...creating lighting pipeline");
+    const uint32_t frameCount = static_cast<uint32_t>(mGBuffers.size());
+    std::array<VkDescriptorPoolSize, 4> poolSizes = {
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 * frameCount},
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * frameCount},
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4 * frameCount},
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, frameCount}};
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets       = frameCount;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes    = poolSizes.data();
+    H_CHECK(vkCreateDescriptorPool(mCtx->device, &poolInfo, nullptr, &mLightingDescriptorPool),
+            "Failed to create lighting descriptor pool");
+
+    // Bindings 0 to 6 mirror the forward renderer's global set, see shaders/common/shading.glsl
+    auto binding = [](VkDescriptorType type, uint32_t index) {
+        return vk::descriptorSetLayoutBinding(type, VK_SHADER_STAGE_COMPUTE_BIT, index);
+    };
+    std::array<VkDescriptorSetLayoutBinding, 10> bindings = {
+        binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0),
+        binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
+        binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3),
+        binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5),
+        binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6),
+        binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, kAlbedoBinding),
+        binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, kNormalBinding),
+        binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, kMetalnessRoughnessBinding),
+        binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, kDepthBinding),
+        binding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, kColorBinding)};
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = bindings.size();
+    layoutInfo.pBindings    = bindings.data();
+    H_CHECK(vkCreateDescriptorSetLayout(mCtx->device, &layoutInfo, nullptr, &mLightingSetLayout),
+            "Unable to create lighting descriptor set layout");
+
+    for (size_t i = 0; i < mGBuffers.size(); ++i)
+    {
+        GBuffer &gbuffer = mGBuffers[i];
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool     = mLightingDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts        = &mLightingSetLayout;
+        H_CHECK(vkAllocateDescriptorSets(mCtx->device, &allocInfo, &gbuffer.lightingDescriptor),
+                "Unable to allocate lighting descriptor set");
+
+        // The depth image is only known once drawing, see shadeGBuffer()
+        const ShadingBuffers buffers = shadingBuffers(i);
+        std::array<VkDescriptorBufferInfo, 5> bufferInfos = {
+            VkDescriptorBufferInfo{buffers.camera, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{buffers.dirLight, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{buffers.pointLights, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{buffers.clusterGrid, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{buffers.clusterLights, 0, VK_WHOLE_SIZE}};
+        std::array<VkDescriptorImageInfo, 4> imageInfos = {
+            VkDescriptorImageInfo{mGBufferSampler, gbuffer.albedo.imageView,
+                                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            VkDescriptorImageInfo{mGBufferSampler, gbuffer.normal.imageView,
+                                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            VkDescriptorImageInfo{mGBufferSampler, gbuffer.metalnessRoughness.imageView,
+                                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            VkDescriptorImageInfo{VK_NULL_HANDLE, gbuffer.color.imageView,
+                                  VK_IMAGE_LAYOUT_GENERAL}};
+
+        VkDescriptorSet set = gbuffer.lightingDescriptor;
+        std::array<VkWriteDescriptorSet, 9> writes = {
+            vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, set, &bufferInfos[0], 0),
+            vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, set, &bufferInfos[1], 2),
+            vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, set, &bufferInfos[2], 3),
+            vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, set, &bufferInfos[3], 5),
+            vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, set, &bufferInfos[4], 6),
+            vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set,
+                                     &imageInfos[0], kAlbedoBinding),
+            vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set,
+                                     &imageInfos[1], kNormalBinding),
+            vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set,
+                                     &imageInfos[2], kMetalnessRoughnessBinding),
+            vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, set, &imageInfos[3],
+                                     kColorBinding)};
+        vkUpdateDescriptorSets(mCtx->device, writes.size(), writes.data(), 0, nullptr);
+    }
+
+    VkPushConstantRange pushConstant{};
+    pushConstant.size       = sizeof(LightingPushConstants);
+    pushConstant.offset     = 0;
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = vk::pipelineLayoutInfo();
+    pipelineLayoutInfo.setLayoutCount             = 1;
+    pipelineLayoutInfo.pSetLayouts                = &mLightingSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount     = 1;
+    pipelineLayoutInfo.pPushConstantRanges        = &pushConstant;
+    H_CHECK(vkCreatePipelineLayout(mCtx->device, &pipelineLayoutInfo, nullptr,
+                                   &mLightingPipelineLayout),
+            "Failed to create lighting pipeline layout");
+
+    VkPipelineShaderStageCreateInfo stageInfo =
+        vk::createShaderStage(mCtx->device, kLightingShaderName, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.layout = mLightingPipelineLayout;
+    pipelineInfo.stage  = stageInfo;
+    H_CHECK(vkCreateComputePipelines(mCtx->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+                                     &mLightingPipeline),
+            "Failed to create lighting pipeline");
+
+    vkDestroyShaderModule(mCtx->device, stageInfo.module, nullptr);
+
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying lighting pipeline");
+        vkDestroyPipeline(mCtx->device, mLightingPipeline, nullptr);
+        vkDestroyPipelineLayout(mCtx->device, mLightingPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(mCtx->device, mLightingSetLayout, nullptr);
+        vkDestroyDescriptorPool(mCtx->device, mLightingDescriptorPool, nullptr);
+    });
+}
+
+void DeferredRenderer::prepareGBuffer(DrawCtx &drawCtx)
+{
+    // Last frame's contents are cleared anyway, but its lighting pass has to be done reading them
+    const GBuffer &gbuffer = mGBuffers[drawCtx.frameIndex];
+    std::array<VkImageMemoryBarrier, 3> barriers;
+    const std::array<VkImage, 3> images = {gbuffer.albedo.image.image, gbuffer.normal.image.image,
+                                           gbuffer.metalnessRoughness.image.image};
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        barriers[i] = imageBarrier(
+            images[i], VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL, VK_ACCESS_NONE,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+    }
+    vkCmdPipelineBarrier(drawCtx.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0, nullptr,
+                         barriers.size(), barriers.data());
+}
+
+void DeferredRenderer::shadeGBuffer(DrawCtx &drawCtx)
+{
+    VkZoneC("shadeGBuffer", tracy::Color::Blue);
+    GBuffer &gbuffer    = mGBuffers[drawCtx.frameIndex];
+    VkCommandBuffer cmd = drawCtx.commandBuffer;
+
+    if (gbuffer.depthView != drawCtx.depthImageView)
+    {
+        VkDescriptorImageInfo depthInfo{mGBufferSampler, drawCtx.depthImageView,
+                                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        VkWriteDescriptorSet write =
+            vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                     gbuffer.lightingDescriptor, &depthInfo, kDepthBinding);
+        vkUpdateDescriptorSets(mCtx->device, 1, &write, 0, nullptr);
+        gbuffer.depthView = drawCtx.depthImageView;
+    }
+
+    std::array<VkImageMemoryBarrier, 5> barriers;
+    const std::array<VkImage, 3> images = {gbuffer.albedo.image.image, gbuffer.normal.image.image,
+                                           gbuffer.metalnessRoughness.image.image};
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        barriers[i] = imageBarrier(images[i], VK_IMAGE_ASPECT_COLOR_BIT,
+                                   VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+                                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                   VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+    barriers[3] = imageBarrier(drawCtx.depthImage, VK_IMAGE_ASPECT_DEPTH_BIT,
+                               VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                               VK_ACCESS_SHADER_READ_BIT);
+    // Last frame's copy to the swapchain has to be done reading it
+    barriers[4] = imageBarrier(gbuffer.color.image.image, VK_IMAGE_ASPECT_COLOR_BIT,
+                               VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_ACCESS_NONE,
+                               VK_ACCESS_SHADER_WRITE_BIT);
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                             VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+                         barriers.size(), barriers.data());
+
+    const VkExtent2D extent = mCtx->swapchainExtent;
+    LightingPushConstants constants{};
+    constants.inverseViewProj = glm::inverse(mScene->camera.GetProjectionMatrix() *
+                                             mScene->camera.GetViewMatrix());
+    constants.extent          = glm::uvec2(extent.width, extent.height);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mLightingPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mLightingPipelineLayout, 0, 1,
+                            &gbuffer.lightingDescriptor, 0, nullptr);
+    vkCmdPushConstants(cmd, mLightingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(LightingPushConstants), &constants);
+    vkCmdDispatch(cmd, (extent.width + kLightingWorkgroupSize - 1) / kLightingWorkgroupSize,
+                  (extent.height + kLightingWorkgroupSize - 1) / kLightingWorkgroupSize, 1);
+}
+
+void DeferredRenderer::copyToSwapchain(DrawCtx &drawCtx)
+{
+    VkZoneC("copyToSwapchain", tracy::Color::Blue);
+    const GBuffer &gbuffer = mGBuffers[drawCtx.frameIndex];
+    VkCommandBuffer cmd    = drawCtx.commandBuffer;
+
+    std::array<VkImageMemoryBarrier, 2> barriers = {
+        imageBarrier(gbuffer.color.image.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_SHADER_WRITE_BIT,
+                     VK_ACCESS_TRANSFER_READ_BIT),
+        imageBarrier(drawCtx.swapchainImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,
+                     VK_ACCESS_TRANSFER_WRITE_BIT)};
+    vkCmdPipelineBarrier(
+        cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, barriers.size(),
+        barriers.data());
+
+    // A blit rather than a copy, since the swapchain's format can differ in channel order
+    const VkExtent2D extent = mCtx->swapchainExtent;
+    VkImageBlit region{};
+    region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.srcOffsets[1]  = {static_cast<int32_t>(extent.width),
+                             static_cast<int32_t>(extent.height), 1};
+    region.dstSubresource = region.srcSubresource;
+    region.dstOffsets[1]  = region.srcOffsets[1];
+    vkCmdBlitImage(cmd, gbuffer.color.image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   drawCtx.swapchainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region,
+                   VK_FILTER_NEAREST);
+
+    // Overlays and ImGui draw on top
+    VkImageMemoryBarrier presentBarrier = imageBarrier(
+        drawCtx.swapchainImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0, nullptr,
+                         1, &presentBarrier);
+}
+
+void DeferredRenderer::recordCommandBuffer(DrawCtx &drawCtx)
+{
+    ZoneScopedC(tracy::Color::PeachPuff);
+
+    prepareGBuffer(drawCtx);
+    ForwardRenderer::recordCommandBuffer(drawCtx);
+    shadeGBuffer(drawCtx);
+    copyToSwapchain(drawCtx);
+}
+}  // namespace hatgpu
@@ -0,0 +1,58 @@
+#ifndef _INCLUDE_DEFERREDRENDERER_H
+#define _INCLUDE_DEFERREDRENDERER_H
+#include "hatpch.h"
+
+#include "application/Constants.h"
+#include "renderers/ForwardRenderer.h"
+#include "vk/gpu_texture.h"
+
+namespace hatgpu
+{
+// Draws the scene like the forward renderer, culling included, but into a G-buffer of albedo,
+// normals, metalness/roughness and depth. A compute pass then shades every pixel once with the
+// same clustered lights, so shading no longer pays for overdraw.
+class DeferredRenderer : public ForwardRenderer
+{
+  public:
+    DeferredRenderer(std::shared_ptr<vk::Ctx> ctx, std::shared_ptr<Scene> scene);
+
+    void Init() override;
+    void OnImGuiRender() override;
+
+    static const LayerRequirements kRequirements;
+
+  protected:
+    std::vector<VkFormat> colorAttachmentFormats() const override;
+    std::vector<VkImageView> colorAttachments(const DrawCtx &drawCtx) const override;
+    void recordCommandBuffer(DrawCtx &drawCtx) override;
+
+  private:
+    void createGBuffer();
+    void createLightingPipeline();
+
+    void prepareGBuffer(DrawCtx &drawCtx);
+    void shadeGBuffer(DrawCtx &drawCtx);
+    void copyToSwapchain(DrawCtx &drawCtx);
+
+    VkDescriptorPool mLightingDescriptorPool;
+    VkDescriptorSetLayout mLightingSetLayout;
+    VkPipelineLayout mLightingPipelineLayout;
+    VkPipeline mLightingPipeline;
+    VkSampler mGBufferSampler;
+
+    struct GBuffer
+    {
+        vk::GpuTexture albedo;
+        vk::GpuTexture normal;
+        vk::GpuTexture metalnessRoughness;
+        // Shaded result, copied to the swapchain
+        vk::GpuTexture color;
+        VkDescriptorSet lightingDescriptor;
+        // The depth image view the descriptor was last written with
+        VkImageView depthView{VK_NULL_HANDLE};
+    };
+    std::array<GBuffer, constants::kMaxFramesInFlight> mGBuffers;
+};
+}  // namespace hatgpu
+
+#endif
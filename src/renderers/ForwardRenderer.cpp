@@ -1,28 +1,29 @@
 #include "hatpch.h"
 
 #include "ForwardRenderer.h"
+#include "geometry/Frustum.h"
 #include "imgui.h"
 #include "texture/Texture.h"
+#include "util/Benchmark.h"
 #include "util/Random.h"
 #include "vk/initializers.h"
 #include "vk/shader.h"
 
 #include <tracy/Tracy.hpp>
 
+#include <chrono>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <numeric>
+#include <span>
 #include <stdexcept>
 
 namespace hatgpu
 {
 namespace
 {
-struct MeshPushConstants
-{
-    glm::mat4x4 renderMatrix;
-};
-
 struct GpuCameraData
 {
     glm::mat4 view;
@@ -38,6 +39,7 @@ struct GpuObjectData
 
 struct GpuPointLight
 {
+    // w is the radius
     glm::vec4 position;
     glm::vec4 color;
 };
@@ -48,19 +50,112 @@ struct GpuDirLight
     glm::vec4 color;
 };
 
+// Per unique mesh data read by the culling shaders, and by the vertex shaders to dequantize packed
+// vertex positions and to pick the draw's material
+struct GpuDrawRecord
+{
+    glm::vec4 boundsMin;
+    glm::vec4 boundsMax;
+    uint32_t instanceBase;
+    uint32_t materialIndex;
+    uint32_t padding[2];
+};
+
+// Comes before the records in the same buffer, see shaders/forward/draws.glsl
+struct GpuDrawListHeader
+{
+    std::array<uint32_t, kDrawBucketCount> bucketStarts;
+};
+static_assert(sizeof(GpuDrawListHeader) % alignof(glm::vec4) == 0,
+              "The records after the header have to stay 16 byte aligned");
+
+// One per (renderable, mesh) pair
+struct GpuCullItem
+{
+    uint32_t objectIndex;
+    uint32_t drawIndex;
+};
+
+struct CullPushConstants
+{
+    std::array<glm::vec4, Frustum::kPlaneCount> frustumPlanes;
+    uint32_t itemCount;
+    // Only draw what was visible last frame
+    uint32_t occlusionCulling;
+};
+
+struct OcclusionPushConstants
+{
+    std::array<glm::vec4, Frustum::kPlaneCount> frustumPlanes;
+    glm::vec2 pyramidSize;
+    uint32_t itemCount;
+    // Whether the first phase was culled on the CPU, which then says what it drew
+    uint32_t firstPhaseFromCpu;
+};
+
+struct CompactPushConstants
+{
+    uint32_t drawCount;
+};
+
+// Specialization constants of the vertex shaders
+struct DrawSpecialization
+{
+    VkBool32 packedVertices;
+    uint32_t drawBucket;
+};
+
+size_t drawBucket(VertexFormat vertexFormat, VkIndexType indexType)
+{
+    return static_cast<size_t>(vertexFormat) * 2 + (indexType == VK_INDEX_TYPE_UINT32 ? 1 : 0);
+}
+
+VertexFormat bucketVertexFormat(size_t bucket)
+{
+    return static_cast<VertexFormat>(bucket / 2);
+}
+
+VkIndexType bucketIndexType(size_t bucket)
+{
+    return bucket % 2 == 1 ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+}
+
 static constexpr const char *kVertexShaderName   = "../shaders/bin/forward/shader.vert.spv";
 static constexpr const char *kFragmentShaderName = "../shaders/bin/forward/shader.frag.spv";
+static constexpr const char *kDepthShaderName    = "../shaders/bin/forward/depth.vert.spv";
+static constexpr const char *kCullShaderName     = "../shaders/bin/forward/cull.comp.spv";
+static constexpr const char *kOcclusionShaderName = "../shaders/bin/forward/occlusion.comp.spv";
+static constexpr const char *kCompactShaderName = "../shaders/bin/forward/compact_draws.comp.spv";
+static constexpr uint32_t kCullWorkgroupSize      = 64;
+// Upper bound of the bindless texture array unless the device's is lower, only as many as the
+// scene has get allocated
+static constexpr uint32_t kMaxBindlessTextures = 4096;
+static constexpr uint32_t kNoTexture           = ~0u;
 }  // namespace
 
 ForwardRenderer::ForwardRenderer(std::shared_ptr<vk::Ctx> ctx, std::shared_ptr<Scene> scene)
-    : Renderer("ForwardRenderer", ctx, scene)
+    : ForwardRenderer("ForwardRenderer", ctx, scene, kFragmentShaderName)
+{}
+
+ForwardRenderer::ForwardRenderer(const std::string &debugName,
+                                 std::shared_ptr<vk::Ctx> ctx,
+                                 std::shared_ptr<Scene> scene,
+                                 const char *fragmentShaderName)
+    : Renderer(debugName, ctx, scene),
+      mFragmentShaderName(fragmentShaderName),
+      mGpuTimePlotName(debugName + " GPU time (ms)")
 {}
 
 const LayerRequirements ForwardRenderer::kRequirements = []() {
     LayerRequirements result{
         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-        {VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME}};
+        {VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+         VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME}};
     result.deviceFeatures.samplerAnisotropy = VK_TRUE;
+    // Indirect draws start at their mesh's range of the instance list
+    result.deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+    // And there are many of them per call
+    result.deviceFeatures.multiDrawIndirect = VK_TRUE;
     return result;
 }();
 
@@ -68,14 +163,48 @@ void ForwardRenderer::Init()
 {
     createDescriptors();
     createGraphicsPipeline();
+    createCullingPipeline();
+    createOcclusionPipeline();
+    createCompactionPipeline();
+    if (benchmark::enabled(benchmark::Mode::kSceneUpload))
+    {
+        benchmarkSceneUpload();
+    }
     uploadSceneToGpu();
+
+    mGpuTimer = vk::GpuTimer(mCtx->device, mCtx->gpuProperties, constants::kMaxFramesInFlight);
+    mDeleter.enqueue([this]() { mGpuTimer.destroy(); });
+
+    if (benchmark::enabled(benchmark::Mode::kFrustumCulling))
+    {
+        frustum_culling::benchmark();
+        benchmark::finish();
+    }
 }
 
 void ForwardRenderer::OnDetach() {}
 
 void ForwardRenderer::OnRender(DrawCtx &drawCtx)
 {
+    // Report when the GPU has actually finished the scene upload, polled so that we never block
+    if (mSceneUploadTicket != 0 && mCtx->uploadContext.isComplete(mSceneUploadTicket))
+    {
+        LOGGER.info("Scene upload: GPU finished after {:.2f}ms",
+                    std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                             mSceneUploadStart)
+                        .count());
+        mSceneUploadTicket = 0;
+    }
+
+    if (std::optional<float> gpuTime = mGpuTimer.read(drawCtx.frameIndex); gpuTime.has_value())
+    {
+        mGpuTimeMs = mGpuTimeMs == 0.f ? *gpuTime : mGpuTimeMs * 0.95f + *gpuTime * 0.05f;
+        TracyPlot(mGpuTimePlotName.c_str(), *gpuTime);
+    }
+
+    mGpuTimer.begin(drawCtx.commandBuffer, drawCtx.frameIndex);
     recordCommandBuffer(drawCtx);
+    mGpuTimer.end(drawCtx.commandBuffer, drawCtx.frameIndex);
     ++mFrameCount;
 }
 
@@ -84,20 +213,88 @@ void ForwardRenderer::OnImGuiRender()
     ImGui::Text("You are viewing the forward renderer.");
     ImGui::Text("Move around with WASD, LSHIFT and LCTRL");
     ImGui::Text("Look around with arrow keys. Zoom in/out with mouse wheel");
+    drawControls();
+}
+
+void ForwardRenderer::drawControls()
+{
+    ImGui::Text("GPU time: %.2f ms", mGpuTimeMs);
+    if (std::optional<bool> toggled = mGpuDrivenToggle.Draw("GPU culling"); toggled.has_value())
+    {
+        mGpuDriven = *toggled;
+    }
+    if (!mGpuDriven)
+    {
+        if (std::optional<bool> toggled = mCpuCullingToggle.Draw("CPU frustum culling");
+            toggled.has_value())
+        {
+            mCpuCulling = *toggled;
+        }
+    }
+    ImGui::Text("%s: %zu draws over %u instances", mGpuDriven ? "GPU culled" : "CPU driven",
+                mDraws.size(), mCullItemCount);
+    if (!mGpuDriven && mCpuCulling)
+    {
+        ImGui::Text("%zu / %u instances visible (%s, %zu wide)", mVisibleItems.size(),
+                    mCullItemCount, frustum_culling::simdName(), frustum_culling::batchSize());
+    }
+    if (std::optional<bool> toggled = mDepthPrepassToggle.Draw("Depth pre-pass");
+        toggled.has_value())
+    {
+        mDepthPrepass = *toggled;
+    }
+    if (std::optional<bool> toggled = mClusteredLightingToggle.Draw("Clustered lighting");
+        toggled.has_value())
+    {
+        mClusteredLighting = *toggled;
+    }
+    ImGui::Text("%zu point lights, %ux%ux%u clusters of up to %u", mScene->pointLights.size(),
+                vk::LightClusters::kGridX, vk::LightClusters::kGridY, vk::LightClusters::kGridZ,
+                vk::LightClusters::kMaxLightsPerCluster);
+    if (std::optional<bool> toggled = mOcclusionCullingToggle.Draw("Occlusion culling");
+        toggled.has_value())
+    {
+        mOcclusionCulling = *toggled;
+    }
+    if (mOcclusionCulling)
+    {
+        ImGui::Text("Drawn %u + %u, occluded %u, outside the frustum %u",
+                    mOcclusionStats.firstPhaseInstances, mOcclusionStats.secondPhaseInstances,
+                    mOcclusionStats.occludedInstances, mOcclusionStats.frustumCulledInstances);
+    }
+
+    if (ImGui::CollapsingHeader("Geometry arena"))
+    {
+        const auto showStats = [](const char *name, const vk::RangeAllocator::Stats &stats) {
+            constexpr float kMegabyte = 1024.f * 1024.f;
+            ImGui::Text("%s: %.2f / %.2f MB used by %zu meshes", name,
+                        (stats.capacity - stats.freeBytes) / kMegabyte, stats.capacity / kMegabyte,
+                        stats.allocationCount);
+            ImGui::Text("  %.2f MB free in %zu blocks, largest %.2f MB, %.1f%% fragmented",
+                        stats.freeBytes / kMegabyte, stats.freeBlockCount,
+                        stats.largestFreeBlock / kMegabyte, stats.fragmentation() * 100.f);
+        };
+        showStats("Vertices", mGeometryArena.vertexStats());
+        showStats("Indices", mGeometryArena.indexStats());
+    }
 }
 
 void ForwardRenderer::createDescriptors()
 {
     H_LOG("...creating descriptors");
-    std::vector<VkDescriptorPoolSize> sizes = {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
-                                               {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 190},
-                                               {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10}};
+    // Every frame has three global sets, a culling and an occlusion culling set and two draw
+    // compaction sets, and all frames share the material set
+    constexpr uint32_t kFrames             = constants::kMaxFramesInFlight;
+    std::vector<VkDescriptorPoolSize> sizes = {
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 * kFrames},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, kMaxBindlessTextures + kFrames},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 48 * kFrames + 1}};
 
     // Creating the descriptor pool
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.flags         = 0;
-    poolInfo.maxSets       = 300;
+    poolInfo.maxSets       = 7 * kFrames + 1;
     poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
     poolInfo.pPoolSizes    = sizes.data();
 
@@ -114,9 +311,23 @@ void ForwardRenderer::createDescriptors()
         VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 2);
     VkDescriptorSetLayoutBinding lightBufferBinding = vk::descriptorSetLayoutBinding(
         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 3);
-
-    std::array<VkDescriptorSetLayoutBinding, 4> layoutBindings = {
-        cameraBufferBinding, objectBufferBinding, dirLightBufferBinding, lightBufferBinding};
+    // Only written once the scene is uploaded, see createDrawList()
+    VkDescriptorSetLayoutBinding instanceBufferBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 4);
+    VkDescriptorSetLayoutBinding clusterGridBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 5);
+    VkDescriptorSetLayoutBinding clusterLightsBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 6);
+    // Also written in createDrawList(), the draw records and the draw ids of the compacted draws
+    VkDescriptorSetLayoutBinding drawRecordBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 7);
+    VkDescriptorSetLayoutBinding drawIdBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 8);
+
+    std::array<VkDescriptorSetLayoutBinding, 9> layoutBindings = {
+        cameraBufferBinding,  objectBufferBinding,   dirLightBufferBinding,
+        lightBufferBinding,   instanceBufferBinding, clusterGridBinding,
+        clusterLightsBinding, drawRecordBinding,     drawIdBinding};
 
     VkDescriptorSetLayoutCreateInfo globalCreateInfo{};
     globalCreateInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -129,26 +340,34 @@ void ForwardRenderer::createDescriptors()
         vkCreateDescriptorSetLayout(mCtx->device, &globalCreateInfo, nullptr, &mGlobalSetLayout),
         "Unable to create global descriptor set layout");
 
+    mLightClusters =
+        vk::LightClusters(mCtx->device, mCtx->allocator, constants::kMaxFramesInFlight);
+
     for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
     {
         constexpr int kMaxObjects = 10000;
-        mFrames[i].objectBuffer = mCtx->allocator.createBuffer(sizeof(GpuObjectData) * kMaxObjects,
-                                                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                                               VMA_MEMORY_USAGE_CPU_TO_GPU);
-        mFrames[i].cameraBuffer = mCtx->allocator.createBuffer(
-            sizeof(GpuCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-        mFrames[i].dirLightBuffer = mCtx->allocator.createBuffer(
-            sizeof(GpuDirLight), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-        // Create this descriptor set
+        mFrames[i].objectBuffer = mCtx->allocator.createMappedBuffer(
+            sizeof(GpuObjectData) * kMaxObjects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        mFrames[i].cameraBuffer = mCtx->allocator.createMappedBuffer(
+            sizeof(GpuCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        mFrames[i].dirLightBuffer = mCtx->allocator.createMappedBuffer(
+            sizeof(GpuDirLight), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+
+        // Create this frame's descriptor sets, one per drawing mode
+        std::array<VkDescriptorSetLayout, 3> globalLayouts = {mGlobalSetLayout, mGlobalSetLayout,
+                                                              mGlobalSetLayout};
+        std::array<VkDescriptorSet, 3> globalSets;
         VkDescriptorSetAllocateInfo allocInfo{};
         allocInfo.pNext              = nullptr;
         allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         allocInfo.descriptorPool     = mDescriptorPool;
-        allocInfo.descriptorSetCount = 1;
-        allocInfo.pSetLayouts        = &mGlobalSetLayout;
+        allocInfo.descriptorSetCount = globalLayouts.size();
+        allocInfo.pSetLayouts        = globalLayouts.data();
 
-        vkAllocateDescriptorSets(mCtx->device, &allocInfo, &mFrames[i].globalDescriptor);
+        vkAllocateDescriptorSets(mCtx->device, &allocInfo, globalSets.data());
+        mFrames[i].globalDescriptor       = globalSets[0];
+        mFrames[i].culledGlobalDescriptor    = globalSets[1];
+        mFrames[i].occlusionGlobalDescriptor = globalSets[2];
 
         // Use GpuCameraData for the first binding
         VkDescriptorBufferInfo cameraBufferInfo{};
@@ -179,8 +398,8 @@ void ForwardRenderer::createDescriptors()
 
         const size_t kLightBufferSize =
             sizeof(GpuPointLight) * std::max(static_cast<size_t>(1), mScene->pointLights.size());
-        mFrames[i].lightBuffer = mCtx->allocator.createBuffer(
-            kLightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        mFrames[i].lightBuffer = mCtx->allocator.createMappedBuffer(
+            kLightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
         // Write the light buffer info
         VkDescriptorBufferInfo lightBufferInfo{};
@@ -191,33 +410,84 @@ void ForwardRenderer::createDescriptors()
         VkWriteDescriptorSet lightSetWrite = vk::writeDescriptorBuffer(
             VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, mFrames[i].globalDescriptor, &lightBufferInfo, 3);
 
-        std::array<VkWriteDescriptorSet, 4> writes = {cameraSetWrite, objSetWrite, dirLightSetWrite,
-                                                      lightSetWrite};
+        // The light clusters bin this frame's lights and hand their lists to the fragment shader
+        mLightClusters.setSources(i, mFrames[i].cameraBuffer.buffer, mFrames[i].lightBuffer.buffer);
+
+        VkDescriptorBufferInfo clusterGridInfo{};
+        clusterGridInfo.buffer = mLightClusters.gridBuffer(i);
+        clusterGridInfo.offset = 0;
+        clusterGridInfo.range  = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet clusterGridWrite = vk::writeDescriptorBuffer(
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, mFrames[i].globalDescriptor, &clusterGridInfo, 5);
+
+        VkDescriptorBufferInfo clusterLightsInfo{};
+        clusterLightsInfo.buffer = mLightClusters.lightListBuffer(i);
+        clusterLightsInfo.offset = 0;
+        clusterLightsInfo.range  = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet clusterLightsWrite = vk::writeDescriptorBuffer(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, mFrames[i].globalDescriptor, &clusterLightsInfo, 6);
+
+        std::array<VkWriteDescriptorSet, 6> writes = {cameraSetWrite,   objSetWrite,
+                                                      dirLightSetWrite, lightSetWrite,
+                                                      clusterGridWrite, clusterLightsWrite};
 
         vkUpdateDescriptorSets(mCtx->device, writes.size(), writes.data(), 0, nullptr);
+
+        // All sets share everything but the instance list and draw ids
+        for (VkDescriptorSet set :
+             {mFrames[i].culledGlobalDescriptor, mFrames[i].occlusionGlobalDescriptor})
+        {
+            for (VkWriteDescriptorSet &write : writes)
+            {
+                write.dstSet = set;
+            }
+            vkUpdateDescriptorSets(mCtx->device, writes.size(), writes.data(), 0, nullptr);
+        }
     }
 
-    VkDescriptorSetLayoutBinding albedoBinding = vk::descriptorSetLayoutBinding(
-        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0);
-    VkDescriptorSetLayoutBinding metallicRoughnessBinding = vk::descriptorSetLayoutBinding(
+    // The material set, bound once for every draw: all of the scene's textures in one array,
+    // and the material buffer indexing into it. The array is sized when the set is allocated, and
+    // slots past the last texture are never written. Only the last binding can vary in size.
+    VkDescriptorSetLayoutBinding materialsBinding = vk::descriptorSetLayoutBinding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 0);
+    VkDescriptorSetLayoutBinding texturesBinding = vk::descriptorSetLayoutBinding(
         VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1);
-    std::array<VkDescriptorSetLayoutBinding, 2> textureBindings = {albedoBinding,
-                                                                   metallicRoughnessBinding};
-
-    VkDescriptorSetLayoutCreateInfo textureLayoutInfo{};
-    textureLayoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    textureLayoutInfo.pNext        = nullptr;
-    textureLayoutInfo.bindingCount = textureBindings.size();
-    textureLayoutInfo.pBindings    = textureBindings.data();
-    textureLayoutInfo.flags        = 0;
-
-    vkCreateDescriptorSetLayout(mCtx->device, &textureLayoutInfo, nullptr, &mTextureSetLayout);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(mCtx->physicalDevice, &properties);
+    mMaxBindlessTextures = std::min({kMaxBindlessTextures,
+                                     properties.limits.maxPerStageDescriptorSamplers,
+                                     properties.limits.maxPerStageDescriptorSampledImages});
+    texturesBinding.descriptorCount = mMaxBindlessTextures;
+    std::array<VkDescriptorSetLayoutBinding, 2> materialBindings = {materialsBinding,
+                                                                    texturesBinding};
+    std::array<VkDescriptorBindingFlags, 2> materialBindingFlags = {
+        0, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+               VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT};
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount  = materialBindingFlags.size();
+    bindingFlagsInfo.pBindingFlags = materialBindingFlags.data();
+
+    VkDescriptorSetLayoutCreateInfo materialLayoutInfo{};
+    materialLayoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    materialLayoutInfo.pNext        = &bindingFlagsInfo;
+    materialLayoutInfo.bindingCount = materialBindings.size();
+    materialLayoutInfo.pBindings    = materialBindings.data();
+    materialLayoutInfo.flags        = 0;
+
+    H_CHECK(vkCreateDescriptorSetLayout(mCtx->device, &materialLayoutInfo, nullptr,
+                                        &mMaterialSetLayout),
+            "Unable to create material descriptor set layout");
 
     mDeleter.enqueue([this]() {
         H_LOG("...destroying descriptor sets");
         vkDestroyDescriptorSetLayout(mCtx->device, mGlobalSetLayout, nullptr);
-        vkDestroyDescriptorSetLayout(mCtx->device, mTextureSetLayout, nullptr);
+        vkDestroyDescriptorSetLayout(mCtx->device, mMaterialSetLayout, nullptr);
         vkDestroyDescriptorPool(mCtx->device, mDescriptorPool, nullptr);
+        mLightClusters.destroy(mCtx->allocator);
 
         H_LOG("...destroying buffers");
         for (size_t i = 0; i < constants::kMaxFramesInFlight; ++i)
@@ -236,20 +506,9 @@ void ForwardRenderer::createGraphicsPipeline()
 
     std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {
         vk::createShaderStage(mCtx->device, kVertexShaderName, VK_SHADER_STAGE_VERTEX_BIT),
-        vk::createShaderStage(mCtx->device, kFragmentShaderName, VK_SHADER_STAGE_FRAGMENT_BIT),
+        vk::createShaderStage(mCtx->device, mFragmentShaderName, VK_SHADER_STAGE_FRAGMENT_BIT),
     };
 
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo = vk::vertexInputInfo();
-
-    auto bindingDescription    = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
-
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions    = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount =
-        static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = vk::inputAssemblyInfo();
 
     VkViewport viewport{};
@@ -283,16 +542,20 @@ void ForwardRenderer::createGraphicsPipeline()
     colorBlendAttachment.dstAlphaBlendFactor                 = VK_BLEND_FACTOR_ZERO;
     colorBlendAttachment.alphaBlendOp                        = VK_BLEND_OP_ADD;
 
+    const std::vector<VkFormat> colorFormats = colorAttachmentFormats();
+    std::vector<VkPipelineColorBlendAttachmentState> blendAttachments(
+        colorFormats.size(), vk::colorBlendAttachmentState());
+    blendAttachments.front() = colorBlendAttachment;
+
     VkPipelineColorBlendStateCreateInfo colorBlending{};
     colorBlending.sType           = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     colorBlending.logicOpEnable   = VK_FALSE;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments    = &colorBlendAttachment;
+    colorBlending.attachmentCount = static_cast<uint32_t>(blendAttachments.size());
+    colorBlending.pAttachments    = blendAttachments.data();
 
+    // No push constants, everything a draw needs is found through its draw id
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vk::pipelineLayoutInfo();
-    pipelineLayoutCreateInfo.pushConstantRangeCount     = 0;
-    pipelineLayoutCreateInfo.pPushConstantRanges        = nullptr;
-    std::array<VkDescriptorSetLayout, 2> layouts        = {mGlobalSetLayout, mTextureSetLayout};
+    std::array<VkDescriptorSetLayout, 2> layouts        = {mGlobalSetLayout, mMaterialSetLayout};
     pipelineLayoutCreateInfo.setLayoutCount             = layouts.size();
     pipelineLayoutCreateInfo.pSetLayouts                = layouts.data();
 
@@ -313,11 +576,8 @@ void ForwardRenderer::createGraphicsPipeline()
     dynamicState.pDynamicStates    = dynamicStates.data();
 
     VkGraphicsPipelineCreateInfo pipelineInfo{};
-    pipelineInfo.sType      = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = shaderStages.size();
-    pipelineInfo.pStages    = shaderStages.data();
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 
-    pipelineInfo.pVertexInputState   = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
     pipelineInfo.pViewportState      = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
@@ -333,105 +593,477 @@ void ForwardRenderer::createGraphicsPipeline()
     VkPipelineRenderingCreateInfo pipelineCreateRenderingInfo{};
     pipelineCreateRenderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
     pipelineCreateRenderingInfo.pNext = nullptr;
-    pipelineCreateRenderingInfo.colorAttachmentCount    = 1;
-    pipelineCreateRenderingInfo.pColorAttachmentFormats = &mCtx->swapchainImageFormat;
+    pipelineCreateRenderingInfo.colorAttachmentCount =
+        static_cast<uint32_t>(colorFormats.size());
+    pipelineCreateRenderingInfo.pColorAttachmentFormats = colorFormats.data();
     pipelineCreateRenderingInfo.depthAttachmentFormat   = constants::kDepthFormat;
 
     pipelineInfo.pNext = &pipelineCreateRenderingInfo;
 
-    H_CHECK(vkCreateGraphicsPipelines(mCtx->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
-                                      &mGraphicsPipeline),
-            "Failed to create graphics pipeline");
+    // The variants only differ in their vertex input and in the vertex shader's specialization
+    // constants: whether vertices are packed, and the bucket to look the draw ids up in
+    const auto bindingDescriptions =
+        std::array{Vertex::getBindingDescription(), PackedVertex::getBindingDescription()};
+    const auto fullAttributes   = Vertex::getAttributeDescriptions();
+    const auto packedAttributes = PackedVertex::getAttributeDescriptions();
+    const std::array<VkSpecializationMapEntry, 2> specializationEntries = {
+        VkSpecializationMapEntry{0, offsetof(DrawSpecialization, packedVertices), sizeof(VkBool32)},
+        VkSpecializationMapEntry{1, offsetof(DrawSpecialization, drawBucket), sizeof(uint32_t)}};
+
+    // `attributeCount` cuts the attributes short, the depth pre-pass only reads positions
+    auto createVariants = [&](std::array<VkPipeline, kDrawBucketCount> &pipelines,
+                              std::span<const VkPipelineShaderStageCreateInfo> stages,
+                              std::optional<uint32_t> attributeCount, const char *errorMessage) {
+        for (size_t bucket = 0; bucket < kDrawBucketCount; ++bucket)
+        {
+            const VertexFormat format = bucketVertexFormat(bucket);
+            const bool packed         = format == VertexFormat::kPacked;
+
+            VkPipelineVertexInputStateCreateInfo vertexInputInfo = vk::vertexInputInfo();
+            vertexInputInfo.vertexBindingDescriptionCount        = 1;
+            vertexInputInfo.pVertexBindingDescriptions =
+                &bindingDescriptions[static_cast<size_t>(format)];
+            vertexInputInfo.vertexAttributeDescriptionCount = attributeCount.value_or(
+                static_cast<uint32_t>(packed ? packedAttributes.size() : fullAttributes.size()));
+            vertexInputInfo.pVertexAttributeDescriptions =
+                packed ? packedAttributes.data() : fullAttributes.data();
+
+            const DrawSpecialization specialization{packed ? VK_TRUE : VK_FALSE,
+                                                    static_cast<uint32_t>(bucket)};
+            VkSpecializationInfo specializationInfo{};
+            specializationInfo.mapEntryCount = specializationEntries.size();
+            specializationInfo.pMapEntries   = specializationEntries.data();
+            specializationInfo.dataSize      = sizeof(DrawSpecialization);
+            specializationInfo.pData         = &specialization;
+
+            std::vector<VkPipelineShaderStageCreateInfo> variantStages(stages.begin(),
+                                                                       stages.end());
+            variantStages[0].pSpecializationInfo = &specializationInfo;
+
+            pipelineInfo.stageCount        = static_cast<uint32_t>(variantStages.size());
+            pipelineInfo.pStages           = variantStages.data();
+            pipelineInfo.pVertexInputState = &vertexInputInfo;
+
+            H_CHECK(vkCreateGraphicsPipelines(mCtx->device, VK_NULL_HANDLE, 1, &pipelineInfo,
+                                              nullptr, &pipelines[bucket]),
+                    errorMessage);
+        }
+    };
+
+    createVariants(mGraphicsPipelines, shaderStages, std::nullopt,
+                   "Failed to create graphics pipeline");
+
+    // After a depth pre-pass only the nearest fragment of every pixel gets shaded
+    depthStencilStateCreateInfo = vk::pipelineDepthStencilInfo(true, false, VK_COMPARE_OP_EQUAL);
+    createVariants(mDepthEqualPipelines, shaderStages, std::nullopt,
+                   "Failed to create graphics pipeline");
+
+    // The pre-pass itself: no color attachments, no fragment shader, and only the position is
+    // fetched out of the vertex buffer
+    depthStencilStateCreateInfo =
+        vk::pipelineDepthStencilInfo(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+    colorBlending.attachmentCount                    = 0;
+    pipelineCreateRenderingInfo.colorAttachmentCount = 0;
+
+    std::array<VkPipelineShaderStageCreateInfo, 1> depthStage = {
+        vk::createShaderStage(mCtx->device, kDepthShaderName, VK_SHADER_STAGE_VERTEX_BIT)};
+    createVariants(mDepthPrepassPipelines, depthStage, 1,
+                   "Failed to create depth pre-pass pipeline");
 
     mDeleter.enqueue([this]() {
-        H_LOG("...destroying graphics pipeline");
-        vkDestroyPipeline(mCtx->device, mGraphicsPipeline, nullptr);
+        H_LOG("...destroying graphics pipelines");
+        for (const auto &pipelines :
+             {mGraphicsPipelines, mDepthEqualPipelines, mDepthPrepassPipelines})
+        {
+            for (VkPipeline pipeline : pipelines)
+            {
+                vkDestroyPipeline(mCtx->device, pipeline, nullptr);
+            }
+        }
     });
 
     for (const auto &stage : shaderStages)
     {
         vkDestroyShaderModule(mCtx->device, stage.module, nullptr);
     }
+    vkDestroyShaderModule(mCtx->device, depthStage[0].module, nullptr);
+}
+
+void ForwardRenderer::createCullingPipeline()
+{
+    H_LOG("...creating culling pipeline");
+
+    std::array<VkDescriptorSetLayoutBinding, 6> bindings;
+    for (uint32_t binding = 0; binding < bindings.size(); ++binding)
+    {
+        bindings[binding] = vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                           VK_SHADER_STAGE_COMPUTE_BIT, binding);
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext        = nullptr;
+    layoutInfo.bindingCount = bindings.size();
+    layoutInfo.pBindings    = bindings.data();
+    layoutInfo.flags        = 0;
+
+    H_CHECK(vkCreateDescriptorSetLayout(mCtx->device, &layoutInfo, nullptr, &mCullSetLayout),
+            "Unable to create culling descriptor set layout");
+
+    VkPushConstantRange pushConstant{};
+    pushConstant.size       = sizeof(CullPushConstants);
+    pushConstant.offset     = 0;
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = vk::pipelineLayoutInfo();
+    pipelineLayoutInfo.setLayoutCount             = 1;
+    pipelineLayoutInfo.pSetLayouts                = &mCullSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount     = 1;
+    pipelineLayoutInfo.pPushConstantRanges        = &pushConstant;
+
+    H_CHECK(
+        vkCreatePipelineLayout(mCtx->device, &pipelineLayoutInfo, nullptr, &mCullPipelineLayout),
+        "Failed to create culling pipeline layout");
+
+    VkPipelineShaderStageCreateInfo stageInfo =
+        vk::createShaderStage(mCtx->device, kCullShaderName, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext  = nullptr;
+    pipelineInfo.layout = mCullPipelineLayout;
+    pipelineInfo.stage  = stageInfo;
+
+    H_CHECK(vkCreateComputePipelines(mCtx->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+                                     &mCullPipeline),
+            "Failed to create culling pipeline");
+
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying culling pipeline");
+        vkDestroyPipeline(mCtx->device, mCullPipeline, nullptr);
+        vkDestroyPipelineLayout(mCtx->device, mCullPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(mCtx->device, mCullSetLayout, nullptr);
+    });
+
+    vkDestroyShaderModule(mCtx->device, stageInfo.module, nullptr);
+}
+
+void ForwardRenderer::createOcclusionPipeline()
+{
+    H_LOG("...creating occlusion culling pipeline");
+
+    // The window can't be resized, so the pyramid is sized once for the swapchain
+    // Every frame in flight has its own depth image to build it from
+    mDepthPyramid = vk::DepthPyramid(mCtx->device, mCtx->allocator, mCtx->samplerCache,
+                                     mCtx->swapchainExtent, constants::kMaxFramesInFlight);
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying depth pyramid");
+        mDepthPyramid.destroy(mCtx->allocator);
+    });
+
+    // Bindings 0 to 7 are the same buffers as the culling pass plus the visibility, first phase
+    // and stats buffers, then the camera and the depth pyramid
+    std::array<VkDescriptorSetLayoutBinding, 10> bindings;
+    for (uint32_t binding = 0; binding < 8; ++binding)
+    {
+        bindings[binding] = vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                           VK_SHADER_STAGE_COMPUTE_BIT, binding);
+    }
+    bindings[8] = vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                                 VK_SHADER_STAGE_COMPUTE_BIT, 8);
+    bindings[9] = vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                                 VK_SHADER_STAGE_COMPUTE_BIT, 9);
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext        = nullptr;
+    layoutInfo.bindingCount = bindings.size();
+    layoutInfo.pBindings    = bindings.data();
+    layoutInfo.flags        = 0;
+
+    H_CHECK(vkCreateDescriptorSetLayout(mCtx->device, &layoutInfo, nullptr, &mOcclusionSetLayout),
+            "Unable to create occlusion culling descriptor set layout");
+
+    VkPushConstantRange pushConstant{};
+    pushConstant.size       = sizeof(OcclusionPushConstants);
+    pushConstant.offset     = 0;
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = vk::pipelineLayoutInfo();
+    pipelineLayoutInfo.setLayoutCount             = 1;
+    pipelineLayoutInfo.pSetLayouts                = &mOcclusionSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount     = 1;
+    pipelineLayoutInfo.pPushConstantRanges        = &pushConstant;
+
+    H_CHECK(vkCreatePipelineLayout(mCtx->device, &pipelineLayoutInfo, nullptr,
+                                   &mOcclusionPipelineLayout),
+            "Failed to create occlusion culling pipeline layout");
+
+    VkPipelineShaderStageCreateInfo stageInfo =
+        vk::createShaderStage(mCtx->device, kOcclusionShaderName, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext  = nullptr;
+    pipelineInfo.layout = mOcclusionPipelineLayout;
+    pipelineInfo.stage  = stageInfo;
+
+    H_CHECK(vkCreateComputePipelines(mCtx->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+                                     &mOcclusionPipeline),
+            "Failed to create occlusion culling pipeline");
+
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying occlusion culling pipeline");
+        vkDestroyPipeline(mCtx->device, mOcclusionPipeline, nullptr);
+        vkDestroyPipelineLayout(mCtx->device, mOcclusionPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(mCtx->device, mOcclusionSetLayout, nullptr);
+    });
+
+    vkDestroyShaderModule(mCtx->device, stageInfo.module, nullptr);
+}
+
+void ForwardRenderer::createCompactionPipeline()
+{
+    H_LOG("...creating draw compaction pipeline");
+
+    // The draw records, a culling pass's commands, and the DrawStream they get compacted into
+    std::array<VkDescriptorSetLayoutBinding, 5> bindings;
+    for (uint32_t binding = 0; binding < bindings.size(); ++binding)
+    {
+        bindings[binding] = vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                           VK_SHADER_STAGE_COMPUTE_BIT, binding);
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext        = nullptr;
+    layoutInfo.bindingCount = bindings.size();
+    layoutInfo.pBindings    = bindings.data();
+    layoutInfo.flags        = 0;
+
+    H_CHECK(vkCreateDescriptorSetLayout(mCtx->device, &layoutInfo, nullptr, &mCompactSetLayout),
+            "Unable to create draw compaction descriptor set layout");
+
+    VkPushConstantRange pushConstant{};
+    pushConstant.size       = sizeof(CompactPushConstants);
+    pushConstant.offset     = 0;
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = vk::pipelineLayoutInfo();
+    pipelineLayoutInfo.setLayoutCount             = 1;
+    pipelineLayoutInfo.pSetLayouts                = &mCompactSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount     = 1;
+    pipelineLayoutInfo.pPushConstantRanges        = &pushConstant;
+
+    H_CHECK(vkCreatePipelineLayout(mCtx->device, &pipelineLayoutInfo, nullptr,
+                                   &mCompactPipelineLayout),
+            "Failed to create draw compaction pipeline layout");
+
+    VkPipelineShaderStageCreateInfo stageInfo =
+        vk::createShaderStage(mCtx->device, kCompactShaderName, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext  = nullptr;
+    pipelineInfo.layout = mCompactPipelineLayout;
+    pipelineInfo.stage  = stageInfo;
+
+    H_CHECK(vkCreateComputePipelines(mCtx->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+                                     &mCompactPipeline),
+            "Failed to create draw compaction pipeline");
+
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying draw compaction pipeline");
+        vkDestroyPipeline(mCtx->device, mCompactPipeline, nullptr);
+        vkDestroyPipelineLayout(mCtx->device, mCompactPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(mCtx->device, mCompactSetLayout, nullptr);
+    });
+
+    vkDestroyShaderModule(mCtx->device, stageInfo.module, nullptr);
 }
 
 void ForwardRenderer::uploadTextures(Mesh &mesh)
 {
     Texture::checkRequiredFormatProperties(mCtx->physicalDevice);
 
-    // Each mesh has its own descriptor set allocated from the global pool
-    VkDescriptorSetAllocateInfo textureDescriptorInfo{};
-    textureDescriptorInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    textureDescriptorInfo.pNext              = nullptr;
-    textureDescriptorInfo.descriptorPool     = mDescriptorPool;
-    textureDescriptorInfo.descriptorSetCount = 1;
-    textureDescriptorInfo.pSetLayouts        = &mTextureSetLayout;
-    vkAllocateDescriptorSets(mCtx->device, &textureDescriptorInfo, &mesh.descriptor);
-
-    // We go through all of a mesh's textures and upload them to the GPU
+    // We go through all of a mesh's textures and upload them to the GPU, giving each a slot in
+    // the bindless texture array
     for (const auto &[typ, path] : mesh.textures)
     {
         // If we've already uploaded this mesh's texture we can skip it
         if (mGpuTextures.contains(path))
             continue;
 
-        std::shared_ptr<Texture> cpuTexture = mScene->textureManager.textures[path];
+        std::shared_ptr<Texture> cpuTexture = mScene->textureManager.get(path);
         vk::GpuTexture gpuTexture =
             cpuTexture->upload(mCtx->device, mCtx->allocator, mCtx->uploadContext);
         mGpuTextures[path] = gpuTexture;
 
         // Get rid of the staging buffer, queue the deletion operation for the GPU image
         mDeleter.enqueue([this, gpuTexture]() mutable { gpuTexture.destroy(mCtx->allocator); });
-    }
 
-    for (const auto &[typ, path] : mesh.textures)
-    {
+        // Textures with the same mip count share a sampler
         VkSamplerCreateInfo samplerInfo = vk::samplerInfo(VK_FILTER_LINEAR);
         samplerInfo.mipmapMode          = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-        samplerInfo.maxLod              = mGpuTextures[path].mipLevels;
+        samplerInfo.maxLod              = gpuTexture.mipLevels;
         samplerInfo.anisotropyEnable    = VK_TRUE;
         samplerInfo.mipLodBias          = -0.5f;
-        VkPhysicalDeviceProperties properties;
-        vkGetPhysicalDeviceProperties(mCtx->physicalDevice, &properties);
-        samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-        VkSampler sampler;
-        vkCreateSampler(mCtx->device, &samplerInfo, nullptr, &sampler);
-        mDeleter.enqueue([this, sampler]() { vkDestroySampler(mCtx->device, sampler, nullptr); });
-
-        VkDescriptorImageInfo imageBufferInfo{};
-        imageBufferInfo.sampler     = sampler;
-        imageBufferInfo.imageView   = mGpuTextures[path].imageView;
-        imageBufferInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-        uint32_t dstBinding = 0;
+        samplerInfo.maxAnisotropy       = mCtx->gpuProperties.limits.maxSamplerAnisotropy;
+        VkSampler sampler               = mCtx->samplerCache.get(samplerInfo);
+
+        mTextureIndices[path] = static_cast<uint32_t>(mBindlessTextures.size());
+        mBindlessTextures.push_back(VkDescriptorImageInfo{
+            sampler, gpuTexture.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL});
+    }
+
+    GpuMaterial material{kNoTexture, kNoTexture};
+    for (const auto &[typ, path] : mesh.textures)
+    {
         switch (typ)
         {
             case TextureType::ALBEDO:
-                dstBinding = 0;
+                material.albedoTexture = mTextureIndices[path];
                 break;
             case TextureType::METALLIC_ROUGHNESS:
-                dstBinding = 1;
+                material.metalnessRoughnessTexture = mTextureIndices[path];
                 break;
         }
-        VkWriteDescriptorSet descriptorWrite =
-            vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, mesh.descriptor,
-                                     &imageBufferInfo, dstBinding);
-        vkUpdateDescriptorSets(mCtx->device, 1, &descriptorWrite, 0, nullptr);
     }
+
+    // Meshes with the same textures share a material
+    for (uint32_t i = 0; i < mMaterials.size(); ++i)
+    {
+        if (mMaterials[i].albedoTexture == material.albedoTexture &&
+            mMaterials[i].metalnessRoughnessTexture == material.metalnessRoughnessTexture)
+        {
+            mesh.materialIndex = i;
+            return;
+        }
+    }
+    mesh.materialIndex = static_cast<uint32_t>(mMaterials.size());
+    mMaterials.push_back(material);
+}
+
+void ForwardRenderer::createMaterialSet()
+{
+    ZoneScopedNC("createMaterialSet", tracy::Color::Orange);
+    if (mBindlessTextures.size() > mMaxBindlessTextures)
+    {
+        LOGGER.error("The scene has {} textures, only the first {} fit in the bindless texture "
+                     "array and the rest won't be drawn",
+                     mBindlessTextures.size(), mMaxBindlessTextures);
+        mBindlessTextures.resize(mMaxBindlessTextures);
+        for (GpuMaterial &material : mMaterials)
+        {
+            for (uint32_t *texture :
+                 {&material.albedoTexture, &material.metalnessRoughnessTexture})
+            {
+                *texture = *texture < mMaxBindlessTextures ? *texture : kNoTexture;
+            }
+        }
+    }
+
+    // Vulkan doesn't allow empty buffers or descriptor arrays either
+    const uint32_t textureCount = std::max<uint32_t>(mBindlessTextures.size(), 1);
+    mMaterials.resize(std::max<size_t>(mMaterials.size(), 1), GpuMaterial{kNoTexture, kNoTexture});
+
+    VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountInfo{};
+    variableCountInfo.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+    variableCountInfo.descriptorSetCount = 1;
+    variableCountInfo.pDescriptorCounts  = &textureCount;
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext              = &variableCountInfo;
+    allocInfo.descriptorPool     = mDescriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts        = &mMaterialSetLayout;
+    H_CHECK(vkAllocateDescriptorSets(mCtx->device, &allocInfo, &mMaterialDescriptor),
+            "Unable to allocate material descriptor set");
+
+    mMaterialBuffer =
+        uploadBuffer(mMaterials.data(), mMaterials.size() * sizeof(GpuMaterial),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                     VK_ACCESS_SHADER_READ_BIT);
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying material buffer");
+        mCtx->allocator.destroyBuffer(mMaterialBuffer);
+    });
+
+    VkDescriptorBufferInfo materialBufferInfo{mMaterialBuffer.buffer, 0, VK_WHOLE_SIZE};
+    std::vector<VkWriteDescriptorSet> writes = {vk::writeDescriptorBuffer(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, mMaterialDescriptor, &materialBufferInfo, 0)};
+    if (!mBindlessTextures.empty())
+    {
+        VkWriteDescriptorSet texturesWrite =
+            vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, mMaterialDescriptor,
+                                     mBindlessTextures.data(), 1);
+        texturesWrite.descriptorCount = static_cast<uint32_t>(mBindlessTextures.size());
+        writes.push_back(texturesWrite);
+    }
+    vkUpdateDescriptorSets(mCtx->device, static_cast<uint32_t>(writes.size()), writes.data(), 0,
+                           nullptr);
+
+    LOGGER.info("Scene upload: {} materials over {} bindless textures, {} samplers created and "
+                "{} reused so far",
+                mMaterials.size(), mBindlessTextures.size(), mCtx->samplerCache.createdCount(),
+                mCtx->samplerCache.reusedCount());
 }
 
 void ForwardRenderer::uploadSceneToGpu()
 {
+    ZoneScopedNC("uploadSceneToGpu", tracy::Color::Orange);
     H_LOG("...uploading scene to GPU");
-    for (auto &renderable : mScene->renderables)
+    mGeometryArena = vk::GeometryArena(mCtx->allocator, constants::kGeometryArenaVertexSize,
+                                       constants::kGeometryArenaIndexSize);
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying geometry arena");
+        mGeometryArena.destroy(mCtx->allocator);
+    });
+
+    mSceneUploadStart                           = std::chrono::steady_clock::now();
+    const vk::UploadContext::Ticket firstTicket = mCtx->uploadContext.submit() + 1;
+
+    // Nothing in here waits on the GPU: the copies are batched by the upload context and the
+    // final batch is submitted without blocking. Queue ordering plus the barrier at the end of
+    // every batch makes the data visible to the first frame.
+    // Renderables that share a model also share its buffers and textures
+    size_t meshCount      = 0;
+    size_t narrowedMeshes = 0;
+    size_t indexBytes     = 0;
+    size_t fullIndexBytes = 0;
+    for (auto &model : mScene->models)
     {
-        for (auto &mesh : renderable.model->meshes)
+        for (auto &mesh : model->meshes)
         {
-            mesh.upload(mCtx->allocator, mCtx->uploadContext);
-            mDeleter.enqueue([this, mesh]() mutable { mesh.destroyBuffers(mCtx->allocator); });
+            if (!mesh.upload(mGeometryArena, mCtx->uploadContext))
+            {
+                LOGGER.error("Geometry arena is out of space, a mesh of {} vertices won't be drawn",
+                             mesh.vertices.size());
+            }
+            ++meshCount;
+            narrowedMeshes += mesh.indexType == VK_INDEX_TYPE_UINT16 ? 1 : 0;
+            indexBytes += mesh.indices.size() * indexTypeSize(mesh.indexType);
+            fullIndexBytes += mesh.indices.size() * sizeof(Mesh::IndexType);
 
             uploadTextures(mesh);
         }
     }
+    createMaterialSet();
+    createDrawList();
+    mSceneUploadTicket = mCtx->uploadContext.submit();
+
+    LOGGER.info("Scene upload: {}/{} meshes use 16 bit indices, {:.2f}MB of indices ({:.2f}MB "
+                "saved)",
+                narrowedMeshes, meshCount, indexBytes / (1024.f * 1024.f),
+                (fullIndexBytes - indexBytes) / (1024.f * 1024.f));
+
+    LOGGER.info("Scene upload: recorded {} batches in {:.2f}ms",
+                mSceneUploadTicket - firstTicket + 1,
+                std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                         mSceneUploadStart)
+                    .count());
 
     mDeleter.enqueue([this]() {
         H_LOG("...destroying texture image views");
@@ -442,9 +1074,757 @@ void ForwardRenderer::uploadSceneToGpu()
     });
 }
 
-void ForwardRenderer::drawObjects(DrawCtx &drawCtx)
+void ForwardRenderer::benchmarkSceneUpload()
+{
+    ZoneScopedNC("benchmarkSceneUpload", tracy::Color::Orange);
+
+    // Textures are left out: they'd need images of their own per run, and the meshes already make
+    // up most of the copies
+    size_t meshCount            = 0;
+    VkDeviceSize vertexCapacity = 0;
+    VkDeviceSize indexCapacity  = 0;
+    for (const auto &model : mScene->models)
+    {
+        for (const auto &mesh : model->meshes)
+        {
+            ++meshCount;
+            // Enough for 32 bit indices and the worst case alignment of every allocation
+            vertexCapacity += mesh.vertices.size() * mesh.vertexStride() + sizeof(Vertex);
+            indexCapacity += mesh.indices.size() * sizeof(Mesh::IndexType) + sizeof(uint32_t);
+        }
+    }
+
+    // What every mesh upload did before batching: a staging buffer and vertex and index buffers
+    // of its own, with full vertices and 32 bit indices, then a submit and a wait on the fence
+    const auto uploadPerMesh = [this]() {
+        std::vector<vk::AllocatedBuffer> buffers;
+        for (const auto &model : mScene->models)
+        {
+            for (const auto &mesh : model->meshes)
+            {
+                if (mesh.vertices.empty() || mesh.indices.empty())
+                {
+                    continue;
+                }
+                const size_t verticesSize = mesh.vertices.size() * sizeof(Vertex);
+                const size_t indicesSize  = mesh.indices.size() * sizeof(Mesh::IndexType);
+
+                vk::AllocatedBuffer staging =
+                    mCtx->allocator.createBuffer(verticesSize + indicesSize,
+                                                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                 VMA_MEMORY_USAGE_CPU_ONLY);
+                void *data = mCtx->allocator.map(staging);
+                std::memcpy(data, mesh.vertices.data(), verticesSize);
+                std::memcpy(static_cast<char *>(data) + verticesSize, mesh.indices.data(),
+                            indicesSize);
+                mCtx->allocator.unmap(staging);
+
+                const vk::AllocatedBuffer vertexBuffer = mCtx->allocator.createBuffer(
+                    verticesSize,
+                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VMA_MEMORY_USAGE_GPU_ONLY);
+                const vk::AllocatedBuffer indexBuffer = mCtx->allocator.createBuffer(
+                    indicesSize,
+                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VMA_MEMORY_USAGE_GPU_ONLY);
+                mCtx->uploadContext.immediateSubmit([&](VkCommandBuffer cmd) {
+                    VkBufferCopy vboCopy{};
+                    vboCopy.size = verticesSize;
+                    vkCmdCopyBuffer(cmd, staging.buffer, vertexBuffer.buffer, 1, &vboCopy);
+
+                    VkBufferCopy iboCopy{};
+                    iboCopy.srcOffset = verticesSize;
+                    iboCopy.size      = indicesSize;
+                    vkCmdCopyBuffer(cmd, staging.buffer, indexBuffer.buffer, 1, &iboCopy);
+                });
+                mCtx->allocator.destroyBuffer(staging);
+
+                buffers.push_back(vertexBuffer);
+                buffers.push_back(indexBuffer);
+            }
+        }
+        return buffers;
+    };
+
+    // One arena sized for the scene, shared by every run, so that the scene's real upload
+    // afterwards is unaffected
+    vk::GeometryArena arena(mCtx->allocator, std::max<VkDeviceSize>(vertexCapacity, 1),
+                            std::max<VkDeviceSize>(indexCapacity, 1));
+    const auto uploadToArena = [this, &arena](bool flushPerMesh) {
+        for (auto &model : mScene->models)
+        {
+            for (auto &mesh : model->meshes)
+            {
+                mesh.upload(arena, mCtx->uploadContext);
+                if (flushPerMesh)
+                {
+                    mCtx->uploadContext.flush();
+                }
+            }
+        }
+    };
+    const auto freeArena = [this, &arena]() {
+        for (auto &model : mScene->models)
+        {
+            for (auto &mesh : model->meshes)
+            {
+                mesh.freeGeometry(arena);
+            }
+        }
+    };
+
+    enum Method
+    {
+        kPerMesh,
+        kFlushPerMesh,
+        kBatched,
+        kMethodCount,
+    };
+    const auto timeUpload = [&](Method method) {
+        mCtx->uploadContext.flush();
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<vk::AllocatedBuffer> buffers;
+        if (method == kPerMesh)
+        {
+            buffers = uploadPerMesh();
+        }
+        else
+        {
+            uploadToArena(method == kFlushPerMesh);
+        }
+        mCtx->uploadContext.flush();
+        const std::chrono::duration<float, std::milli> time =
+            std::chrono::steady_clock::now() - start;
+
+        for (const vk::AllocatedBuffer &buffer : buffers)
+        {
+            mCtx->allocator.destroyBuffer(buffer);
+        }
+        freeArena();
+        return time.count();
+    };
+
+    // Best of a few runs of each, interleaved so that no method always runs on a warmer cache
+    constexpr int kRuns = 3;
+    std::array<float, kMethodCount> bestMs;
+    bestMs.fill(std::numeric_limits<float>::max());
+    for (int run = 0; run < kRuns; ++run)
+    {
+        for (int method = 0; method < kMethodCount; ++method)
+        {
+            bestMs[method] = std::min(bestMs[method], timeUpload(static_cast<Method>(method)));
+        }
+    }
+    arena.destroy(mCtx->allocator);
+
+    LOGGER.info("Scene upload benchmark: {} meshes on {}", meshCount,
+                mCtx->gpuProperties.deviceName);
+    LOGGER.info("  staging buffer and immediateSubmit per mesh (old path): {:.2f}ms",
+                bestMs[kPerMesh]);
+    LOGGER.info("  staging ring, flushed after every mesh (flush overhead only): {:.2f}ms",
+                bestMs[kFlushPerMesh]);
+    LOGGER.info("  staging ring, batched: {:.2f}ms ({:.2f}x faster than the old path)",
+                bestMs[kBatched], bestMs[kPerMesh] / bestMs[kBatched]);
+    benchmark::finish();
+}
+
+void ForwardRenderer::createDrawList()
+{
+    ZoneScopedNC("createDrawList", tracy::Color::Orange);
+
+    // Same order as the CPU loop used to draw in, by model and then by mesh, but one bucket after
+    // the other so that every bucket's draws are contiguous
+    std::vector<GpuDrawRecord> records;
+    std::vector<GpuCullItem> cullItems;
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    for (size_t bucket = 0; bucket < kDrawBucketCount; ++bucket)
+    {
+        mBucketStarts[bucket] = static_cast<uint32_t>(mDraws.size());
+        for (const auto &instances : mScene->instances)
+        {
+            for (const auto &mesh : instances.model->meshes)
+            {
+                if (!mesh.geometry.has_value() || !mesh.textures.contains(TextureType::ALBEDO) ||
+                    !mesh.textures.contains(TextureType::METALLIC_ROUGHNESS) ||
+                    drawBucket(mesh.vertexFormat, mesh.indexType) != bucket)
+                    continue;
+
+                const uint32_t drawIndex    = static_cast<uint32_t>(mDraws.size());
+                const uint32_t instanceBase = static_cast<uint32_t>(mCullItemObjects.size());
+                mDraws.push_back(DrawEntry{&mesh, instanceBase, instances.instanceCount, bucket});
+
+                GpuDrawRecord record{};
+                record.boundsMin     = mesh.localBounds.min;
+                record.boundsMax     = mesh.localBounds.max;
+                record.instanceBase  = instanceBase;
+                record.materialIndex = mesh.materialIndex;
+                records.push_back(record);
+
+                VkDrawIndexedIndirectCommand command{};
+                command.indexCount    = static_cast<uint32_t>(mesh.indices.size());
+                command.instanceCount = 0;
+                command.firstIndex    = mesh.firstIndex();
+                command.vertexOffset  = mesh.vertexOffset();
+                command.firstInstance = instanceBase;
+                commands.push_back(command);
+
+                // Renderables don't move once the scene is loaded, so their bounds are only
+                // transformed to world space once
+                for (uint32_t i = 0; i < instances.instanceCount; ++i)
+                {
+                    const uint32_t objectIndex = instances.firstInstance + i;
+                    cullItems.push_back(GpuCullItem{objectIndex, drawIndex});
+                    mCullItemObjects.push_back(objectIndex);
+                    mCullItemBounds.push_back(
+                        mesh.BoundingBox(mScene->renderables[objectIndex].transform));
+                }
+            }
+        }
+        mBucketSizes[bucket] = static_cast<uint32_t>(mDraws.size()) - mBucketStarts[bucket];
+    }
+    mCullItemCount = static_cast<uint32_t>(cullItems.size());
+    mVisibleItems.reserve(mCullItemCount);
+
+    // Vulkan doesn't allow empty buffers, so an empty scene still gets one element of each
+    const size_t instanceListSize = std::max<size_t>(mCullItemCount, 1) * sizeof(uint32_t);
+    records.resize(std::max<size_t>(records.size(), 1));
+    cullItems.resize(std::max<size_t>(cullItems.size(), 1));
+    commands.resize(std::max<size_t>(commands.size(), 1));
+
+    const GpuDrawListHeader header{mBucketStarts};
+    std::vector<std::byte> drawList(sizeof(GpuDrawListHeader) +
+                                    records.size() * sizeof(GpuDrawRecord));
+    std::memcpy(drawList.data(), &header, sizeof(GpuDrawListHeader));
+    std::memcpy(drawList.data() + sizeof(GpuDrawListHeader), records.data(),
+                records.size() * sizeof(GpuDrawRecord));
+    mDrawRecordBuffer = uploadBuffer(
+        drawList.data(), drawList.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT);
+    mCullItemBuffer =
+        uploadBuffer(cullItems.data(), cullItems.size() * sizeof(GpuCullItem),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                     VK_ACCESS_SHADER_READ_BIT);
+    mDrawCommandTemplateBuffer =
+        uploadBuffer(commands.data(), commands.size() * sizeof(VkDrawIndexedIndirectCommand),
+                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                     VK_ACCESS_TRANSFER_READ_BIT);
+
+    // Everything counts as visible until the first occlusion test says otherwise
+    const std::vector<uint32_t> allVisible(std::max<size_t>(mCullItemCount, 1), 1);
+    const size_t visibilitySize = allVisible.size() * sizeof(uint32_t);
+    mVisibilityBuffer =
+        uploadBuffer(allVisible.data(), visibilitySize,
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                     VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // Streams the CPU writes are mapped, the ones compact_draws.comp writes live on the GPU
+    const size_t commandsSize = commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+    const size_t drawIdsSize  = commands.size() * sizeof(uint32_t);
+    const size_t countsSize   = kDrawBucketCount * sizeof(uint32_t);
+    const auto createDrawStream = [this, commandsSize, drawIdsSize, countsSize](bool cpuWritten) {
+        constexpr VkBufferUsageFlags kIndirect =
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        vk::Allocator &allocator = mCtx->allocator;
+        if (cpuWritten)
+        {
+            return DrawStream{
+                allocator.createMappedBuffer(commandsSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT),
+                allocator.createMappedBuffer(drawIdsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT),
+                allocator.createMappedBuffer(countsSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)};
+        }
+        return DrawStream{
+            allocator.createBuffer(commandsSize, kIndirect, VMA_MEMORY_USAGE_GPU_ONLY),
+            allocator.createBuffer(drawIdsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                   VMA_MEMORY_USAGE_GPU_ONLY),
+            allocator.createBuffer(countsSize, kIndirect, VMA_MEMORY_USAGE_GPU_ONLY)};
+    };
+
+    for (FrameData &frame : mFrames)
+    {
+        for (vk::AllocatedBuffer *buffer :
+             {&frame.drawCommandBuffer, &frame.occlusionCommandBuffer})
+        {
+            *buffer = mCtx->allocator.createBuffer(
+                commandsSize,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VMA_MEMORY_USAGE_GPU_ONLY);
+        }
+        frame.cpuDraws       = createDrawStream(true);
+        frame.culledDraws    = createDrawStream(false);
+        frame.occlusionDraws = createDrawStream(false);
+
+        frame.culledInstanceBuffer = mCtx->allocator.createBuffer(
+            instanceListSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        frame.occlusionInstanceBuffer = mCtx->allocator.createBuffer(
+            instanceListSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        frame.instanceBuffer = mCtx->allocator.createMappedBuffer(
+            instanceListSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        frame.firstPhaseBuffer =
+            mCtx->allocator.createMappedBuffer(visibilitySize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        frame.visibilityReadback = mCtx->allocator.createBuffer(
+            visibilitySize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+        frame.occlusionStatsBuffer = mCtx->allocator.createBuffer(
+            sizeof(OcclusionStats),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+        // CPU culling reads this before the GPU has ever written it
+        void *readback = mCtx->allocator.map(frame.visibilityReadback);
+        std::memcpy(readback, allVisible.data(), visibilitySize);
+        mCtx->allocator.unmap(frame.visibilityReadback);
+
+        std::array<VkDescriptorSetLayout, 4> layouts = {mCullSetLayout, mOcclusionSetLayout,
+                                                        mCompactSetLayout, mCompactSetLayout};
+        std::array<VkDescriptorSet, 4> sets;
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.pNext              = nullptr;
+        allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool     = mDescriptorPool;
+        allocInfo.descriptorSetCount = layouts.size();
+        allocInfo.pSetLayouts        = layouts.data();
+        vkAllocateDescriptorSets(mCtx->device, &allocInfo, sets.data());
+        frame.cullDescriptor             = sets[0];
+        frame.occlusionDescriptor        = sets[1];
+        frame.culledCompactDescriptor    = sets[2];
+        frame.occlusionCompactDescriptor = sets[3];
+
+        // Culling reads the objects, items, records and last frame's visibility and writes the
+        // commands and instance lists
+        std::array<VkDescriptorBufferInfo, 6> cullBufferInfos = {
+            VkDescriptorBufferInfo{frame.objectBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{mCullItemBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{mDrawRecordBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{frame.drawCommandBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{frame.culledInstanceBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{mVisibilityBuffer.buffer, 0, VK_WHOLE_SIZE},
+        };
+        // The occlusion pass has its own commands and instance lists, and more inputs
+        std::array<VkDescriptorBufferInfo, 9> occlusionBufferInfos = {
+            cullBufferInfos[0],
+            cullBufferInfos[1],
+            cullBufferInfos[2],
+            VkDescriptorBufferInfo{frame.occlusionCommandBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{frame.occlusionInstanceBuffer.buffer, 0, VK_WHOLE_SIZE},
+            cullBufferInfos[5],
+            VkDescriptorBufferInfo{frame.firstPhaseBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{frame.occlusionStatsBuffer.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{frame.cameraBuffer.buffer, 0, VK_WHOLE_SIZE},
+        };
+        VkDescriptorImageInfo pyramidInfo{mDepthPyramid.sampler(), mDepthPyramid.view(),
+                                          VK_IMAGE_LAYOUT_GENERAL};
+        // Each compaction reads its pass's commands and fills one of the streams
+        const auto compactBufferInfos = [&](const vk::AllocatedBuffer &commands,
+                                            const DrawStream &draws) {
+            return std::array<VkDescriptorBufferInfo, 5>{
+                cullBufferInfos[2],
+                VkDescriptorBufferInfo{commands.buffer, 0, VK_WHOLE_SIZE},
+                VkDescriptorBufferInfo{draws.commands.buffer, 0, VK_WHOLE_SIZE},
+                VkDescriptorBufferInfo{draws.drawIds.buffer, 0, VK_WHOLE_SIZE},
+                VkDescriptorBufferInfo{draws.counts.buffer, 0, VK_WHOLE_SIZE}};
+        };
+        const std::array<std::array<VkDescriptorBufferInfo, 5>, 2> compactInfos = {
+            compactBufferInfos(frame.drawCommandBuffer, frame.culledDraws),
+            compactBufferInfos(frame.occlusionCommandBuffer, frame.occlusionDraws)};
+        const std::array<VkDescriptorSet, 2> compactSets = {frame.culledCompactDescriptor,
+                                                            frame.occlusionCompactDescriptor};
+
+        std::vector<VkWriteDescriptorSet> writes;
+        for (uint32_t binding = 0; binding < cullBufferInfos.size(); ++binding)
+        {
+            writes.push_back(vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                       frame.cullDescriptor,
+                                                       &cullBufferInfos[binding], binding));
+        }
+        for (uint32_t binding = 0; binding < occlusionBufferInfos.size(); ++binding)
+        {
+            const VkDescriptorType type = binding == 8 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                                       : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes.push_back(vk::writeDescriptorBuffer(type, frame.occlusionDescriptor,
+                                                       &occlusionBufferInfos[binding], binding));
+        }
+        writes.push_back(vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                                  frame.occlusionDescriptor, &pyramidInfo, 9));
+        for (size_t pass = 0; pass < compactSets.size(); ++pass)
+        {
+            for (uint32_t binding = 0; binding < compactInfos[pass].size(); ++binding)
+            {
+                writes.push_back(vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                           compactSets[pass],
+                                                           &compactInfos[pass][binding], binding));
+            }
+        }
+
+        // And the graphics side reads one of the three instance lists and draw id buffers, along
+        // with the records
+        const std::array<VkDescriptorSet, 3> globalSets = {frame.globalDescriptor,
+                                                           frame.culledGlobalDescriptor,
+                                                           frame.occlusionGlobalDescriptor};
+        const std::array<VkDescriptorBufferInfo, 3> instanceInfos = {
+            VkDescriptorBufferInfo{frame.instanceBuffer.buffer, 0, VK_WHOLE_SIZE},
+            cullBufferInfos[4], occlusionBufferInfos[4]};
+        const std::array<VkDescriptorBufferInfo, 3> drawIdInfos = {
+            VkDescriptorBufferInfo{frame.cpuDraws.drawIds.buffer, 0, VK_WHOLE_SIZE},
+            compactInfos[0][3], compactInfos[1][3]};
+        for (size_t i = 0; i < globalSets.size(); ++i)
+        {
+            writes.push_back(vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                       globalSets[i], &instanceInfos[i], 4));
+            writes.push_back(vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                       globalSets[i], &cullBufferInfos[2], 7));
+            writes.push_back(vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                       globalSets[i], &drawIdInfos[i], 8));
+        }
+
+        vkUpdateDescriptorSets(mCtx->device, writes.size(), writes.data(), 0, nullptr);
+    }
+
+    mDeleter.enqueue([this]() {
+        H_LOG("...destroying draw list buffers");
+        mCtx->allocator.destroyBuffer(mDrawRecordBuffer);
+        mCtx->allocator.destroyBuffer(mCullItemBuffer);
+        mCtx->allocator.destroyBuffer(mDrawCommandTemplateBuffer);
+        mCtx->allocator.destroyBuffer(mVisibilityBuffer);
+        for (FrameData &frame : mFrames)
+        {
+            mCtx->allocator.destroyBuffer(frame.drawCommandBuffer);
+            mCtx->allocator.destroyBuffer(frame.culledInstanceBuffer);
+            mCtx->allocator.destroyBuffer(frame.instanceBuffer);
+            mCtx->allocator.destroyBuffer(frame.occlusionCommandBuffer);
+            mCtx->allocator.destroyBuffer(frame.occlusionInstanceBuffer);
+            mCtx->allocator.destroyBuffer(frame.firstPhaseBuffer);
+            mCtx->allocator.destroyBuffer(frame.visibilityReadback);
+            mCtx->allocator.destroyBuffer(frame.occlusionStatsBuffer);
+            for (DrawStream *draws : {&frame.cpuDraws, &frame.culledDraws, &frame.occlusionDraws})
+            {
+                mCtx->allocator.destroyBuffer(draws->commands);
+                mCtx->allocator.destroyBuffer(draws->drawIds);
+                mCtx->allocator.destroyBuffer(draws->counts);
+            }
+        }
+    });
+}
+
+vk::AllocatedBuffer ForwardRenderer::uploadBuffer(const void *data,
+                                                  size_t size,
+                                                  VkBufferUsageFlags usage,
+                                                  VkPipelineStageFlags dstStage,
+                                                  VkAccessFlags dstAccess)
+{
+    vk::AllocatedBuffer buffer = mCtx->allocator.createBuffer(
+        size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    vk::StagingAllocation staging = mCtx->uploadContext.stage(data, size);
+
+    vk::UploadContext &context = mCtx->uploadContext;
+    context.record(
+        [=, &context](VkCommandBuffer cmd) {
+            VkBufferCopy copy{};
+            copy.srcOffset = staging.offset;
+            copy.dstOffset = 0;
+            copy.size      = size;
+            vkCmdCopyBuffer(cmd, staging.buffer, buffer.buffer, 1, &copy);
+            context.releaseBuffer(cmd, buffer.buffer);
+        },
+        [=, &context](VkCommandBuffer cmd) {
+            context.acquireBuffer(cmd, buffer.buffer, dstStage, dstAccess);
+        });
+    return buffer;
+}
+
+void ForwardRenderer::cullObjectsOnCpu(DrawCtx &drawCtx)
+{
+    ZoneScopedNC("cullObjectsOnCpu", tracy::Color::DeepSkyBlue4);
+    FrameData &frame = mFrames[drawCtx.frameIndex];
+
+    mVisibleItems.clear();
+    if (mCpuCulling)
+    {
+        frustum_culling::cull(Frustum::fromMatrix(mScene->camera.GetProjectionMatrix() *
+                                                  mScene->camera.GetViewMatrix()),
+                              mCullItemBounds, mVisibleItems);
+    }
+    else
+    {
+        mVisibleItems.resize(mCullItemCount);
+        std::iota(mVisibleItems.begin(), mVisibleItems.end(), 0);
+    }
+    TracyPlot("CPU culled instances", static_cast<int64_t>(mVisibleItems.size()));
+
+    // First phase of occlusion culling: keep what the GPU last found visible, and tell the second
+    // phase exactly what that was
+    if (mOcclusionCulling)
+    {
+        const auto *wasVisible =
+            static_cast<const uint32_t *>(mCtx->allocator.map(frame.visibilityReadback));
+        std::erase_if(mVisibleItems, [wasVisible](uint32_t item) { return wasVisible[item] == 0; });
+        mCtx->allocator.unmap(frame.visibilityReadback);
+
+        // Built on the CPU first: setting scattered flags in place would mean writing the mapped
+        // memory twice and out of order
+        mFirstPhaseFlags.assign(mCullItemCount, 0);
+        for (const uint32_t item : mVisibleItems)
+        {
+            mFirstPhaseFlags[item] = 1;
+        }
+        std::memcpy(vk::Allocator::mapped<uint32_t>(frame.firstPhaseBuffer),
+                    mFirstPhaseFlags.data(), mCullItemCount * sizeof(uint32_t));
+    }
+
+    // The visible items come out sorted, so each draw's visible instances are a contiguous run of
+    // them. Those get compacted to the start of the draw's instance list range, and the draws
+    // with any to the start of their bucket the same way compact_draws.comp does it.
+    auto *instances = vk::Allocator::mapped<uint32_t>(frame.instanceBuffer);
+    auto *commands  = vk::Allocator::mapped<VkDrawIndexedIndirectCommand>(frame.cpuDraws.commands);
+    auto *drawIds   = vk::Allocator::mapped<uint32_t>(frame.cpuDraws.drawIds);
+    std::array<uint32_t, kDrawBucketCount> drawCounts{};
+    size_t visible = 0;
+    for (size_t i = 0; i < mDraws.size(); ++i)
+    {
+        const DrawEntry &draw = mDraws[i];
+        const uint32_t end    = draw.instanceBase + draw.instanceCount;
+
+        uint32_t count = 0;
+        for (; visible < mVisibleItems.size() && mVisibleItems[visible] < end; ++visible)
+        {
+            instances[draw.instanceBase + count++] = mCullItemObjects[mVisibleItems[visible]];
+        }
+        if (count == 0)
+        {
+            continue;
+        }
+
+        const uint32_t slot = mBucketStarts[draw.bucket] + drawCounts[draw.bucket]++;
+        commands[slot] = VkDrawIndexedIndirectCommand{
+            static_cast<uint32_t>(draw.mesh->indices.size()), count, draw.mesh->firstIndex(),
+            draw.mesh->vertexOffset(), draw.instanceBase};
+        drawIds[slot] = static_cast<uint32_t>(i);
+    }
+    std::memcpy(vk::Allocator::mapped<uint32_t>(frame.cpuDraws.counts), drawCounts.data(),
+                sizeof(drawCounts));
+}
+
+void ForwardRenderer::cullObjectsOnGpu(DrawCtx &drawCtx)
+{
+    VkZoneC("cullObjectsOnGpu", tracy::Color::Blue);
+    if (mDraws.empty())
+    {
+        return;
+    }
+
+    FrameData &frame    = mFrames[drawCtx.frameIndex];
+    VkCommandBuffer cmd = drawCtx.commandBuffer;
+
+    // Every draw starts out with no instances, culling then adds the visible ones
+    VkBufferCopy resetCopy{};
+    resetCopy.size = mDraws.size() * sizeof(VkDrawIndexedIndirectCommand);
+    vkCmdCopyBuffer(cmd, mDrawCommandTemplateBuffer.buffer, frame.drawCommandBuffer.buffer, 1,
+                    &resetCopy);
+
+    // Also covers the visibility written by the last frame's occlusion pass
+    VkMemoryBarrier resetBarrier{};
+    resetBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, nullptr, 0,
+                         nullptr);
+
+    CullPushConstants constants{};
+    constants.frustumPlanes =
+        Frustum::fromMatrix(mScene->camera.GetProjectionMatrix() * mScene->camera.GetViewMatrix())
+            .planes;
+    constants.itemCount        = mCullItemCount;
+    constants.occlusionCulling = mOcclusionCulling ? 1 : 0;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mCullPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mCullPipelineLayout, 0, 1,
+                            &frame.cullDescriptor, 0, nullptr);
+    vkCmdPushConstants(cmd, mCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(CullPushConstants), &constants);
+    vkCmdDispatch(cmd, (mCullItemCount + kCullWorkgroupSize - 1) / kCullWorkgroupSize, 1, 1);
+
+    // The commands go on to be compacted, the instance lists to the vertex shader
+    VkMemoryBarrier cullBarrier{};
+    cullBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cullBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                         0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+    compactDraws(drawCtx, frame.culledCompactDescriptor);
+}
+
+void ForwardRenderer::compactDraws(DrawCtx &drawCtx, VkDescriptorSet compactDescriptor)
+{
+    VkZoneC("compactDraws", tracy::Color::Blue);
+    VkCommandBuffer cmd = drawCtx.commandBuffer;
+
+    const CompactPushConstants constants{static_cast<uint32_t>(mDraws.size())};
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mCompactPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mCompactPipelineLayout, 0, 1,
+                            &compactDescriptor, 0, nullptr);
+    vkCmdPushConstants(cmd, mCompactPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(CompactPushConstants), &constants);
+    // One workgroup walks the whole draw list, there are far fewer draws than instances
+    vkCmdDispatch(cmd, 1, 1, 1);
+
+    VkMemoryBarrier compactBarrier{};
+    compactBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    compactBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    compactBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                         0, 1, &compactBarrier, 0, nullptr, 0, nullptr);
+}
+
+void ForwardRenderer::buildLightClusters(DrawCtx &drawCtx)
+{
+    VkZoneC("buildLightClusters", tracy::Color::Blue);
+    const Camera &camera = mScene->camera;
+    mLightClusters.update(drawCtx.frameIndex, camera.GetProjectionMatrix(), camera.Near,
+                          camera.Far, mCtx->swapchainExtent,
+                          static_cast<uint32_t>(mScene->pointLights.size()), mClusteredLighting);
+    if (mClusteredLighting)
+    {
+        mLightClusters.build(drawCtx.commandBuffer, drawCtx.frameIndex);
+    }
+}
+
+void ForwardRenderer::buildDepthPyramid(DrawCtx &drawCtx)
+{
+    VkZoneC("buildDepthPyramid", tracy::Color::Blue);
+    VkCommandBuffer cmd = drawCtx.commandBuffer;
+
+    VkImageMemoryBarrier depthBarrier{};
+    depthBarrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    depthBarrier.oldLayout           = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    depthBarrier.newLayout           = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    depthBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    depthBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    depthBarrier.image               = drawCtx.depthImage;
+    depthBarrier.srcAccessMask       = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depthBarrier.dstAccessMask       = VK_ACCESS_SHADER_READ_BIT;
+    depthBarrier.subresourceRange    = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                         &depthBarrier);
+
+    mDepthPyramid.build(cmd, drawCtx.depthImageView);
+
+    // Back to rendering for the second phase, which also loads the first phase's color
+    std::swap(depthBarrier.oldLayout, depthBarrier.newLayout);
+    depthBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkMemoryBarrier colorBarrier{};
+    colorBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    colorBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    colorBarrier.dstAccessMask =
+        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    vkCmdPipelineBarrier(
+        cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        0, 1, &colorBarrier, 0, nullptr, 1, &depthBarrier);
+}
+
+void ForwardRenderer::cullOccludedObjects(DrawCtx &drawCtx)
+{
+    VkZoneC("cullOccludedObjects", tracy::Color::Blue);
+    FrameData &frame    = mFrames[drawCtx.frameIndex];
+    VkCommandBuffer cmd = drawCtx.commandBuffer;
+
+    VkBufferCopy resetCopy{};
+    resetCopy.size = mDraws.size() * sizeof(VkDrawIndexedIndirectCommand);
+    vkCmdCopyBuffer(cmd, mDrawCommandTemplateBuffer.buffer, frame.occlusionCommandBuffer.buffer,
+                    1, &resetCopy);
+    vkCmdFillBuffer(cmd, frame.occlusionStatsBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier resetBarrier{};
+    resetBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &resetBarrier, 0, nullptr, 0, nullptr);
+
+    const VkExtent2D pyramidExtent = mDepthPyramid.extent();
+
+    OcclusionPushConstants constants{};
+    constants.frustumPlanes =
+        Frustum::fromMatrix(mScene->camera.GetProjectionMatrix() * mScene->camera.GetViewMatrix())
+            .planes;
+    constants.pyramidSize       = glm::vec2(pyramidExtent.width, pyramidExtent.height);
+    constants.itemCount         = mCullItemCount;
+    constants.firstPhaseFromCpu = mGpuDriven ? 0 : 1;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mOcclusionPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mOcclusionPipelineLayout, 0, 1,
+                            &frame.occlusionDescriptor, 0, nullptr);
+    vkCmdPushConstants(cmd, mOcclusionPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(OcclusionPushConstants), &constants);
+    vkCmdDispatch(cmd, (mCullItemCount + kCullWorkgroupSize - 1) / kCullWorkgroupSize, 1, 1);
+
+    // The visibility buffer is shared by every frame, the next frame's culling passes read and
+    // write it in compute shaders, possibly while this one is still in flight
+    VkMemoryBarrier cullBarrier{};
+    cullBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT |
+                                VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+    compactDraws(drawCtx, frame.occlusionCompactDescriptor);
+
+    // CPU culling reads the visibility back once this frame is done, along with the stats
+    VkBufferCopy readbackCopy{};
+    readbackCopy.size = mCullItemCount * sizeof(uint32_t);
+    if (readbackCopy.size > 0)
+    {
+        vkCmdCopyBuffer(cmd, mVisibilityBuffer.buffer, frame.visibilityReadback.buffer, 1,
+                        &readbackCopy);
+    }
+
+    VkMemoryBarrier hostBarrier{};
+    hostBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+    frame.occlusionStatsPending = true;
+}
+
+void ForwardRenderer::readOcclusionStats(DrawCtx &drawCtx)
+{
+    // The frame's fence has been waited on, so whatever its last use wrote is complete
+    FrameData &frame = mFrames[drawCtx.frameIndex];
+    if (!frame.occlusionStatsPending)
+    {
+        return;
+    }
+
+    const void *data = mCtx->allocator.map(frame.occlusionStatsBuffer);
+    std::memcpy(&mOcclusionStats, data, sizeof(OcclusionStats));
+    mCtx->allocator.unmap(frame.occlusionStatsBuffer);
+    frame.occlusionStatsPending = false;
+
+    const uint32_t drawn =
+        mOcclusionStats.firstPhaseInstances + mOcclusionStats.secondPhaseInstances;
+    TracyPlot("Occlusion visible instances", static_cast<int64_t>(drawn));
+    TracyPlot("Occlusion culled instances", static_cast<int64_t>(mCullItemCount - drawn));
+    TracyPlot("Occluded instances", static_cast<int64_t>(mOcclusionStats.occludedInstances));
+}
+
+void ForwardRenderer::updateSceneBuffers(DrawCtx &drawCtx)
 {
-    VkZoneC("drawObjects", tracy::Color::Blue);
     const glm::mat4 view     = mScene->camera.GetViewMatrix();
     const glm::mat4 proj     = mScene->camera.GetProjectionMatrix();
     const glm::mat4 viewproj = proj * view;
@@ -458,127 +1838,245 @@ void ForwardRenderer::drawObjects(DrawCtx &drawCtx)
     {
         ZoneScopedNC("Scene buffer writes", tracy::Color::DeepSkyBlue4);
         VkZoneC("Scene buffer writes", tracy::Color::Olive);
-        // Writing camera data
-        void *data = mCtx->allocator.map(mFrames[drawCtx.frameIndex].cameraBuffer);
-        std::memcpy(data, &cameraData, sizeof(GpuCameraData));
-        mCtx->allocator.unmap(mFrames[drawCtx.frameIndex].cameraBuffer);
-
-        // Writing all of the object transforms
-        data            = mCtx->allocator.map(mFrames[drawCtx.frameIndex].objectBuffer);
-        auto objectData = static_cast<GpuObjectData *>(data);
+        FrameData &frame = mFrames[drawCtx.frameIndex];
+        *vk::Allocator::mapped<GpuCameraData>(frame.cameraBuffer) = cameraData;
+
+        // Every frame has its own copy of the transforms and lights, so each one is brought up to
+        // date the first time it's used after the scene changed
+        if (frame.sceneRevision == mScene->revision)
+        {
+            return;
+        }
+        frame.sceneRevision = mScene->revision;
+
+        auto *objectData = vk::Allocator::mapped<GpuObjectData>(frame.objectBuffer);
         for (size_t i = 0; i < mScene->renderables.size(); ++i)
         {
             objectData[i].modelTransform = mScene->renderables[i].transform;
         }
-        mCtx->allocator.unmap(mFrames[drawCtx.frameIndex].objectBuffer);
 
-        // Writing the dir light
-        data                    = mCtx->allocator.map(mFrames[drawCtx.frameIndex].dirLightBuffer);
-        auto dirLightData       = static_cast<GpuDirLight *>(data);
-        dirLightData->direction = glm::vec4(mScene->dirLight.direction, 0.f);
-        dirLightData->color     = glm::vec4(mScene->dirLight.color, 0.f);
-        mCtx->allocator.unmap(mFrames[drawCtx.frameIndex].dirLightBuffer);
+        *vk::Allocator::mapped<GpuDirLight>(frame.dirLightBuffer) =
+            GpuDirLight{glm::vec4(mScene->dirLight.direction, 0.f),
+                        glm::vec4(mScene->dirLight.color, 0.f)};
 
-        // Writing the lights to the light buffer
-        data                 = mCtx->allocator.map(mFrames[drawCtx.frameIndex].lightBuffer);
-        auto lightBufferData = static_cast<GpuPointLight *>(data);
+        auto *lightBufferData = vk::Allocator::mapped<GpuPointLight>(frame.lightBuffer);
         for (size_t i = 0; i < mScene->pointLights.size(); ++i)
         {
-            lightBufferData[i].position = glm::vec4(mScene->pointLights[i].position, 0.f);
+            lightBufferData[i].position =
+                glm::vec4(mScene->pointLights[i].position, mScene->pointLights[i].radius);
             lightBufferData[i].color    = glm::vec4(mScene->pointLights[i].color, 0.f);
         }
-        mCtx->allocator.unmap(mFrames[drawCtx.frameIndex].lightBuffer);
+    }
+}
+
+void ForwardRenderer::drawObjects(DrawCtx &drawCtx,
+                                  bool firstPass,
+                                  VkDescriptorSet globalDescriptor,
+                                  const DrawStream &draws)
+{
+    VkZoneC("drawObjects", tracy::Color::Blue);
+    // The second occlusion culling phase draws on top of the first
+    const VkAttachmentLoadOp loadOp =
+        firstPass ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+
+    if (firstPass)
+    {
+        // Depth gets cleared anyway, so whatever layout the last frame left it in is discarded
+        VkImageMemoryBarrier depthBarrier{};
+        depthBarrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        depthBarrier.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthBarrier.newLayout           = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+        depthBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        depthBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        depthBarrier.image               = drawCtx.depthImage;
+        depthBarrier.srcAccessMask       = 0;
+        depthBarrier.dstAccessMask       = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        depthBarrier.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+        vkCmdPipelineBarrier(drawCtx.commandBuffer,
+                             VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+    }
+
+    if (!mDepthPrepass)
+    {
+        beginRendering(drawCtx, globalDescriptor, colorAttachments(drawCtx), loadOp, loadOp);
+        recordDraws(drawCtx, draws, mGraphicsPipelines);
+        vkCmdEndRendering(drawCtx.commandBuffer);
+        return;
     }
 
+    // Lay down depth first with a position only pipeline, then shade with an EQUAL depth test
+    // so every pixel runs the fragment shader once no matter how much overdraw the scene has
     {
-        VkZoneC("Renderpass Begin", tracy::Color::LavenderBlush);
+        VkZoneC("depthPrepass", tracy::Color::SlateGray);
+        beginRendering(drawCtx, globalDescriptor, {}, loadOp, loadOp);
+        recordDraws(drawCtx, draws, mDepthPrepassPipelines);
+        vkCmdEndRendering(drawCtx.commandBuffer);
+    }
+
+    VkImageMemoryBarrier depthBarrier{};
+    depthBarrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    depthBarrier.oldLayout           = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    depthBarrier.newLayout           = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    depthBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    depthBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    depthBarrier.image               = drawCtx.depthImage;
+    depthBarrier.srcAccessMask       = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depthBarrier.dstAccessMask       = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    depthBarrier.subresourceRange    = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(drawCtx.commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                             VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+
+    beginRendering(drawCtx, globalDescriptor, colorAttachments(drawCtx), loadOp,
+                   VK_ATTACHMENT_LOAD_OP_LOAD);
+    recordDraws(drawCtx, draws, mDepthEqualPipelines);
+    vkCmdEndRendering(drawCtx.commandBuffer);
+}
+
+void ForwardRenderer::beginRendering(DrawCtx &drawCtx,
+                                     VkDescriptorSet globalDescriptor,
+                                     const std::vector<VkImageView> &colorViews,
+                                     VkAttachmentLoadOp colorLoadOp,
+                                     VkAttachmentLoadOp depthLoadOp)
+{
+    VkZoneC("Renderpass Begin", tracy::Color::LavenderBlush);
 
+    std::vector<VkRenderingAttachmentInfo> colorAttachmentInfos;
+    for (VkImageView view : colorViews)
+    {
         VkRenderingAttachmentInfo colorAttachment{};
         colorAttachment.sType       = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
-        colorAttachment.imageView   = drawCtx.swapchainImageView;
+        colorAttachment.imageView   = view;
         colorAttachment.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
-        colorAttachment.loadOp      = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.loadOp      = colorLoadOp;
         colorAttachment.storeOp     = VK_ATTACHMENT_STORE_OP_STORE;
         colorAttachment.clearValue  = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+        colorAttachmentInfos.push_back(colorAttachment);
+    }
 
-        VkRenderingAttachmentInfo depthAttachment{};
-        depthAttachment.sType       = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
-        depthAttachment.imageView   = drawCtx.depthImageView;
-        depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-        depthAttachment.loadOp      = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depthAttachment.storeOp     = VK_ATTACHMENT_STORE_OP_STORE;
-        VkClearValue depthClear{};
-        depthClear.depthStencil.depth = 1.0f;
-        depthAttachment.clearValue    = depthClear;
-
-        VkRenderingInfo renderInfo{};
-        renderInfo.sType                = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
-        renderInfo.flags                = 0;
-        renderInfo.renderArea           = {.offset = {0, 0}, .extent = mCtx->swapchainExtent};
-        renderInfo.layerCount           = 1;
-        renderInfo.colorAttachmentCount = 1;
-        renderInfo.pColorAttachments    = &colorAttachment;
-        renderInfo.pDepthAttachment     = &depthAttachment;
-
-        vkCmdBeginRendering(drawCtx.commandBuffer, &renderInfo);
-
-        vkCmdBindPipeline(drawCtx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          mGraphicsPipeline);
+    VkRenderingAttachmentInfo depthAttachment{};
+    depthAttachment.sType       = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    depthAttachment.imageView   = drawCtx.depthImageView;
+    depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    depthAttachment.loadOp      = depthLoadOp;
+    depthAttachment.storeOp     = VK_ATTACHMENT_STORE_OP_STORE;
+    VkClearValue depthClear{};
+    depthClear.depthStencil.depth = 1.0f;
+    depthAttachment.clearValue    = depthClear;
+
+    VkRenderingInfo renderInfo{};
+    renderInfo.sType                = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+    renderInfo.flags                = 0;
+    renderInfo.renderArea           = {.offset = {0, 0}, .extent = mCtx->swapchainExtent};
+    renderInfo.layerCount           = 1;
+    renderInfo.colorAttachmentCount = static_cast<uint32_t>(colorAttachmentInfos.size());
+    renderInfo.pColorAttachments    = colorAttachmentInfos.data();
+    renderInfo.pDepthAttachment     = &depthAttachment;
+
+    vkCmdBeginRendering(drawCtx.commandBuffer, &renderInfo);
+
+    // Nothing else gets bound per draw, draws find their bounds and material through their draw id
+    std::array<VkDescriptorSet, 2> sets = {globalDescriptor, mMaterialDescriptor};
+    vkCmdBindDescriptorSets(drawCtx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            mGraphicsPipelineLayout, 0, sets.size(), sets.data(), 0, nullptr);
 
-        std::array<VkDescriptorSet, 1> descriptorSets = {
-            mFrames[drawCtx.frameIndex].globalDescriptor};
-        vkCmdBindDescriptorSets(drawCtx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                mGraphicsPipelineLayout, 0, descriptorSets.size(),
-                                descriptorSets.data(), 0, nullptr);
+    VkViewport viewport{};
+    viewport.x        = 0.0f;
+    viewport.y        = 0.0f;
+    viewport.width    = static_cast<float>(mCtx->swapchainExtent.width);
+    viewport.height   = static_cast<float>(mCtx->swapchainExtent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(drawCtx.commandBuffer, 0, 1, &viewport);
 
-        VkViewport viewport{};
-        viewport.x        = 0.0f;
-        viewport.y        = 0.0f;
-        viewport.width    = static_cast<float>(mCtx->swapchainExtent.width);
-        viewport.height   = static_cast<float>(mCtx->swapchainExtent.height);
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        vkCmdSetViewport(drawCtx.commandBuffer, 0, 1, &viewport);
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = mCtx->swapchainExtent;
+    vkCmdSetScissor(drawCtx.commandBuffer, 0, 1, &scissor);
 
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = mCtx->swapchainExtent;
-        vkCmdSetScissor(drawCtx.commandBuffer, 0, 1, &scissor);
-    }
+    // Every mesh lives in the same vertex buffer, addressed through vertexOffset
+    VkBuffer vertexBuffer = mGeometryArena.vertexBuffer();
+    VkDeviceSize offset   = 0;
+    vkCmdBindVertexBuffers(drawCtx.commandBuffer, 0, 1, &vertexBuffer, &offset);
+}
 
-    for (const auto &object : mScene->renderables)
+void ForwardRenderer::recordDraws(DrawCtx &drawCtx,
+                                  const DrawStream &draws,
+                                  const std::array<VkPipeline, kDrawBucketCount> &pipelines)
+{
+    // One indirect call per bucket, whose draws are whichever the culling pass left with any
+    // instances. gl_DrawID picks each one's draw id out of the stream, and the instance list
+    // maps gl_InstanceIndex to an object index. Only the pipeline and the index type change
+    // between buckets.
+    VkCommandBuffer cmd = drawCtx.commandBuffer;
+    for (size_t bucket = 0; bucket < kDrawBucketCount; ++bucket)
     {
-        ZoneScopedC(tracy::Color::AntiqueWhite);
-
-        for (auto &mesh : object.model->meshes)
+        if (mBucketSizes[bucket] == 0)
         {
-            ZoneScopedC(tracy::Color::DodgerBlue);
-            VkZoneC("Mesh Draw", tracy::Color::Red);
-            if (!mesh.textures.contains(TextureType::ALBEDO) ||
-                !mesh.textures.contains(TextureType::METALLIC_ROUGHNESS))
-                continue;
+            continue;
+        }
 
-            VkDeviceSize offset = 0;
-            vkCmdBindVertexBuffers(drawCtx.commandBuffer, 0, 1, &mesh.vertexBuffer.buffer, &offset);
-            vkCmdBindIndexBuffer(drawCtx.commandBuffer, mesh.indexBuffer.buffer, 0,
-                                 VK_INDEX_TYPE_UINT32);
+        ZoneScopedC(tracy::Color::DodgerBlue);
+        VkZoneC("Bucket Draw", tracy::Color::Red);
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[bucket]);
+        vkCmdBindIndexBuffer(cmd, mGeometryArena.indexBuffer(), 0, bucketIndexType(bucket));
+        vkCmdDrawIndexedIndirectCount(
+            cmd, draws.commands.buffer,
+            mBucketStarts[bucket] * sizeof(VkDrawIndexedIndirectCommand), draws.counts.buffer,
+            bucket * sizeof(uint32_t), mBucketSizes[bucket], sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
 
-            vkCmdBindDescriptorSets(drawCtx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                    mGraphicsPipelineLayout, 1, 1, &mesh.descriptor, 0, nullptr);
+std::vector<VkFormat> ForwardRenderer::colorAttachmentFormats() const
+{
+    return {mCtx->swapchainImageFormat};
+}
 
-            vkCmdDrawIndexed(drawCtx.commandBuffer, static_cast<uint32_t>(mesh.indices.size()), 1,
-                             0, 0, 0);
-        }
-    }
+std::vector<VkImageView> ForwardRenderer::colorAttachments(const DrawCtx &drawCtx) const
+{
+    return {drawCtx.swapchainImageView};
+}
 
-    vkCmdEndRendering(drawCtx.commandBuffer);
+ForwardRenderer::ShadingBuffers ForwardRenderer::shadingBuffers(size_t frame) const
+{
+    return ShadingBuffers{mFrames[frame].cameraBuffer.buffer, mFrames[frame].dirLightBuffer.buffer,
+                          mFrames[frame].lightBuffer.buffer, mLightClusters.gridBuffer(frame),
+                          mLightClusters.lightListBuffer(frame)};
 }
 
 void ForwardRenderer::recordCommandBuffer(DrawCtx &drawCtx)
 {
     ZoneScopedC(tracy::Color::PeachPuff);
 
-    drawObjects(drawCtx);
+    FrameData &frame = mFrames[drawCtx.frameIndex];
+
+    updateSceneBuffers(drawCtx);
+    buildLightClusters(drawCtx);
+    readOcclusionStats(drawCtx);
+    if (mGpuDriven)
+    {
+        cullObjectsOnGpu(drawCtx);
+    }
+    else
+    {
+        cullObjectsOnCpu(drawCtx);
+    }
+    drawObjects(drawCtx, true, mGpuDriven ? frame.culledGlobalDescriptor : frame.globalDescriptor,
+                mGpuDriven ? frame.culledDraws : frame.cpuDraws);
+
+    // Second phase: whatever the first phase skipped but the new depth pyramid shows is visible
+    if (mOcclusionCulling)
+    {
+        buildDepthPyramid(drawCtx);
+        cullOccludedObjects(drawCtx);
+        drawObjects(drawCtx, false, frame.occlusionGlobalDescriptor, frame.occlusionDraws);
+    }
 }
 
 }  // namespace hatgpu
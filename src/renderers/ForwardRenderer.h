@@ -4,6 +4,7 @@
 
 #include "application/Constants.h"
 #include "application/Renderer.h"
+#include "geometry/FrustumCuller.h"
 #include "geometry/Model.h"
 #include "scene/Camera.h"
 #include "scene/Scene.h"
@@ -11,15 +12,24 @@
 #include "ui/Toggle.h"
 #include "vk/allocator.h"
 #include "vk/deleter.h"
+#include "vk/depth_pyramid.h"
+#include "vk/geometry_arena.h"
+#include "vk/gpu_timer.h"
 #include "vk/gpu_texture.h"
+#include "vk/light_clusters.h"
 #include "vk/types.h"
 
 #include <glm/glm.hpp>
 
+#include <chrono>
 #include <iostream>
+#include <optional>
 
 namespace hatgpu
 {
+// Draws are grouped by what has to be bound for them, the pipeline of their vertex format and the
+// index buffer with their index type, and every group is drawn with one indirect call
+static constexpr size_t kDrawBucketCount = kVertexFormatCount * 2;
 
 class ForwardRenderer : public Renderer
 {
@@ -31,40 +41,247 @@ class ForwardRenderer : public Renderer
     void OnRender(DrawCtx &drawCtx) override;
     void OnImGuiRender() override;
 
+    // Smoothed GPU time of everything this renderer records per frame
+    inline float gpuTimeMs() const { return mGpuTimeMs; }
+
     static const LayerRequirements kRequirements;
 
+  protected:
+    // For renderers that only change how the drawn scene gets shaded, and reuse everything else
+    ForwardRenderer(const std::string &debugName,
+                    std::shared_ptr<vk::Ctx> ctx,
+                    std::shared_ptr<Scene> scene,
+                    const char *fragmentShaderName);
+
+    // What the scene is drawn into, the swapchain image by default. Only the first attachment is
+    // blended.
+    virtual std::vector<VkFormat> colorAttachmentFormats() const;
+    virtual std::vector<VkImageView> colorAttachments(const DrawCtx &drawCtx) const;
+    virtual void recordCommandBuffer(DrawCtx &drawCtx);
+
+    // The culling and lighting controls
+    void drawControls();
+
+    // The buffers shading a frame reads, in the bindings of shaders/common/shading.glsl
+    struct ShadingBuffers
+    {
+        VkBuffer camera;
+        VkBuffer dirLight;
+        VkBuffer pointLights;
+        VkBuffer clusterGrid;
+        VkBuffer clusterLights;
+    };
+    ShadingBuffers shadingBuffers(size_t frame) const;
+
   private:
+    // What actually gets drawn: the commands of the draws with any instances, packed to the front
+    // of their bucket's range of the draw list. drawIds holds the draw each command is for and
+    // counts how many commands each bucket has.
+    struct DrawStream
+    {
+        vk::AllocatedBuffer commands;
+        vk::AllocatedBuffer drawIds;
+        vk::AllocatedBuffer counts;
+    };
+
     void createDescriptors();
     void createGraphicsPipeline();
+    void createCullingPipeline();
+    void createOcclusionPipeline();
+    void createCompactionPipeline();
     void uploadSceneToGpu();
+    // See benchmark::Mode::kSceneUpload
+    void benchmarkSceneUpload();
+    void createDrawList();
+    vk::AllocatedBuffer uploadBuffer(const void *data,
+                                     size_t size,
+                                     VkBufferUsageFlags usage,
+                                     VkPipelineStageFlags dstStage,
+                                     VkAccessFlags dstAccess);
 
-    void drawObjects(DrawCtx &drawCtx);
-    void recordCommandBuffer(DrawCtx &drawCtx);
+    void updateSceneBuffers(DrawCtx &drawCtx);
+    void buildLightClusters(DrawCtx &drawCtx);
+    void cullObjectsOnCpu(DrawCtx &drawCtx);
+    void cullObjectsOnGpu(DrawCtx &drawCtx);
+    void cullOccludedObjects(DrawCtx &drawCtx);
+    // Turns the per draw commands a GPU culling pass wrote into one of the frame's DrawStreams
+    void compactDraws(DrawCtx &drawCtx, VkDescriptorSet compactDescriptor);
+    void readOcclusionStats(DrawCtx &drawCtx);
 
+    // Draws `draws`, whose draw ids have to be the ones bound in `globalDescriptor`. The first
+    // pass clears the attachments and later ones load them.
+    void drawObjects(DrawCtx &drawCtx,
+                     bool firstPass,
+                     VkDescriptorSet globalDescriptor,
+                     const DrawStream &draws);
+    void buildDepthPyramid(DrawCtx &drawCtx);
+    // Begins rendering to `colorViews` and the depth image, with the state every draw shares
+    void beginRendering(DrawCtx &drawCtx,
+                        VkDescriptorSet globalDescriptor,
+                        const std::vector<VkImageView> &colorViews,
+                        VkAttachmentLoadOp colorLoadOp,
+                        VkAttachmentLoadOp depthLoadOp);
+    void recordDraws(DrawCtx &drawCtx,
+                     const DrawStream &draws,
+                     const std::array<VkPipeline, kDrawBucketCount> &pipelines);
+
+    // Uploads the mesh's textures and assigns it a material
     void uploadTextures(Mesh &mesh);
+    // Writes every uploaded texture and material to mMaterialDescriptor
+    void createMaterialSet();
 
     VkPipelineLayout mGraphicsPipelineLayout;
-    VkPipeline mGraphicsPipeline;
+    // One variant per draw bucket, indexed by it. Buckets of the same vertex format only differ in
+    // which part of the draw id buffer they read.
+    std::array<VkPipeline, kDrawBucketCount> mGraphicsPipelines;
+    // Depth only variants for the pre-pass, and shading ones testing EQUAL against its depth
+    std::array<VkPipeline, kDrawBucketCount> mDepthPrepassPipelines;
+    std::array<VkPipeline, kDrawBucketCount> mDepthEqualPipelines;
 
     VkDescriptorSetLayout mGlobalSetLayout;
-    VkDescriptorSetLayout mTextureSetLayout;
+    VkDescriptorSetLayout mMaterialSetLayout;
+
+    VkDescriptorSetLayout mCullSetLayout;
+    VkPipelineLayout mCullPipelineLayout;
+    VkPipeline mCullPipeline;
+
+    VkDescriptorSetLayout mOcclusionSetLayout;
+    VkPipelineLayout mOcclusionPipelineLayout;
+    VkPipeline mOcclusionPipeline;
+
+    VkDescriptorSetLayout mCompactSetLayout;
+    VkPipelineLayout mCompactPipelineLayout;
+    VkPipeline mCompactPipeline;
 
     VkDescriptorPool mDescriptorPool;
     struct FrameData
     {
         VkDescriptorSet globalDescriptor;
+        // Same as globalDescriptor, but with the instance list and draw ids the culling pass
+        // writes
+        VkDescriptorSet culledGlobalDescriptor;
+        // And with the ones the occlusion pass writes
+        VkDescriptorSet occlusionGlobalDescriptor;
+        VkDescriptorSet cullDescriptor;
+        VkDescriptorSet occlusionDescriptor;
+        VkDescriptorSet culledCompactDescriptor;
+        VkDescriptorSet occlusionCompactDescriptor;
         vk::AllocatedBuffer cameraBuffer;
         vk::AllocatedBuffer objectBuffer;
         vk::AllocatedBuffer dirLightBuffer;
         vk::AllocatedBuffer lightBuffer;
+        // Scene::revision the object and light buffers were last written for
+        std::optional<uint64_t> sceneRevision;
+        // Instance lists and draws written by the CPU every frame when not culling on the GPU
+        vk::AllocatedBuffer instanceBuffer;
+        DrawStream cpuDraws;
+        vk::AllocatedBuffer drawCommandBuffer;
+        vk::AllocatedBuffer culledInstanceBuffer;
+        DrawStream culledDraws;
+
+        // Second phase of occlusion culling
+        vk::AllocatedBuffer occlusionCommandBuffer;
+        vk::AllocatedBuffer occlusionInstanceBuffer;
+        DrawStream occlusionDraws;
+        // Per cull item, 1 if the CPU drew it in the first phase
+        vk::AllocatedBuffer firstPhaseBuffer;
+        // Copy of mVisibilityBuffer for CPU culling to read once this frame is done
+        vk::AllocatedBuffer visibilityReadback;
+        vk::AllocatedBuffer occlusionStatsBuffer;
+        bool occlusionStatsPending{false};
     };
     std::array<FrameData, constants::kMaxFramesInFlight> mFrames;
 
+    // Vertex and index data of every mesh in the scene
+    vk::GeometryArena mGeometryArena;
+
+    // Point lights binned into view space clusters, so fragments only shade the ones reaching them
+    vk::LightClusters mLightClusters;
+
+    // Two phase occlusion culling: the first phase draws what was visible last frame, a depth
+    // pyramid is built from the result, and the second phase draws whatever that reveals.
+    // mVisibilityBuffer holds 1 per cull item that passed the last second phase.
+    vk::DepthPyramid mDepthPyramid;
+    vk::AllocatedBuffer mVisibilityBuffer;
+    struct OcclusionStats
+    {
+        uint32_t firstPhaseInstances;
+        uint32_t secondPhaseInstances;
+        uint32_t occludedInstances;
+        uint32_t frustumCulledInstances;
+    };
+    OcclusionStats mOcclusionStats{};
+
+    // One draw per unique mesh, each owning the instance list range [instanceBase, instanceBase +
+    // instanceCount). Both drawing modes go through these, only where the instance counts and
+    // lists come from differs. Cull item i is the i-th entry of the full instance list, so the
+    // items of a draw are its instance list range too. Sorted by bucket, bucket b's draws are
+    // [mBucketStarts[b], mBucketStarts[b] + mBucketSizes[b]).
+    struct DrawEntry
+    {
+        const Mesh *mesh;
+        uint32_t instanceBase;
+        uint32_t instanceCount;
+        size_t bucket;
+    };
+    std::vector<DrawEntry> mDraws;
+    std::array<uint32_t, kDrawBucketCount> mBucketStarts{};
+    std::array<uint32_t, kDrawBucketCount> mBucketSizes{};
+    uint32_t mCullItemCount{0};
+    vk::AllocatedBuffer mCullItemBuffer;
+    // The bucket starts followed by every draw's bounds, material and instance list range, read by
+    // the culling passes and the vertex shaders
+    vk::AllocatedBuffer mDrawRecordBuffer;
+    // Indirect commands with instanceCount = 0, copied over the frame's commands before culling
+    vk::AllocatedBuffer mDrawCommandTemplateBuffer;
+
+    // CPU side of the cull items: the object index and world space bounds of each
+    std::vector<uint32_t> mCullItemObjects;
+    AabbSoA mCullItemBounds;
+    // Indices of the items that passed CPU culling this frame
+    std::vector<uint32_t> mVisibleItems;
+    // Staging for the frame's firstPhaseBuffer
+    std::vector<uint32_t> mFirstPhaseFlags;
+
+    ui::Toggle mGpuDrivenToggle{false};
+    bool mGpuDriven{false};
+    ui::Toggle mCpuCullingToggle{true};
+    bool mCpuCulling{true};
+    ui::Toggle mOcclusionCullingToggle{true};
+    bool mOcclusionCulling{true};
+    ui::Toggle mClusteredLightingToggle{true};
+    bool mClusteredLighting{true};
+    ui::Toggle mDepthPrepassToggle{false};
+    bool mDepthPrepass{false};
+
     TextureManager mTextureManager;
     std::unordered_map<std::string, vk::GpuTexture> mGpuTextures;
 
+    // Bindless materials: every texture in one descriptor array, which the materials index into.
+    // Meshes select theirs through their draw record, so the set is bound once per pass.
+    // Indices into the texture array, ~0u where the mesh has none
+    struct GpuMaterial
+    {
+        uint32_t albedoTexture;
+        uint32_t metalnessRoughnessTexture;
+    };
+    std::unordered_map<std::string, uint32_t> mTextureIndices;
+    std::vector<VkDescriptorImageInfo> mBindlessTextures;
+    uint32_t mMaxBindlessTextures{0};
+    std::vector<GpuMaterial> mMaterials;
+    vk::AllocatedBuffer mMaterialBuffer;
+    VkDescriptorSet mMaterialDescriptor;
+
     uint32_t mFrameCount{0};
 
+    const char *mFragmentShaderName;
+    vk::GpuTimer mGpuTimer;
+    float mGpuTimeMs{0.f};
+    std::string mGpuTimePlotName;
+
+    vk::UploadContext::Ticket mSceneUploadTicket{0};
+    std::chrono::steady_clock::time_point mSceneUploadStart;
+
     std::string mScenePath;
 };
 
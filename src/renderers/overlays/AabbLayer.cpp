@@ -233,30 +233,20 @@ void AabbLayer::createGeometry()
 
 void AabbLayer::uploadGeometry()
 {
-    // Uploading the vertex data followed by the index data in contiguous memory
     const size_t verticesSize = mVertices.size() * sizeof(glm::vec4);
-    const size_t indicesSize  = mIndices.size() * sizeof(Mesh::IndexType);
 
-    vk::Allocator allocator = mCtx->allocator;
-
-    vk::AllocatedBuffer vertexStagingBuffer = allocator.createBuffer(
-        verticesSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-    vk::AllocatedBuffer indexStagingBuffer = allocator.createBuffer(
-        indicesSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-    void *data = allocator.map(vertexStagingBuffer);
-    std::memcpy(data, mVertices.data(), verticesSize);
-    /*glm::vec4 *dataGlm = reinterpret_cast<glm::vec4 *>(data);
-    for (size_t i = 0; i < mVertices.size(); ++i)
+    // Same rule as for meshes, the boxes of small scenes fit in 16 bit indices
+    mIndexType = selectIndexType(mVertices.size());
+    std::vector<uint16_t> narrowedIndices;
+    const void *indexData = mIndices.data();
+    if (mIndexType == VK_INDEX_TYPE_UINT16)
     {
-        LOGGER.error("{}: {}", i, glm::to_string(dataGlm[i]));
-    }*/
-    ;
-    allocator.unmap(vertexStagingBuffer);
+        narrowIndices(mIndices, narrowedIndices);
+        indexData = narrowedIndices.data();
+    }
+    const size_t indicesSize = mIndices.size() * indexTypeSize(mIndexType);
 
-    data = allocator.map(indexStagingBuffer);
-    std::memcpy(data, mIndices.data(), indicesSize);
-    allocator.unmap(indexStagingBuffer);
+    vk::Allocator &allocator = mCtx->allocator;
 
     mVertexBuffer = allocator.createBuffer(
         verticesSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
@@ -265,22 +255,36 @@ void AabbLayer::uploadGeometry()
         indicesSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VMA_MEMORY_USAGE_GPU_ONLY);
 
-    mCtx->uploadContext.immediateSubmit([=, this](VkCommandBuffer cmd) {
-        VkBufferCopy vboCopy{};
-        vboCopy.dstOffset = 0;
-        vboCopy.srcOffset = 0;
-        vboCopy.size      = verticesSize;
-        vkCmdCopyBuffer(cmd, vertexStagingBuffer.buffer, mVertexBuffer.buffer, 1, &vboCopy);
-
-        VkBufferCopy iboCopy{};
-        iboCopy.dstOffset = 0;
-        iboCopy.srcOffset = 0;
-        iboCopy.size      = indicesSize;
-        vkCmdCopyBuffer(cmd, indexStagingBuffer.buffer, mIndexBuffer.buffer, 1, &iboCopy);
-    });
-
-    allocator.destroyBuffer(vertexStagingBuffer);
-    allocator.destroyBuffer(indexStagingBuffer);
+    vk::StagingAllocation vertexStaging =
+        mCtx->uploadContext.stage(mVertices.data(), verticesSize);
+    vk::StagingAllocation indexStaging = mCtx->uploadContext.stage(indexData, indicesSize);
+
+    mCtx->uploadContext.record(
+        [=, this](VkCommandBuffer cmd) {
+            VkBufferCopy vboCopy{};
+            vboCopy.dstOffset = 0;
+            vboCopy.srcOffset = vertexStaging.offset;
+            vboCopy.size      = verticesSize;
+            vkCmdCopyBuffer(cmd, vertexStaging.buffer, mVertexBuffer.buffer, 1, &vboCopy);
+
+            VkBufferCopy iboCopy{};
+            iboCopy.dstOffset = 0;
+            iboCopy.srcOffset = indexStaging.offset;
+            iboCopy.size      = indicesSize;
+            vkCmdCopyBuffer(cmd, indexStaging.buffer, mIndexBuffer.buffer, 1, &iboCopy);
+
+            mCtx->uploadContext.releaseBuffer(cmd, mVertexBuffer.buffer);
+            mCtx->uploadContext.releaseBuffer(cmd, mIndexBuffer.buffer);
+        },
+        [this](VkCommandBuffer cmd) {
+            mCtx->uploadContext.acquireBuffer(cmd, mVertexBuffer.buffer,
+                                              VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                              VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+            mCtx->uploadContext.acquireBuffer(cmd, mIndexBuffer.buffer,
+                                              VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                              VK_ACCESS_INDEX_READ_BIT);
+        });
+    mCtx->uploadContext.submit();
 }
 
 void AabbLayer::OnDetach()
@@ -336,7 +340,7 @@ void AabbLayer::OnRender(DrawCtx &drawCtx)
 
         VkDeviceSize offset = 0;
         vkCmdBindVertexBuffers(drawCtx.commandBuffer, 0, 1, &mVertexBuffer.buffer, &offset);
-        vkCmdBindIndexBuffer(drawCtx.commandBuffer, mIndexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdBindIndexBuffer(drawCtx.commandBuffer, mIndexBuffer.buffer, 0, mIndexType);
 
         PushConstants pushConstants{};
         pushConstants.renderMatrix =
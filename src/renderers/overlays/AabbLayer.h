@@ -39,6 +39,7 @@ class AabbLayer : public Layer
     std::vector<Mesh::IndexType> mIndices;
     vk::AllocatedBuffer mVertexBuffer;
     vk::AllocatedBuffer mIndexBuffer;
+    VkIndexType mIndexType{VK_INDEX_TYPE_UINT32};
 };
 
 }  // namespace hatgpu
@@ -2,9 +2,11 @@
 
 #include "Scene.h"
 #include "util/Random.h"
+#include "util/ThreadPool.h"
 
 #include <nlohmann/json.hpp>
 
+#include <cmath>
 #include <fstream>
 
 using namespace nlohmann;
@@ -23,10 +25,25 @@ void from_json(const json &j, ::glm::vec3 &v)
 
 namespace hatgpu
 {
+namespace
+{
+// Has to match kPointLightIntensity in shaders/common/light_clusters.glsl
+static constexpr float kPointLightIntensity = 5.f;
+static constexpr float kPointLightCutoff    = 1.f / 32.f;
+
+// Where intensity * color / distance^2 falls to kPointLightCutoff for the brightest channel
+float cutoffRadius(const glm::vec3 &color)
+{
+    const float brightest = std::max({color.r, color.g, color.b});
+    return std::sqrt(kPointLightIntensity * brightest / kPointLightCutoff);
+}
+}  // namespace
+
 void from_json(const json &j, PointLight &p)
 {
     j.at("position").get_to(p.position);
     j.at("color").get_to(p.color);
+    p.radius = j.value("radius", 0.f);
 }
 
 void from_json(const json &j, DirLight &d)
@@ -35,6 +52,33 @@ void from_json(const json &j, DirLight &d)
     j.at("color").get_to(d.color);
 }
 
+void Scene::groupInstances()
+{
+    // Order renderables by the order their model was first loaded in, so that every model's
+    // instances occupy one contiguous range of the object buffer
+    std::unordered_map<const Model *, size_t> modelOrder;
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        modelOrder[models[i].get()] = i;
+    }
+    std::stable_sort(renderables.begin(), renderables.end(),
+                     [&modelOrder](const RenderObject &a, const RenderObject &b) {
+                         return modelOrder[a.model.get()] < modelOrder[b.model.get()];
+                     });
+
+    instances.clear();
+    for (size_t i = 0; i < renderables.size(); ++i)
+    {
+        if (instances.empty() || instances.back().model != renderables[i].model)
+        {
+            instances.push_back({renderables[i].model, static_cast<uint32_t>(i), 0});
+        }
+        ++instances.back().instanceCount;
+    }
+
+    LOGGER.info("Scene: {} renderables share {} unique models", renderables.size(), models.size());
+}
+
 void Scene::loadFromJson(const std::string &path)
 {
     std::ifstream inputFile(path);
@@ -46,6 +90,8 @@ void Scene::loadFromJson(const std::string &path)
 
         if (j.contains("models"))
         {
+            std::unordered_map<std::string, std::shared_ptr<Model>> modelsByPath;
+
             for (auto &modelJson : j.at("models"))
             {
                 std::string modelPath = modelJson.at("path").get<std::string>();
@@ -80,13 +126,25 @@ void Scene::loadFromJson(const std::string &path)
 
                 glm::mat4 modelTransform = translation * rotation * scale;
 
+                std::shared_ptr<Model> &model = modelsByPath[modelPath];
+                if (model == nullptr)
+                {
+                    model = std::make_shared<Model>();
+                    model->loadFromObj(modelPath, textureManager);
+                    models.push_back(model);
+                }
+
                 RenderObject renderObj{};
-                renderObj.model = std::make_shared<Model>();
-                renderObj.model->loadFromObj(modelPath, textureManager);
+                renderObj.model     = model;
                 renderObj.transform = modelTransform;
 
                 renderables.push_back(renderObj);
             };
+
+            groupInstances();
+
+            // Models only register the textures they reference, decode all of them in one go
+            textureManager.decodePending(ThreadPool::GetOrCreateInstance());
         }
 
         if (j.contains("lights"))
@@ -98,12 +156,15 @@ void Scene::loadFromJson(const std::string &path)
                 auto rangeMax = lightsJson.at("rangeMax").get<glm::vec3>();
                 auto colors   = lightsJson.at("colors").get<std::vector<glm::vec3>>();
                 auto count    = lightsJson.at("count").get<size_t>();
+                auto radius   = lightsJson.value("radius", 0.f);
 
+                pointLights.reserve(count);
                 for (size_t i = 0; i < count; ++i)
                 {
                     PointLight p;
                     p.color    = colors[i % colors.size()];
                     p.position = Random::GetRandomInRange<glm::vec3>(rangeMin, rangeMax);
+                    p.radius   = radius;
                     pointLights.push_back(p);
                 }
             }
@@ -112,6 +173,14 @@ void Scene::loadFromJson(const std::string &path)
                 lightsJson.at("pointLights").get_to(pointLights);
             }
 
+            for (PointLight &p : pointLights)
+            {
+                if (p.radius <= 0.f)
+                {
+                    p.radius = cutoffRadius(p.color);
+                }
+            }
+
             if (lightsJson.contains("dirLight"))
             {
                 lightsJson.at("dirLight").get_to(dirLight);
@@ -126,5 +195,7 @@ void Scene::loadFromJson(const std::string &path)
     {
         H_ASSERT(false, e.what());
     }
+
+    ++revision;
 }
 }  // namespace hatgpu
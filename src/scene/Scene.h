@@ -19,10 +19,22 @@ struct RenderObject
     glm::mat4 transform;
 };
 
+// A contiguous range of Scene::renderables that all use the same model, drawn as one instanced
+// draw per mesh
+struct ModelInstances
+{
+    std::shared_ptr<Model> model;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+
 struct PointLight
 {
     glm::vec3 position;
     glm::vec3 color = glm::vec3(1.f);
+    // Past this the light contributes nothing, which is what lets it be binned into clusters.
+    // Lights that don't set it get the distance where they fade out, see cutoffRadius().
+    float radius = 0.f;
 };
 
 struct DirLight
@@ -33,14 +45,24 @@ struct DirLight
 
 struct Scene
 {
+    // Sorted so that renderables sharing a model are next to each other
     std::vector<RenderObject> renderables;
+    // Every model is only loaded once, no matter how many renderables reference it
+    std::vector<std::shared_ptr<Model>> models;
+    std::vector<ModelInstances> instances;
     std::vector<PointLight> pointLights;
     DirLight dirLight;
+    // Bumped whenever a renderable's transform or a light changes, so renderers can skip
+    // re-uploading them when it hasn't
+    uint64_t revision{0};
 
     Camera camera;
     TextureManager textureManager;
 
     void loadFromJson(const std::string &path);
+
+  private:
+    void groupInstances();
 };
 }  // namespace hatgpu
 
@@ -1,9 +1,14 @@
 #include "hatpch.h"
 
 #include "texture/Texture.h"
+#include "util/Benchmark.h"
 #include "vk/gpu_texture.h"
 #include "vk/initializers.h"
 
+#include <tracy/Tracy.hpp>
+
+#include <chrono>
+
 #ifdef DEBUG_BUILD
 #    define STBI_NO_SIMD
 #endif
@@ -12,6 +17,45 @@
 
 namespace hatgpu
 {
+namespace
+{
+// Runs on worker threads, so failures are reported by returning nullptr instead of asserting
+std::shared_ptr<Texture> decodeTexture(const std::string &file)
+{
+    ZoneScopedNC("Decode texture", tracy::Color::Orange);
+
+    int width, height, channels;
+    stbi_uc *ucPixels = stbi_load(file.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (ucPixels == nullptr)
+    {
+        return nullptr;
+    }
+
+    return std::make_shared<Texture>(static_cast<void *>(ucPixels), width, height);
+}
+
+// Decodes every file on `pool` and returns the total number of decoded bytes
+size_t decodeAll(const std::vector<std::string> &files, ThreadPool &pool)
+{
+    std::vector<std::future<std::shared_ptr<Texture>>> results;
+    results.reserve(files.size());
+    for (const auto &file : files)
+    {
+        results.push_back(pool.submit([file]() { return decodeTexture(file); }));
+    }
+
+    size_t totalBytes = 0;
+    for (auto &result : results)
+    {
+        if (std::shared_ptr<Texture> texture = result.get())
+        {
+            totalBytes += texture->sizeBytes();
+        }
+    }
+    return totalBytes;
+}
+}  // namespace
+
 void TextureManager::loadTexture(const std::string &file)
 {
     if (textures.contains(file))
@@ -19,13 +63,86 @@ void TextureManager::loadTexture(const std::string &file)
         return;
     }
 
-    int width, height, channels;
-    stbi_uc *ucPixels = stbi_load(file.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    // The future gets filled in once decodePending() kicks off the decode
+    textures.emplace(file, std::shared_future<std::shared_ptr<Texture>>());
+    mPending.push_back(file);
+}
+
+void TextureManager::decodePending(ThreadPool &pool)
+{
+    if (mPending.empty())
+    {
+        return;
+    }
+
+    ZoneScopedNC("TextureManager::decodePending", tracy::Color::Orange);
+    const auto start = std::chrono::steady_clock::now();
+
+    for (const auto &file : mPending)
+    {
+        textures[file] = pool.submit([file]() { return decodeTexture(file); }).share();
+    }
+
+    size_t totalBytes = 0;
+    for (const auto &file : mPending)
+    {
+        const std::shared_ptr<Texture> &texture = textures[file].get();
+        H_ASSERT(texture != nullptr, std::string("Failed to load texture file: ") + file);
+        if (texture != nullptr)
+        {
+            totalBytes += texture->sizeBytes();
+        }
+    }
+
+    const std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+    const float megabytes                      = static_cast<float>(totalBytes) / (1024 * 1024);
+    LOGGER.info("Decoded {} textures ({:.1f}MB) in {:.2f}ms on {} threads, {:.1f}MB/s",
+                mPending.size(), megabytes, elapsed.count() * 1000.f, pool.size(),
+                megabytes / elapsed.count());
+
+    if (benchmark::enabled(benchmark::Mode::kTextureDecode))
+    {
+        benchmarkDecode(mPending);
+        benchmark::finish();
+    }
+
+    mPending.clear();
+}
+
+std::shared_ptr<Texture> TextureManager::get(const std::string &file) const
+{
+    const auto it = textures.find(file);
+    H_ASSERT(it != textures.end() && it->second.valid(),
+             std::string("Texture was never decoded: ") + file);
+    return it->second.get();
+}
 
-    H_ASSERT(ucPixels != nullptr, std::string("Failed to load texture file: ") + file);
+void TextureManager::benchmarkDecode(const std::vector<std::string> &files) const
+{
+    const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> threadCounts{1, 2, 4, hardwareThreads};
+    std::sort(threadCounts.begin(), threadCounts.end());
+    threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+    float singleThreadedSeconds = 0.f;
+    for (const size_t threadCount : threadCounts)
+    {
+        ThreadPool pool(threadCount);
+
+        const auto start                           = std::chrono::steady_clock::now();
+        const size_t totalBytes                    = decodeAll(files, pool);
+        const std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
 
-    auto result    = std::make_shared<Texture>(static_cast<void *>(ucPixels), width, height);
-    textures[file] = std::move(result);
+        if (threadCount == 1)
+        {
+            singleThreadedSeconds = elapsed.count();
+        }
+
+        const float megabytes = static_cast<float>(totalBytes) / (1024 * 1024);
+        LOGGER.info("Texture decode benchmark: {} threads, {:.2f}ms, {:.1f}MB/s, {:.2f}x speedup",
+                    threadCount, elapsed.count() * 1000.f, megabytes / elapsed.count(),
+                    singleThreadedSeconds / elapsed.count());
+    }
 }
 
 Texture::~Texture()
@@ -37,15 +154,9 @@ vk::GpuTexture Texture::upload(VkDevice device,
                                vk::Allocator &allocator,
                                vk::UploadContext &context)
 {
-    // Create staging buffer for image
-    VkDeviceSize imageSize            = width * height * 4;
-    vk::AllocatedBuffer stagingBuffer = allocator.createBuffer(
-        imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-    // Write the CPU texture data into the staging buffer
-    void *data = allocator.map(stagingBuffer);
-    std::memcpy(data, pixels, imageSize);
-    allocator.unmap(stagingBuffer);
+    // Write the CPU texture data into staging memory owned by the upload context
+    VkDeviceSize imageSize        = width * height * 4;
+    vk::StagingAllocation staging = context.stage(pixels, imageSize);
 
     // Grab the dimensions of the texture
     VkExtent3D imageExtent{};
@@ -68,17 +179,18 @@ vk::GpuTexture Texture::upload(VkDevice device,
     vmaCreateImage(allocator.Impl, &imageInfo, &imgAllocInfo, &newImage.image, &newImage.allocation,
                    nullptr);
 
-    // Use GPU commands to transfer the data from the staging buffer
-    // and create the mip levels with blits
-    context.immediateSubmit([&](VkCommandBuffer cmd) {
-        // Make a barrier so that we are ready to write to our destination texture
-        VkImageSubresourceRange range;
-        range.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
-        range.baseMipLevel   = 0;
-        range.levelCount     = mipLevels;
-        range.baseArrayLayer = 0;
-        range.layerCount     = 1;
+    VkImageSubresourceRange range;
+    range.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel   = 0;
+    range.levelCount     = mipLevels;
+    range.baseArrayLayer = 0;
+    range.layerCount     = 1;
 
+    // Use GPU commands to transfer the data from the staging buffer on the transfer queue, then
+    // create the mip levels with blits on the graphics queue since transfer queues can't blit.
+    // This only records the commands, they execute whenever the upload context submits the batch.
+    const auto copyToImage = [&](VkCommandBuffer cmd) {
+        // Make a barrier so that we are ready to write to our destination texture
         VkImageMemoryBarrier imageBarrierTransfer{};
         imageBarrierTransfer.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         imageBarrierTransfer.oldLayout        = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -93,7 +205,7 @@ vk::GpuTexture Texture::upload(VkDevice device,
                              0, 0, nullptr, 0, nullptr, 1, &imageBarrierTransfer);
 
         VkBufferImageCopy copyRegion = {};
-        copyRegion.bufferOffset      = 0;
+        copyRegion.bufferOffset      = staging.offset;
         copyRegion.bufferRowLength   = 0;
         copyRegion.bufferImageHeight = 0;
 
@@ -104,9 +216,17 @@ vk::GpuTexture Texture::upload(VkDevice device,
         copyRegion.imageExtent                     = imageExtent;
 
         // copy the buffer into the image
-        vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, newImage.image,
+        vkCmdCopyBufferToImage(cmd, staging.buffer, newImage.image,
                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
 
+        context.releaseImage(cmd, newImage.image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    };
+
+    const auto generateMips = [&](VkCommandBuffer cmd) {
+        context.acquireImage(cmd, newImage.image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
         // The barrier that we'll use for our mip map generation
         VkImageMemoryBarrier barrier{};
         barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -184,14 +304,13 @@ vk::GpuTexture Texture::upload(VkDevice device,
         vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
                              VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
                              &barrier);
-    });
+    };
+
+    context.record(copyToImage, generateMips);
 
     vk::GpuTexture result;
     result.mipLevels = mipLevels;
     result.image     = newImage;
-    // Create the image view
-
-    allocator.destroyBuffer(stagingBuffer);
 
     // Create the image view
     VkImageViewCreateInfo imageViewInfo = vk::imageViewInfo(VK_FORMAT_R8G8B8A8_SRGB, newImage.image,
@@ -3,10 +3,13 @@
 #include <vulkan/vulkan_core.h>
 #include "hatpch.h"
 
+#include "util/ThreadPool.h"
 #include "vk/allocator.h"
 #include "vk/gpu_texture.h"
 #include "vk/upload_context.h"
 
+#include <future>
+
 namespace hatgpu
 {
 class Texture
@@ -41,6 +44,9 @@ class Texture
 
     vk::GpuTexture upload(VkDevice device, vk::Allocator &allocator, vk::UploadContext &context);
 
+    // Size of the decoded RGBA8 pixels
+    inline size_t sizeBytes() const { return static_cast<size_t>(width) * height * 4; }
+
   private:
     void *pixels;
     uint32_t width;
@@ -53,11 +59,25 @@ enum class TextureType
     METALLIC_ROUGHNESS,
 };
 
-// Caches and manages CPU texture data
+// Caches and manages CPU texture data. Loading happens in two steps: models register the paths
+// they reference while they're being imported, and then every registered path is decoded at once
+// on a thread pool. A path is only ever decoded once no matter how often it's registered.
 struct TextureManager
 {
+    // Registers `file` to be decoded by the next call to decodePending()
     void loadTexture(const std::string &file);
-    std::unordered_map<std::string, std::shared_ptr<Texture>> textures;
+    // Decodes all registered textures that haven't been decoded yet and waits for them
+    void decodePending(ThreadPool &pool);
+
+    // Only valid for textures that went through decodePending()
+    std::shared_ptr<Texture> get(const std::string &file) const;
+
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<Texture>>> textures;
+
+  private:
+    void benchmarkDecode(const std::vector<std::string> &files) const;
+
+    std::vector<std::string> mPending;
 };
 }  // namespace hatgpu
 
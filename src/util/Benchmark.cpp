@@ -0,0 +1,125 @@
+#include "hatpch.h"
+
+#include "Benchmark.h"
+
+#include <functional>
+
+namespace hatgpu
+{
+namespace benchmark
+{
+namespace
+{
+struct NamedMode
+{
+    std::string_view name;
+    Mode mode;
+};
+constexpr std::array kModes = {
+    NamedMode{"scene-upload", Mode::kSceneUpload},
+    NamedMode{"texture-decode", Mode::kTextureDecode},
+    NamedMode{"frustum-culling", Mode::kFrustumCulling},
+    NamedMode{"frames-in-flight", Mode::kFramesInFlight},
+    NamedMode{"bdpt-tiles", Mode::kBdptTiles},
+    NamedMode{"bvh-build", Mode::kBvhBuild},
+    NamedMode{"bdpt-throughput", Mode::kBdptThroughput},
+};
+
+struct State
+{
+    Mode selected{Mode::kNone};
+    bool finished{false};
+};
+
+State &state()
+{
+    static State instance;
+    return instance;
+}
+}  // namespace
+
+bool select(std::string_view name)
+{
+    const auto it = std::find_if(kModes.begin(), kModes.end(),
+                                 [name](const NamedMode &mode) { return mode.name == name; });
+    if (it == kModes.end())
+    {
+        return false;
+    }
+    state().selected = it->mode;
+    return true;
+}
+
+bool enabled(Mode mode)
+{
+    return mode != Mode::kNone && state().selected == mode && !state().finished;
+}
+
+std::string names()
+{
+    std::string result;
+    for (const NamedMode &mode : kModes)
+    {
+        result += result.empty() ? "" : ", ";
+        result += mode.name;
+    }
+    return result;
+}
+
+void finish()
+{
+    LOGGER.info("Benchmark finished");
+    state().finished = true;
+}
+
+bool finished()
+{
+    return state().finished;
+}
+
+FrameSeries::FrameSeries(size_t settingCount, uint32_t warmupFrames, uint32_t measuredFrames)
+    : mSettingCount(settingCount), mWarmupFrames(warmupFrames), mMeasuredFrames(measuredFrames)
+{
+    H_ASSERT(measuredFrames > 0, "A frame series has to measure at least one frame");
+}
+
+std::optional<size_t> FrameSeries::setting() const
+{
+    if (mSetting >= mSettingCount)
+    {
+        return std::nullopt;
+    }
+    return mSetting;
+}
+
+void FrameSeries::skip()
+{
+    ++mSetting;
+    mFrame = 0;
+    mSums.clear();
+}
+
+std::optional<std::vector<double>> FrameSeries::add(std::initializer_list<double> samples)
+{
+    if (!setting().has_value() || ++mFrame <= mWarmupFrames)
+    {
+        return std::nullopt;
+    }
+
+    mSums.resize(samples.size(), 0.0);
+    std::transform(samples.begin(), samples.end(), mSums.begin(), mSums.begin(), std::plus<>());
+    if (mFrame < mWarmupFrames + mMeasuredFrames)
+    {
+        return std::nullopt;
+    }
+
+    std::vector<double> averages = std::move(mSums);
+    for (double &average : averages)
+    {
+        average /= mMeasuredFrames;
+    }
+    skip();
+    return averages;
+}
+}  // namespace benchmark
+}  // namespace hatgpu
@@ -0,0 +1,78 @@
+#ifndef _INCLUDE_BENCHMARK_H
+#define _INCLUDE_BENCHMARK_H
+#include "hatpch.h"
+
+#include <initializer_list>
+#include <string_view>
+
+namespace hatgpu
+{
+// Measurements picked with `--benchmark <name>` on the command line, at most one per run. The
+// selected one logs its results and then calls finish(), which closes the window so that scripted
+// runs exit on their own.
+namespace benchmark
+{
+enum class Mode
+{
+    kNone,
+    // Uploads the scene's geometry at startup the way uploads used to work and batched, and logs
+    // how long each took until the GPU was done
+    kSceneUpload,
+    // Re-decodes the scene's textures with 1, 2, 4 and all hardware threads and logs the
+    // throughput of each run
+    kTextureDecode,
+    // SIMD frustum culling against the scalar reference, see frustum_culling::benchmark()
+    kFrustumCulling,
+    // Renders a few hundred frames with each number of frames in flight from 1 up, logs the
+    // average frame time and fence wait of each and goes back to the default
+    kFramesInFlight,
+    // Renders a few hundred BDPT frames with every tile size the device supports, at the window's
+    // resolution, and logs the average GPU time of each one's dispatch
+    kBdptTiles,
+    // Sequential, parallel and linear BVH builds over the BDPT scene and a synthetic mesh, see
+    // bvh::benchmark(). The synthetic runs need about 2GB of memory.
+    kBvhBuild,
+    // Logs the BDPT renderer's samples per pixel and throughput for a few seconds' worth of
+    // throughput windows, and whenever accumulation starts over
+    kBdptThroughput,
+};
+
+// Returns false if there's no benchmark called `name`
+bool select(std::string_view name);
+// Whether `mode` was selected and hasn't finished yet
+bool enabled(Mode mode);
+// Every benchmark's name, for the usage message
+std::string names();
+
+void finish();
+bool finished();
+
+// Averages per-frame samples over a series of settings, one setting after the other. The first
+// frames of every setting aren't counted, they're still refilling the pipeline or reading back
+// timings of the previous setting.
+class FrameSeries
+{
+  public:
+    FrameSeries(size_t settingCount, uint32_t warmupFrames, uint32_t measuredFrames);
+
+    // Setting the next frame should use, nothing once every setting has been measured
+    std::optional<size_t> setting() const;
+    // Moves on to the next setting without measuring the current one
+    void skip();
+    // Adds one frame's samples to the current setting. Once it has all of its measured frames,
+    // returns the average of each sample and moves on to the next setting.
+    std::optional<std::vector<double>> add(std::initializer_list<double> samples);
+
+  private:
+    size_t mSettingCount;
+    uint32_t mWarmupFrames;
+    uint32_t mMeasuredFrames;
+
+    size_t mSetting{0};
+    uint32_t mFrame{0};
+    std::vector<double> mSums;
+};
+}  // namespace benchmark
+}  // namespace hatgpu
+
+#endif  //_INCLUDE_BENCHMARK_H
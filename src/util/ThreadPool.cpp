@@ -0,0 +1,73 @@
+#include "hatpch.h"
+
+#include "ThreadPool.h"
+
+#include <tracy/Tracy.hpp>
+
+namespace hatgpu
+{
+std::unique_ptr<ThreadPool> ThreadPool::mInstance = nullptr;
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+    if (numThreads == 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    mWorkers.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        mWorkers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+
+    for (auto &worker : mWorkers)
+    {
+        worker.join();
+    }
+}
+
+ThreadPool &ThreadPool::GetOrCreateInstance()
+{
+    if (mInstance == nullptr)
+    {
+        mInstance = std::make_unique<ThreadPool>();
+    }
+    return *mInstance;
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+    const std::string threadName = "Worker " + std::to_string(index);
+    tracy::SetThreadName(threadName.c_str());
+
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this]() { return mStopping || !mTasks.empty(); });
+
+            // Drain whatever is left before shutting down so no future is left dangling
+            if (mTasks.empty())
+            {
+                return;
+            }
+
+            task = std::move(mTasks.front());
+            mTasks.pop_front();
+        }
+
+        task();
+    }
+}
+}  // namespace hatgpu
@@ -0,0 +1,59 @@
+#ifndef _INCLUDE_THREAD_POOL_H
+#define _INCLUDE_THREAD_POOL_H
+#include "hatpch.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace hatgpu
+{
+// Fixed-size pool of worker threads pulling tasks from a single FIFO queue. Tasks must not log,
+// the logger isn't thread safe, so report failures through the returned future instead.
+class ThreadPool
+{
+  public:
+    // Defaults to one worker per hardware thread
+    explicit ThreadPool(size_t numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &other)            = delete;
+    ThreadPool &operator=(const ThreadPool &other) = delete;
+
+    // Shared pool used for loading work, sized to the hardware
+    static ThreadPool &GetOrCreateInstance();
+
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F &&function)
+    {
+        using Result = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(function));
+        std::future<Result> future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTasks.emplace_back([task]() { (*task)(); });
+        }
+        mCondition.notify_one();
+        return future;
+    }
+
+    inline size_t size() const { return mWorkers.size(); }
+
+  private:
+    void workerLoop(size_t index);
+
+    std::vector<std::thread> mWorkers;
+    std::deque<std::function<void()>> mTasks;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mStopping{false};
+
+    static std::unique_ptr<ThreadPool> mInstance;
+};
+}  // namespace hatgpu
+
+#endif  //_INCLUDE_THREAD_POOL_H
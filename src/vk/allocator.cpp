@@ -5,6 +5,8 @@
 #include "vk/deleter.h"
 #include "vk/types.h"
 
+#include <tracy/Tracy.hpp>
+
 namespace hatgpu
 {
 namespace vk
@@ -17,6 +19,14 @@ Allocator::Allocator(VmaAllocatorCreateInfo create)
 AllocatedBuffer Allocator::createBuffer(size_t allocSize,
                                         VkBufferUsageFlags usage,
                                         VmaMemoryUsage memoryUsage)
+{
+    return createBuffer(allocSize, usage, memoryUsage, 0);
+}
+
+AllocatedBuffer Allocator::createBuffer(size_t allocSize,
+                                        VkBufferUsageFlags usage,
+                                        VmaMemoryUsage memoryUsage,
+                                        VmaAllocationCreateFlags flags)
 {
     // allocate vertex buffer
     VkBufferCreateInfo bufferInfo{};
@@ -28,17 +38,33 @@ AllocatedBuffer Allocator::createBuffer(size_t allocSize,
 
     VmaAllocationCreateInfo vmaAllocInfo = {};
     vmaAllocInfo.usage                   = memoryUsage;
+    vmaAllocInfo.flags                   = flags;
 
     vk::AllocatedBuffer newBuffer;
+    VmaAllocationInfo allocationInfo{};
 
     // allocate the buffer
     H_CHECK(vmaCreateBuffer(Impl, &bufferInfo, &vmaAllocInfo, &newBuffer.buffer,
-                            &newBuffer.allocation, nullptr),
+                            &newBuffer.allocation, &allocationInfo),
             "Failed to allocate new buffer of size " + std::to_string(allocSize));
 
+    if (flags & VMA_ALLOCATION_CREATE_MAPPED_BIT)
+    {
+        newBuffer.mapped = allocationInfo.pMappedData;
+    }
+
     return newBuffer;
 }
 
+AllocatedBuffer Allocator::createMappedBuffer(size_t allocSize, VkBufferUsageFlags usage)
+{
+    AllocatedBuffer buffer = createBuffer(
+        allocSize, usage, VMA_MEMORY_USAGE_CPU_TO_GPU,
+        VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+    H_ASSERT(buffer.mapped != nullptr, "Mapped buffer must be host visible");
+    return buffer;
+}
+
 void *Allocator::map(const AllocatedBuffer &buf)
 {
     void *result;
@@ -60,5 +86,107 @@ void Allocator::destroyImage(const AllocatedImage &img)
 {
     vmaDestroyImage(Impl, img.image, img.allocation);
 }
+
+StagingRing::StagingRing(Allocator &allocator, VkDeviceSize size) : mSize(size)
+{
+    mBuffer = allocator.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                     VMA_MEMORY_USAGE_CPU_ONLY, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    H_ASSERT(mBuffer.mapped != nullptr, "Staging ring must be host visible");
+}
+
+std::optional<StagingAllocation> StagingRing::allocate(VkDeviceSize size,
+                                                       VkDeviceSize alignment,
+                                                       uint64_t tag)
+{
+    H_ASSERT(mRegions.empty() || mRegions.back().tag <= tag, "Staging ring tags must not decrease");
+    if (size > mSize)
+    {
+        return std::nullopt;
+    }
+
+    const auto alignUp = [alignment](VkDeviceSize offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    };
+
+    // Free space is [head, size) + [0, tail) when the live regions don't wrap around the end of
+    // the buffer, and [head, tail) when they do
+    VkDeviceSize offset = alignUp(mHead);
+    if (mRegions.empty())
+    {
+        offset = 0;
+    }
+    else
+    {
+        const VkDeviceSize tail = mRegions.front().begin;
+        if (mHead > tail)
+        {
+            if (offset + size > mSize)
+            {
+                offset = 0;
+                if (size > tail)
+                {
+                    return std::nullopt;
+                }
+            }
+        }
+        else if (offset + size > tail)
+        {
+            return std::nullopt;
+        }
+    }
+
+    // The region starts at the old head so that alignment padding and any space skipped when
+    // wrapping around is given back together with it
+    if (mRegions.empty() || mRegions.back().tag != tag)
+    {
+        mRegions.push_back({mRegions.empty() ? offset : mHead, tag});
+    }
+    mHead = offset + size;
+
+    TracyPlot("Staging ring occupancy (MB)", static_cast<float>(occupancy()) / (1024 * 1024));
+
+    return StagingAllocation{mBuffer.buffer, offset, static_cast<char *>(mBuffer.mapped) + offset};
+}
+
+void StagingRing::reclaim(uint64_t completedTag)
+{
+    while (!mRegions.empty() && mRegions.front().tag <= completedTag)
+    {
+        mRegions.pop_front();
+    }
+    if (mRegions.empty())
+    {
+        mHead = 0;
+    }
+
+    TracyPlot("Staging ring occupancy (MB)", static_cast<float>(occupancy()) / (1024 * 1024));
+}
+
+VkDeviceSize StagingRing::occupancy() const
+{
+    if (mRegions.empty())
+    {
+        return 0;
+    }
+
+    const VkDeviceSize tail = mRegions.front().begin;
+    return mHead > tail ? mHead - tail : mSize - tail + mHead;
+}
+
+std::optional<uint64_t> StagingRing::oldestTag() const
+{
+    if (mRegions.empty())
+    {
+        return std::nullopt;
+    }
+    return mRegions.front().tag;
+}
+
+void StagingRing::destroy(Allocator &allocator)
+{
+    allocator.destroyBuffer(mBuffer);
+    mRegions.clear();
+    mHead = 0;
+}
 }  // namespace vk
 }  // namespace hatgpu
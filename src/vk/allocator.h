@@ -5,6 +5,8 @@
 #include "vk/deleter.h"
 #include "vk/types.h"
 
+#include <deque>
+
 namespace hatgpu
 {
 namespace vk
@@ -17,6 +19,24 @@ struct Allocator
     AllocatedBuffer createBuffer(size_t allocSize,
                                  VkBufferUsageFlags usage,
                                  VmaMemoryUsage memoryUsage);
+    // Same as above, but with extra VMA flags. Passing VMA_ALLOCATION_CREATE_MAPPED_BIT keeps the
+    // buffer mapped for its whole lifetime and fills in AllocatedBuffer::mapped.
+    AllocatedBuffer createBuffer(size_t allocSize,
+                                 VkBufferUsageFlags usage,
+                                 VmaMemoryUsage memoryUsage,
+                                 VmaAllocationCreateFlags flags);
+    // Host visible buffer that stays mapped for its whole lifetime, for data the CPU rewrites
+    // every frame. The CPU must only ever write to it, never read it back, since the memory may
+    // be uncached. Write to it through mapped<T>() instead of map()/unmap().
+    AllocatedBuffer createMappedBuffer(size_t allocSize, VkBufferUsageFlags usage);
+
+    // Typed view of a buffer that was created persistently mapped
+    template <typename T>
+    static T *mapped(const AllocatedBuffer &buf)
+    {
+        H_ASSERT(buf.mapped != nullptr, "Buffer was not created persistently mapped");
+        return static_cast<T *>(buf.mapped);
+    }
 
     void destroy() { vmaDestroyAllocator(Impl); }
 
@@ -28,6 +48,50 @@ struct Allocator
 
     VmaAllocator Impl = VK_NULL_HANDLE;
 };
+
+struct StagingAllocation
+{
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void *data;
+};
+
+// A fixed-size, persistently mapped staging buffer that hands out memory linearly and wraps
+// around. Every allocation is tagged with a monotonically increasing value (e.g. a fence or batch
+// ticket), and memory is only reused once reclaim() has been told that value has completed.
+class StagingRing
+{
+  public:
+    StagingRing() = default;
+    StagingRing(Allocator &allocator, VkDeviceSize size);
+
+    // Returns nullopt when there's currently not enough free space. Tags must never decrease.
+    std::optional<StagingAllocation> allocate(VkDeviceSize size,
+                                              VkDeviceSize alignment,
+                                              uint64_t tag);
+    // Releases every allocation whose tag is <= completedTag
+    void reclaim(uint64_t completedTag);
+
+    void destroy(Allocator &allocator);
+
+    inline VkDeviceSize capacity() const { return mSize; }
+    VkDeviceSize occupancy() const;
+    // Tag of the oldest allocation that is still alive, if any
+    std::optional<uint64_t> oldestTag() const;
+
+  private:
+    struct Region
+    {
+        VkDeviceSize begin;
+        uint64_t tag;
+    };
+
+    AllocatedBuffer mBuffer{};
+    VkDeviceSize mSize{0};
+    VkDeviceSize mHead{0};
+    // Regions in allocation order; consecutive allocations with the same tag share one region
+    std::deque<Region> mRegions;
+};
 }  // namespace vk
 }  // namespace hatgpu
 
@@ -4,6 +4,7 @@
 
 #include "allocator.h"
 #include "deleter.h"
+#include "sampler_cache.h"
 #include "upload_context.h"
 
 namespace hatgpu
@@ -24,6 +25,8 @@ struct Ctx
 
     vk::Allocator allocator;
     vk::UploadContext uploadContext;
+    // Shared by every layer, samplers from it must not be destroyed by their users
+    vk::SamplerCache samplerCache;
 };
 }  // namespace vk
 }  // namespace hatgpu
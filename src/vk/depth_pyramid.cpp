@@ -0,0 +1,251 @@
+#include "hatpch.h"
+
+#include "vk/depth_pyramid.h"
+
+#include "vk/initializers.h"
+#include "vk/shader.h"
+
+#include <bit>
+
+namespace hatgpu
+{
+namespace vk
+{
+namespace
+{
+struct ReducePushConstants
+{
+    std::array<uint32_t, 2> srcSize;
+    std::array<uint32_t, 2> dstSize;
+};
+
+static constexpr const char *kReduceShaderName = "../shaders/bin/common/depth_reduce.comp.spv";
+static constexpr uint32_t kReduceWorkgroupSize = 8;
+
+VkExtent2D levelExtent(VkExtent2D extent, uint32_t level)
+{
+    return VkExtent2D{std::max(1u, extent.width >> level), std::max(1u, extent.height >> level)};
+}
+}  // namespace
+
+DepthPyramid::DepthPyramid(VkDevice device,
+                           Allocator &allocator,
+                           SamplerCache &samplers,
+                           VkExtent2D depthExtent,
+                           size_t sourceCount)
+    : mDevice(device), mDepthExtent(depthExtent)
+{
+    // Rounding down keeps every texel of level 0 covering at least one full depth texel, and
+    // makes each level after it exactly half the previous one
+    mExtent     = VkExtent2D{std::bit_floor(depthExtent.width), std::bit_floor(depthExtent.height)};
+    mLevelCount = std::bit_width(std::max(mExtent.width, mExtent.height));
+
+    VkImageCreateInfo imageInfo =
+        vk::imageInfo(VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                      VkExtent3D{mExtent.width, mExtent.height, 1}, mLevelCount);
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VmaAllocationCreateInfo allocationInfo{};
+    allocationInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    H_CHECK(vmaCreateImage(allocator.Impl, &imageInfo, &allocationInfo, &mImage.image,
+                           &mImage.allocation, nullptr),
+            "Failed to allocate depth pyramid");
+
+    VkImageViewCreateInfo viewInfo = vk::imageViewInfo(VK_FORMAT_R32_SFLOAT, mImage.image,
+                                                       VK_IMAGE_ASPECT_COLOR_BIT, mLevelCount);
+    H_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &mView),
+            "Failed to create depth pyramid view");
+
+    mLevelViews.resize(mLevelCount);
+    for (uint32_t level = 0; level < mLevelCount; ++level)
+    {
+        VkImageViewCreateInfo levelInfo =
+            vk::imageViewInfo(VK_FORMAT_R32_SFLOAT, mImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        levelInfo.subresourceRange.baseMipLevel = level;
+        H_CHECK(vkCreateImageView(device, &levelInfo, nullptr, &mLevelViews[level]),
+                "Failed to create depth pyramid level view");
+    }
+
+    // Nearest filtering everywhere, both the reduction and the occlusion test pick their texels
+    // themselves
+    VkSamplerCreateInfo samplerInfo =
+        vk::samplerInfo(VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.minLod     = 0.f;
+    samplerInfo.maxLod     = static_cast<float>(mLevelCount);
+    mSampler = samplers.get(samplerInfo);
+
+    const uint32_t setCount = mLevelCount - 1 + static_cast<uint32_t>(sourceCount);
+    std::array<VkDescriptorPoolSize, 2> poolSizes = {
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount},
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount}};
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets       = setCount;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes    = poolSizes.data();
+    H_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &mDescriptorPool),
+            "Failed to create depth pyramid descriptor pool");
+
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {
+        vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                       VK_SHADER_STAGE_COMPUTE_BIT, 0),
+        vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                       VK_SHADER_STAGE_COMPUTE_BIT, 1)};
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = bindings.size();
+    layoutInfo.pBindings    = bindings.data();
+    H_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &mSetLayout),
+            "Unable to create depth pyramid descriptor set layout");
+
+    // The first sourceCount sets are level 0's, the rest go to the other levels in order
+    std::vector<VkDescriptorSetLayout> setLayouts(setCount, mSetLayout);
+    std::vector<VkDescriptorSet> sets(setCount);
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool     = mDescriptorPool;
+    allocInfo.descriptorSetCount = setCount;
+    allocInfo.pSetLayouts        = setLayouts.data();
+    H_CHECK(vkAllocateDescriptorSets(device, &allocInfo, sets.data()),
+            "Unable to allocate depth pyramid descriptor sets");
+
+    // Level 0's source is a depth image, which is only known once build() is called with it
+    mSets.assign(mLevelCount, VK_NULL_HANDLE);
+    for (uint32_t i = 0; i < setCount; ++i)
+    {
+        const uint32_t level = i < sourceCount ? 0 : i - static_cast<uint32_t>(sourceCount) + 1;
+        if (level == 0)
+        {
+            mSourceSets.emplace_back(VK_NULL_HANDLE, sets[i]);
+        }
+        else
+        {
+            mSets[level] = sets[i];
+        }
+
+        std::array<VkDescriptorImageInfo, 2> imageInfos = {
+            VkDescriptorImageInfo{mSampler, level > 0 ? mLevelViews[level - 1] : VK_NULL_HANDLE,
+                                  VK_IMAGE_LAYOUT_GENERAL},
+            VkDescriptorImageInfo{VK_NULL_HANDLE, mLevelViews[level], VK_IMAGE_LAYOUT_GENERAL}};
+        std::array<VkWriteDescriptorSet, 2> writes = {
+            vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, sets[i],
+                                     &imageInfos[0], 0),
+            vk::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, sets[i], &imageInfos[1],
+                                     1)};
+        const uint32_t firstWrite = level > 0 ? 0 : 1;
+        vkUpdateDescriptorSets(device, writes.size() - firstWrite, writes.data() + firstWrite, 0,
+                               nullptr);
+    }
+
+    VkPushConstantRange pushConstant{};
+    pushConstant.size       = sizeof(ReducePushConstants);
+    pushConstant.offset     = 0;
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = vk::pipelineLayoutInfo();
+    pipelineLayoutInfo.setLayoutCount             = 1;
+    pipelineLayoutInfo.pSetLayouts                = &mSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount     = 1;
+    pipelineLayoutInfo.pPushConstantRanges        = &pushConstant;
+    H_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &mPipelineLayout),
+            "Failed to create depth pyramid pipeline layout");
+
+    VkPipelineShaderStageCreateInfo stageInfo =
+        vk::createShaderStage(device, kReduceShaderName, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.layout = mPipelineLayout;
+    pipelineInfo.stage  = stageInfo;
+    H_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mPipeline),
+            "Failed to create depth pyramid pipeline");
+
+    vkDestroyShaderModule(device, stageInfo.module, nullptr);
+}
+
+VkDescriptorSet DepthPyramid::sourceSet(VkImageView depthView)
+{
+    for (auto &[view, set] : mSourceSets)
+    {
+        if (view == depthView)
+        {
+            return set;
+        }
+        if (view == VK_NULL_HANDLE)
+        {
+            VkDescriptorImageInfo imageInfo{mSampler, depthView,
+                                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+            VkWriteDescriptorSet write = vk::writeDescriptorImage(
+                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set, &imageInfo, 0);
+            vkUpdateDescriptorSets(mDevice, 1, &write, 0, nullptr);
+            view = depthView;
+            return set;
+        }
+    }
+    H_ASSERT(false, "Depth pyramid built from more depth images than it has source sets for");
+    return mSourceSets.front().second;
+}
+
+void DepthPyramid::build(VkCommandBuffer cmd, VkImageView depthView)
+{
+    const VkDescriptorSet levelZeroSet = sourceSet(depthView);
+
+    // Last frame's contents are never read again, and the occlusion test that read them has to be
+    // done before they're overwritten
+    VkImageMemoryBarrier discardBarrier{};
+    discardBarrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    discardBarrier.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
+    discardBarrier.newLayout           = VK_IMAGE_LAYOUT_GENERAL;
+    discardBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    discardBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    discardBarrier.image               = mImage.image;
+    discardBarrier.srcAccessMask       = VK_ACCESS_NONE;
+    discardBarrier.dstAccessMask       = VK_ACCESS_SHADER_WRITE_BIT;
+    discardBarrier.subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mLevelCount, 0, 1};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                         &discardBarrier);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+    for (uint32_t level = 0; level < mLevelCount; ++level)
+    {
+        const VkExtent2D src = level > 0 ? levelExtent(mExtent, level - 1) : mDepthExtent;
+        const VkExtent2D dst = levelExtent(mExtent, level);
+
+        ReducePushConstants constants{{src.width, src.height}, {dst.width, dst.height}};
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout, 0, 1,
+                                level > 0 ? &mSets[level] : &levelZeroSet, 0, nullptr);
+        vkCmdPushConstants(cmd, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(ReducePushConstants), &constants);
+        vkCmdDispatch(cmd, (dst.width + kReduceWorkgroupSize - 1) / kReduceWorkgroupSize,
+                      (dst.height + kReduceWorkgroupSize - 1) / kReduceWorkgroupSize, 1);
+
+        // The next level reads this one
+        VkImageMemoryBarrier levelBarrier            = discardBarrier;
+        levelBarrier.oldLayout                       = VK_IMAGE_LAYOUT_GENERAL;
+        levelBarrier.srcAccessMask                   = VK_ACCESS_SHADER_WRITE_BIT;
+        levelBarrier.dstAccessMask                   = VK_ACCESS_SHADER_READ_BIT;
+        levelBarrier.subresourceRange.baseMipLevel   = level;
+        levelBarrier.subresourceRange.levelCount     = 1;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                             &levelBarrier);
+    }
+}
+
+void DepthPyramid::destroy(Allocator &allocator)
+{
+    vkDestroyPipeline(mDevice, mPipeline, nullptr);
+    vkDestroyPipelineLayout(mDevice, mPipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(mDevice, mSetLayout, nullptr);
+    vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+    for (VkImageView levelView : mLevelViews)
+    {
+        vkDestroyImageView(mDevice, levelView, nullptr);
+    }
+    vkDestroyImageView(mDevice, mView, nullptr);
+    allocator.destroyImage(mImage);
+}
+}  // namespace vk
+}  // namespace hatgpu
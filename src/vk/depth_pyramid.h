@@ -0,0 +1,71 @@
+#ifndef _INCLUDED_DEPTH_PYRAMID_H
+#define _INCLUDED_DEPTH_PYRAMID_H
+#include "hatpch.h"
+
+#include "vk/allocator.h"
+#include "vk/sampler_cache.h"
+#include "vk/types.h"
+
+#include <vector>
+
+namespace hatgpu
+{
+namespace vk
+{
+// Hierarchical depth buffer (Hi-Z) for occlusion culling. Level 0 is the depth image reduced to
+// the power of two below its size, and each level after that halves the one before it. Every
+// texel holds the farthest depth of the area it covers, so a box whose nearest depth is farther
+// than that is hidden.
+class DepthPyramid
+{
+  public:
+    DepthPyramid() = default;
+    // build() can be called with up to `sourceCount` different depth images, one per frame in
+    // flight
+    DepthPyramid(VkDevice device,
+                 Allocator &allocator,
+                 SamplerCache &samplers,
+                 VkExtent2D depthExtent,
+                 size_t sourceCount);
+
+    // Records the reduction of `depthView` into every level. The depth image has to be in
+    // SHADER_READ_ONLY_OPTIMAL with its writes visible to compute shaders. Afterwards every level
+    // is in GENERAL and can be read by compute shaders.
+    void build(VkCommandBuffer cmd, VkImageView depthView);
+
+    void destroy(Allocator &allocator);
+
+    // Covers every level, to be sampled with sampler(), which belongs to the sampler cache
+    inline VkImageView view() const { return mView; }
+    inline VkSampler sampler() const { return mSampler; }
+    inline VkExtent2D extent() const { return mExtent; }
+    inline uint32_t levelCount() const { return mLevelCount; }
+
+  private:
+    // The level 0 set reading `depthView`, written the first time that view is seen
+    VkDescriptorSet sourceSet(VkImageView depthView);
+
+    VkDevice mDevice{VK_NULL_HANDLE};
+    VkExtent2D mDepthExtent{};
+    VkExtent2D mExtent{};
+    uint32_t mLevelCount{0};
+
+    AllocatedImage mImage{};
+    VkImageView mView{VK_NULL_HANDLE};
+    std::vector<VkImageView> mLevelViews;
+    VkSampler mSampler{VK_NULL_HANDLE};
+
+    VkDescriptorPool mDescriptorPool{VK_NULL_HANDLE};
+    VkDescriptorSetLayout mSetLayout{VK_NULL_HANDLE};
+    VkPipelineLayout mPipelineLayout{VK_NULL_HANDLE};
+    VkPipeline mPipeline{VK_NULL_HANDLE};
+    // One per level past the first, reading the level below and writing that level
+    std::vector<VkDescriptorSet> mSets;
+    // Level 0's sets, one per depth image it's built from. A set can't be rewritten while an
+    // earlier frame using it may still be executing, so each source keeps its own.
+    std::vector<std::pair<VkImageView, VkDescriptorSet>> mSourceSets;
+};
+}  // namespace vk
+}  // namespace hatgpu
+
+#endif
@@ -0,0 +1,149 @@
+#include "hatpch.h"
+
+#include "vk/geometry_arena.h"
+
+namespace hatgpu
+{
+namespace vk
+{
+RangeAllocator::RangeAllocator(VkDeviceSize capacity) : mCapacity(capacity)
+{
+    if (capacity > 0)
+    {
+        mFreeBlocks.emplace(0, capacity);
+    }
+}
+
+std::optional<VkDeviceSize> RangeAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    // Empty ranges don't take up any space but still have to be freed
+    if (size == 0)
+    {
+        ++mAllocationCount;
+        return 0;
+    }
+
+    for (auto it = mFreeBlocks.begin(); it != mFreeBlocks.end(); ++it)
+    {
+        const auto [blockOffset, blockSize] = *it;
+        const VkDeviceSize offset  = (blockOffset + alignment - 1) / alignment * alignment;
+        const VkDeviceSize padding = offset - blockOffset;
+        if (padding + size > blockSize)
+        {
+            continue;
+        }
+
+        // Whatever is left on either side of the allocation stays free
+        mFreeBlocks.erase(it);
+        if (padding > 0)
+        {
+            mFreeBlocks.emplace(blockOffset, padding);
+        }
+        if (padding + size < blockSize)
+        {
+            mFreeBlocks.emplace(offset + size, blockSize - padding - size);
+        }
+
+        ++mAllocationCount;
+        return offset;
+    }
+
+    return std::nullopt;
+}
+
+void RangeAllocator::free(VkDeviceSize offset, VkDeviceSize size)
+{
+    H_ASSERT(offset + size <= mCapacity, "Freeing a range outside of the allocator");
+    H_ASSERT(mAllocationCount > 0, "Freeing more ranges than were allocated");
+    --mAllocationCount;
+    if (size == 0)
+    {
+        return;
+    }
+
+    auto next = mFreeBlocks.lower_bound(offset);
+    H_ASSERT(next == mFreeBlocks.end() || offset + size <= next->first, "Double free of a range");
+
+    // Merge with the block that ends where this one starts
+    if (next != mFreeBlocks.begin())
+    {
+        auto previous = std::prev(next);
+        H_ASSERT(previous->first + previous->second <= offset, "Double free of a range");
+        if (previous->first + previous->second == offset)
+        {
+            offset = previous->first;
+            size += previous->second;
+            mFreeBlocks.erase(previous);
+        }
+    }
+
+    // And with the block that starts where this one ends
+    if (next != mFreeBlocks.end() && offset + size == next->first)
+    {
+        size += next->second;
+        mFreeBlocks.erase(next);
+    }
+
+    mFreeBlocks.emplace(offset, size);
+}
+
+RangeAllocator::Stats RangeAllocator::stats() const
+{
+    Stats stats{mCapacity, 0, 0, mFreeBlocks.size(), mAllocationCount};
+    for (const auto &[offset, size] : mFreeBlocks)
+    {
+        stats.freeBytes += size;
+        stats.largestFreeBlock = std::max(stats.largestFreeBlock, size);
+    }
+    return stats;
+}
+
+GeometryArena::GeometryArena(Allocator &allocator,
+                             VkDeviceSize vertexCapacity,
+                             VkDeviceSize indexCapacity)
+    : mVertexRanges(vertexCapacity), mIndexRanges(indexCapacity)
+{
+    mVertexBuffer = allocator.createBuffer(
+        vertexCapacity, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    mIndexBuffer = allocator.createBuffer(
+        indexCapacity, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+}
+
+std::optional<GeometryAllocation> GeometryArena::allocate(VkDeviceSize vertexSize,
+                                                          VkDeviceSize vertexAlignment,
+                                                          VkDeviceSize indexSize,
+                                                          VkDeviceSize indexAlignment)
+{
+    const std::optional<VkDeviceSize> vertexOffset =
+        mVertexRanges.allocate(vertexSize, vertexAlignment);
+    if (!vertexOffset.has_value())
+    {
+        return std::nullopt;
+    }
+
+    const std::optional<VkDeviceSize> indexOffset =
+        mIndexRanges.allocate(indexSize, indexAlignment);
+    if (!indexOffset.has_value())
+    {
+        mVertexRanges.free(*vertexOffset, vertexSize);
+        return std::nullopt;
+    }
+
+    return GeometryAllocation{*vertexOffset, vertexSize, *indexOffset, indexSize};
+}
+
+void GeometryArena::free(const GeometryAllocation &allocation)
+{
+    mVertexRanges.free(allocation.vertexOffset, allocation.vertexSize);
+    mIndexRanges.free(allocation.indexOffset, allocation.indexSize);
+}
+
+void GeometryArena::destroy(Allocator &allocator)
+{
+    allocator.destroyBuffer(mVertexBuffer);
+    allocator.destroyBuffer(mIndexBuffer);
+}
+}  // namespace vk
+}  // namespace hatgpu
@@ -0,0 +1,94 @@
+#ifndef _INCLUDED_GEOMETRY_ARENA_H
+#define _INCLUDED_GEOMETRY_ARENA_H
+#include "hatpch.h"
+
+#include "vk/allocator.h"
+#include "vk/types.h"
+
+#include <map>
+
+namespace hatgpu
+{
+namespace vk
+{
+// First-fit free list over the offsets [0, capacity). Free blocks are kept sorted by offset so that
+// freeing coalesces with both neighbours. Doesn't own any memory itself.
+class RangeAllocator
+{
+  public:
+    struct Stats
+    {
+        VkDeviceSize capacity;
+        VkDeviceSize freeBytes;
+        VkDeviceSize largestFreeBlock;
+        size_t freeBlockCount;
+        size_t allocationCount;
+
+        // 0 when all of the free space is one block, approaching 1 as it gets split up
+        inline float fragmentation() const
+        {
+            return freeBytes == 0 ? 0.f
+                                  : 1.f - static_cast<float>(largestFreeBlock) /
+                                              static_cast<float>(freeBytes);
+        }
+    };
+
+    RangeAllocator() = default;
+    explicit RangeAllocator(VkDeviceSize capacity);
+
+    // Returns nullopt when no free block can fit `size` bytes at the requested alignment
+    std::optional<VkDeviceSize> allocate(VkDeviceSize size, VkDeviceSize alignment);
+    void free(VkDeviceSize offset, VkDeviceSize size);
+
+    Stats stats() const;
+
+  private:
+    VkDeviceSize mCapacity{0};
+    size_t mAllocationCount{0};
+    // Offset -> size of every free block
+    std::map<VkDeviceSize, VkDeviceSize> mFreeBlocks;
+};
+
+// Where a mesh's data lives in the arena, all in bytes
+struct GeometryAllocation
+{
+    VkDeviceSize vertexOffset;
+    VkDeviceSize vertexSize;
+    VkDeviceSize indexOffset;
+    VkDeviceSize indexSize;
+};
+
+// One device local vertex buffer and one index buffer shared by every mesh, so that drawing only
+// needs a single bind and each mesh is addressed through vertexOffset/firstIndex. Callers pick
+// alignments that are multiples of their vertex stride and index size so that the byte offsets
+// convert to element offsets exactly.
+class GeometryArena
+{
+  public:
+    GeometryArena() = default;
+    GeometryArena(Allocator &allocator, VkDeviceSize vertexCapacity, VkDeviceSize indexCapacity);
+
+    // Returns nullopt if either buffer is out of space
+    std::optional<GeometryAllocation> allocate(VkDeviceSize vertexSize,
+                                               VkDeviceSize vertexAlignment,
+                                               VkDeviceSize indexSize,
+                                               VkDeviceSize indexAlignment);
+    void free(const GeometryAllocation &allocation);
+
+    void destroy(Allocator &allocator);
+
+    inline VkBuffer vertexBuffer() const { return mVertexBuffer.buffer; }
+    inline VkBuffer indexBuffer() const { return mIndexBuffer.buffer; }
+    inline RangeAllocator::Stats vertexStats() const { return mVertexRanges.stats(); }
+    inline RangeAllocator::Stats indexStats() const { return mIndexRanges.stats(); }
+
+  private:
+    AllocatedBuffer mVertexBuffer{};
+    AllocatedBuffer mIndexBuffer{};
+    RangeAllocator mVertexRanges;
+    RangeAllocator mIndexRanges;
+};
+}  // namespace vk
+}  // namespace hatgpu
+
+#endif
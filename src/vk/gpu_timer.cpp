@@ -0,0 +1,64 @@
+#include "hatpch.h"
+
+#include "vk/gpu_timer.h"
+
+#include <array>
+
+namespace hatgpu
+{
+namespace vk
+{
+GpuTimer::GpuTimer(VkDevice device, const VkPhysicalDeviceProperties &properties, size_t frameCount)
+    : mDevice(device), mTimestampPeriod(properties.limits.timestampPeriod), mPending(frameCount)
+{
+    H_ASSERT(properties.limits.timestampComputeAndGraphics,
+             "GPU timers need timestamps on the graphics queue");
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = static_cast<uint32_t>(2 * frameCount);
+    H_CHECK(vkCreateQueryPool(device, &poolInfo, nullptr, &mQueryPool),
+            "Failed to create timestamp query pool");
+}
+
+std::optional<float> GpuTimer::read(size_t frame)
+{
+    if (!mPending[frame])
+    {
+        return std::nullopt;
+    }
+
+    std::array<uint64_t, 2> timestamps{};
+    const VkResult result = vkGetQueryPoolResults(
+        mDevice, mQueryPool, static_cast<uint32_t>(2 * frame), 2, sizeof(timestamps),
+        timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS)
+    {
+        return std::nullopt;
+    }
+
+    mPending[frame] = false;
+    return static_cast<float>(timestamps[1] - timestamps[0]) * mTimestampPeriod * 1e-6f;
+}
+
+void GpuTimer::begin(VkCommandBuffer cmd, size_t frame)
+{
+    vkCmdResetQueryPool(cmd, mQueryPool, static_cast<uint32_t>(2 * frame), 2);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, mQueryPool,
+                        static_cast<uint32_t>(2 * frame));
+}
+
+void GpuTimer::end(VkCommandBuffer cmd, size_t frame)
+{
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, mQueryPool,
+                        static_cast<uint32_t>(2 * frame + 1));
+    mPending[frame] = true;
+}
+
+void GpuTimer::destroy()
+{
+    vkDestroyQueryPool(mDevice, mQueryPool, nullptr);
+}
+}  // namespace vk
+}  // namespace hatgpu
@@ -0,0 +1,40 @@
+#ifndef _INCLUDED_GPU_TIMER_H
+#define _INCLUDED_GPU_TIMER_H
+#include "hatpch.h"
+
+#include <optional>
+#include <vector>
+
+namespace hatgpu
+{
+namespace vk
+{
+// Measures the GPU time between two points of a frame with timestamp queries. Every frame in
+// flight has its own pair, read back without waiting once that frame's fence has signaled, so
+// results lag behind by the number of frames in flight.
+class GpuTimer
+{
+  public:
+    GpuTimer() = default;
+    GpuTimer(VkDevice device, const VkPhysicalDeviceProperties &properties, size_t frameCount);
+
+    // Returns the time the last begin()/end() pair of this frame took, if it hasn't been read yet.
+    // Has to be called before begin() reuses the frame's queries.
+    std::optional<float> read(size_t frame);
+
+    void begin(VkCommandBuffer cmd, size_t frame);
+    void end(VkCommandBuffer cmd, size_t frame);
+
+    void destroy();
+
+  private:
+    VkDevice mDevice{VK_NULL_HANDLE};
+    VkQueryPool mQueryPool{VK_NULL_HANDLE};
+    // Nanoseconds per timestamp tick
+    float mTimestampPeriod{1.f};
+    std::vector<bool> mPending;
+};
+}  // namespace vk
+}  // namespace hatgpu
+
+#endif
@@ -7,14 +7,15 @@ namespace hatgpu
 {
 namespace vk
 {
-VkCommandPoolCreateInfo commandPoolInfo([[maybe_unused]] uint32_t queueFamilyIndex,
+VkCommandPoolCreateInfo commandPoolInfo(uint32_t queueFamilyIndex,
                                         VkCommandPoolCreateFlags flags /*= 0*/)
 {
     VkCommandPoolCreateInfo info = {};
     info.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     info.pNext                   = nullptr;
 
-    info.flags = flags;
+    info.queueFamilyIndex = queueFamilyIndex;
+    info.flags            = flags;
     return info;
 }
 
@@ -0,0 +1,186 @@
+#include "hatpch.h"
+
+#include "vk/light_clusters.h"
+
+#include "vk/initializers.h"
+#include "vk/shader.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace hatgpu
+{
+namespace vk
+{
+namespace
+{
+// Matches ClusterGrid in light_clusters.glsl
+struct GpuClusterGrid
+{
+    glm::uvec4 size;
+    glm::vec4 depth;
+    glm::vec4 screen;
+    uint32_t lightCount;
+    uint32_t clustered;
+    uint32_t padding[2];
+    glm::mat4 inverseProj;
+};
+
+static constexpr const char *kClusterShaderName = "../shaders/bin/common/light_clusters.comp.spv";
+// The count comes first in every cluster's slot
+static constexpr uint32_t kClusterStride = LightClusters::kMaxLightsPerCluster + 1;
+}  // namespace
+
+LightClusters::LightClusters(VkDevice device, Allocator &allocator, size_t frameCount)
+    : mDevice(device), mFrames(frameCount)
+{
+    const uint32_t setCount = static_cast<uint32_t>(frameCount);
+    std::array<VkDescriptorPoolSize, 2> poolSizes = {
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2 * setCount},
+        VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * setCount}};
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets       = setCount;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes    = poolSizes.data();
+    H_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &mDescriptorPool),
+            "Failed to create light cluster descriptor pool");
+
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings = {
+        vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                       VK_SHADER_STAGE_COMPUTE_BIT, 0),
+        vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                       VK_SHADER_STAGE_COMPUTE_BIT, 1),
+        vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                       VK_SHADER_STAGE_COMPUTE_BIT, 2),
+        vk::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                       VK_SHADER_STAGE_COMPUTE_BIT, 3)};
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = bindings.size();
+    layoutInfo.pBindings    = bindings.data();
+    H_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &mSetLayout),
+            "Unable to create light cluster descriptor set layout");
+
+    std::vector<VkDescriptorSetLayout> setLayouts(frameCount, mSetLayout);
+    std::vector<VkDescriptorSet> sets(frameCount);
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool     = mDescriptorPool;
+    allocInfo.descriptorSetCount = setCount;
+    allocInfo.pSetLayouts        = setLayouts.data();
+    H_CHECK(vkAllocateDescriptorSets(device, &allocInfo, sets.data()),
+            "Unable to allocate light cluster descriptor sets");
+
+    const size_t lightListSize = sizeof(uint32_t) * kClusterStride * kClusterCount;
+    for (size_t i = 0; i < frameCount; ++i)
+    {
+        Frame &frame     = mFrames[i];
+        frame.descriptor = sets[i];
+        // Rewritten every frame, so it stays mapped
+        frame.grid = allocator.createBuffer(sizeof(GpuClusterGrid),
+                                            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                            VMA_MEMORY_USAGE_CPU_TO_GPU,
+                                            VMA_ALLOCATION_CREATE_MAPPED_BIT);
+        frame.lightLists = allocator.createBuffer(
+            lightListSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+        std::array<VkDescriptorBufferInfo, 2> bufferInfos = {
+            VkDescriptorBufferInfo{frame.grid.buffer, 0, VK_WHOLE_SIZE},
+            VkDescriptorBufferInfo{frame.lightLists.buffer, 0, VK_WHOLE_SIZE}};
+        std::array<VkWriteDescriptorSet, 2> writes = {
+            vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frame.descriptor,
+                                      &bufferInfos[0], 2),
+            vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.descriptor,
+                                      &bufferInfos[1], 3)};
+        vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+    }
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = vk::pipelineLayoutInfo();
+    pipelineLayoutInfo.setLayoutCount             = 1;
+    pipelineLayoutInfo.pSetLayouts                = &mSetLayout;
+    H_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &mPipelineLayout),
+            "Failed to create light cluster pipeline layout");
+
+    VkPipelineShaderStageCreateInfo stageInfo =
+        vk::createShaderStage(device, kClusterShaderName, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.layout = mPipelineLayout;
+    pipelineInfo.stage  = stageInfo;
+    H_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mPipeline),
+            "Failed to create light cluster pipeline");
+
+    vkDestroyShaderModule(device, stageInfo.module, nullptr);
+}
+
+void LightClusters::setSources(size_t frame, VkBuffer cameraBuffer, VkBuffer lightBuffer)
+{
+    std::array<VkDescriptorBufferInfo, 2> bufferInfos = {
+        VkDescriptorBufferInfo{cameraBuffer, 0, VK_WHOLE_SIZE},
+        VkDescriptorBufferInfo{lightBuffer, 0, VK_WHOLE_SIZE}};
+    std::array<VkWriteDescriptorSet, 2> writes = {
+        vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, mFrames[frame].descriptor,
+                                  &bufferInfos[0], 0),
+        vk::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, mFrames[frame].descriptor,
+                                  &bufferInfos[1], 1)};
+    vkUpdateDescriptorSets(mDevice, writes.size(), writes.data(), 0, nullptr);
+}
+
+void LightClusters::update(size_t frame,
+                           const glm::mat4 &proj,
+                           float near,
+                           float far,
+                           VkExtent2D extent,
+                           uint32_t lightCount,
+                           bool clustered)
+{
+    // slice = log(depth) * scale - bias puts near at slice 0 and far at the last one
+    const float logRange = std::log(far / near);
+
+    GpuClusterGrid grid{};
+    grid.size  = glm::uvec4(kGridX, kGridY, kGridZ, kClusterStride);
+    grid.depth = glm::vec4(near, far, kGridZ / logRange, kGridZ * std::log(near) / logRange);
+    // Rounded up so that the grid covers every pixel
+    grid.screen = glm::vec4(static_cast<float>((extent.width + kGridX - 1) / kGridX),
+                            static_cast<float>((extent.height + kGridY - 1) / kGridY),
+                            1.f / static_cast<float>(extent.width),
+                            1.f / static_cast<float>(extent.height));
+    grid.lightCount  = lightCount;
+    grid.clustered   = clustered ? 1 : 0;
+    grid.inverseProj = glm::inverse(proj);
+    std::memcpy(mFrames[frame].grid.mapped, &grid, sizeof(GpuClusterGrid));
+}
+
+void LightClusters::build(VkCommandBuffer cmd, size_t frame)
+{
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout, 0, 1,
+                            &mFrames[frame].descriptor, 0, nullptr);
+    vkCmdDispatch(cmd, kClusterCount, 1, 1);
+
+    VkMemoryBarrier barrier{};
+    barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void LightClusters::destroy(Allocator &allocator)
+{
+    vkDestroyPipeline(mDevice, mPipeline, nullptr);
+    vkDestroyPipelineLayout(mDevice, mPipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(mDevice, mSetLayout, nullptr);
+    vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+    for (Frame &frame : mFrames)
+    {
+        allocator.destroyBuffer(frame.grid);
+        allocator.destroyBuffer(frame.lightLists);
+    }
+}
+}  // namespace vk
+}  // namespace hatgpu
@@ -0,0 +1,79 @@
+#ifndef _INCLUDED_LIGHT_CLUSTERS_H
+#define _INCLUDED_LIGHT_CLUSTERS_H
+#include "hatpch.h"
+
+#include "vk/allocator.h"
+#include "vk/types.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace hatgpu
+{
+namespace vk
+{
+// Clustered light assignment. The view frustum is split into a grid of clusters, and a compute
+// pass writes the point lights reaching each one into its slot of a light list buffer, so that
+// shading only has to loop over those. See shaders/common/light_clusters.glsl for the layout.
+//
+// Every frame in flight gets its own grid and light lists. The camera and light buffers the pass
+// reads come from the renderer.
+class LightClusters
+{
+  public:
+    // Screen space tiles along x and y, depth slices along z
+    static constexpr uint32_t kGridX        = 16;
+    static constexpr uint32_t kGridY        = 9;
+    static constexpr uint32_t kGridZ        = 24;
+    static constexpr uint32_t kClusterCount = kGridX * kGridY * kGridZ;
+    // Lights past this are dropped from a cluster, which shows up as the farthest ones flickering
+    static constexpr uint32_t kMaxLightsPerCluster = 255;
+
+    LightClusters() = default;
+    LightClusters(VkDevice device, Allocator &allocator, size_t frameCount);
+
+    // The camera buffer has to hold the view matrix first, and the light buffer PointLights
+    void setSources(size_t frame, VkBuffer cameraBuffer, VkBuffer lightBuffer);
+    // Writes the frame's grid. With `clustered` off shaders go over every light instead, and
+    // build() doesn't need to be called.
+    void update(size_t frame,
+                const glm::mat4 &proj,
+                float near,
+                float far,
+                VkExtent2D extent,
+                uint32_t lightCount,
+                bool clustered);
+    // Records the light assignment, whose lists fragment and compute shaders can read afterwards
+    void build(VkCommandBuffer cmd, size_t frame);
+
+    void destroy(Allocator &allocator);
+
+    // A uniform buffer with the ClusterGrid
+    inline VkBuffer gridBuffer(size_t frame) const { return mFrames[frame].grid.buffer; }
+    // A storage buffer with every cluster's light list
+    inline VkBuffer lightListBuffer(size_t frame) const
+    {
+        return mFrames[frame].lightLists.buffer;
+    }
+
+  private:
+    struct Frame
+    {
+        AllocatedBuffer grid;
+        AllocatedBuffer lightLists;
+        VkDescriptorSet descriptor;
+    };
+
+    VkDevice mDevice{VK_NULL_HANDLE};
+    std::vector<Frame> mFrames;
+
+    VkDescriptorPool mDescriptorPool{VK_NULL_HANDLE};
+    VkDescriptorSetLayout mSetLayout{VK_NULL_HANDLE};
+    VkPipelineLayout mPipelineLayout{VK_NULL_HANDLE};
+    VkPipeline mPipeline{VK_NULL_HANDLE};
+};
+}  // namespace vk
+}  // namespace hatgpu
+
+#endif
@@ -0,0 +1,102 @@
+#include "hatpch.h"
+
+#include "sampler_cache.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <functional>
+
+namespace hatgpu
+{
+namespace vk
+{
+SamplerCache::SamplerCache(VkDevice device) : mDevice(device) {}
+
+VkSampler SamplerCache::get(const VkSamplerCreateInfo &info)
+{
+    const Key key = makeKey(info);
+    if (auto it = mSamplers.find(key); it != mSamplers.end())
+    {
+        ++mReusedCount;
+        return it->second;
+    }
+
+    ZoneScopedC(tracy::Color::Gold);
+    VkSampler sampler{VK_NULL_HANDLE};
+    H_CHECK(vkCreateSampler(mDevice, &info, nullptr, &sampler), "Failed to create sampler");
+    mSamplers.emplace(key, sampler);
+    ++mCreatedCount;
+    return sampler;
+}
+
+void SamplerCache::destroy()
+{
+    H_LOG(std::format("...destroying {} cached samplers, {} requests were served from the cache",
+                      mCreatedCount, mReusedCount));
+    for (const auto &[_, sampler] : mSamplers)
+    {
+        vkDestroySampler(mDevice, sampler, nullptr);
+    }
+    mSamplers.clear();
+}
+
+SamplerCache::Key SamplerCache::makeKey(const VkSamplerCreateInfo &info)
+{
+    Key key{};
+    key.flags                   = info.flags;
+    key.magFilter               = info.magFilter;
+    key.minFilter               = info.minFilter;
+    key.mipmapMode              = info.mipmapMode;
+    key.addressModeU            = info.addressModeU;
+    key.addressModeV            = info.addressModeV;
+    key.addressModeW            = info.addressModeW;
+    key.mipLodBias              = info.mipLodBias;
+    key.anisotropyEnable        = info.anisotropyEnable;
+    key.maxAnisotropy           = info.maxAnisotropy;
+    key.compareEnable           = info.compareEnable;
+    key.compareOp               = info.compareOp;
+    key.minLod                  = info.minLod;
+    key.maxLod                  = info.maxLod;
+    key.borderColor             = info.borderColor;
+    key.unnormalizedCoordinates = info.unnormalizedCoordinates;
+    key.reductionMode           = VK_SAMPLER_REDUCTION_MODE_WEIGHTED_AVERAGE;
+
+    const auto *next = static_cast<const VkBaseInStructure *>(info.pNext);
+    while (next != nullptr)
+    {
+        H_ASSERT(next->sType == VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO,
+                 "Only the reduction mode can be chained to a cached sampler");
+        key.reductionMode =
+            reinterpret_cast<const VkSamplerReductionModeCreateInfo *>(next)->reductionMode;
+        next = next->pNext;
+    }
+    return key;
+}
+
+size_t SamplerCache::KeyHash::operator()(const Key &key) const
+{
+    size_t seed  = 0;
+    auto combine = [&seed](auto value) {
+        seed ^= std::hash<decltype(value)>{}(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    };
+    combine(key.flags);
+    combine(key.magFilter);
+    combine(key.minFilter);
+    combine(key.mipmapMode);
+    combine(key.addressModeU);
+    combine(key.addressModeV);
+    combine(key.addressModeW);
+    combine(key.mipLodBias);
+    combine(key.anisotropyEnable);
+    combine(key.maxAnisotropy);
+    combine(key.compareEnable);
+    combine(key.compareOp);
+    combine(key.minLod);
+    combine(key.maxLod);
+    combine(key.borderColor);
+    combine(key.unnormalizedCoordinates);
+    combine(key.reductionMode);
+    return seed;
+}
+}  // namespace vk
+}  // namespace hatgpu
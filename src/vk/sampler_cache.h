@@ -0,0 +1,67 @@
+#ifndef _INCLUDED_SAMPLER_CACHE_H
+#define _INCLUDED_SAMPLER_CACHE_H
+#include "hatpch.h"
+
+#include <unordered_map>
+
+namespace hatgpu
+{
+namespace vk
+{
+// Hands out one VkSampler per distinct VkSamplerCreateInfo, so every texture sampled the same way
+// shares a sampler no matter which renderer or overlay asked for it. The cache owns the samplers
+// and destroys them all at once, callers never destroy what they get.
+class SamplerCache
+{
+  public:
+    SamplerCache() = default;
+    explicit SamplerCache(VkDevice device);
+
+    // Every field of `info` is part of the key. Its pNext chain can only hold a
+    // VkSamplerReductionModeCreateInfo.
+    VkSampler get(const VkSamplerCreateInfo &info);
+
+    void destroy();
+
+    inline size_t createdCount() const { return mCreatedCount; }
+    inline size_t reusedCount() const { return mReusedCount; }
+
+  private:
+    struct Key
+    {
+        VkSamplerCreateFlags flags;
+        VkFilter magFilter;
+        VkFilter minFilter;
+        VkSamplerMipmapMode mipmapMode;
+        VkSamplerAddressMode addressModeU;
+        VkSamplerAddressMode addressModeV;
+        VkSamplerAddressMode addressModeW;
+        float mipLodBias;
+        VkBool32 anisotropyEnable;
+        float maxAnisotropy;
+        VkBool32 compareEnable;
+        VkCompareOp compareOp;
+        float minLod;
+        float maxLod;
+        VkBorderColor borderColor;
+        VkBool32 unnormalizedCoordinates;
+        VkSamplerReductionMode reductionMode;
+
+        bool operator==(const Key &other) const = default;
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const;
+    };
+
+    static Key makeKey(const VkSamplerCreateInfo &info);
+
+    VkDevice mDevice{VK_NULL_HANDLE};
+    std::unordered_map<Key, VkSampler, KeyHash> mSamplers;
+    size_t mCreatedCount{0};
+    size_t mReusedCount{0};
+};
+}  // namespace vk
+}  // namespace hatgpu
+
+#endif
@@ -12,6 +12,8 @@ struct AllocatedBuffer
 {
     VkBuffer buffer;
     VmaAllocation allocation;
+    // Only set for buffers created persistently mapped
+    void *mapped{nullptr};
 };
 
 struct AllocatedImage
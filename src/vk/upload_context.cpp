@@ -4,53 +4,454 @@
 #include "vk/initializers.h"
 #include "vk/upload_context.h"
 
-#include <iostream>
+#include <tracy/Tracy.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <limits>
 
 namespace hatgpu
 {
 namespace vk
 {
-UploadContext::UploadContext(VkDevice device, VkQueue graphicsQueue, uint32_t graphicsQueueIndex)
-    : device(device), graphicsQueue(graphicsQueue)
+UploadContext::UploadContext(VkDevice device,
+                             Allocator *allocator,
+                             VkQueue graphicsQueue,
+                             uint32_t graphicsQueueIndex,
+                             VkQueue transferQueue,
+                             uint32_t transferQueueIndex,
+                             VkDeviceSize stagingRingSize)
+    : device(device),
+      allocator(allocator),
+      graphicsQueue(graphicsQueue),
+      graphicsQueueIndex(graphicsQueueIndex),
+      transferQueue(transferQueue),
+      transferQueueIndex(transferQueueIndex),
+      mStagingRing(*allocator, stagingRingSize),
+      mMaxBatchStagingBytes(stagingRingSize / kStagingRingDivisions)
 {
-    VkFenceCreateInfo uploadFenceCreateInfo = vk::fenceInfo();
-    H_CHECK(vkCreateFence(device, &uploadFenceCreateInfo, nullptr, &uploadFence),
-            "Failed to create upload context fence");
+    mBatches.resize(kMaxBatchesInFlight);
+    for (Batch &batch : mBatches)
+    {
+        VkFenceCreateInfo uploadFenceCreateInfo = vk::fenceInfo();
+        H_CHECK(vkCreateFence(device, &uploadFenceCreateInfo, nullptr, &batch.fence),
+                "Failed to create upload context fence");
+
+        VkCommandPoolCreateInfo transferPoolCreateInfo = vk::commandPoolInfo(transferQueueIndex);
+        H_CHECK(vkCreateCommandPool(device, &transferPoolCreateInfo, nullptr, &batch.transferPool),
+                "Failed to create upload context command pool");
+
+        VkCommandBufferAllocateInfo transferAllocInfo =
+            vk::commandBufferAllocInfo(batch.transferPool);
+        H_CHECK(vkAllocateCommandBuffers(device, &transferAllocInfo, &batch.transferCommandBuffer),
+                "Failed to allocate upload context command buffer");
+
+        if (hasDedicatedTransferQueue())
+        {
+            VkCommandPoolCreateInfo graphicsPoolCreateInfo =
+                vk::commandPoolInfo(graphicsQueueIndex);
+            H_CHECK(
+                vkCreateCommandPool(device, &graphicsPoolCreateInfo, nullptr, &batch.graphicsPool),
+                "Failed to create upload context graphics command pool");
+
+            VkCommandBufferAllocateInfo graphicsAllocInfo =
+                vk::commandBufferAllocInfo(batch.graphicsPool);
+            H_CHECK(
+                vkAllocateCommandBuffers(device, &graphicsAllocInfo, &batch.graphicsCommandBuffer),
+                "Failed to allocate upload context graphics command buffer");
+        }
+    }
 
-    VkCommandPoolCreateInfo commandPoolCreateInfo = vk::commandPoolInfo(graphicsQueueIndex);
-    H_CHECK(vkCreateCommandPool(this->device, &commandPoolCreateInfo, nullptr, &commandPool),
-            "Failed to create upload context command pool");
+    if (hasDedicatedTransferQueue())
+    {
+        VkSemaphoreTypeCreateInfo timelineCreateInfo{};
+        timelineCreateInfo.sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        timelineCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        timelineCreateInfo.initialValue  = 0;
 
-    VkCommandBufferAllocateInfo commandBufferAllocInfo = vk::commandBufferAllocInfo(commandPool);
-    H_CHECK(vkAllocateCommandBuffers(device, &commandBufferAllocInfo, &commandBuffer),
-            "Failed to allocate upload context command buffer");
+        VkSemaphoreCreateInfo semaphoreCreateInfo = vk::semaphoreInfo();
+        semaphoreCreateInfo.pNext                 = &timelineCreateInfo;
+        H_CHECK(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &mTransferTimeline),
+                "Failed to create upload context timeline semaphore");
+    }
 }
 
-void UploadContext::immediateSubmit(std::function<void(VkCommandBuffer)> &&function)
+UploadContext::Batch &UploadContext::currentBatch()
 {
-    VkCommandBuffer cmd = commandBuffer;
+    Batch &batch = mBatches[mCurrentBatch];
+    if (batch.recording)
+    {
+        return batch;
+    }
+
+    if (batch.inFlight)
+    {
+        // Every slot in the ring is busy, so the oldest batch has to finish first
+        ZoneScopedNC("Upload batch backpressure", tracy::Color::Red);
+        vkWaitForFences(device, 1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        retire(batch);
+    }
+
+    vkResetFences(device, 1, &batch.fence);
+
     VkCommandBufferBeginInfo cmdBeginInfo =
         vk::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-    H_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo), "Failed to begin command buffer");
 
-    function(cmd);
+    vkResetCommandPool(device, batch.transferPool, 0);
+    H_CHECK(vkBeginCommandBuffer(batch.transferCommandBuffer, &cmdBeginInfo),
+            "Failed to begin command buffer");
+    if (hasDedicatedTransferQueue())
+    {
+        vkResetCommandPool(device, batch.graphicsPool, 0);
+        H_CHECK(vkBeginCommandBuffer(batch.graphicsCommandBuffer, &cmdBeginInfo),
+                "Failed to begin command buffer");
+    }
+
+    batch.ticket      = mNextTicket++;
+    batch.recording   = true;
+    batch.jobCount    = 0;
+    batch.stagedBytes = 0;
+
+    return batch;
+}
+
+void UploadContext::retire(Batch &batch)
+{
+    for (const auto &stagingBuffer : batch.stagingBuffers)
+    {
+        allocator->destroyBuffer(stagingBuffer);
+    }
+    batch.stagingBuffers.clear();
+    batch.inFlight = false;
+
+    // Batches can technically finish out of order, so only advance up to the oldest pending one
+    Ticket oldestPending = mNextTicket;
+    for (const Batch &other : mBatches)
+    {
+        if (other.inFlight || other.recording)
+        {
+            oldestPending = std::min(oldestPending, other.ticket);
+        }
+    }
+    mCompletedTicket = oldestPending - 1;
+
+    mStagingRing.reclaim(mCompletedTicket);
+}
+
+VkCommandBuffer UploadContext::graphicsCommandBuffer(const Batch &batch) const
+{
+    return hasDedicatedTransferQueue() ? batch.graphicsCommandBuffer : batch.transferCommandBuffer;
+}
+
+StagingAllocation UploadContext::stage(const void *data, size_t size)
+{
+    Batch &batch = currentBatch();
+
+    std::optional<StagingAllocation> staging;
+    if (size <= mStagingRing.capacity())
+    {
+        staging = mStagingRing.allocate(size, kStagingAlignment, batch.ticket);
+        while (!staging)
+        {
+            // Only wait on batches that have already been submitted. If the ring is full of data
+            // from the batch being recorded, waiting would never free anything up.
+            const std::optional<Ticket> oldest = mStagingRing.oldestTag();
+            if (!oldest || *oldest >= batch.ticket)
+            {
+                break;
+            }
+
+            ZoneScopedNC("Staging ring wait", tracy::Color::Red);
+            const auto waitStart = std::chrono::steady_clock::now();
+            wait(*oldest);
+            const std::chrono::duration<float, std::milli> waitTime =
+                std::chrono::steady_clock::now() - waitStart;
+            TracyPlot("Staging ring wait (ms)", waitTime.count());
+
+            staging = mStagingRing.allocate(size, kStagingAlignment, batch.ticket);
+        }
+    }
+
+    if (!staging)
+    {
+        AllocatedBuffer stagingBuffer = allocator->createBuffer(
+            size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+            VMA_ALLOCATION_CREATE_MAPPED_BIT);
+        batch.stagingBuffers.push_back(stagingBuffer);
+        staging = StagingAllocation{stagingBuffer.buffer, 0, stagingBuffer.mapped};
+    }
+
+    std::memcpy(staging->data, data, size);
+    batch.stagedBytes += size;
+
+    return *staging;
+}
+
+UploadContext::Ticket UploadContext::record(RecordFunction &&transfer, RecordFunction &&graphics)
+{
+    Batch &batch = currentBatch();
+    if (transfer)
+    {
+        transfer(batch.transferCommandBuffer);
+    }
+    if (graphics)
+    {
+        graphics(graphicsCommandBuffer(batch));
+    }
+    ++batch.jobCount;
+
+    // Submitting here rather than in stage() keeps a job's staging memory and copy commands in the
+    // same batch
+    const Ticket ticket = batch.ticket;
+    if (batch.jobCount >= kMaxBatchJobs || batch.stagedBytes >= mMaxBatchStagingBytes)
+    {
+        submit();
+    }
+
+    return ticket;
+}
+
+UploadContext::Ticket UploadContext::submit()
+{
+    Batch &batch = mBatches[mCurrentBatch];
+    if (!batch.recording)
+    {
+        return mNextTicket - 1;
+    }
+
+    ZoneScopedNC("Upload batch submit", tracy::Color::Orange);
+
+    // Make the uploads visible to whatever gets submitted to the graphics queue afterwards.
+    // Resources coming from a dedicated transfer queue are made visible by their acquire barriers.
+    VkCommandBuffer graphicsCmd = graphicsCommandBuffer(batch);
+    VkMemoryBarrier barrier{};
+    barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(graphicsCmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0,
+                         nullptr);
 
-    H_CHECK(vkEndCommandBuffer(cmd), "Failed to end command buffer");
+    if (hasDedicatedTransferQueue())
+    {
+        H_CHECK(vkEndCommandBuffer(batch.transferCommandBuffer), "Failed to end command buffer");
+        H_CHECK(vkEndCommandBuffer(batch.graphicsCommandBuffer), "Failed to end command buffer");
 
-    VkSubmitInfo submitInfo = vk::submitInfo(&cmd);
-    H_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, uploadFence), "Failed to submit to queue");
+        // The transfer queue signals the batch's ticket on the timeline, and the graphics queue
+        // waits for it before acquiring the resources
+        VkTimelineSemaphoreSubmitInfo transferTimelineInfo{};
+        transferTimelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        transferTimelineInfo.signalSemaphoreValueCount = 1;
+        transferTimelineInfo.pSignalSemaphoreValues    = &batch.ticket;
 
-    vkWaitForFences(device, 1, &uploadFence, true, std::numeric_limits<uint32_t>::max());
-    vkResetFences(device, 1, &uploadFence);
+        VkSubmitInfo transferSubmitInfo         = vk::submitInfo(&batch.transferCommandBuffer);
+        transferSubmitInfo.pNext                = &transferTimelineInfo;
+        transferSubmitInfo.signalSemaphoreCount = 1;
+        transferSubmitInfo.pSignalSemaphores    = &mTransferTimeline;
+        H_CHECK(vkQueueSubmit(transferQueue, 1, &transferSubmitInfo, VK_NULL_HANDLE),
+                "Failed to submit to transfer queue");
+
+        VkTimelineSemaphoreSubmitInfo graphicsTimelineInfo{};
+        graphicsTimelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        graphicsTimelineInfo.waitSemaphoreValueCount = 1;
+        graphicsTimelineInfo.pWaitSemaphoreValues    = &batch.ticket;
+
+        const VkPipelineStageFlags waitStage  = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkSubmitInfo graphicsSubmitInfo       = vk::submitInfo(&batch.graphicsCommandBuffer);
+        graphicsSubmitInfo.pNext              = &graphicsTimelineInfo;
+        graphicsSubmitInfo.waitSemaphoreCount = 1;
+        graphicsSubmitInfo.pWaitSemaphores    = &mTransferTimeline;
+        graphicsSubmitInfo.pWaitDstStageMask  = &waitStage;
+        H_CHECK(vkQueueSubmit(graphicsQueue, 1, &graphicsSubmitInfo, batch.fence),
+                "Failed to submit to queue");
+    }
+    else
+    {
+        H_CHECK(vkEndCommandBuffer(batch.transferCommandBuffer), "Failed to end command buffer");
+
+        VkSubmitInfo submitInfo = vk::submitInfo(&batch.transferCommandBuffer);
+        H_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch.fence),
+                "Failed to submit to queue");
+    }
+
+    batch.recording = false;
+    batch.inFlight  = true;
+    mCurrentBatch   = (mCurrentBatch + 1) % mBatches.size();
+
+    return batch.ticket;
+}
+
+bool UploadContext::isComplete(Ticket ticket)
+{
+    if (ticket <= mCompletedTicket)
+    {
+        return true;
+    }
+
+    for (Batch &batch : mBatches)
+    {
+        if (batch.inFlight && vkGetFenceStatus(device, batch.fence) == VK_SUCCESS)
+        {
+            retire(batch);
+        }
+    }
+
+    return ticket <= mCompletedTicket;
+}
+
+void UploadContext::wait(Ticket ticket)
+{
+    if (isComplete(ticket))
+    {
+        return;
+    }
+
+    ZoneScopedNC("Upload wait", tracy::Color::Red);
+
+    const Batch &current = mBatches[mCurrentBatch];
+    if (current.recording && current.ticket <= ticket)
+    {
+        submit();
+    }
+
+    for (Batch &batch : mBatches)
+    {
+        if (batch.inFlight && batch.ticket <= ticket)
+        {
+            vkWaitForFences(device, 1, &batch.fence, VK_TRUE,
+                            std::numeric_limits<uint64_t>::max());
+            retire(batch);
+        }
+    }
+}
+
+void UploadContext::flush()
+{
+    wait(submit());
+}
+
+void UploadContext::immediateSubmit(RecordFunction &&function)
+{
+    wait(record({}, std::move(function)));
+}
+
+void UploadContext::releaseBuffer(VkCommandBuffer cmd,
+                                  VkBuffer buffer,
+                                  VkDeviceSize offset,
+                                  VkDeviceSize size) const
+{
+    if (!hasDedicatedTransferQueue())
+    {
+        return;
+    }
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask       = 0;
+    barrier.srcQueueFamilyIndex = transferQueueIndex;
+    barrier.dstQueueFamilyIndex = graphicsQueueIndex;
+    barrier.buffer              = buffer;
+    barrier.offset              = offset;
+    barrier.size                = size;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void UploadContext::acquireBuffer(VkCommandBuffer cmd,
+                                  VkBuffer buffer,
+                                  VkPipelineStageFlags dstStage,
+                                  VkAccessFlags dstAccess,
+                                  VkDeviceSize offset,
+                                  VkDeviceSize size) const
+{
+    if (!hasDedicatedTransferQueue())
+    {
+        return;
+    }
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask       = 0;
+    barrier.dstAccessMask       = dstAccess;
+    barrier.srcQueueFamilyIndex = transferQueueIndex;
+    barrier.dstQueueFamilyIndex = graphicsQueueIndex;
+    barrier.buffer              = buffer;
+    barrier.offset              = offset;
+    barrier.size                = size;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 1,
+                         &barrier, 0, nullptr);
+}
+
+void UploadContext::releaseImage(VkCommandBuffer cmd,
+                                 VkImage image,
+                                 const VkImageSubresourceRange &range,
+                                 VkImageLayout layout) const
+{
+    if (!hasDedicatedTransferQueue())
+    {
+        return;
+    }
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask       = 0;
+    barrier.oldLayout           = layout;
+    barrier.newLayout           = layout;
+    barrier.srcQueueFamilyIndex = transferQueueIndex;
+    barrier.dstQueueFamilyIndex = graphicsQueueIndex;
+    barrier.image               = image;
+    barrier.subresourceRange    = range;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void UploadContext::acquireImage(VkCommandBuffer cmd,
+                                 VkImage image,
+                                 const VkImageSubresourceRange &range,
+                                 VkImageLayout layout,
+                                 VkPipelineStageFlags dstStage,
+                                 VkAccessFlags dstAccess) const
+{
+    if (!hasDedicatedTransferQueue())
+    {
+        return;
+    }
 
-    vkResetCommandPool(device, commandPool, 0);
+    VkImageMemoryBarrier barrier{};
+    barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask       = 0;
+    barrier.dstAccessMask       = dstAccess;
+    barrier.oldLayout           = layout;
+    barrier.newLayout           = layout;
+    barrier.srcQueueFamilyIndex = transferQueueIndex;
+    barrier.dstQueueFamilyIndex = graphicsQueueIndex;
+    barrier.image               = image;
+    barrier.subresourceRange    = range;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
 }
 
 void UploadContext::destroy()
 {
     H_LOG("...destroying upload context");
-    vkDestroyFence(device, uploadFence, nullptr);
-    vkDestroyCommandPool(device, commandPool, nullptr);
+    flush();
+    for (Batch &batch : mBatches)
+    {
+        vkDestroyFence(device, batch.fence, nullptr);
+        vkDestroyCommandPool(device, batch.transferPool, nullptr);
+        if (batch.graphicsPool != VK_NULL_HANDLE)
+        {
+            vkDestroyCommandPool(device, batch.graphicsPool, nullptr);
+        }
+    }
+    mBatches.clear();
+    if (mTransferTimeline != VK_NULL_HANDLE)
+    {
+        vkDestroySemaphore(device, mTransferTimeline, nullptr);
+    }
+    mStagingRing.destroy(*allocator);
 }
 }  // namespace vk
 }  // namespace hatgpu
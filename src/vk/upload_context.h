@@ -4,6 +4,7 @@
 
 #include "vk/allocator.h"
 #include "vk/deleter.h"
+#include "vk/types.h"
 
 #include <functional>
 
@@ -11,20 +12,133 @@ namespace hatgpu
 {
 namespace vk
 {
+// Batches transfer work into a small ring of command buffers. Callers stage their data and record
+// their copies, and the batch gets submitted once it grows big enough (or when asked to). Every
+// batch is identified by a monotonically increasing ticket which can be waited on, so loading code
+// never has to block on an individual copy. Staging memory comes out of a persistently mapped ring
+// whose allocations are tagged with the ticket of the batch that reads them.
+//
+// When the device has a dedicated transfer queue family, copies execute there and each batch also
+// gets a small graphics queue command buffer which waits on a timeline semaphore and acquires
+// ownership of the uploaded resources. Without one, both halves of a batch are recorded into the
+// same graphics queue command buffer and the ownership helpers become no-ops.
 struct UploadContext
 {
+    using Ticket         = uint64_t;
+    using RecordFunction = std::function<void(VkCommandBuffer)>;
+
+    static constexpr VkDeviceSize kDefaultStagingRingSize = 64 * 1024 * 1024;
+    static constexpr VkDeviceSize kStagingAlignment       = 16;
+    // A batch is submitted automatically once it records this many jobs, or once its staged data
+    // takes up this fraction of the staging ring
+    static constexpr size_t kMaxBatchJobs         = 256;
+    static constexpr size_t kMaxBatchesInFlight   = 4;
+    static constexpr size_t kStagingRingDivisions = 4;
+
     UploadContext() = default;
-    UploadContext(VkDevice device, VkQueue graphicsQueue, uint32_t graphicsQueueIndex);
+    // Pass the graphics queue as the transfer queue when there's no dedicated transfer family
+    UploadContext(VkDevice device,
+                  Allocator *allocator,
+                  VkQueue graphicsQueue,
+                  uint32_t graphicsQueueIndex,
+                  VkQueue transferQueue,
+                  uint32_t transferQueueIndex,
+                  VkDeviceSize stagingRingSize = kDefaultStagingRingSize);
+
+    // Copies `size` bytes of `data` into CPU-visible memory which stays alive until the batch
+    // currently being recorded has finished executing. Copies have to read from the returned
+    // buffer at the returned offset. Anything too big for the ring gets a dedicated buffer.
+    StagingAllocation stage(const void *data, size_t size);
+
+    // Records `transfer` into the current batch's transfer command buffer and `graphics` into its
+    // graphics command buffer, which executes after the transfer work has finished. Either one can
+    // be empty. Returns the ticket that batch will complete with.
+    Ticket record(RecordFunction &&transfer, RecordFunction &&graphics = {});
 
-    void immediateSubmit(std::function<void(VkCommandBuffer)> &&function);
+    // Submits the current batch without waiting on it
+    Ticket submit();
+    void wait(Ticket ticket);
+    bool isComplete(Ticket ticket);
+    // Submits the current batch and waits until every batch has finished
+    void flush();
+
+    // Records into the graphics command buffer, submits and waits in one go. Only use this for
+    // one-off work outside of loading.
+    void immediateSubmit(RecordFunction &&function);
+
+    // Queue family ownership transfers from the transfer queue to the graphics queue. The release
+    // half goes in a transfer recording and the acquire half in the matching graphics recording.
+    // Buffers can be transferred a range at a time, which is what suballocated buffers need.
+    void releaseBuffer(VkCommandBuffer cmd,
+                       VkBuffer buffer,
+                       VkDeviceSize offset = 0,
+                       VkDeviceSize size   = VK_WHOLE_SIZE) const;
+    void acquireBuffer(VkCommandBuffer cmd,
+                       VkBuffer buffer,
+                       VkPipelineStageFlags dstStage,
+                       VkAccessFlags dstAccess,
+                       VkDeviceSize offset = 0,
+                       VkDeviceSize size   = VK_WHOLE_SIZE) const;
+    void releaseImage(VkCommandBuffer cmd,
+                      VkImage image,
+                      const VkImageSubresourceRange &range,
+                      VkImageLayout layout) const;
+    void acquireImage(VkCommandBuffer cmd,
+                      VkImage image,
+                      const VkImageSubresourceRange &range,
+                      VkImageLayout layout,
+                      VkPipelineStageFlags dstStage,
+                      VkAccessFlags dstAccess) const;
+
+    inline bool hasDedicatedTransferQueue() const
+    {
+        return transferQueueIndex != graphicsQueueIndex;
+    }
 
     void destroy();
 
-    VkFence uploadFence;
-    VkCommandPool commandPool;
-    VkCommandBuffer commandBuffer;
     VkDevice device;
+    Allocator *allocator;
     VkQueue graphicsQueue;
+    uint32_t graphicsQueueIndex;
+    VkQueue transferQueue;
+    uint32_t transferQueueIndex;
+
+  private:
+    struct Batch
+    {
+        VkCommandPool transferPool;
+        VkCommandBuffer transferCommandBuffer;
+        // Only created when there's a dedicated transfer queue
+        VkCommandPool graphicsPool{VK_NULL_HANDLE};
+        VkCommandBuffer graphicsCommandBuffer{VK_NULL_HANDLE};
+        VkFence fence;
+
+        Ticket ticket{0};
+        bool recording{false};
+        bool inFlight{false};
+
+        size_t jobCount{0};
+        size_t stagedBytes{0};
+        // Dedicated buffers for data that didn't fit in the staging ring
+        std::vector<AllocatedBuffer> stagingBuffers;
+    };
+
+    Batch &currentBatch();
+    void retire(Batch &batch);
+    VkCommandBuffer graphicsCommandBuffer(const Batch &batch) const;
+
+    std::vector<Batch> mBatches;
+    size_t mCurrentBatch{0};
+
+    StagingRing mStagingRing;
+    size_t mMaxBatchStagingBytes{0};
+
+    // Signalled with a batch's ticket once its transfer work is done
+    VkSemaphore mTransferTimeline{VK_NULL_HANDLE};
+
+    Ticket mNextTicket{1};
+    Ticket mCompletedTicket{0};
 };
 }  // namespace vk
 }  // namespace hatgpu
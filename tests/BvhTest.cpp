@@ -0,0 +1,539 @@
+#include "hatpch.h"
+
+#include "Expect.h"
+#include "geometry/Bvh.h"
+#include "util/ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <limits>
+#include <random>
+
+using namespace hatgpu;
+
+namespace
+{
+constexpr float kMiss = std::numeric_limits<float>::max();
+
+struct Ray
+{
+    glm::vec3 origin;
+    glm::vec3 dir;
+};
+
+// Clusters of triangles of very different sizes, so that the splits have something to weigh,
+// with a few degenerate ones mixed in
+std::vector<BvhTriangle> randomTriangles(size_t count, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    std::uniform_real_distribution<float> scale(0.01f, 2.f);
+
+    std::vector<BvhTriangle> triangles;
+    glm::vec3 cluster(0.f);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i % 64 == 0)
+        {
+            cluster = 50.f * glm::vec3(unit(rng), unit(rng), unit(rng));
+        }
+        const glm::vec3 center = cluster + 5.f * glm::vec3(unit(rng), unit(rng), unit(rng));
+        const float size       = scale(rng);
+        const auto corner      = [&]() {
+            return glm::vec4(center + size * glm::vec3(unit(rng), unit(rng), unit(rng)), 1.f);
+        };
+        BvhTriangle triangle{corner(), corner(), corner()};
+        if (i % 97 == 96)
+        {
+            triangle.v2 = triangle.v1;
+        }
+        triangles.push_back(triangle);
+    }
+    return triangles;
+}
+
+// Rays from all around the triangles, half of them aimed at one so that there are plenty of hits
+std::vector<Ray> randomRays(const std::vector<BvhTriangle> &triangles, size_t count, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    std::uniform_int_distribution<size_t> pick(0, triangles.size() - 1);
+
+    std::vector<Ray> rays;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const glm::vec3 origin = 80.f * glm::vec3(unit(rng), unit(rng), unit(rng));
+        glm::vec3 target       = 60.f * glm::vec3(unit(rng), unit(rng), unit(rng));
+        if (i % 2 == 0)
+        {
+            const BvhTriangle &triangle = triangles[pick(rng)];
+            target = glm::vec3(triangle.v0 + triangle.v1 + triangle.v2) / 3.f;
+        }
+        rays.push_back(Ray{origin, target - origin});
+    }
+    return rays;
+}
+
+// Same tests as bvh.glsl, so that a tree the CPU traverses correctly also works there
+float intersectBox(const Ray &ray, const glm::vec3 &invDir, const BvhNode &node, float tMax)
+{
+    const glm::vec3 t0    = (node.boundsMin - ray.origin) * invDir;
+    const glm::vec3 t1    = (node.boundsMax - ray.origin) * invDir;
+    const glm::vec3 tNear = glm::min(t0, t1);
+    const glm::vec3 tFar  = glm::max(t0, t1);
+    const float enter     = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+    const float exit      = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit ? enter : kMiss;
+}
+
+// Distance to the triangle if it's closer than `tMax`, `tMax` otherwise
+float intersectTriangle(const Ray &ray, const BvhTriangle &triangle, float tMax)
+{
+    const glm::vec3 e1 = glm::vec3(triangle.v1 - triangle.v0);
+    const glm::vec3 e2 = glm::vec3(triangle.v2 - triangle.v0);
+    const glm::vec3 p  = glm::cross(ray.dir, e2);
+    const float det    = glm::dot(e1, p);
+    if (std::abs(det) < 1e-12f)
+    {
+        return tMax;
+    }
+
+    const float invDet = 1.f / det;
+    const glm::vec3 s  = ray.origin - glm::vec3(triangle.v0);
+    const float u      = glm::dot(s, p) * invDet;
+    if (u < 0.f || u > 1.f)
+    {
+        return tMax;
+    }
+    const glm::vec3 q = glm::cross(s, e1);
+    const float v     = glm::dot(ray.dir, q) * invDet;
+    if (v < 0.f || u + v > 1.f)
+    {
+        return tMax;
+    }
+    const float t = glm::dot(e2, q) * invDet;
+    return t > 1e-4f && t < tMax ? t : tMax;
+}
+
+// Closest hit below the bottom level rooted at `root`, the way traceBlas() in bvh.glsl finds it
+float traceBvh(const std::vector<BvhNode> &nodes,
+               const std::vector<BvhTriangle> &triangles,
+               uint32_t root,
+               const Ray &ray,
+               float tMax)
+{
+    const glm::vec3 invDir = 1.f / ray.dir;
+    if (intersectBox(ray, invDir, nodes[root], tMax) == kMiss)
+    {
+        return tMax;
+    }
+
+    std::vector<uint32_t> stack = {root};
+    while (!stack.empty())
+    {
+        const uint32_t index = stack.back();
+        const BvhNode &node  = nodes[index];
+        stack.pop_back();
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+            {
+                tMax = intersectTriangle(ray, triangles[i], tMax);
+            }
+            continue;
+        }
+        for (const uint32_t child : {index + 1, node.offset})
+        {
+            if (intersectBox(ray, invDir, nodes[child], tMax) != kMiss)
+            {
+                stack.push_back(child);
+            }
+        }
+    }
+    return tMax;
+}
+
+float bruteForce(const std::vector<BvhTriangle> &triangles, const Ray &ray, float tMax)
+{
+    for (const BvhTriangle &triangle : triangles)
+    {
+        tMax = intersectTriangle(ray, triangle, tMax);
+    }
+    return tMax;
+}
+
+// Triangles sorted by their coordinates, two lists with the same triangles in different orders
+// give the same result
+std::vector<std::array<float, 9>> sortedTriangles(const std::vector<BvhTriangle> &triangles)
+{
+    std::vector<std::array<float, 9>> sorted;
+    for (const BvhTriangle &triangle : triangles)
+    {
+        sorted.push_back({triangle.v0.x, triangle.v0.y, triangle.v0.z, triangle.v1.x,
+                          triangle.v1.y, triangle.v1.z, triangle.v2.x, triangle.v2.y,
+                          triangle.v2.z});
+    }
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+// Every ray has to find the same closest hit through the tree as by testing every triangle
+size_t checkHits(const Bvh &bvh,
+                 const std::vector<BvhTriangle> &triangles,
+                 const std::vector<Ray> &rays,
+                 const char *message)
+{
+    size_t hits       = 0;
+    size_t mismatches = 0;
+    for (const Ray &ray : rays)
+    {
+        const float expected = bruteForce(triangles, ray, kMiss);
+        hits += expected != kMiss ? 1 : 0;
+        mismatches += traceBvh(bvh.nodes, bvh.triangles, 0, ray, kMiss) != expected ? 1 : 0;
+    }
+    H_EXPECT(mismatches == 0, message);
+    return hits;
+}
+
+void testSahBuild()
+{
+    for (const size_t count : {1, 2, 5, 100, 4099})
+    {
+        const std::vector<BvhTriangle> triangles =
+            randomTriangles(count, static_cast<uint32_t>(count));
+        const Bvh bvh = bvh::build(triangles);
+
+        H_EXPECT(bvh::validate(bvh), "The SAH BVH doesn't validate");
+        H_EXPECT(sortedTriangles(bvh.triangles) == sortedTriangles(triangles),
+                 "The SAH BVH doesn't reference every triangle exactly once");
+
+        const std::vector<Ray> rays = randomRays(triangles, 2000, 7);
+        const size_t hits = checkHits(bvh, triangles, rays, "SAH BVH hits differ from brute force");
+        H_EXPECT(hits > rays.size() / 4, "Too few rays hit anything to tell");
+
+        const bvh::Stats stats = bvh::computeStats(bvh);
+        H_EXPECT(stats.depth <= bvh::kMaxDepth, "The SAH BVH is deeper than bvh.glsl allows");
+        LOGGER.info("{} triangles: {} nodes, depth {}, SAH cost {:.2f}, {} of {} rays hit", count,
+                    stats.nodeCount, stats.depth, stats.sahCost, hits, rays.size());
+    }
+}
+
+void testEmptyBuild()
+{
+    const Bvh bvh = bvh::build({});
+    H_EXPECT(bvh::validate(bvh), "The BVH of no triangles doesn't validate");
+    const Ray ray{glm::vec3(0.f, 0.f, -10.f), glm::vec3(0.f, 0.f, 1.f)};
+    H_EXPECT(traceBvh(bvh.nodes, bvh.triangles, 0, ray, kMiss) == kMiss,
+             "A ray hit the BVH of no triangles");
+}
+
+// Heightfield of about `count` triangles, more like a scene's geometry than the random clusters
+std::vector<BvhTriangle> terrainTriangles(size_t count)
+{
+    const auto side   = static_cast<size_t>(std::sqrt(count / 2.0));
+    const auto vertex = [side](size_t x, size_t z) {
+        const float u = 100.f * x / side;
+        const float v = 100.f * z / side;
+        return glm::vec4(u, 5.f * std::sin(u * 0.3f) * std::cos(v * 0.2f), v, 1.f);
+    };
+
+    std::vector<BvhTriangle> triangles;
+    for (size_t z = 0; z < side; ++z)
+    {
+        for (size_t x = 0; x < side; ++x)
+        {
+            triangles.push_back(BvhTriangle{vertex(x, z), vertex(x + 1, z), vertex(x, z + 1)});
+            triangles.push_back(
+                BvhTriangle{vertex(x + 1, z), vertex(x + 1, z + 1), vertex(x, z + 1)});
+        }
+    }
+    return triangles;
+}
+
+bool sameTriangles(const std::vector<BvhTriangle> &a, const std::vector<BvhTriangle> &b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                      [](const BvhTriangle &x, const BvhTriangle &y) {
+                          return x.v0 == y.v0 && x.v1 == y.v1 && x.v2 == y.v2;
+                      });
+}
+
+// Big enough inputs to go through the parallel binning and the subtree tasks, on pools of
+// different sizes, have to give the sequential tree node for node
+void testParallelMatchesSequential()
+{
+    const std::vector<std::vector<BvhTriangle>> inputs = {
+        randomTriangles(100, 21), randomTriangles(5000, 22), randomTriangles(300'000, 23),
+        terrainTriangles(262'144)};
+    for (const size_t threadCount : {1, 4})
+    {
+        ThreadPool pool(threadCount);
+        for (const std::vector<BvhTriangle> &triangles : inputs)
+        {
+            const Bvh sequential = bvh::build(triangles);
+            const Bvh parallel   = bvh::buildParallel(triangles, pool);
+            H_EXPECT(parallel.nodes == sequential.nodes,
+                     "The parallel SAH BVH's nodes differ from the sequential one's");
+            H_EXPECT(sameTriangles(parallel.triangles, sequential.triangles),
+                     "The parallel SAH BVH's triangle order differs from the sequential one's");
+        }
+    }
+}
+
+void testLinearBuild()
+{
+    ThreadPool pool(4);
+    for (const size_t count : {1, 2, 5, 100, 4099, 20'000})
+    {
+        const std::vector<BvhTriangle> triangles =
+            randomTriangles(count, static_cast<uint32_t>(count) + 1);
+        const Bvh linear = bvh::buildLinear(triangles, pool);
+
+        H_EXPECT(bvh::validate(linear), "The LBVH doesn't validate");
+        H_EXPECT(sortedTriangles(linear.triangles) == sortedTriangles(triangles),
+                 "The LBVH doesn't reference every triangle exactly once");
+        H_EXPECT(bvh::computeStats(linear).depth <= bvh::kMaxDepth,
+                 "The LBVH is deeper than bvh.glsl allows");
+
+        const std::vector<Ray> rays = randomRays(triangles, 2000, 8);
+        const size_t hits = checkHits(linear, triangles, rays, "LBVH hits differ from brute force");
+        H_EXPECT(hits > rays.size() / 4, "Too few rays hit anything to tell");
+    }
+
+    // Many triangles sharing a centroid all get the same Morton code, and still have to be split
+    // into leaves of at most maxLeafSize
+    const std::vector<BvhTriangle> stacked(1000, BvhTriangle{glm::vec4(0.f, 0.f, 0.f, 1.f),
+                                                             glm::vec4(1.f, 0.f, 0.f, 1.f),
+                                                             glm::vec4(0.f, 1.f, 0.f, 1.f)});
+    const Bvh linear = bvh::buildLinear(stacked, pool);
+    H_EXPECT(bvh::validate(linear), "The LBVH of identical triangles doesn't validate");
+    H_EXPECT(bvh::computeStats(linear).depth <= bvh::kMaxDepth,
+             "The LBVH of identical triangles is deeper than bvh.glsl allows");
+}
+
+// Closest hit in the scene, the way traceScene() in bvh.glsl finds it. The direction isn't
+// normalized in object space, so distances carry over between the levels.
+float traceTopLevel(const TopLevelBvh &tlas, const Bvh &bottomLevels, const Ray &ray, float tMax)
+{
+    const glm::vec3 invDir = 1.f / ray.dir;
+    if (intersectBox(ray, invDir, tlas.nodes[0], tMax) == kMiss)
+    {
+        return tMax;
+    }
+
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty())
+    {
+        const uint32_t index = stack.back();
+        const BvhNode &node  = tlas.nodes[index];
+        stack.pop_back();
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+            {
+                const BvhInstance &instance = tlas.instances[i];
+                const Ray objectRay{glm::vec3(instance.worldToObject * glm::vec4(ray.origin, 1.f)),
+                                    glm::mat3(instance.worldToObject) * ray.dir};
+                tMax = traceBvh(bottomLevels.nodes, bottomLevels.triangles, instance.blasRoot,
+                                objectRay, tMax);
+            }
+            continue;
+        }
+        for (const uint32_t child : {index + 1, node.offset})
+        {
+            if (intersectBox(ray, invDir, tlas.nodes[child], tMax) != kMiss)
+            {
+                stack.push_back(child);
+            }
+        }
+    }
+    return tMax;
+}
+
+// A handful of models placed many times, the way the BDPT renderer sets up its scene
+struct InstancedScene
+{
+    std::vector<std::vector<BvhTriangle>> models;
+    Bvh bottomLevels;
+    std::vector<uint32_t> blasRoots;
+    // Per instance
+    std::vector<size_t> modelIndices;
+    std::vector<glm::mat4> transforms;
+};
+
+glm::mat4 randomTransform(std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    std::uniform_real_distribution<float> scale(0.05f, 0.3f);
+    const glm::vec3 position = 200.f * glm::vec3(unit(rng), unit(rng), unit(rng));
+    const glm::vec3 axis     = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + 2.f);
+    glm::mat4 transform      = glm::translate(glm::mat4(1.f), position);
+    transform                = glm::rotate(transform, 3.f * unit(rng), axis);
+    return glm::scale(transform, glm::vec3(scale(rng)));
+}
+
+InstancedScene instancedScene(size_t instanceCount, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    InstancedScene scene;
+    for (const size_t triangleCount : {50, 300, 1000})
+    {
+        scene.models.push_back(randomTriangles(triangleCount, seed + triangleCount));
+        scene.blasRoots.push_back(
+            bvh::appendBottomLevel(bvh::build(scene.models.back()), scene.bottomLevels));
+    }
+    for (size_t i = 0; i < instanceCount; ++i)
+    {
+        scene.modelIndices.push_back(i % scene.models.size());
+        scene.transforms.push_back(randomTransform(rng));
+    }
+    return scene;
+}
+
+std::vector<uint32_t> instanceRoots(const InstancedScene &scene)
+{
+    std::vector<uint32_t> roots;
+    for (const size_t model : scene.modelIndices)
+    {
+        roots.push_back(scene.blasRoots[model]);
+    }
+    return roots;
+}
+
+// Every instance's triangles in world space, only used to aim rays at
+std::vector<BvhTriangle> worldTriangles(const InstancedScene &scene)
+{
+    std::vector<BvhTriangle> triangles;
+    for (size_t i = 0; i < scene.transforms.size(); ++i)
+    {
+        for (const BvhTriangle &triangle : scene.models[scene.modelIndices[i]])
+        {
+            const glm::mat4 &transform = scene.transforms[i];
+            triangles.push_back(
+                BvhTriangle{transform * triangle.v0, transform * triangle.v1,
+                            transform * triangle.v2});
+        }
+    }
+    return triangles;
+}
+
+// Tests every triangle of every instance, with the ray moved into object space like the
+// traversal does it so that the distances come out bit identical
+float bruteForceScene(const InstancedScene &scene, const Ray &ray)
+{
+    float tMax = kMiss;
+    for (size_t i = 0; i < scene.transforms.size(); ++i)
+    {
+        const glm::mat4 worldToObject = glm::inverse(scene.transforms[i]);
+        const Ray objectRay{glm::vec3(worldToObject * glm::vec4(ray.origin, 1.f)),
+                            glm::mat3(worldToObject) * ray.dir};
+        tMax = bruteForce(scene.models[scene.modelIndices[i]], objectRay, tMax);
+    }
+    return tMax;
+}
+
+void checkSceneHits(const TopLevelBvh &tlas,
+                    const InstancedScene &scene,
+                    uint32_t seed,
+                    const char *message)
+{
+    // Aimed at the instances where they are now
+    const std::vector<BvhTriangle> targets = worldTriangles(scene);
+    const std::vector<Ray> rays            = randomRays(targets, 1000, seed);
+
+    size_t hits       = 0;
+    size_t mismatches = 0;
+    for (const Ray &ray : rays)
+    {
+        const float expected = bruteForceScene(scene, ray);
+        hits += expected != kMiss ? 1 : 0;
+        mismatches += traceTopLevel(tlas, scene.bottomLevels, ray, kMiss) != expected ? 1 : 0;
+    }
+    H_EXPECT(mismatches == 0, message);
+    H_EXPECT(hits > rays.size() / 4, "Too few rays hit anything to tell");
+}
+
+void testTopLevel()
+{
+    InstancedScene scene = instancedScene(200, 31);
+    TopLevelBvh tlas =
+        bvh::buildTopLevel(scene.bottomLevels.nodes, instanceRoots(scene), scene.transforms);
+
+    std::vector<uint32_t> indices = tlas.instanceIndices;
+    std::sort(indices.begin(), indices.end());
+    std::vector<uint32_t> expected(scene.transforms.size());
+    std::iota(expected.begin(), expected.end(), 0);
+    H_EXPECT(indices == expected, "The TLAS doesn't reference every instance exactly once");
+    checkSceneHits(tlas, scene, 32, "TLAS hits differ from brute force");
+
+    // Moving instances far from where they were built only keeps the hits right if the refit
+    // grows the bounds along
+    std::mt19937 rng(33);
+    for (size_t i = 0; i < scene.transforms.size(); i += 7)
+    {
+        scene.transforms[i] = glm::translate(glm::mat4(1.f), glm::vec3(300.f, 0.f, 0.f)) *
+                              randomTransform(rng);
+    }
+    bvh::refitTopLevel(tlas, scene.bottomLevels.nodes, scene.transforms);
+    checkSceneHits(tlas, scene, 34, "Refitted TLAS hits differ from brute force");
+}
+
+void testEmptyTopLevel()
+{
+    // The same bottom levels the BDPT renderer ends up with for an empty scene
+    Bvh bottomLevels;
+    bvh::appendBottomLevel(bvh::build({}), bottomLevels);
+    const TopLevelBvh tlas = bvh::buildTopLevel(bottomLevels.nodes, {}, {});
+
+    std::mt19937 rng(35);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    size_t hits = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        const Ray ray{100.f * glm::vec3(unit(rng), unit(rng), unit(rng)),
+                      glm::vec3(unit(rng), unit(rng), unit(rng))};
+        hits += traceTopLevel(tlas, bottomLevels, ray, kMiss) != kMiss ? 1 : 0;
+    }
+    H_EXPECT(hits == 0, "A ray hit the TLAS of an empty scene");
+}
+
+// Build times and tree quality for a scene sized mesh, not checked against anything
+void logBuilds()
+{
+    const std::vector<BvhTriangle> triangles = terrainTriangles(262'144);
+    ThreadPool pool;
+
+    const auto timeBuild = [&](const char *name, const auto &buildFunction) {
+        const auto start = std::chrono::steady_clock::now();
+        const Bvh bvh    = buildFunction();
+        const std::chrono::duration<float, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        const bvh::Stats stats = bvh::computeStats(bvh);
+        H_EXPECT(bvh::validate(bvh), "A large BVH doesn't validate");
+        LOGGER.info("{} build of {} triangles: {:.1f} ms, {} nodes, {} leaves, depth {}, SAH "
+                    "cost {:.2f}",
+                    name, triangles.size(), elapsed.count(), stats.nodeCount, stats.leafCount,
+                    stats.depth, stats.sahCost);
+    };
+    timeBuild("Sequential SAH", [&]() { return bvh::build(triangles); });
+    timeBuild("Parallel SAH", [&]() { return bvh::buildParallel(triangles, pool); });
+    timeBuild("LBVH", [&]() { return bvh::buildLinear(triangles, pool); });
+    LOGGER.info("Parallel builds ran on {} threads", pool.size());
+}
+}  // namespace
+
+int main()
+{
+    testSahBuild();
+    testEmptyBuild();
+    testParallelMatchesSequential();
+    testLinearBuild();
+    testTopLevel();
+    testEmptyTopLevel();
+    logBuilds();
+    return test::exitCode();
+}
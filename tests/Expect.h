@@ -0,0 +1,38 @@
+#ifndef _INCLUDE_EXPECT_H
+#define _INCLUDE_EXPECT_H
+#include "hatpch.h"
+
+// Checks for the CPU unit tests in this directory. A failed expectation is logged and the test
+// keeps going so that one run reports all of them, main() then returns test::exitCode().
+namespace hatgpu
+{
+namespace test
+{
+inline uint32_t &failureCount()
+{
+    static uint32_t count = 0;
+    return count;
+}
+
+inline int exitCode()
+{
+    if (failureCount() > 0)
+    {
+        LOGGER.error("{} expectations failed", failureCount());
+        return 1;
+    }
+    LOGGER.info("All expectations passed");
+    return 0;
+}
+}  // namespace test
+}  // namespace hatgpu
+
+#define H_EXPECT(stmt, msg)                                                                     \
+    if (!(stmt))                                                                                \
+    {                                                                                           \
+        LOGGER.error("[FAILED EXPECT: {}] [{}:{}] [{}]", msg, __FILE__, __LINE__,               \
+                     __PRETTY_FUNCTION__);                                                      \
+        ++::hatgpu::test::failureCount();                                                       \
+    }
+
+#endif
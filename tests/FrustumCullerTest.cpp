@@ -0,0 +1,193 @@
+#include "hatpch.h"
+
+#include "Expect.h"
+#include "geometry/FrustumCuller.h"
+
+#include <algorithm>
+#include <random>
+
+using namespace hatgpu;
+
+namespace
+{
+// Same camera as frustum_culling::benchmark(): at the origin looking down -z
+Frustum testFrustum()
+{
+    const glm::mat4 proj = glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.1f, 1000.f);
+    const glm::mat4 view =
+        glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+    return Frustum::fromMatrix(proj * view);
+}
+
+float planeDistance(const glm::vec4 &plane, const glm::vec3 &point)
+{
+    return glm::dot(glm::vec3(plane), point) + plane.w;
+}
+
+// Random point inside the frustum
+glm::vec3 pointInside(const Frustum &frustum, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> lateral(-400.f, 400.f);
+    std::uniform_real_distribution<float> depth(-999.f, -1.f);
+    while (true)
+    {
+        const glm::vec3 point(lateral(rng), lateral(rng), depth(rng));
+        if (std::all_of(frustum.planes.begin(), frustum.planes.end(),
+                        [&](const glm::vec4 &plane) { return planeDistance(plane, point) > 0.f; }))
+        {
+            return point;
+        }
+    }
+}
+
+// Boxes spread all around the camera like in the benchmark, most of them clearly in or out
+void appendRandomBoxes(size_t count, std::mt19937 &rng, AabbSoA &boxes)
+{
+    std::uniform_real_distribution<float> position(-500.f, 500.f);
+    std::uniform_real_distribution<float> extent(0.1f, 10.f);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const glm::vec3 min(position(rng), position(rng), position(rng));
+        const glm::vec3 size(extent(rng), extent(rng), extent(rng));
+        boxes.push_back(Aabb{glm::vec4(min, 1.f), glm::vec4(min + size, 1.f)});
+    }
+}
+
+// Boxes centered on `plane`, give or take a fraction of their size, with their centers inside the
+// other planes. Part of each box is outside the frustum, but the box can't be culled by any plane.
+void appendStraddlingBoxes(const Frustum &frustum,
+                           Frustum::Plane plane,
+                           size_t count,
+                           std::mt19937 &rng,
+                           AabbSoA &boxes)
+{
+    constexpr float kHalfExtent = 0.01f;
+    std::uniform_real_distribution<float> jitter(-0.5f * kHalfExtent, 0.5f * kHalfExtent);
+    const glm::vec4 &p = frustum.planes[plane];
+    const glm::vec3 normal(p);
+    while (count > 0)
+    {
+        // The side planes go through the camera, so a point inside can be pulled onto them along
+        // their normal, which is unit length. The near and far planes are small or far away, so
+        // their points get slid along the ray from the camera instead, which keeps them inside
+        // the side planes.
+        const glm::vec3 inside = pointInside(frustum, rng);
+        glm::vec3 center;
+        if (plane == Frustum::kNear || plane == Frustum::kFar)
+        {
+            const float t = -planeDistance(p, inside) / glm::dot(normal, inside);
+            center        = inside * (1.f + t);
+        }
+        else
+        {
+            center = inside - planeDistance(p, inside) * normal;
+        }
+        center += jitter(rng) * normal;
+
+        const bool insideOthers =
+            std::all_of(frustum.planes.begin(), frustum.planes.end(), [&](const glm::vec4 &other) {
+                return &other == &p || planeDistance(other, center) > 0.f;
+            });
+        if (!insideOthers)
+        {
+            continue;
+        }
+        boxes.push_back(Aabb{glm::vec4(center - kHalfExtent, 1.f),
+                             glm::vec4(center + kHalfExtent, 1.f)});
+        --count;
+    }
+}
+
+bool increasing(const std::vector<uint32_t> &indices)
+{
+    return std::adjacent_find(indices.begin(), indices.end(),
+                              [](uint32_t a, uint32_t b) { return a >= b; }) == indices.end();
+}
+
+// cull() against cullScalar() at counts around the SIMD batch size, so that every tail length
+// gets exercised, and for the mix of random and straddling boxes
+void testMatchesScalar()
+{
+    const Frustum frustum = testFrustum();
+    std::mt19937 rng(1);
+    for (const size_t count : {0, 1, 7, 15, 17, 1021, 100003})
+    {
+        AabbSoA boxes;
+        appendRandomBoxes(count - count / 4, rng, boxes);
+        for (size_t plane = 0; plane < Frustum::kPlaneCount && boxes.size() < count; ++plane)
+        {
+            const size_t remaining = count - boxes.size();
+            const size_t share = std::max<size_t>(remaining / (Frustum::kPlaneCount - plane), 1);
+            appendStraddlingBoxes(frustum, static_cast<Frustum::Plane>(plane),
+                                  std::min(share, remaining), rng, boxes);
+        }
+
+        std::vector<uint32_t> visible;
+        std::vector<uint32_t> scalarVisible;
+        frustum_culling::cull(frustum, boxes, visible);
+        frustum_culling::cullScalar(frustum, boxes, scalarVisible);
+
+        H_EXPECT(boxes.size() == count, "The test built the wrong number of boxes");
+        H_EXPECT(visible == scalarVisible, "cull() disagrees with cullScalar()");
+        H_EXPECT(increasing(visible), "cull() output isn't in increasing order");
+        H_EXPECT(count < 100 || (!visible.empty() && visible.size() < count),
+                 "Expected some but not all boxes to be visible");
+        LOGGER.info("{} boxes: {} visible with {} batches of {}", count, visible.size(),
+                    frustum_culling::simdName(), frustum_culling::batchSize());
+    }
+}
+
+// Every straddling box intersects the frustum, whichever plane it's on
+void testStraddlingBoxesVisible()
+{
+    const Frustum frustum = testFrustum();
+    std::mt19937 rng(2);
+    for (size_t plane = 0; plane < Frustum::kPlaneCount; ++plane)
+    {
+        // Not a multiple of any SIMD width, so the last ones go through the tail
+        constexpr size_t kCount = 37;
+        AabbSoA boxes;
+        appendStraddlingBoxes(frustum, static_cast<Frustum::Plane>(plane), kCount, rng, boxes);
+
+        std::vector<uint32_t> visible;
+        frustum_culling::cull(frustum, boxes, visible);
+        H_EXPECT(visible.size() == kCount, "cull() dropped a box straddling a frustum plane");
+        frustum_culling::cullScalar(frustum, boxes, visible);
+        H_EXPECT(visible.size() == kCount,
+                 "cullScalar() dropped a box straddling a frustum plane");
+    }
+}
+
+// Boxes just past any one plane are culled
+void testOutsideBoxesCulled()
+{
+    const Frustum frustum = testFrustum();
+    std::mt19937 rng(3);
+    for (const glm::vec4 &plane : frustum.planes)
+    {
+        constexpr size_t kCount     = 19;
+        constexpr float kHalfExtent = 0.05f;
+        AabbSoA boxes;
+        while (boxes.size() < kCount)
+        {
+            const glm::vec3 inside = pointInside(frustum, rng);
+            const glm::vec3 center =
+                inside - (planeDistance(plane, inside) + 2.f * kHalfExtent) * glm::vec3(plane);
+            boxes.push_back(Aabb{glm::vec4(center - kHalfExtent, 1.f),
+                                 glm::vec4(center + kHalfExtent, 1.f)});
+        }
+
+        std::vector<uint32_t> visible;
+        frustum_culling::cull(frustum, boxes, visible);
+        H_EXPECT(visible.empty(), "cull() kept a box outside a frustum plane");
+    }
+}
+}  // namespace
+
+int main()
+{
+    testMatchesScalar();
+    testStraddlingBoxesVisible();
+    testOutsideBoxesCulled();
+    return test::exitCode();
+}
@@ -0,0 +1,87 @@
+#include "hatpch.h"
+
+#include "Expect.h"
+#include "geometry/IndexNarrowing.h"
+
+#include <algorithm>
+#include <array>
+#include <random>
+
+using namespace hatgpu;
+
+namespace
+{
+// Triangle strip over `vertexCount` vertices unrolled into a list, so that every vertex up to the
+// last one is referenced, in a shuffled triangle order
+std::vector<uint32_t> stripIndices(size_t vertexCount, uint32_t seed)
+{
+    std::vector<std::array<uint32_t, 3>> triangles;
+    for (uint32_t v = 0; v + 2 < vertexCount; ++v)
+    {
+        triangles.push_back({v, v + 1, v + 2});
+    }
+    std::mt19937 rng(seed);
+    std::shuffle(triangles.begin(), triangles.end(), rng);
+
+    std::vector<uint32_t> indices;
+    for (const auto &triangle : triangles)
+    {
+        indices.insert(indices.end(), triangle.begin(), triangle.end());
+    }
+    return indices;
+}
+
+void testSelectIndexType()
+{
+    H_EXPECT(selectIndexType(0) == VK_INDEX_TYPE_UINT16, "Empty meshes should use 16 bits");
+    H_EXPECT(selectIndexType(65535) == VK_INDEX_TYPE_UINT16,
+             "65535 vertices should use 16 bit indices");
+    // The last vertex is index 0xFFFF, which is only safe because primitive restart is off
+    H_EXPECT(selectIndexType(65536) == VK_INDEX_TYPE_UINT16,
+             "65536 vertices should use 16 bit indices");
+    H_EXPECT(selectIndexType(65537) == VK_INDEX_TYPE_UINT32,
+             "65537 vertices should use 32 bit indices");
+    H_EXPECT(indexTypeSize(VK_INDEX_TYPE_UINT16) == 2, "16 bit indices should be 2 bytes");
+    H_EXPECT(indexTypeSize(VK_INDEX_TYPE_UINT32) == 4, "32 bit indices should be 4 bytes");
+}
+
+// What Mesh::upload() stages for a mesh, read back the way the GPU's index fetch would read it,
+// has to give back the original indices
+void testRoundTrip(size_t vertexCount)
+{
+    const std::vector<uint32_t> indices =
+        stripIndices(vertexCount, static_cast<uint32_t>(vertexCount));
+    H_EXPECT(*std::max_element(indices.begin(), indices.end()) == vertexCount - 1,
+             "The test mesh should reference its last vertex");
+
+    const VkIndexType indexType = selectIndexType(vertexCount);
+    std::vector<uint32_t> fetched(indices.size());
+    if (indexType == VK_INDEX_TYPE_UINT16)
+    {
+        std::vector<uint16_t> narrowed;
+        narrowIndices(indices, narrowed);
+        H_EXPECT(narrowed.size() * sizeof(uint16_t) == indices.size() * indexTypeSize(indexType),
+                 "The narrowed copy isn't the size the upload stages");
+        std::copy(narrowed.begin(), narrowed.end(), fetched.begin());
+    }
+    else
+    {
+        fetched = indices;
+    }
+
+    H_EXPECT(fetched == indices, "Indices changed after a round trip through the uploaded width");
+    LOGGER.info("{} vertices: {} bit indices, {} bytes of indices", vertexCount,
+                indexType == VK_INDEX_TYPE_UINT16 ? 16 : 32,
+                indices.size() * indexTypeSize(indexType));
+}
+}  // namespace
+
+int main()
+{
+    testSelectIndexType();
+    for (const size_t vertexCount : {3, 1000, 65535, 65536, 65537})
+    {
+        testRoundTrip(vertexCount);
+    }
+    return test::exitCode();
+}
@@ -0,0 +1,281 @@
+#include "hatpch.h"
+
+#include "Expect.h"
+#include "geometry/MeshOptimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+using namespace hatgpu;
+
+namespace
+{
+using IndexType = Mesh::IndexType;
+using Triangle  = std::array<IndexType, 3>;
+
+// Flat grid of size x size vertices with its triangles in a random order, which is about as bad
+// for the vertex cache as it gets
+void shuffledGrid(uint32_t size,
+                  uint32_t seed,
+                  std::vector<Vertex> &vertices,
+                  std::vector<IndexType> &indices)
+{
+    vertices.clear();
+    for (uint32_t z = 0; z < size; ++z)
+    {
+        for (uint32_t x = 0; x < size; ++x)
+        {
+            const glm::vec2 uv(static_cast<float>(x) / static_cast<float>(size - 1),
+                               static_cast<float>(z) / static_cast<float>(size - 1));
+            vertices.push_back(Vertex{glm::vec3(uv.x, 0.f, uv.y), glm::vec3(0.f, 1.f, 0.f), uv});
+        }
+    }
+
+    std::vector<Triangle> triangles;
+    for (uint32_t z = 0; z + 1 < size; ++z)
+    {
+        for (uint32_t x = 0; x + 1 < size; ++x)
+        {
+            const IndexType corner = z * size + x;
+            triangles.push_back({corner, corner + 1, corner + size});
+            triangles.push_back({corner + 1, corner + size + 1, corner + size});
+        }
+    }
+    std::mt19937 rng(seed);
+    std::shuffle(triangles.begin(), triangles.end(), rng);
+
+    indices.clear();
+    for (const Triangle &triangle : triangles)
+    {
+        indices.insert(indices.end(), triangle.begin(), triangle.end());
+    }
+}
+
+// Every triangle rotated so that its smallest index comes first, which keeps the winding, and
+// sorted. Two index buffers drawing the same triangles in different orders give the same list.
+std::vector<Triangle> canonicalTriangles(const std::vector<IndexType> &indices)
+{
+    std::vector<Triangle> triangles;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        Triangle triangle{indices[i], indices[i + 1], indices[i + 2]};
+        std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()),
+                    triangle.end());
+        triangles.push_back(triangle);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+// Band around a sphere of `radius`, from 0.1 pi to 0.9 pi latitude so that there are no
+// degenerate triangles at the poles. Front faces are clockwise like imported meshes, and face
+// away from the center if `outward` is set.
+void appendSphere(float radius,
+                  bool outward,
+                  std::vector<Vertex> &vertices,
+                  std::vector<IndexType> &indices)
+{
+    constexpr uint32_t kRings    = 12;
+    constexpr uint32_t kSegments = 24;
+    constexpr float kPi          = 3.14159265f;
+
+    const IndexType base = static_cast<IndexType>(vertices.size());
+    for (uint32_t ring = 0; ring <= kRings; ++ring)
+    {
+        const float theta = kPi * (0.1f + 0.8f * static_cast<float>(ring) / kRings);
+        for (uint32_t segment = 0; segment < kSegments; ++segment)
+        {
+            const float phi = 2.f * kPi * static_cast<float>(segment) / kSegments;
+            const glm::vec3 normal(std::sin(theta) * std::cos(phi), std::cos(theta),
+                                   std::sin(theta) * std::sin(phi));
+            vertices.push_back(Vertex{normal * radius, normal, glm::vec2(0.f)});
+        }
+    }
+
+    const auto vertex = [base](uint32_t ring, uint32_t segment) {
+        return base + ring * kSegments + segment % kSegments;
+    };
+    for (uint32_t ring = 0; ring < kRings; ++ring)
+    {
+        for (uint32_t segment = 0; segment < kSegments; ++segment)
+        {
+            for (Triangle triangle :
+                 {Triangle{vertex(ring, segment), vertex(ring + 1, segment),
+                           vertex(ring, segment + 1)},
+                  Triangle{vertex(ring, segment + 1), vertex(ring + 1, segment),
+                           vertex(ring + 1, segment + 1)}})
+            {
+                const glm::vec3 &a = vertices[triangle[0]].position;
+                const glm::vec3 &b = vertices[triangle[1]].position;
+                const glm::vec3 &c = vertices[triangle[2]].position;
+                // The front face of a clockwise triangle points along cross(c - a, b - a)
+                const bool facesOut = glm::dot(glm::cross(c - a, b - a), a + b + c) > 0.f;
+                if (facesOut != outward)
+                {
+                    std::swap(triangle[1], triangle[2]);
+                }
+                indices.insert(indices.end(), triangle.begin(), triangle.end());
+            }
+        }
+    }
+}
+
+void testVertexCacheLowersAcmr()
+{
+    std::vector<Vertex> vertices;
+    std::vector<IndexType> indices;
+    shuffledGrid(64, 1, vertices, indices);
+
+    const float before = mesh_optimizer::analyzeVertexCache(indices, vertices.size()).acmr;
+    std::vector<IndexType> optimized = indices;
+    mesh_optimizer::optimizeVertexCache(optimized, vertices.size());
+    const float after = mesh_optimizer::analyzeVertexCache(optimized, vertices.size()).acmr;
+
+    LOGGER.info("Shuffled 64x64 grid: ACMR {:.3f} before, {:.3f} after", before, after);
+    H_EXPECT(after < before, "optimizeVertexCache didn't lower the ACMR");
+    // A regular grid gets close to 0.5 with a perfect order, Tipsify with a 16 entry cache
+    // should get well under 1
+    H_EXPECT(after < 1.f, "optimizeVertexCache left the ACMR at 1 or more on a regular grid");
+}
+
+void testVertexCacheKeepsTriangles()
+{
+    std::vector<Vertex> vertices;
+    std::vector<IndexType> indices;
+    shuffledGrid(33, 2, vertices, indices);
+
+    std::vector<IndexType> optimized = indices;
+    mesh_optimizer::optimizeVertexCache(optimized, vertices.size());
+    H_EXPECT(optimized.size() == indices.size(), "optimizeVertexCache changed the index count");
+    H_EXPECT(canonicalTriangles(optimized) == canonicalTriangles(indices),
+             "optimizeVertexCache output isn't a permutation of the input triangles");
+
+    std::vector<IndexType> overdrawOptimized = optimized;
+    mesh_optimizer::optimizeOverdraw(overdrawOptimized, vertices);
+    H_EXPECT(canonicalTriangles(overdrawOptimized) == canonicalTriangles(indices),
+             "optimizeOverdraw output isn't a permutation of the input triangles");
+}
+
+void testDeterministic()
+{
+    std::vector<Vertex> vertices;
+    std::vector<IndexType> indices;
+    shuffledGrid(48, 3, vertices, indices);
+
+    // The passes optimize() runs, without a Mesh since that would pull in its upload code
+    const auto run = [&]() {
+        std::pair<std::vector<Vertex>, std::vector<IndexType>> mesh{vertices, indices};
+        mesh_optimizer::optimizeVertexCache(mesh.second, mesh.first.size());
+        mesh_optimizer::optimizeOverdraw(mesh.second, mesh.first);
+        mesh_optimizer::optimizeVertexFetch(mesh.first, mesh.second);
+        return mesh;
+    };
+    const auto [firstVertices, firstIndices]   = run();
+    const auto [secondVertices, secondIndices] = run();
+
+    H_EXPECT(firstIndices == secondIndices, "Two runs gave different indices");
+    bool sameVertices = firstVertices.size() == secondVertices.size();
+    for (size_t i = 0; sameVertices && i < firstVertices.size(); ++i)
+    {
+        sameVertices = firstVertices[i].position == secondVertices[i].position;
+    }
+    H_EXPECT(sameVertices, "Two runs gave different vertex orders");
+}
+
+void testVertexFetchRemap()
+{
+    std::vector<Vertex> vertices;
+    std::vector<IndexType> indices;
+    shuffledGrid(20, 4, vertices, indices);
+
+    // Vertices in a random order, plus some that no triangle uses
+    std::vector<IndexType> permutation(vertices.size());
+    std::iota(permutation.begin(), permutation.end(), 0);
+    std::mt19937 rng(5);
+    std::shuffle(permutation.begin(), permutation.end(), rng);
+    std::vector<Vertex> shuffled(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        shuffled[permutation[i]] = vertices[i];
+    }
+    for (IndexType &index : indices)
+    {
+        index = permutation[index];
+    }
+    const size_t referencedCount = shuffled.size();
+    for (int i = 0; i < 5; ++i)
+    {
+        shuffled.push_back(Vertex{glm::vec3(-1.f), glm::vec3(0.f), glm::vec2(0.f)});
+    }
+
+    std::vector<Vertex> remappedVertices   = shuffled;
+    std::vector<IndexType> remappedIndices = indices;
+    mesh_optimizer::optimizeVertexFetch(remappedVertices, remappedIndices);
+
+    H_EXPECT(remappedVertices.size() == referencedCount,
+             "optimizeVertexFetch didn't drop exactly the unreferenced vertices");
+    H_EXPECT(remappedIndices.size() == indices.size(),
+             "optimizeVertexFetch changed the index count");
+
+    bool sameCorners   = true;
+    bool firstUseOrder = true;
+    IndexType nextNew  = 0;
+    for (size_t i = 0; i < indices.size() && i < remappedIndices.size(); ++i)
+    {
+        const IndexType index = remappedIndices[i];
+        if (index >= remappedVertices.size())
+        {
+            sameCorners = false;
+            break;
+        }
+        // Every corner still has to land on the same vertex data
+        const Vertex &original = shuffled[indices[i]];
+        const Vertex &remapped = remappedVertices[index];
+        sameCorners            = sameCorners && remapped.position == original.position &&
+                      remapped.normal == original.normal;
+        // And vertices get numbered in the order they're first used
+        if (index == nextNew)
+        {
+            ++nextNew;
+        }
+        firstUseOrder = firstUseOrder && index < nextNew;
+    }
+    H_EXPECT(sameCorners, "optimizeVertexFetch remapped a corner to a different vertex");
+    H_EXPECT(firstUseOrder, "optimizeVertexFetch didn't number vertices in first use order");
+}
+
+void testOverdrawDrawsOutsideFirst()
+{
+    // A shell seen from outside around one seen from inside: the outer sphere occludes the inner
+    // one from every viewpoint, so all of its clusters should come first
+    std::vector<Vertex> vertices;
+    std::vector<IndexType> indices;
+    appendSphere(1.f, false, vertices, indices);
+    const IndexType outerFirstVertex = static_cast<IndexType>(vertices.size());
+    appendSphere(2.f, true, vertices, indices);
+    const size_t outerTriangles = indices.size() / 3 / 2;
+
+    mesh_optimizer::optimizeVertexCache(indices, vertices.size());
+    mesh_optimizer::optimizeOverdraw(indices, vertices);
+
+    bool outerFirst = true;
+    for (size_t triangle = 0; triangle < outerTriangles; ++triangle)
+    {
+        outerFirst = outerFirst && indices[triangle * 3] >= outerFirstVertex;
+    }
+    H_EXPECT(outerFirst, "optimizeOverdraw didn't put the outward facing clusters first");
+}
+}  // namespace
+
+int main()
+{
+    testVertexCacheLowersAcmr();
+    testVertexCacheKeepsTriangles();
+    testDeterministic();
+    testVertexFetchRemap();
+    testOverdrawDrawsOutsideFirst();
+    return test::exitCode();
+}